@@ -0,0 +1,554 @@
+// End-to-end benchmarks: builds a synthetic repository, then times the
+// commands people wait on (add, status, commit, checkout), raw object
+// reads and writes, SHA-1, and a pull from a local server. Each case runs
+// several times; results come out as JSON with percentiles, one case per
+// line, and with --baseline an earlier run's file gates on regressions.
+//
+//   make bench BENCH_ARGS="--files 20000 --runs 9"
+//   ./bin/gyatt_bench --baseline old.json --threshold 15 > new.json
+#define _XOPEN_SOURCE 700
+#include "../src/gyatt.h"
+#include "../src/object.h"
+#include "../src/hash.h"
+#include "../src/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_RUNS 101
+#define MAX_CASES 16
+#define FILES_PER_DIR 200
+#define OBJECT_COUNT 2000
+#define OBJECT_SIZE 4096
+#define SHA1_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+    size_t files;              // In the synthetic tree
+    size_t size_min;           // File sizes are log-uniform in [min, max]
+    size_t size_max;
+    int depth;                 // Commits of history before timing starts
+    int runs;
+    int port;
+    int keep;                  // Leave the scratch directory behind
+    const char *dir;
+    const char *only;          // Comma-separated case names
+    const char *baseline;
+    double threshold;          // Percent slower than baseline that fails
+} bench_config_t;
+
+typedef struct {
+    const char *name;
+    double samples[MAX_RUNS];  // Seconds
+    int count;
+    uint64_t bytes;            // Per run, for the throughput cases
+    double p50, p90, p99;
+} bench_result_t;
+
+static bench_config_t config = {
+    .files = 5000,
+    .size_min = 64,
+    .size_max = 64 * 1024,
+    .depth = 10,
+    .runs = 7,
+    .port = 19418,
+    .threshold = 10.0,
+};
+static bench_result_t results[MAX_CASES];
+static size_t result_count;
+static int quiet_fd = -1;      // stdout while muted
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// xorshift64*: deterministic, so every run builds the same repository
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void fill_random(unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t v = rng_next();
+        size_t n = len - i < 8 ? len - i : 8;
+        memcpy(buf + i, &v, n);
+    }
+}
+
+// Commands print as they go; keep that out of the JSON
+static void mute(void) {
+    fflush(stdout);
+    quiet_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+}
+
+static void unmute(void) {
+    if (quiet_fd < 0) return;
+    fflush(stdout);
+    dup2(quiet_fd, STDOUT_FILENO);
+    close(quiet_fd);
+    quiet_fd = -1;
+}
+
+static int wanted(const char *name) {
+    if (!config.only) return 1;
+    size_t len = strlen(name);
+    for (const char *p = config.only; *p; ) {
+        const char *comma = strchr(p, ',');
+        size_t n = comma ? (size_t)(comma - p) : strlen(p);
+        if (n == len && strncmp(p, name, n) == 0) return 1;
+        if (!comma) break;
+        p = comma + 1;
+    }
+    return 0;
+}
+
+static bench_result_t *result_begin(const char *name, uint64_t bytes) {
+    if (result_count >= MAX_CASES) return NULL;
+    bench_result_t *result = &results[result_count++];
+    result->name = name;
+    result->bytes = bytes;
+    return result;
+}
+
+static void result_add(bench_result_t *result, double seconds) {
+    if (result && result->count < MAX_RUNS) result->samples[result->count++] = seconds;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile over sorted samples
+static double percentile(const double *sorted, int count, double p) {
+    int rank = (int)ceil(p / 100.0 * count);
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
+}
+
+// ==================== Repository helpers ====================
+
+// Run a command the way main() would, on a freshly opened repository
+static int run_command(int (*cmd)(gyatt_repo_t *, int, char **), int argc, char **argv) {
+    gyatt_repo_t *repo = repo_open();
+    int result = cmd(repo, argc, argv);
+    repo_free(repo);
+    return result;
+}
+
+static size_t file_size(size_t i) {
+    // Log-uniform, so most files are small and a few are big, like source trees
+    double lo = log((double)config.size_min), hi = log((double)config.size_max);
+    double r = (double)((i * 2654435761u) % 10007) / 10007.0;
+    return (size_t)exp(lo + (hi - lo) * r);
+}
+
+static void file_path(size_t i, char *out, size_t out_size) {
+    snprintf(out, out_size, "d%03zu/f%05zu.dat", i / FILES_PER_DIR, i);
+}
+
+static int write_synthetic_file(size_t i, unsigned char *buf) {
+    char path[64];
+    file_path(i, path, sizeof(path));
+    size_t size = file_size(i);
+    fill_random(buf, size);
+    return write_file(path, buf, size);
+}
+
+// Rewrite every stride-th file starting at offset, for that many files
+static int touch_files(size_t count, size_t offset, unsigned char *buf) {
+    size_t stride = count > 0 && config.files / count > 0 ? config.files / count : 1;
+    for (size_t n = 0; n < count; n++) {
+        if (write_synthetic_file((offset + n * stride) % config.files, buf) != 0) return -1;
+    }
+    return 0;
+}
+
+static int commit_all(const char *message) {
+    char *add_argv[] = { "add", ".", NULL };
+    char *commit_argv[] = { "commit", "-m", (char *)message, NULL };
+    if (run_command(cmd_add, 2, add_argv) != 0) return -1;
+    return run_command(cmd_commit, 3, commit_argv);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_tree(const char *path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// The synthetic repository: config.files files over directories of
+// FILES_PER_DIR, then config.depth commits each touching 1% of them, and
+// a second branch that differs from main by another 1%
+static int build_repo(unsigned char *buf) {
+    char *init_argv[] = { "init", NULL };
+    if (cmd_init(NULL, 1, init_argv) != 0) return -1;
+
+    for (size_t d = 0; d * FILES_PER_DIR < config.files; d++) {
+        char dir[16];
+        snprintf(dir, sizeof(dir), "d%03zu", d);
+        if (mkdir_recursive(dir) != 0) return -1;
+    }
+    for (size_t i = 0; i < config.files; i++) {
+        if (write_synthetic_file(i, buf) != 0) return -1;
+    }
+    if (commit_all("initial") != 0) return -1;
+
+    size_t churn = config.files / 100 > 0 ? config.files / 100 : 1;
+    for (int c = 1; c < config.depth; c++) {
+        char message[32];
+        snprintf(message, sizeof(message), "history %d", c);
+        if (touch_files(churn, (size_t)c, buf) != 0 || commit_all(message) != 0) return -1;
+    }
+
+    char *branch_argv[] = { "branch", "bench-alt", NULL };
+    char *to_alt[] = { "checkout", "bench-alt", NULL };
+    char *to_main[] = { "checkout", "main", NULL };
+    if (run_command(cmd_branch, 2, branch_argv) != 0 || run_command(cmd_checkout, 2, to_alt) != 0) return -1;
+    if (touch_files(churn, 7, buf) != 0 || commit_all("alt") != 0) return -1;
+    return run_command(cmd_checkout, 2, to_main);
+}
+
+// ==================== Cases ====================
+
+static void bench_add(void) {
+    bench_result_t *result = result_begin("add", 0);
+    char *argv[] = { "add", ".", NULL };
+    for (int r = 0; r < config.runs; r++) {
+        // From an empty index: every file is hashed, nothing is new to store
+        unlink(GYATT_DIR "/index");
+        double start = now_seconds();
+        run_command(cmd_add, 2, argv);
+        result_add(result, now_seconds() - start);
+    }
+}
+
+static void bench_status(unsigned char *buf) {
+    char *argv[] = { "status", NULL };
+    char *add_argv[] = { "add", ".", NULL };
+    bench_result_t *clean = result_begin("status_clean", 0);
+    run_command(cmd_status, 1, argv);
+    for (int r = 0; r < config.runs; r++) {
+        double start = now_seconds();
+        run_command(cmd_status, 1, argv);
+        result_add(clean, now_seconds() - start);
+    }
+
+    // 1% of the files rewritten; status has to hash those, every time
+    size_t churn = config.files / 100 > 0 ? config.files / 100 : 1;
+    touch_files(churn, 3, buf);
+    bench_result_t *dirty = result_begin("status_dirty", 0);
+    for (int r = 0; r < config.runs; r++) {
+        double start = now_seconds();
+        run_command(cmd_status, 1, argv);
+        result_add(dirty, now_seconds() - start);
+    }
+    run_command(cmd_add, 2, add_argv);
+}
+
+static void bench_commit(unsigned char *buf) {
+    bench_result_t *result = result_begin("commit", 0);
+    char *add_argv[] = { "add", ".", NULL };
+    for (int r = 0; r < config.runs; r++) {
+        char message[32];
+        snprintf(message, sizeof(message), "bench %d", r);
+        char *argv[] = { "commit", "-m", message, NULL };
+        touch_files(10, (size_t)r * 31, buf);
+        run_command(cmd_add, 2, add_argv);
+
+        double start = now_seconds();
+        run_command(cmd_commit, 3, argv);
+        result_add(result, now_seconds() - start);
+    }
+}
+
+static void bench_checkout(void) {
+    bench_result_t *result = result_begin("checkout", 0);
+    char *to_alt[] = { "checkout", "bench-alt", NULL };
+    char *to_main[] = { "checkout", "main", NULL };
+    for (int r = 0; r < config.runs; r++) {
+        double start = now_seconds();
+        run_command(cmd_checkout, 2, r % 2 == 0 ? to_alt : to_main);
+        result_add(result, now_seconds() - start);
+    }
+    if (config.runs % 2 == 1) run_command(cmd_checkout, 2, to_main);
+}
+
+static void bench_objects(unsigned char *buf) {
+    gyatt_hash_t *hashes = malloc(OBJECT_COUNT * sizeof(gyatt_hash_t));
+    gyatt_repo_t *repo = repo_open();
+    if (!hashes || !repo) {
+        free(hashes);
+        repo_free(repo);
+        return;
+    }
+
+    bench_result_t *write = wanted("object_write") ? result_begin("object_write", (uint64_t)OBJECT_COUNT * OBJECT_SIZE) : NULL;
+    bench_result_t *read = wanted("object_read") ? result_begin("object_read", (uint64_t)OBJECT_COUNT * OBJECT_SIZE) : NULL;
+    for (int r = 0; r < config.runs; r++) {
+        // New content every run, so each write really stores
+        double start = now_seconds();
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            fill_random(buf, OBJECT_SIZE);
+            object_write(repo, buf, OBJECT_SIZE, OBJ_BLOB, &hashes[i]);
+        }
+        result_add(write, now_seconds() - start);
+
+        start = now_seconds();
+        for (size_t i = 0; i < OBJECT_COUNT; i++) {
+            object_type_t type;
+            size_t size;
+            free(object_read(repo, &hashes[i], &type, &size));
+        }
+        result_add(read, now_seconds() - start);
+    }
+
+    repo_free(repo);
+    free(hashes);
+}
+
+static void bench_sha1(void) {
+    unsigned char *data = malloc(SHA1_SIZE);
+    if (!data) return;
+    fill_random(data, SHA1_SIZE);
+
+    bench_result_t *result = result_begin("sha1", SHA1_SIZE);
+    for (int r = 0; r < config.runs; r++) {
+        gyatt_hash_t hash;
+        double start = now_seconds();
+        sha1_hash(data, SHA1_SIZE, &hash);
+        result_add(result, now_seconds() - start);
+    }
+    free(data);
+}
+
+static int wait_for_port(int port) {
+    for (int i = 0; i < 500; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int ok = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (fd >= 0) close(fd);
+        if (ok) return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+// A full pull of main into an empty repository, from a server on this one
+static void bench_transfer(const char *root) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", config.port);
+
+    pid_t server = fork();
+    if (server < 0) return;
+    if (server == 0) {
+        char *argv[] = { "server", port, NULL };
+        _exit(run_command(cmd_server, 2, argv));
+    }
+    if (wait_for_port(config.port) != 0) {
+        fprintf(stderr, "Error: Bench server didn't come up on port %d\n", config.port);
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        return;
+    }
+
+    char remote[32];
+    snprintf(remote, sizeof(remote), "127.0.0.1:%d", config.port);
+    bench_result_t *result = result_begin("transfer", 0);
+    for (int r = 0; r < config.runs; r++) {
+        char clone[PATH_MAX + 8];
+        snprintf(clone, sizeof(clone), "%s-clone", root);
+        remove_tree(clone);
+        if (mkdir_recursive(clone) != 0 || chdir(clone) != 0) break;
+
+        char *init_argv[] = { "init", NULL };
+        char *pull_argv[] = { "pull", remote, "main", NULL };
+        cmd_init(NULL, 1, init_argv);
+        double start = now_seconds();
+        run_command(cmd_pull, 3, pull_argv);
+        result_add(result, now_seconds() - start);
+
+        if (chdir(root) != 0) break;
+        remove_tree(clone);
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+}
+
+// ==================== Output ====================
+
+// The p50 an earlier run recorded for name, or a negative number. Only
+// reads back what print_results writes: one case per line.
+static double baseline_p50(const char *text, const char *name) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char *line = strstr(text, key);
+    if (!line) return -1;
+    const char *p50 = strstr(line, "\"p50\": ");
+    const char *eol = strchr(line, '\n');
+    if (!p50 || (eol && p50 > eol)) return -1;
+    return atof(p50 + 7);
+}
+
+static int print_results(void) {
+    char *baseline = NULL;
+    if (config.baseline) {
+        size_t size;
+        baseline = read_file(config.baseline, &size);
+        if (!baseline) fprintf(stderr, "Error: Cannot read baseline %s\n", config.baseline);
+    }
+
+    int regressions = 0;
+    printf("{\n");
+    printf("  \"config\": {\"files\": %zu, \"size_min\": %zu, \"size_max\": %zu, \"depth\": %d, \"runs\": %d, \"sha1\": \"%s\"},\n",
+           config.files, config.size_min, config.size_max, config.depth, config.runs, sha1_backend());
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < result_count; i++) {
+        bench_result_t *r = &results[i];
+        if (r->count == 0 || !wanted(r->name)) continue;
+
+        double sorted[MAX_RUNS], sum = 0;
+        memcpy(sorted, r->samples, r->count * sizeof(double));
+        qsort(sorted, r->count, sizeof(double), compare_double);
+        for (int j = 0; j < r->count; j++) sum += sorted[j];
+        r->p50 = percentile(sorted, r->count, 50);
+        r->p90 = percentile(sorted, r->count, 90);
+        r->p99 = percentile(sorted, r->count, 99);
+
+        printf("    {\"name\": \"%s\", \"runs\": %d, \"min\": %.6f, \"mean\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f",
+               r->name, r->count, sorted[0], sum / r->count, r->p50, r->p90, r->p99, sorted[r->count - 1]);
+        if (r->bytes > 0 && r->p50 > 0) {
+            printf(", \"mb_per_s\": %.1f", (double)r->bytes / r->p50 / (1024.0 * 1024.0));
+        }
+
+        double before = baseline ? baseline_p50(baseline, r->name) : -1;
+        if (before > 0) {
+            double change = (r->p50 - before) / before * 100.0;
+            int regressed = change > config.threshold;
+            printf(", \"baseline_p50\": %.6f, \"change_pct\": %.1f, \"regressed\": %s",
+                   before, change, regressed ? "true" : "false");
+            if (regressed) {
+                fprintf(stderr, "Regression: %s p50 %.6fs vs %.6fs (%+.1f%%)\n", r->name, r->p50, before, change);
+                regressions++;
+            }
+        }
+        printf("}%s\n", i + 1 < result_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    free(baseline);
+    return regressions;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: gyatt_bench [--files <n>] [--size-min <bytes>] [--size-max <bytes>]\n");
+    fprintf(stderr, "                   [--depth <commits>] [--runs <n>] [--dir <path>] [--port <n>]\n");
+    fprintf(stderr, "                   [--only <case,...>] [--baseline <json>] [--threshold <pct>] [--keep]\n");
+    fprintf(stderr, "Cases: add status_clean status_dirty commit checkout object_write object_read sha1 transfer\n");
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--keep") == 0) {
+            config.keep = 1;
+            continue;
+        }
+        if (!value) {
+            usage();
+            return 2;
+        }
+        i++;
+        if (strcmp(arg, "--files") == 0) config.files = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--size-min") == 0) config.size_min = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--size-max") == 0) config.size_max = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--depth") == 0) config.depth = atoi(value);
+        else if (strcmp(arg, "--runs") == 0) config.runs = atoi(value);
+        else if (strcmp(arg, "--port") == 0) config.port = atoi(value);
+        else if (strcmp(arg, "--dir") == 0) config.dir = value;
+        else if (strcmp(arg, "--only") == 0) config.only = value;
+        else if (strcmp(arg, "--baseline") == 0) config.baseline = value;
+        else if (strcmp(arg, "--threshold") == 0) config.threshold = atof(value);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (config.files == 0 || config.size_min == 0 || config.size_max < config.size_min ||
+        config.depth < 1 || config.runs < 1 || config.runs > MAX_RUNS) {
+        usage();
+        return 2;
+    }
+
+    char root[PATH_MAX];
+    if (config.dir) snprintf(root, sizeof(root), "%s", config.dir);
+    else snprintf(root, sizeof(root), "/tmp/gyatt-bench-%d", (int)getpid());
+    remove_tree(root);
+    if (mkdir_recursive(root) != 0 || chdir(root) != 0) {
+        fprintf(stderr, "Error: Cannot use %s\n", root);
+        return 1;
+    }
+
+    unsigned char *buf = malloc(config.size_max > OBJECT_SIZE ? config.size_max : OBJECT_SIZE);
+    if (!buf) return 1;
+
+    fprintf(stderr, "Building %zu files, %d commits in %s\n", config.files, config.depth, root);
+    mute();
+    int built = build_repo(buf);
+    unmute();
+    if (built != 0) {
+        fprintf(stderr, "Error: Failed to build the synthetic repository\n");
+        free(buf);
+        return 1;
+    }
+
+    mute();
+    if (wanted("add")) bench_add();
+    if (wanted("status_clean") || wanted("status_dirty")) bench_status(buf);
+    if (wanted("commit")) bench_commit(buf);
+    if (wanted("checkout")) bench_checkout();
+    if (wanted("object_write") || wanted("object_read")) bench_objects(buf);
+    if (wanted("sha1")) bench_sha1();
+    if (wanted("transfer")) bench_transfer(root);
+    unmute();
+
+    int regressions = print_results();
+
+    if (chdir("/") == 0 && !config.keep) remove_tree(root);
+    free(buf);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t used;
+    size_t size;
+    alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+void arena_init(arena_t *arena, size_t chunk_size) {
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size > 0 ? chunk_size : 64 * 1024;
+}
+
+void arena_free(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    arena_chunk_t *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        // Oversized requests get a chunk of their own, behind the current
+        // one so its free space isn't wasted
+        size_t chunk_size = size > arena->chunk_size / 4 ? size : arena->chunk_size;
+        arena_chunk_t *fresh = malloc(sizeof(arena_chunk_t) + chunk_size);
+        if (!fresh) return NULL;
+        fresh->used = 0;
+        fresh->size = chunk_size;
+
+        if (chunk && chunk_size != arena->chunk_size) {
+            fresh->next = chunk->next;
+            chunk->next = fresh;
+        } else {
+            fresh->next = chunk;
+            arena->chunks = fresh;
+        }
+        chunk = fresh;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_absorb(arena_t *into, arena_t *from) {
+    if (!from->chunks) return;
+
+    // Chain into's chunks behind from's, keeping from's newest in front
+    arena_chunk_t *last = from->chunks;
+    while (last->next) last = last->next;
+    last->next = into->chunks;
+    into->chunks = from->chunks;
+    from->chunks = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for lots of small things that all die together: each
+// allocation is a pointer bump into the current chunk, and arena_free()
+// releases everything in one go. Not thread-safe; give each thread its own.
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunks;     // Newest first
+    size_t chunk_size;         // Default size of new chunks
+} arena_t;
+
+void arena_init(arena_t *arena, size_t chunk_size);
+void arena_free(arena_t *arena);
+
+// Aligned for any type; NULL if out of memory
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+// Hand all of from's memory over to into, leaving from empty
+void arena_absorb(arena_t *into, arena_t *from);
+
+#endif // ARENA_H
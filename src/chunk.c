@@ -0,0 +1,218 @@
+#include "chunk.h"
+#include "object.h"
+#include "buffer.h"
+#include "hash.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// FastCDC (Xia et al., USENIX ATC '16): a gear hash rolled over the
+// bytes, cut where its top bits are all zero. Nothing before CHUNK_MIN
+// is even looked at, and the mask is stricter before CHUNK_AVG than after
+// it ("normalized chunking"), which keeps sizes bunched around the
+// average. In a gear hash the high bits have seen the most bytes, so
+// those are the ones tested.
+#define MASK_STRICT (~0ull << (64 - 20))
+#define MASK_LOOSE (~0ull << (64 - 16))
+
+// How much of the file is read at a time; whatever follows a cut gets
+// moved to the front of the buffer, so this bounds that copy
+#define CHUNK_READ (64 * 1024)
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// The table is part of the format - other values would cut files
+// elsewhere - so it comes from a fixed seed (splitmix64)
+static void gear_init(void) {
+    uint64_t state = 0x6779617474636463ull;  // "gyattcdc"
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+void chunker_init(chunker_t *chunker) {
+    pthread_once(&gear_once, gear_init);
+    chunker->fp = 0;
+    chunker->len = 0;
+}
+
+size_t chunker_scan(chunker_t *chunker, const unsigned char *data, size_t len, int *cut) {
+    *cut = 0;
+    size_t i = 0;
+    if (chunker->len < CHUNK_MIN) {
+        i = CHUNK_MIN - chunker->len < len ? CHUNK_MIN - chunker->len : len;
+        chunker->len += i;
+    }
+
+    uint64_t fp = chunker->fp;
+    size_t chunk_len = chunker->len;
+    for (; i < len; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        chunk_len++;
+        uint64_t mask = chunk_len < CHUNK_AVG ? MASK_STRICT : MASK_LOOSE;
+        if ((fp & mask) == 0 || chunk_len >= CHUNK_MAX) {
+            *cut = 1;
+            i++;
+            break;
+        }
+    }
+    chunker->fp = fp;
+    chunker->len = chunk_len;
+    return i;
+}
+
+int chunk_wanted(const gyatt_repo_t *repo, uint64_t size) {
+    int mb = repo ? repo->config.chunk_threshold_mb : 0;
+    return mb > 0 && size >= (uint64_t)mb * 1024 * 1024;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// One finished chunk: stored (a chunk that's already there is only
+// hashed) or just hashed, and added to the list
+static int chunk_emit(gyatt_repo_t *repo, int store, const unsigned char *data, size_t len, buffer_t *list) {
+    gyatt_hash_t hash;
+    if (store) {
+        if (object_write(repo, data, len, OBJ_BLOB, &hash) != 0) return -1;
+    } else {
+        object_hash(data, len, OBJ_BLOB, &hash);
+    }
+
+    unsigned char ref[CHUNK_REF_SIZE];
+    memcpy(ref, hash.hash, HASH_SIZE);
+    put_u32(ref + HASH_SIZE, (uint32_t)len);
+    buffer_append(list, ref, sizeof(ref));
+    return 0;
+}
+
+static int chunk_fd(gyatt_repo_t *repo, int fd, uint64_t size, int store, gyatt_hash_t *hash) {
+    unsigned char *buf = malloc(CHUNK_MAX);
+    buffer_t *list = buffer_create((size_t)(size / CHUNK_AVG + 2) * CHUNK_REF_SIZE);
+    if (!buf || !list) {
+        free(buf);
+        buffer_free(list);
+        return -1;
+    }
+
+    chunker_t chunker;
+    chunker_init(&chunker);
+    size_t have = 0;           // Bytes in buf; the chunk starts at buf[0]
+    size_t scanned = 0;        // How many of them the chunker has seen
+    uint64_t total = 0;
+    int eof = 0;
+    int result = 0;
+    while (result == 0) {
+        if (scanned == have && !eof) {
+            size_t room = CHUNK_MAX - have;
+            ssize_t n = read(fd, buf + have, room < CHUNK_READ ? room : CHUNK_READ);
+            TRACE_SYSCALL();
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                result = -1;
+                break;
+            }
+            if (n == 0) eof = 1;
+            have += (size_t)n;
+            total += (uint64_t)n;
+        }
+        if (have == 0) break;
+
+        int cut;
+        scanned += chunker_scan(&chunker, buf + scanned, have - scanned, &cut);
+        if (!cut && !(eof && scanned == have)) continue;
+
+        result = chunk_emit(repo, store, buf, scanned, list);
+        memmove(buf, buf + scanned, have - scanned);
+        have -= scanned;
+        scanned = 0;
+        chunker_init(&chunker);
+    }
+    free(buf);
+
+    // Fails if the file grew or shrank while we were reading it
+    if (result == 0 && total != size) result = -1;
+    if (result == 0) {
+        if (store) result = object_write(repo, list->data, list->len, OBJ_CHUNKED, hash);
+        else object_hash(list->data, list->len, OBJ_CHUNKED, hash);
+    }
+    buffer_free(list);
+    return result;
+}
+
+int chunk_file(gyatt_repo_t *repo, int fd, uint64_t size, int store, gyatt_hash_t *hash) {
+    trace_span_t span = trace_begin(TRACE_CHUNK);
+    int result = chunk_fd(repo, fd, size, store, hash);
+    trace_end(span, result == 0 ? size : 0, 0);
+    return result;
+}
+
+int chunk_list_foreach(const void *list, size_t list_size, chunk_ref_fn fn, void *arg) {
+    if (list_size % CHUNK_REF_SIZE != 0) return -1;
+
+    const unsigned char *p = list;
+    for (size_t pos = 0; pos < list_size; pos += CHUNK_REF_SIZE) {
+        gyatt_hash_t hash;
+        memcpy(hash.hash, p + pos, HASH_SIZE);
+        uint32_t size = get_u32(p + pos + HASH_SIZE);
+        if (size == 0 || size > CHUNK_MAX) return -1;
+        int ret = fn(&hash, size, arg);
+        if (ret != 0) return ret;
+    }
+    return 0;
+}
+
+static int add_size(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)hash;
+    *(uint64_t *)arg += size;
+    return 0;
+}
+
+int chunk_list_total(const void *list, size_t list_size, uint64_t *total) {
+    *total = 0;
+    return chunk_list_foreach(list, list_size, add_size, total) == 0 ? 0 : -1;
+}
+
+typedef struct {
+    gyatt_repo_t *repo;
+    chunk_data_fn fn;
+    void *arg;
+} chunk_reader_t;
+
+static int read_one(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    chunk_reader_t *reader = arg;
+    object_type_t type;
+    size_t got;
+    void *data = object_read(reader->repo, hash, &type, &got);
+    if (!data || type != OBJ_BLOB || got != size) {
+        char hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hex);
+        fprintf(stderr, "Error: Could not read chunk %s\n", hex);
+        free(data);
+        return -1;
+    }
+    int result = reader->fn(data, got, reader->arg);
+    free(data);
+    return result;
+}
+
+int chunk_read(gyatt_repo_t *repo, const void *list, size_t list_size, chunk_data_fn fn, void *arg) {
+    chunk_reader_t reader = { repo, fn, arg };
+    return chunk_list_foreach(list, list_size, read_one, &reader) == 0 ? 0 : -1;
+}
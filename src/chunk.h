@@ -0,0 +1,57 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include "gyatt.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Content-defined chunking for big files. With [core] chunkthreshold set
+// (in MB), a file at least that big is cut into chunks with FastCDC, each
+// chunk is stored as an ordinary blob, and the file is a "chunked" object
+// listing them. A few changed bytes then only change a chunk or two: the
+// rest are already stored, and aren't sent again by push or to IPFS,
+// where each chunk is one block.
+//
+// The chunked object's hash is what the tree and index record for the
+// file, so changing the threshold changes the hash big files get the
+// next time they're added.
+//
+// Payload: per chunk, its blob hash then its size (u32, big-endian).
+// The largest chunk leaves room for its "blob N\0" header, so its loose
+// form still fits in one 1 MiB IPFS block.
+#define CHUNK_MIN (64 * 1024)
+#define CHUNK_AVG (256 * 1024)
+#define CHUNK_MAX (1024 * 1024 - 32)
+#define CHUNK_REF_SIZE (HASH_SIZE + 4)
+
+typedef struct {
+    uint64_t fp;               // Gear hash over the current chunk
+    size_t len;                // Bytes in it so far
+} chunker_t;
+
+void chunker_init(chunker_t *chunker);
+// Looks for the end of the current chunk in data. Returns how many bytes
+// belong to it; *cut says whether it ends there.
+size_t chunker_scan(chunker_t *chunker, const unsigned char *data, size_t len, int *cut);
+
+// Whether a file this big gets chunked in this repo
+int chunk_wanted(const gyatt_repo_t *repo, uint64_t size);
+
+// Chunk an open file into the store (or, with store 0, only work out the
+// hash it would get). size is what fstat said; a file that doesn't read
+// back that long fails.
+int chunk_file(gyatt_repo_t *repo, int fd, uint64_t size, int store, gyatt_hash_t *hash);
+
+// Walk a chunked object's payload: fn gets each chunk's hash and size,
+// and returning non-zero stops the walk (and becomes the return value).
+// -1 if the payload is malformed.
+typedef int (*chunk_ref_fn)(const gyatt_hash_t *hash, uint32_t size, void *arg);
+int chunk_list_foreach(const void *list, size_t list_size, chunk_ref_fn fn, void *arg);
+// The size of the file it stands for, -1 if it's malformed
+int chunk_list_total(const void *list, size_t list_size, uint64_t *total);
+
+// Reassemble a chunked object's file one chunk at a time, in order
+typedef int (*chunk_data_fn)(const void *data, size_t len, void *arg);
+int chunk_read(gyatt_repo_t *repo, const void *list, size_t list_size, chunk_data_fn fn, void *arg);
+
+#endif // CHUNK_H
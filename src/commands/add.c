@@ -1,142 +1,295 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
-#include <dirent.h>
 #include <sys/stat.h>
 #include "../gyatt.h"
+#include "../fsmonitor.h"
+#include "../ignore.h"
 #include "../index.h"
+#include "../object.h"
+#include "../pool.h"
+#include "../scan.h"
 #include "../utils.h"
 
-static int should_ignore(const char *path) {
-    // Always ignore .gyatt directory
-    if (strstr(path, ".gyatt") != NULL) {
-        return 1;
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// One file to stage. The walker fills in the path and stat data, a worker
+// hashes and stores the blob, and the main thread folds it into the index.
+typedef struct {
+    gyatt_repo_t *repo;
+    char *path;                // As the user typed/walked it (relative to cwd)
+    char *rel_path;            // Relative to the repo root
+    struct stat st;
+    gyatt_hash_t hash;
+    size_t size;
+    int result;
+} add_job_t;
+
+typedef struct {
+    gyatt_repo_t *repo;
+    pool_t *pool;
+    ignore_t *ignore;
+    fsmonitor_view_t *view;    // Set when the fsmonitor daemon said what changed
+    add_job_t **jobs;
+    size_t count;
+    size_t capacity;
+} add_queue_t;
+
+static int is_digits(const char *s) {
+    if (!*s) return 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return 0;
     }
-    
-    // Check .gyattignore patterns (simple implementation)
-    // TODO: Implement full .gyattignore parsing
-    
-    return 0;
+    return 1;
+}
+
+// How many arguments from argv[i] on make up a jobs option (-j N, -jN or
+// --jobs N, and nothing else that merely starts with -j): 0 if argv[i]
+// isn't one, -1 if its value is missing or not a number
+static int parse_jobs_option(int argc, char *argv[], int i, int *threads) {
+    const char *arg = argv[i];
+    const char *value;
+    int used;
+    if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: %s needs a number of threads\n", arg);
+            return -1;
+        }
+        value = argv[i + 1];
+        used = 2;
+    } else if (strncmp(arg, "-j", 2) == 0 && is_digits(arg + 2)) {
+        value = arg + 2;
+        used = 1;
+    } else {
+        return 0;
+    }
+
+    errno = 0;
+    long n = is_digits(value) ? strtol(value, NULL, 10) : -1;
+    if (n < 0 || errno != 0 || n > INT_MAX) {
+        fprintf(stderr, "Error: Invalid number of threads '%s'\n", value);
+        return -1;
+    }
+    *threads = n < 1 ? 1 : (int)n;
+    return used;
+}
+
+// Worker: hash, compress and store one file. Touches nothing shared.
+static void add_job_run(void *arg) {
+    add_job_t *job = arg;
+
+    if (blob_write_file(job->repo, job->path, &job->hash, &job->size) != 0) {
+        fprintf(stderr, "Error: Failed to write blob for '%s'\n", job->path);
+        job->result = -1;
+        return;
+    }
+
+    job->result = 0;
+}
+
+static int add_job_compare(const void *a, const void *b) {
+    const add_job_t *ja = *(add_job_t *const *)a;
+    const add_job_t *jb = *(add_job_t *const *)b;
+    return strcmp(ja->rel_path, jb->rel_path);
 }
 
-static int add_directory_recursive(index_t *index, const char *dir_path) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
+// rel_path is path relative to the repo root, which the caller already has
+static int add_queue_push(add_queue_t *queue, const char *path, const char *rel_path, const struct stat *st) {
+    if (queue->count >= queue->capacity) {
+        size_t new_capacity = queue->capacity == 0 ? 256 : queue->capacity * 2;
+        add_job_t **new_jobs = realloc(queue->jobs, new_capacity * sizeof(add_job_t *));
+        if (!new_jobs) return -1;
+        queue->jobs = new_jobs;
+        queue->capacity = new_capacity;
+    }
+
+    add_job_t *job = calloc(1, sizeof(add_job_t));
+    if (!job) return -1;
+
+    job->repo = queue->repo;
+    job->path = str_duplicate(path);
+    job->rel_path = str_duplicate(rel_path);
+    job->st = *st;
+    job->result = -1;
+    if (!job->path || !job->rel_path) {
+        free(job->path);
+        free(job->rel_path);
+        free(job);
+        return -1;
+    }
+
+    queue->jobs[queue->count++] = job;
+    return pool_submit(queue->pool, add_job_run, job);
+}
+
+static void add_queue_free(add_queue_t *queue) {
+    for (size_t i = 0; i < queue->count; i++) {
+        free(queue->jobs[i]->path);
+        free(queue->jobs[i]->rel_path);
+        free(queue->jobs[i]);
+    }
+    free(queue->jobs);
+}
+
+// Queue every file under dir_path, which is rel_dir relative to the repo
+// root ("" for the root itself). Under the fsmonitor daemon that's only
+// the files it saw change (or status had to look at last time): anything
+// else is tracked and still the way the index has it.
+static int add_directory(add_queue_t *queue, const char *dir_path, const char *rel_dir) {
+    scan_t *scan = queue->view ? queue->view->files :
+                   scan_worktree(queue->repo, rel_dir, queue->ignore, pool_thread_count(queue->pool));
+    if (!scan) {
         fprintf(stderr, "Error: Cannot open directory '%s'\n", dir_path);
         return -1;
     }
-    
-    int added = 0;
-    struct dirent *entry;
-    
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        char *entry_path = path_join(dir_path, entry->d_name);
-        
-        if (should_ignore(entry_path)) {
-            free(entry_path);
-            continue;
-        }
-        
-        struct stat st;
-        if (stat(entry_path, &st) != 0) {
-            free(entry_path);
-            continue;
-        }
-        
-        if (S_ISDIR(st.st_mode)) {
-            // Recurse into subdirectory
-            int result = add_directory_recursive(index, entry_path);
-            if (result >= 0) {
-                added += result;
-            }
-        } else if (S_ISREG(st.st_mode)) {
-            // Add file
-            if (index_add_file(index, entry_path) == 0) {
-                printf("add '%s'\n", entry_path);
-                added++;
-            }
+
+    // Named the way the user did, for the messages
+    size_t skip = rel_dir[0] ? strlen(rel_dir) + 1 : 0;
+    int queued = 0;
+    for (size_t i = 0; i < scan->count; i++) {
+        const char *rel_path = scan->entries[i].path;
+        if (skip && (strncmp(rel_path, rel_dir, skip - 1) != 0 || rel_path[skip - 1] != '/')) continue;
+
+        char *entry_path = path_join(dir_path, rel_path + skip);
+        if (entry_path && add_queue_push(queue, entry_path, rel_path, &scan->entries[i].st) == 0) {
+            queued++;
         }
-        
         free(entry_path);
     }
-    
-    closedir(dir);
-    return added;
+
+    if (!queue->view) scan_free(scan);
+    return queued;
 }
 
-int cmd_add(int argc, char *argv[]) {
-    if (!is_gyatt_repo()) {
+int cmd_add(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a Gyatt repository\n");
         fprintf(stderr, "Run 'gyatt init' to create a repository\n");
         return 1;
     }
-    
-    if (argc < 2) {
+
+    // Parse options (-j N, -jN, --jobs N); everything else is a path
+    int threads = config_thread_count(&repo->config);
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        int used = parse_jobs_option(argc, argv, i, &threads);
+        if (used < 0) return 1;
+        if (used > 0) {
+            i += used - 1;
+        } else {
+            path_count++;
+        }
+    }
+
+    if (path_count == 0) {
         fprintf(stderr, "Error: No files specified\n");
-        fprintf(stderr, "Usage: gyatt add <file>...\n");
+        fprintf(stderr, "Usage: gyatt add [-j <threads>] <file>...\n");
         fprintf(stderr, "       gyatt add .           # Add all files\n");
         return 1;
     }
-    
+
     // Load the index
     index_t *index = index_create();
     if (!index) {
         fprintf(stderr, "Error: Failed to create index\n");
         return 1;
     }
-    
-    if (index_read(index) != 0) {
+
+    if (index_read(repo, index) != 0) {
         fprintf(stderr, "Warning: Could not read existing index, starting fresh\n");
     }
-    
-    int total_added = 0;
-    
-    // Process each argument
+
+    add_queue_t queue = {0};
+    queue.repo = repo;
+    queue.pool = pool_create(threads);
+    queue.ignore = ignore_create(repo);
+    if (!queue.pool || !queue.ignore) {
+        fprintf(stderr, "Error: Failed to start worker threads\n");
+        pool_free(queue.pool);
+        ignore_free(queue.ignore);
+        index_free(index);
+        return 1;
+    }
+
+    // With the fsmonitor daemon running, directories only need what it
+    // saw change looked at, the same as status does
+    fsmonitor_view_t view;
+    if (fsmonitor_view(repo, index, queue.ignore, &view) == 0) queue.view = &view;
+
+    // Process each argument; files are hashed and compressed on the
+    // workers as they're queued
     for (int i = 1; i < argc; i++) {
         const char *path = argv[i];
-        
+
+        int ignored_threads;
+        int used = parse_jobs_option(argc, argv, i, &ignored_threads);
+        if (used > 0) {
+            i += used - 1;  // Already taken care of above
+            continue;
+        }
+
         struct stat st;
         if (stat(path, &st) != 0) {
             fprintf(stderr, "Error: '%s' does not exist\n", path);
             continue;
         }
-        
-        if (should_ignore(path)) {
+
+        char rel_path[PATH_MAX];
+        if (repo_relative_path(repo, path, rel_path, sizeof(rel_path)) != 0) {
+            fprintf(stderr, "Error: '%s' is outside the repository\n", path);
+            continue;
+        }
+        if (ignore_path(queue.ignore, rel_path, S_ISDIR(st.st_mode))) {
             printf("Ignoring '%s'\n", path);
             continue;
         }
-        
+
         if (S_ISDIR(st.st_mode)) {
             // Add directory recursively
-            int added = add_directory_recursive(index, path);
-            if (added >= 0) {
-                total_added += added;
-            }
+            add_directory(&queue, path, rel_path);
         } else if (S_ISREG(st.st_mode)) {
             // Add single file
-            if (index_add_file(index, path) == 0) {
-                printf("add '%s'\n", path);
-                total_added++;
-            }
+            add_queue_push(&queue, path, rel_path, &st);
         } else {
             fprintf(stderr, "Warning: Skipping '%s' (not a regular file)\n", path);
         }
     }
-    
+
+    // Collect results on this thread, in path order: output is stable and
+    // the sorted index takes each new entry as an append
+    pool_wait(queue.pool);
+    pool_free(queue.pool);
+    ignore_free(queue.ignore);
+    fsmonitor_view_free(&view);
+    qsort(queue.jobs, queue.count, sizeof(add_job_t *), add_job_compare);
+
+    int total_added = 0;
+    for (size_t i = 0; i < queue.count; i++) {
+        add_job_t *job = queue.jobs[i];
+        if (job->result != 0) continue;
+
+        index_entry_t *entry = index_add_entry(index, job->rel_path, &job->hash,
+                                               job->st.st_mode & 0777, job->size,
+                                               job->st.st_mtime);
+        if (entry) index_entry_set_stat(entry, &job->st);
+        printf("add '%s'\n", job->path);
+        total_added++;
+    }
+    add_queue_free(&queue);
+
     // Write the updated index
-    if (index_write(index) != 0) {
+    if (index_write(repo, index) != 0) {
         fprintf(stderr, "Error: Failed to write index\n");
         index_free(index);
         return 1;
     }
-    
+
     printf("\n%d file(s) staged for commit\n", total_added);
-    
+
     index_free(index);
     return 0;
 }
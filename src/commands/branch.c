@@ -12,16 +12,12 @@
 #endif
 
 // Helper to get current branch name
-static char *get_current_branch(void) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return NULL;
-    
+static char *get_current_branch(gyatt_repo_t *repo) {
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     
     size_t size = 0;
     char *head_content = read_file(head_path, &size);
-    free(gyatt_dir);
     
     if (!head_content) return NULL;
     
@@ -43,20 +39,15 @@ static char *get_current_branch(void) {
 }
 
 // Helper to get current HEAD commit hash
-static int get_head_commit_hash(gyatt_hash_t *hash) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return -1;
-    
-    char *current_branch = get_current_branch();
+static int get_head_commit_hash(gyatt_repo_t *repo, gyatt_hash_t *hash) {
+    char *current_branch = get_current_branch(repo);
     if (!current_branch) {
-        free(gyatt_dir);
         return -1;
     }
     
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", gyatt_dir, current_branch);
+    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", repo->gyatt_dir, current_branch);
     free(current_branch);
-    free(gyatt_dir);
     
     size_t size = 0;
     char *hash_str = read_file(branch_path, &size);
@@ -73,16 +64,9 @@ static int get_head_commit_hash(gyatt_hash_t *hash) {
 }
 
 // List all branches
-static int list_branches(void) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        fprintf(stderr, "Error: Not a gyatt repository\n");
-        return 1;
-    }
-    
+static int list_branches(gyatt_repo_t *repo) {
     char refs_path[PATH_MAX];
-    snprintf(refs_path, sizeof(refs_path), "%s/refs/heads", gyatt_dir);
-    free(gyatt_dir);
+    snprintf(refs_path, sizeof(refs_path), "%s/refs/heads", repo->gyatt_dir);
     
     DIR *dir = opendir(refs_path);
     if (!dir) {
@@ -90,7 +74,7 @@ static int list_branches(void) {
         return 1;
     }
     
-    char *current_branch = get_current_branch();
+    char *current_branch = get_current_branch(repo);
     
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
@@ -122,7 +106,7 @@ static int list_branches(void) {
 }
 
 // Create a new branch
-static int create_branch(const char *branch_name) {
+static int create_branch(gyatt_repo_t *repo, const char *branch_name) {
     if (!branch_name || strlen(branch_name) == 0) {
         fprintf(stderr, "Error: Branch name required\n");
         return 1;
@@ -135,27 +119,19 @@ static int create_branch(const char *branch_name) {
         return 1;
     }
     
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        fprintf(stderr, "Error: Not a gyatt repository\n");
-        return 1;
-    }
-    
     // Check if branch already exists
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", gyatt_dir, branch_name);
+    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", repo->gyatt_dir, branch_name);
     
     if (file_exists(branch_path)) {
         fprintf(stderr, "Error: Branch '%s' already exists\n", branch_name);
-        free(gyatt_dir);
         return 1;
     }
     
     // Get current HEAD commit
     gyatt_hash_t head_hash;
-    if (get_head_commit_hash(&head_hash) != 0) {
+    if (get_head_commit_hash(repo, &head_hash) != 0) {
         fprintf(stderr, "Error: Could not get HEAD commit\n");
-        free(gyatt_dir);
         return 1;
     }
     
@@ -171,7 +147,6 @@ static int create_branch(const char *branch_name) {
     if (!has_commits) {
         fprintf(stderr, "Error: Cannot create branch without any commits\n");
         fprintf(stderr, "Create your first commit before creating branches\n");
-        free(gyatt_dir);
         return 1;
     }
     
@@ -182,24 +157,22 @@ static int create_branch(const char *branch_name) {
     
     if (write_file(branch_path, hash_hex, strlen(hash_hex)) != 0) {
         fprintf(stderr, "Error: Failed to create branch '%s'\n", branch_name);
-        free(gyatt_dir);
         return 1;
     }
     
     printf("Branch '%s' created\n", branch_name);
-    free(gyatt_dir);
     
     return 0;
 }
 
 // Delete a branch
-static int delete_branch(const char *branch_name) {
+static int delete_branch(gyatt_repo_t *repo, const char *branch_name) {
     if (!branch_name || strlen(branch_name) == 0) {
         fprintf(stderr, "Error: Branch name required\n");
         return 1;
     }
     
-    char *current_branch = get_current_branch();
+    char *current_branch = get_current_branch(repo);
     if (current_branch && strcmp(branch_name, current_branch) == 0) {
         fprintf(stderr, "Error: Cannot delete current branch '%s'\n", branch_name);
         free(current_branch);
@@ -207,15 +180,8 @@ static int delete_branch(const char *branch_name) {
     }
     free(current_branch);
     
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        fprintf(stderr, "Error: Not a gyatt repository\n");
-        return 1;
-    }
-    
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", gyatt_dir, branch_name);
-    free(gyatt_dir);
+    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", repo->gyatt_dir, branch_name);
     
     if (!file_exists(branch_path)) {
         fprintf(stderr, "Error: Branch '%s' does not exist\n", branch_name);
@@ -232,15 +198,15 @@ static int delete_branch(const char *branch_name) {
     return 0;
 }
 
-int cmd_branch(int argc, char *argv[]) {
-    if (!is_gyatt_repo()) {
+int cmd_branch(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a Gyatt repository\n");
         return 1;
     }
     
     // No arguments - list branches
     if (argc == 1) {
-        return list_branches();
+        return list_branches(repo);
     }
     
     // Parse options
@@ -251,10 +217,10 @@ int cmd_branch(int argc, char *argv[]) {
                 fprintf(stderr, "Error: Branch name required after %s\n", argv[i]);
                 return 1;
             }
-            return delete_branch(argv[i + 1]);
+            return delete_branch(repo, argv[i + 1]);
         } else {
             // Create branch
-            return create_branch(argv[i]);
+            return create_branch(repo, argv[i]);
         }
     }
     
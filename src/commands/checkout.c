@@ -3,36 +3,17 @@
 #include <string.h>
 #include "../gyatt.h"
 #include "../utils.h"
-#include "../object.h"
-#include "../index.h"
 #include "../hash.h"
+#include "../worktree.h"
 
 #ifndef PATH_MAX
     #define PATH_MAX 4096
 #endif
 
-// Helper to check if working directory is clean
-static int is_working_directory_clean(void) {
-    // For now, just check if index is empty
-    // In a full implementation, we'd check for uncommitted changes
-    index_t *index = index_create();
-    if (!index) return 0;
-    
-    index_read(index);
-    int is_clean = (index->entry_count == 0);
-    index_free(index);
-    
-    return is_clean;
-}
-
 // Helper to update HEAD to point to a branch
-static int update_head_to_branch(const char *branch_name) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return -1;
-    
+static int update_head_to_branch(gyatt_repo_t *repo, const char *branch_name) {
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
-    free(gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     
     char ref_content[PATH_MAX];
     snprintf(ref_content, sizeof(ref_content), "ref: refs/heads/%s\n", branch_name);
@@ -44,54 +25,8 @@ static int update_head_to_branch(const char *branch_name) {
     return 0;
 }
 
-// Helper to restore files from a commit
-static int restore_files_from_commit(const gyatt_hash_t *commit_hash) {
-    // Read commit
-    commit_object_t *commit = commit_read(commit_hash);
-    if (!commit) {
-        fprintf(stderr, "Error: Could not read commit\n");
-        return -1;
-    }
-    
-    // Read tree
-    tree_object_t *tree = tree_read(&commit->tree);
-    commit_free(commit);
-    
-    if (!tree) {
-        fprintf(stderr, "Error: Could not read tree\n");
-        return -1;
-    }
-    
-    // For each entry in tree, restore the file
-    for (size_t i = 0; i < tree->entry_count; i++) {
-        tree_entry_t *entry = &tree->entries[i];
-        
-        if (entry->type != OBJ_BLOB) {
-            continue;  // Skip non-blobs for now
-        }
-        
-        // Read blob
-        blob_object_t *blob = blob_read(&entry->hash);
-        if (!blob) {
-            fprintf(stderr, "Warning: Could not read blob for '%s'\n", entry->name);
-            continue;
-        }
-        
-        // Write file
-        if (write_file(entry->name, blob->data, blob->header.size) != 0) {
-            fprintf(stderr, "Warning: Could not write file '%s'\n", entry->name);
-        }
-        
-        blob_free(blob);
-    }
-    
-    tree_free(tree);
-    
-    return 0;
-}
-
-int cmd_checkout(int argc, char *argv[]) {
-    if (!is_gyatt_repo()) {
+int cmd_checkout(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a Gyatt repository\n");
         return 1;
     }
@@ -104,26 +39,18 @@ int cmd_checkout(int argc, char *argv[]) {
     const char *branch_name = argv[1];
     
     // Check if branch exists
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        fprintf(stderr, "Error: Not a gyatt repository\n");
-        return 1;
-    }
-    
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", gyatt_dir, branch_name);
+    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", repo->gyatt_dir, branch_name);
     
     if (!file_exists(branch_path)) {
         fprintf(stderr, "Error: Branch '%s' does not exist\n", branch_name);
-        free(gyatt_dir);
         return 1;
     }
     
     // Check if working directory is clean
-    if (!is_working_directory_clean()) {
+    if (!worktree_is_clean(repo)) {
         fprintf(stderr, "Error: You have uncommitted changes\n");
         fprintf(stderr, "Please commit or stash them before switching branches\n");
-        free(gyatt_dir);
         return 1;
     }
     
@@ -132,7 +59,6 @@ int cmd_checkout(int argc, char *argv[]) {
     char *hash_str = read_file(branch_path, &size);
     if (!hash_str) {
         fprintf(stderr, "Error: Could not read branch ref\n");
-        free(gyatt_dir);
         return 1;
     }
     
@@ -140,23 +66,22 @@ int cmd_checkout(int argc, char *argv[]) {
     hex_to_hash(hash_str, &commit_hash);
     free(hash_str);
     
-    // Restore files from the commit
-    if (restore_files_from_commit(&commit_hash) != 0) {
+    // Only what differs from HEAD gets touched (everything, if HEAD has no
+    // commit yet)
+    gyatt_hash_t head_hash;
+    int has_head = repo_resolve_ref(repo, "HEAD", &head_hash) == 0;
+    if (worktree_checkout(repo, has_head ? &head_hash : NULL, &commit_hash) != 0) {
         fprintf(stderr, "Error: Failed to restore files\n");
-        free(gyatt_dir);
         return 1;
     }
     
     // Update HEAD to point to the new branch
-    if (update_head_to_branch(branch_name) != 0) {
+    if (update_head_to_branch(repo, branch_name) != 0) {
         fprintf(stderr, "Error: Failed to update HEAD\n");
-        free(gyatt_dir);
         return 1;
     }
     
     printf("Switched to branch '%s'\n", branch_name);
     
-    free(gyatt_dir);
-    
     return 0;
 }
@@ -12,33 +12,99 @@
     #define PATH_MAX 4096
 #endif
 
-// Helper to build tree from index
-static tree_object_t *build_tree_from_index(index_t *index) {
+// Write the tree for index entries [lo, hi), which all sit under dir
+// ("" for the root), and every tree below it. Directories whose cached
+// tree is still valid are reused as-is, so a commit only rebuilds the
+// trees along the paths that changed.
+static int write_tree_range(gyatt_repo_t *repo, index_t *index, size_t lo, size_t hi,
+                            const char *dir, size_t dir_len, gyatt_hash_t *hash,
+                            size_t *trees_written) {
+    if (index_cache_tree_get(index, dir, dir_len, hi - lo, hash)) return 0;
+    
     tree_object_t *tree = tree_create();
-    if (!tree) return NULL;
+    if (!tree) return -1;
     
-    // Add each index entry as a tree entry
-    for (size_t i = 0; i < index->entry_count; i++) {
+    size_t skip = dir_len > 0 ? dir_len + 1 : 0;  // "dir/"
+    int result = 0;
+    size_t i = lo;
+    while (i < hi && result == 0) {
         index_entry_t *idx_entry = &index->entries[i];
+        const char *path = index_entry_path(index, idx_entry);
+        const char *name = path + skip;
+        const char *slash = strchr(name, '/');
+        
+        if (!slash) {
+            tree_add_entry(tree, name, idx_entry->mode, &idx_entry->hash, OBJ_BLOB);
+            i++;
+            continue;
+        }
         
-        // Determine if it's a file or directory
-        // For now, we treat everything as blobs (files)
-        tree_add_entry(tree, idx_entry->path, idx_entry->mode, 
-                      &idx_entry->hash, OBJ_BLOB);
+        // Entries are sorted by full path, so everything under this
+        // subdirectory is one contiguous run
+        size_t sub_len = (size_t)(slash - path);
+        size_t end = i + 1;
+        while (end < hi && strncmp(index_entry_path(index, &index->entries[end]), path, sub_len + 1) == 0) {
+            end++;
+        }
+        
+        char sub_name[256];
+        size_t name_len = (size_t)(slash - name);
+        if (name_len >= sizeof(sub_name)) {
+            fprintf(stderr, "Error: Directory name too long: %.*s\n", (int)sub_len, path);
+            result = -1;
+            break;
+        }
+        memcpy(sub_name, name, name_len);
+        sub_name[name_len] = '\0';
+        
+        gyatt_hash_t sub_hash;
+        result = write_tree_range(repo, index, i, end, path, sub_len, &sub_hash, trees_written);
+        if (result == 0) tree_add_entry(tree, sub_name, TREE_MODE_DIR, &sub_hash, OBJ_TREE);
+        i = end;
     }
     
-    return tree;
+    if (result == 0) result = tree_write(repo, tree);
+    if (result == 0) {
+        *hash = tree->header.hash;
+        (*trees_written)++;
+        index_cache_tree_set(index, dir, dir_len, hi - lo, hash);
+    }
+    
+    tree_free(tree);
+    return result;
 }
 
-// Helper to read current HEAD commit hash
-static int get_head_commit(gyatt_hash_t *head_hash) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        return -1;
+static int is_zero_hash(const gyatt_hash_t *hash) {
+    for (int i = 0; i < HASH_SIZE; i++) {
+        if (hash->hash[i] != 0) return 0;
     }
+    return 1;
+}
+
+// Files added, modified or removed relative to the parent commit's tree
+static size_t count_changed_files(index_t *index, tree_object_t *parent_tree) {
+    if (!parent_tree) return index->entry_count;
     
+    size_t changed = 0;
+    size_t still_present = 0;
+    for (size_t i = 0; i < index->entry_count; i++) {
+        index_entry_t *idx_entry = &index->entries[i];
+        tree_entry_t *tree_entry = tree_find_entry(parent_tree, index_entry_path(index, idx_entry));
+        if (!tree_entry) {
+            changed++;
+        } else {
+            still_present++;
+            if (hash_compare(&tree_entry->hash, &idx_entry->hash) != 0) changed++;
+        }
+    }
+    
+    return changed + (parent_tree->entry_count - still_present);
+}
+
+// Helper to read current HEAD commit hash
+static int get_head_commit(gyatt_repo_t *repo, gyatt_hash_t *head_hash) {
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     
     // Read HEAD to get current branch ref
     size_t ref_size = 0;
@@ -62,7 +128,7 @@ static int get_head_commit(gyatt_hash_t *head_hash) {
     
     // Read the branch ref file
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/%s", gyatt_dir, ref_start);
+    snprintf(branch_path, sizeof(branch_path), "%s/%s", repo->gyatt_dir, ref_start);
     
     size_t hash_size = 0;
     char *hash_str = read_file(branch_path, &hash_size);
@@ -78,19 +144,13 @@ static int get_head_commit(gyatt_hash_t *head_hash) {
     
     free(hash_str);
     free(ref_path);
-    free(gyatt_dir);
     return 0;
 }
 
 // Helper to update HEAD to point to new commit
-static int update_head(const gyatt_hash_t *commit_hash) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
-        return -1;
-    }
-    
+static int update_head(gyatt_repo_t *repo, const gyatt_hash_t *commit_hash) {
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     
     // Read HEAD to get current branch ref
     size_t ref_size = 0;
@@ -114,7 +174,7 @@ static int update_head(const gyatt_hash_t *commit_hash) {
     
     // Write commit hash to branch ref
     char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/%s", gyatt_dir, ref_start);
+    snprintf(branch_path, sizeof(branch_path), "%s/%s", repo->gyatt_dir, ref_start);
     
     char hash_hex[HASH_HEX_SIZE + 2];
     hash_to_hex(commit_hash, hash_hex);
@@ -122,16 +182,14 @@ static int update_head(const gyatt_hash_t *commit_hash) {
     
     if (write_file(branch_path, hash_hex, strlen(hash_hex)) != 0) {
         free(ref_content);
-        free(gyatt_dir);
         return -1;
     }
     
     free(ref_content);
-    free(gyatt_dir);
     return 0;
 }
 
-int cmd_commit(int argc, char *argv[]) {
+int cmd_commit(gyatt_repo_t *repo, int argc, char *argv[]) {
     // Parse arguments - looking for -m "message"
     char *message = NULL;
     
@@ -147,9 +205,7 @@ int cmd_commit(int argc, char *argv[]) {
         return 1;
     }
     
-    // Find gyatt directory
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a gyatt repository\n");
         return 1;
     }
@@ -158,14 +214,12 @@ int cmd_commit(int argc, char *argv[]) {
     index_t *index = index_create();
     if (!index) {
         fprintf(stderr, "Error: Failed to create index\n");
-        free(gyatt_dir);
         return 1;
     }
     
-    if (index_read(index) != 0) {
+    if (index_read(repo, index) != 0) {
         fprintf(stderr, "Error: Could not read index\n");
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
@@ -173,41 +227,49 @@ int cmd_commit(int argc, char *argv[]) {
         fprintf(stderr, "Error: Nothing to commit (staging area is empty)\n");
         fprintf(stderr, "Use 'gyatt add <file>' to stage files for commit\n");
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
-    // Build tree from index
-    tree_object_t *tree = build_tree_from_index(index);
-    if (!tree) {
-        fprintf(stderr, "Error: Failed to build tree\n");
+    // The index now mirrors HEAD after a commit, so compare against the
+    // parent's tree to decide whether anything is actually staged
+    gyatt_hash_t parent_hash;
+    get_head_commit(repo, &parent_hash);
+    
+    tree_object_t *parent_tree = NULL;
+    if (!is_zero_hash(&parent_hash)) {
+        commit_object_t *parent = commit_read(repo, &parent_hash);
+        if (parent) {
+            parent_tree = tree_read_flat(repo, &parent->tree);
+            commit_free(parent);
+        }
+    }
+    
+    // Build the trees, reusing whatever the index has cached
+    gyatt_hash_t tree_hash;
+    size_t trees_written = 0;
+    if (write_tree_range(repo, index, 0, index->entry_count, "", 0, &tree_hash, &trees_written) != 0) {
+        fprintf(stderr, "Error: Failed to write tree objects\n");
+        if (parent_tree) tree_free(parent_tree);
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
-    // Write tree object
-    if (tree_write(tree) != 0) {
-        fprintf(stderr, "Error: Failed to write tree object\n");
-        tree_free(tree);
+    if (parent_tree && hash_compare(&parent_tree->header.hash, &tree_hash) == 0) {
+        fprintf(stderr, "Error: Nothing to commit (no changes since last commit)\n");
+        fprintf(stderr, "Use 'gyatt add <file>' to stage files for commit\n");
+        tree_free(parent_tree);
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
-    gyatt_hash_t tree_hash = tree->header.hash;
-    tree_free(tree);
-    
-    // Get parent commit
-    gyatt_hash_t parent_hash;
-    get_head_commit(&parent_hash);
+    size_t file_count = count_changed_files(index, parent_tree);
+    if (parent_tree) tree_free(parent_tree);
     
     // Create commit object
     commit_object_t *commit = commit_create();
     if (!commit) {
         fprintf(stderr, "Error: Failed to create commit\n");
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
@@ -215,23 +277,22 @@ int cmd_commit(int argc, char *argv[]) {
     commit->tree = tree_hash;
     commit->parent = parent_hash;
     
-    // Set info (for now, I'll use a placeholder)
-    // TODO: Read from config
-    strncpy(commit->author.name, "Gyatt User", sizeof(commit->author.name) - 1);
-    strncpy(commit->author.email, "user@gyatt.local", sizeof(commit->author.email) - 1);
+    // Author from [user] in the config; the placeholders only when it's unset
+    const gyatt_config_t *config = &repo->config;
+    commit->author.name = config->user_name[0] ? config->user_name : "Gyatt User";
+    commit->author.email = config->user_email[0] ? config->user_email : "user@gyatt.local";
     commit->author.timestamp = time(NULL);
     commit->author.timezone = 0;
     
     commit->committer = commit->author;
     
-    strncpy(commit->message, message, sizeof(commit->message) - 1);
+    commit->message = message;
     
     // Write commit object
-    if (commit_write(commit) != 0) {
+    if (commit_write(repo, commit) != 0) {
         fprintf(stderr, "Error: Failed to write commit object\n");
         commit_free(commit);
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
@@ -239,19 +300,17 @@ int cmd_commit(int argc, char *argv[]) {
     commit_free(commit);
     
     // Update HEAD
-    if (update_head(&commit_hash) != 0) {
+    if (update_head(repo, &commit_hash) != 0) {
         fprintf(stderr, "Error: Failed to update HEAD\n");
         index_free(index);
-        free(gyatt_dir);
         return 1;
     }
     
-    // Save file count before clearing
-    size_t file_count = index->entry_count;
-    
-    // Clear the index after successful commit
-    index->entry_count = 0;
-    index_write(index);
+    // Keep the freshly cached trees for next time; a failure here only
+    // costs the next commit some rehashing
+    if (trees_written > 0 && index_write(repo, index) != 0) {
+        fprintf(stderr, "Warning: Could not update the index's tree cache\n");
+    }
     
     // Print success
     char hash_hex[HASH_HEX_SIZE + 1];
@@ -261,7 +320,7 @@ int cmd_commit(int argc, char *argv[]) {
     
     // Get current branch name from HEAD
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     size_t head_size = 0;
     char *head_content = read_file(head_path, &head_size);
     if (head_content) {
@@ -279,6 +338,5 @@ int cmd_commit(int argc, char *argv[]) {
     printf(" %zu file(s) changed\n", file_count);
     
     index_free(index);
-    free(gyatt_dir);
     return 0;
 }
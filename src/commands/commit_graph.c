@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include "../gyatt.h"
+#include "../hash.h"
+#include "../commit_graph.h"
+
+int cmd_commit_graph(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    if (argc != 2 || strcmp(argv[1], "write") != 0) {
+        fprintf(stderr, "Usage: gyatt commit-graph write\n");
+        return 1;
+    }
+
+    size_t count = 0;
+    if (commit_graph_write(repo, &count) != 0) {
+        fprintf(stderr, "Error: Failed to write commit graph\n");
+        return 1;
+    }
+
+    printf("Wrote commit graph with %zu commit(s)\n", count);
+    return 0;
+}
+
+int cmd_merge_base(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    int is_ancestor = argc == 4 && strcmp(argv[1], "--is-ancestor") == 0;
+    if (argc != 3 && !is_ancestor) {
+        fprintf(stderr, "Usage: gyatt merge-base <commit> <commit>\n");
+        fprintf(stderr, "       gyatt merge-base --is-ancestor <ancestor> <descendant>\n");
+        return 1;
+    }
+
+    gyatt_hash_t a, b;
+    const char *name_a = argv[argc - 2], *name_b = argv[argc - 1];
+    if (repo_resolve_ref(repo, name_a, &a) != 0) {
+        fprintf(stderr, "Error: Unknown revision '%s'\n", name_a);
+        return 1;
+    }
+    if (repo_resolve_ref(repo, name_b, &b) != 0) {
+        fprintf(stderr, "Error: Unknown revision '%s'\n", name_b);
+        return 1;
+    }
+
+    // --is-ancestor answers in the exit code only, for scripts
+    if (is_ancestor) {
+        int ret = commit_is_ancestor(repo, &a, &b);
+        if (ret < 0) {
+            fprintf(stderr, "Error: Could not walk history\n");
+            return 2;
+        }
+        return ret ? 0 : 1;
+    }
+
+    gyatt_hash_t base;
+    int ret = commit_merge_base(repo, &a, &b, &base);
+    if (ret < 0) {
+        fprintf(stderr, "Error: Could not walk history\n");
+        return 2;
+    }
+    if (ret > 0) return 1;  // No common history
+
+    char hex[HASH_HEX_SIZE];
+    hash_to_hex(&base, hex);
+    printf("%s\n", hex);
+    return 0;
+}
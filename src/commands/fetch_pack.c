@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../gyatt.h"
+#include "../hash.h"
+#include "../remote.h"
+
+// Plumbing: fetch exactly the objects named (not what they reach) from a
+// server in one batch. push/pull build on the same remote_fetch().
+
+static int add_hash(gyatt_hash_t **list, size_t *count, size_t *capacity, const char *hex) {
+    if (strlen(hex) != HASH_HEX_SIZE - 1 || strspn(hex, "0123456789abcdefABCDEF") != HASH_HEX_SIZE - 1) {
+        fprintf(stderr, "Error: '%s' is not an object hash\n", hex);
+        return -1;
+    }
+    if (*count >= *capacity) {
+        size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        gyatt_hash_t *grown = realloc(*list, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        *list = grown;
+        *capacity = new_capacity;
+    }
+    hex_to_hash(hex, &(*list)[(*count)++]);
+    return 0;
+}
+
+int cmd_fetch_pack(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: gyatt fetch-pack <remote> [--have <hash>]... <hash>...\n");
+        return 1;
+    }
+
+    gyatt_hash_t *wants = NULL, *haves = NULL;
+    size_t want_count = 0, want_capacity = 0, have_count = 0, have_capacity = 0;
+    int result = 0;
+    for (int i = 2; i < argc && result == 0; i++) {
+        if (strcmp(argv[i], "--have") == 0 && i + 1 < argc) {
+            result = add_hash(&haves, &have_count, &have_capacity, argv[++i]);
+        } else {
+            result = add_hash(&wants, &want_count, &want_capacity, argv[i]);
+        }
+    }
+
+    remote_t *remote = result == 0 ? remote_open(argv[1]) : NULL;
+    remote_fetch_stats_t stats;
+    if (remote) {
+        result = remote_fetch(repo, remote, wants, want_count, haves, have_count, 0, &stats);
+        remote_close(remote);
+    } else {
+        result = -1;
+    }
+    free(wants);
+    free(haves);
+
+    if (result != 0) return 1;
+
+    printf("Fetched %zu object(s), %llu bytes", stats.objects, (unsigned long long)stats.bytes);
+    if (stats.missing) printf(", %zu missing on the remote", stats.missing);
+    printf("\n");
+    return stats.missing ? 1 : 0;
+}
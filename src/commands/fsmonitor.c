@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../gyatt.h"
+#include "../fsmonitor.h"
+
+static void fsmonitor_usage(void) {
+    fprintf(stderr, "Usage: gyatt fsmonitor <start|stop|status|run>\n");
+    fprintf(stderr, "  start   Watch the working tree in the background\n");
+    fprintf(stderr, "  stop    Stop watching\n");
+    fprintf(stderr, "  status  Say whether it's running\n");
+    fprintf(stderr, "  run     Watch in the foreground\n");
+}
+
+// Detach and run the daemon, then wait until it answers
+static int fsmonitor_start(gyatt_repo_t *repo) {
+    if (fsmonitor_is_running(repo)) {
+        printf("fsmonitor is already running\n");
+        return 0;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: Cannot start fsmonitor\n");
+        return 1;
+    }
+    if (pid == 0) {
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            if (null_fd > STDERR_FILENO) close(null_fd);
+        }
+        _exit(fsmonitor_run(repo) == 0 ? 0 : 1);
+    }
+
+    for (int i = 0; i < 200; i++) {
+        if (fsmonitor_is_running(repo)) {
+            printf("fsmonitor started (pid %d)\n", (int)pid);
+            return 0;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "Error: fsmonitor didn't come up\n");
+    return 1;
+}
+
+int cmd_fsmonitor(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+    if (argc < 2) {
+        fsmonitor_usage();
+        return 1;
+    }
+
+    const char *action = argv[1];
+    if (strcmp(action, "start") == 0) {
+        return fsmonitor_start(repo);
+    } else if (strcmp(action, "run") == 0) {
+        return fsmonitor_run(repo) == 0 ? 0 : 1;
+    } else if (strcmp(action, "stop") == 0) {
+        if (fsmonitor_stop(repo) != 0) {
+            fprintf(stderr, "Error: fsmonitor isn't running\n");
+            return 1;
+        }
+        printf("fsmonitor stopped\n");
+        return 0;
+    } else if (strcmp(action, "status") == 0) {
+        int running = fsmonitor_is_running(repo);
+        printf("fsmonitor is %s\n", running ? "running" : "not running");
+        return running ? 0 : 1;
+    }
+
+    fsmonitor_usage();
+    return 1;
+}
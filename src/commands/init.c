@@ -62,6 +62,7 @@ static int create_config_file(const char *base_path) {
     buffer_t *buf = buffer_create(512);
     buffer_append_str(buf, "[core]\n");
     buffer_append_str(buf, "\tcompression = 6\n");
+    buffer_append_str(buf, "\tthreads = 0\n");
     buffer_append_str(buf, "\n");
     buffer_append_str(buf, "[user]\n");
     buffer_append_str(buf, "\tname = Your Name\n");
@@ -133,7 +134,7 @@ static int create_gyattignore(const char *repo_root) {
     return result;
 }
 
-int cmd_init(int argc, char *argv[]) {
+int cmd_init(gyatt_repo_t *repo, int argc, char *argv[]) {
     (void)argc;  // Mark as intentionally unused
     (void)argv;  // Mark as intentionally unused
     
@@ -144,9 +145,9 @@ int cmd_init(int argc, char *argv[]) {
     }
     
     // Check if already in a Gyatt repository
-    if (is_gyatt_repo()) {
+    if (repo) {
         fprintf(stderr, "Error: Already in a Gyatt repository\n");
-        fprintf(stderr, "Repository location: %s\n", find_repo_root());
+        fprintf(stderr, "Repository location: %s\n", repo->root);
         free(cwd);
         return 1;
     }
@@ -1,6 +1,9 @@
 #include "../gyatt.h"
 #include "../ipfs/ipfs_storage.h"
+#include "../ipfs/ipfs_fetch.h"
 #include "../hash.h"
+#include "../commit_graph.h"
+#include "../worktree.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,26 +18,28 @@ static void print_ipfs_help(void) {
     printf("IPFS Integration Commands:\n");
     printf("  init       Check IPFS daemon status and initialize IPFS storage\n");
     printf("  push       Upload repository objects to IPFS\n");
-    printf("  pull       Download repository objects from IPFS manifest\n");
+    printf("  pull       Fetch branches from a published manifest and fast-forward to them\n");
     printf("  publish    Create and publish repository manifest to IPFS\n");
     printf("  status     Show IPFS storage status and statistics\n");
     printf("\nExamples:\n");
     printf("  gyatt ipfs init           # Check IPFS daemon\n");
     printf("  gyatt ipfs push           # Upload all objects to IPFS\n");
-    printf("  gyatt ipfs push main      # Upload specific branch\n");
+    printf("  gyatt ipfs push main      # Upload a branch's history as one pinned DAG\n");
     printf("  gyatt ipfs publish        # Publish manifest and get shareable CID\n");
+    printf("  gyatt ipfs pull <cid>     # Fetch every branch in a manifest (also to clone)\n");
+    printf("  gyatt ipfs pull <cid> main\n");
     printf("  gyatt ipfs status         # Show what's uploaded\n");
 }
 
-static int cmd_ipfs_init(void) {
+static int cmd_ipfs_init(gyatt_repo_t *repo) {
     printf("Initializing IPFS storage...\n\n");
 
-    if (!is_gyatt_repo()) {
+    if (!repo) {
         fprintf(stderr, "Not a Gyatt repository\n");
         return 1;
     }
 
-    ipfs_storage_t *storage = ipfs_storage_init(".");
+    ipfs_storage_t *storage = ipfs_storage_init(repo);
     if (!storage) {
         fprintf(stderr, "Failed to initialize IPFS storage\n");
         return 1;
@@ -61,19 +66,19 @@ static int cmd_ipfs_init(void) {
     }
 
     printf("\n✓ IPFS storage initialized successfully\n");
-    printf("  Storage path: .gyatt/ipfs-refs\n");
+    printf("  CID map: .gyatt/ipfs-map.idx (%zu mapping(s))\n", cid_map_count(storage->map));
     
     ipfs_storage_free(storage);
     return 0;
 }
 
-static int cmd_ipfs_push(int argc, char *argv[]) {
-    if (!is_gyatt_repo()) {
+static int cmd_ipfs_push(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
         fprintf(stderr, "Not a Gyatt repository\n");
         return 1;
     }
 
-    ipfs_storage_t *storage = ipfs_storage_init(".");
+    ipfs_storage_t *storage = ipfs_storage_init(repo);
     if (!storage) {
         fprintf(stderr, "Failed to initialize IPFS storage\n");
         return 1;
@@ -100,13 +105,151 @@ static int cmd_ipfs_push(int argc, char *argv[]) {
     return result;
 }
 
-static int cmd_ipfs_publish(void) {
-    if (!is_gyatt_repo()) {
+// Fast-forward only, like gyatt pull; the objects are already here
+static int ipfs_update_branch(gyatt_repo_t *repo, const ipfs_manifest_branch_t *branch, int is_current) {
+    gyatt_hash_t local;
+    int has_local = repo_resolve_ref(repo, branch->name, &local) == 0;
+    if (has_local && hash_compare(&local, &branch->commit) == 0) {
+        printf("  %s: already up to date\n", branch->name);
+        return 0;
+    }
+    if (has_local) {
+        if (commit_is_ancestor(repo, &branch->commit, &local) == 1) {
+            printf("  %s: local is ahead; nothing to do\n", branch->name);
+            return 0;
+        }
+        if (commit_is_ancestor(repo, &local, &branch->commit) != 1) {
+            fprintf(stderr, "Error: '%s' has diverged from the manifest; can't fast-forward\n", branch->name);
+            return -1;
+        }
+    }
+
+    // The files have to be able to follow before the branch moves
+    if (is_current && worktree_checkout_check(repo, has_local ? &local : NULL, &branch->commit) != 0) {
+        return -1;
+    }
+
+    gyatt_hash_t none = {0};
+    int moved = repo_update_branch(repo, branch->name, has_local ? &local : &none, &branch->commit);
+    if (moved != 0) {
+        fprintf(stderr, "Error: %s\n", moved > 0 ? "Branch moved while pulling; try again" : "Failed to update branch");
+        return -1;
+    }
+    if (is_current && worktree_checkout(repo, has_local ? &local : NULL, &branch->commit) != 0) {
+        fprintf(stderr, "Error: Branch updated but the files couldn't be checked out\n");
+        return -1;
+    }
+
+    char old_hex[HASH_HEX_SIZE], new_hex[HASH_HEX_SIZE];
+    hash_to_hex(&branch->commit, new_hex);
+    if (has_local) {
+        hash_to_hex(&local, old_hex);
+        printf("  Fast-forward %.7s..%.7s  %s\n", old_hex, new_hex, branch->name);
+    } else {
+        printf("  * [new branch]  %s at %.7s\n", branch->name, new_hex);
+    }
+    return 0;
+}
+
+static int cmd_ipfs_pull(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Not a Gyatt repository\n");
+        return 1;
+    }
+    if (argc < 1 || argc > 2) {
+        fprintf(stderr, "Usage: gyatt ipfs pull <manifest-cid> [branch]\n");
+        return 1;
+    }
+
+    ipfs_storage_t *storage = ipfs_storage_init(repo);
+    if (!storage) {
+        fprintf(stderr, "Failed to initialize IPFS storage\n");
+        return 1;
+    }
+    if (!ipfs_is_online(storage->client)) {
+        fprintf(stderr, "✗ IPFS daemon is not running. Run: gyatt ipfs init\n");
+        ipfs_storage_free(storage);
+        return 1;
+    }
+
+    ipfs_manifest_branch_t *branches;
+    size_t count;
+    if (ipfs_storage_read_manifest(storage, argv[0], &branches, &count) != 0) {
+        ipfs_storage_free(storage);
+        return 1;
+    }
+
+    // Just the one branch, or all of them
+    size_t selected = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (argc > 1 && strcmp(branches[i].name, argv[1]) != 0) continue;
+        if (!branches[i].root[0]) {
+            fprintf(stderr, "Error: The manifest has no DAG for '%s'; republish it with gyatt ipfs publish\n",
+                    branches[i].name);
+            free(branches);
+            ipfs_storage_free(storage);
+            return 1;
+        }
+        branches[selected++] = branches[i];
+    }
+    if (selected == 0) {
+        fprintf(stderr, "Error: The manifest has no branch '%s'\n", argc > 1 ? argv[1] : "");
+        free(branches);
+        ipfs_storage_free(storage);
+        return 1;
+    }
+
+    char head_branch[256] = "";
+    int detached = repo_head_branch(repo, head_branch, sizeof(head_branch)) != 0;
+    for (size_t i = 0; i < selected; i++) {
+        gyatt_hash_t local;
+        int changes = repo_resolve_ref(repo, branches[i].name, &local) != 0 ||
+                      hash_compare(&local, &branches[i].commit) != 0;
+        if (!detached && changes && strcmp(branches[i].name, head_branch) == 0 && !worktree_is_clean(repo)) {
+            fprintf(stderr, "Error: You have uncommitted changes\n");
+            fprintf(stderr, "Please commit or stash them before pulling\n");
+            free(branches);
+            ipfs_storage_free(storage);
+            return 1;
+        }
+    }
+
+    ipfs_fetch_tip_t *tips = malloc(selected * sizeof(ipfs_fetch_tip_t));
+    int result = tips ? 0 : -1;
+    for (size_t i = 0; i < selected && tips; i++) {
+        tips[i].commit = branches[i].commit;
+        snprintf(tips[i].root, sizeof(tips[i].root), "%s", branches[i].root);
+    }
+
+    ipfs_fetch_stats_t stats;
+    if (result == 0) {
+        printf("Fetching %zu branch(es) from IPFS...\n", selected);
+        result = ipfs_fetch(storage, tips, selected, &stats);
+        printf("%s %zu object(s), %zu bytes", result == 0 ? "✓ Fetched" : "✗ Fetched only", stats.objects,
+               stats.bytes);
+        if (stats.retries) printf(", %zu retried", stats.retries);
+        printf("\n");
+        if (result != 0) fprintf(stderr, "Run the same pull again to carry on from here\n");
+    }
+    free(tips);
+
+    for (size_t i = 0; i < selected && result == 0; i++) {
+        int is_current = !detached && strcmp(branches[i].name, head_branch) == 0;
+        if (ipfs_update_branch(repo, &branches[i], is_current) != 0) result = -1;
+    }
+
+    free(branches);
+    ipfs_storage_free(storage);
+    return result == 0 ? 0 : 1;
+}
+
+static int cmd_ipfs_publish(gyatt_repo_t *repo) {
+    if (!repo) {
         fprintf(stderr, "Not a Gyatt repository\n");
         return 1;
     }
 
-    ipfs_storage_t *storage = ipfs_storage_init(".");
+    ipfs_storage_t *storage = ipfs_storage_init(repo);
     if (!storage) {
         fprintf(stderr, "Failed to initialize IPFS storage\n");
         return 1;
@@ -138,13 +281,32 @@ static int cmd_ipfs_publish(void) {
     return 0;
 }
 
-static int cmd_ipfs_status(void) {
-    if (!is_gyatt_repo()) {
+typedef struct {
+    gyatt_hash_t *hashes;
+    size_t count;
+    size_t capacity;
+} ipfs_object_list_t;
+
+static int collect_local_object(const gyatt_hash_t *hash, void *arg) {
+    ipfs_object_list_t *list = arg;
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        gyatt_hash_t *grown = realloc(list->hashes, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        list->hashes = grown;
+        list->capacity = new_capacity;
+    }
+    list->hashes[list->count++] = *hash;
+    return 0;
+}
+
+static int cmd_ipfs_status(gyatt_repo_t *repo) {
+    if (!repo) {
         fprintf(stderr, "Not a Gyatt repository\n");
         return 1;
     }
 
-    ipfs_storage_t *storage = ipfs_storage_init(".");
+    ipfs_storage_t *storage = ipfs_storage_init(repo);
     if (!storage) {
         fprintf(stderr, "Failed to initialize IPFS storage\n");
         return 1;
@@ -167,43 +329,14 @@ static int cmd_ipfs_status(void) {
     int total_objects = 0;
     int uploaded_objects = 0;
 
-    char objects_path[4096];
-    snprintf(objects_path, sizeof(objects_path), ".gyatt/objects");
-
-    DIR *dir = opendir(objects_path);
-    if (dir) {
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (entry->d_name[0] == '.') continue;
-            if (strlen(entry->d_name) != 2) continue;
-
-            char subdir_path[4096];
-            snprintf(subdir_path, sizeof(subdir_path), "%s/%s", objects_path, entry->d_name);
-
-            DIR *subdir = opendir(subdir_path);
-            if (!subdir) continue;
-
-            struct dirent *obj_entry;
-            while ((obj_entry = readdir(subdir)) != NULL) {
-                if (obj_entry->d_name[0] == '.') continue;
-
-                total_objects++;
-
-                // Check if uploaded to IPFS
-                char hash_hex[HASH_HEX_SIZE];
-                snprintf(hash_hex, sizeof(hash_hex), "%s%s", entry->d_name, obj_entry->d_name);
-
-                gyatt_hash_t hash;
-                hex_to_hash(hash_hex, &hash);
-
-                if (ipfs_storage_has_object(storage, &hash)) {
-                    uploaded_objects++;
-                }
-            }
-            closedir(subdir);
-        }
-        closedir(dir);
+    // One pass over the map for the lot
+    ipfs_object_list_t objects = { NULL, 0, 0 };
+    if (object_foreach(repo, collect_local_object, &objects) == 0) {
+        size_t missing = ipfs_storage_missing(storage, objects.hashes, objects.count, objects.hashes);
+        total_objects = (int)objects.count;
+        uploaded_objects = (int)(objects.count - missing);
     }
+    free(objects.hashes);
 
     printf("  Total: %d objects\n", total_objects);
     printf("  Uploaded to IPFS: %d objects\n", uploaded_objects);
@@ -216,7 +349,10 @@ static int cmd_ipfs_status(void) {
 
     // Show branches
     printf("\nBranches:\n");
-    DIR *refs_dir = opendir(".gyatt/refs/heads");
+    char heads_path[4096];
+    snprintf(heads_path, sizeof(heads_path), "%s/refs/heads", repo->gyatt_dir);
+
+    DIR *refs_dir = opendir(heads_path);
     if (refs_dir) {
         struct dirent *entry;
         while ((entry = readdir(refs_dir)) != NULL) {
@@ -226,7 +362,7 @@ static int cmd_ipfs_status(void) {
 
             // Check if branch is uploaded
             char branch_path[4096];
-            snprintf(branch_path, sizeof(branch_path), ".gyatt/refs/heads/%s", entry->d_name);
+            snprintf(branch_path, sizeof(branch_path), "%s/%s", heads_path, entry->d_name);
 
             FILE *f = fopen(branch_path, "r");
             if (f) {
@@ -262,7 +398,7 @@ static int cmd_ipfs_status(void) {
     return 0;
 }
 
-int cmd_ipfs(int argc, char *argv[]) {
+int cmd_ipfs(gyatt_repo_t *repo, int argc, char *argv[]) {
     if (argc < 1) {
         print_ipfs_help();
         return 0;
@@ -271,13 +407,15 @@ int cmd_ipfs(int argc, char *argv[]) {
     const char *subcommand = argv[0];
 
     if (strcmp(subcommand, "init") == 0) {
-        return cmd_ipfs_init();
+        return cmd_ipfs_init(repo);
     } else if (strcmp(subcommand, "push") == 0) {
-        return cmd_ipfs_push(argc - 1, argv + 1);
+        return cmd_ipfs_push(repo, argc - 1, argv + 1);
+    } else if (strcmp(subcommand, "pull") == 0) {
+        return cmd_ipfs_pull(repo, argc - 1, argv + 1);
     } else if (strcmp(subcommand, "publish") == 0) {
-        return cmd_ipfs_publish();
+        return cmd_ipfs_publish(repo);
     } else if (strcmp(subcommand, "status") == 0) {
-        return cmd_ipfs_status();
+        return cmd_ipfs_status(repo);
     } else if (strcmp(subcommand, "help") == 0 || strcmp(subcommand, "--help") == 0) {
         print_ipfs_help();
         return 0;
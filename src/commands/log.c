@@ -1,12 +1,142 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "../gyatt.h"
+#include "../object.h"
+#include "../hash.h"
+#include "../commit_graph.h"
+
+static void print_usage_log(void) {
+    fprintf(stderr, "Usage: gyatt log [-n <count>] [--oneline] [<rev> | <from>..<to>]\n");
+    fprintf(stderr, "  -n <count>   Show at most <count> commits\n");
+    fprintf(stderr, "  --oneline    One line per commit: short hash and subject\n");
+}
+
+static int resolve_or_complain(gyatt_repo_t *repo, const char *name, gyatt_hash_t *hash) {
+    if (repo_resolve_ref(repo, name, hash) == 0) return 0;
+    fprintf(stderr, "Error: Unknown revision '%s'\n", name);
+    return -1;
+}
+
+static void print_commit(gyatt_repo_t *repo, const commit_info_t *info, int oneline) {
+    char hex[HASH_HEX_SIZE];
+    hash_to_hex(&info->hash, hex);
+
+    // The walk itself never needs the object; only the text shown does
+    commit_object_t *commit = commit_read(repo, &info->hash);
+    const char *message = commit ? commit->message : "";
+
+    if (oneline) {
+        size_t subject_len = strcspn(message, "\n");
+        printf("%.7s %.*s\n", hex, (int)subject_len, message);
+    } else {
+        printf("commit %s\n", hex);
+        if (commit) {
+            time_t when = commit->author.timestamp;
+            char date[64];
+            struct tm tm;
+            strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", gmtime_r(&when, &tm));
+            printf("Author: %s <%s>\n", commit->author.name, commit->author.email);
+            printf("Date:   %s +0000\n", date);
+        }
+        printf("\n");
+
+        // Indent every line of the message like git does
+        const char *line = message;
+        while (*line) {
+            size_t len = strcspn(line, "\n");
+            printf("    %.*s\n", (int)len, line);
+            line += len;
+            if (*line == '\n') line++;
+        }
+        printf("\n");
+    }
+
+    if (commit) commit_free(commit);
+}
+
+int cmd_log(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    long max_count = -1;
+    int oneline = 0;
+    const char *rev = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            char *end;
+            max_count = strtol(argv[++i], &end, 10);
+            if (*end || max_count < 0) {
+                print_usage_log();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--oneline") == 0) {
+            oneline = 1;
+        } else if (argv[i][0] != '-' && !rev) {
+            rev = argv[i];
+        } else {
+            print_usage_log();
+            return 1;
+        }
+    }
+
+    // <from>..<to> is everything on <to> that <from> doesn't have. History
+    // is linear per commit, so that's <to> down to (not including) the
+    // merge base.
+    gyatt_hash_t tip, stop;
+    int has_stop = 0;
+    const char *dots = rev ? strstr(rev, "..") : NULL;
+    if (dots) {
+        char from[256];
+        size_t from_len = (size_t)(dots - rev);
+        if (from_len >= sizeof(from)) {
+            fprintf(stderr, "Error: Unknown revision '%s'\n", rev);
+            return 1;
+        }
+        memcpy(from, rev, from_len);
+        from[from_len] = '\0';
+
+        gyatt_hash_t from_hash;
+        if (resolve_or_complain(repo, from_len ? from : "HEAD", &from_hash) != 0 ||
+            resolve_or_complain(repo, dots[2] ? dots + 2 : "HEAD", &tip) != 0) {
+            return 1;
+        }
+
+        int ret = commit_merge_base(repo, &from_hash, &tip, &stop);
+        if (ret < 0) {
+            fprintf(stderr, "Error: Could not walk history\n");
+            return 1;
+        }
+        has_stop = ret == 0;
+    } else if (repo_resolve_ref(repo, rev ? rev : "HEAD", &tip) != 0) {
+        if (!rev) {
+            printf("No commits yet\n");
+            return 0;
+        }
+        fprintf(stderr, "Error: Unknown revision '%s'\n", rev);
+        return 1;
+    }
+
+    gyatt_hash_t hash = tip;
+    for (long shown = 0; max_count < 0 || shown < max_count; shown++) {
+        if (has_stop && hash_compare(&hash, &stop) == 0) break;
+
+        commit_info_t info;
+        if (commit_info_get(repo, &hash, &info) != 0) {
+            char hex[HASH_HEX_SIZE];
+            hash_to_hex(&hash, hex);
+            fprintf(stderr, "Error: Could not read commit %s\n", hex);
+            return 1;
+        }
+
+        print_commit(repo, &info, oneline);
+        if (!info.has_parent) break;
+        hash = info.parent;
+    }
 
-int cmd_log(int argc, char *argv[]) {
-    printf("Log command\n");
-    
-    // TODO: Will implement in Part 6
-    printf("Not yet implemented. Coming in Part 6!\n");
-    
     return 0;
 }
@@ -3,21 +3,173 @@
 #include <string.h>
 #include <unistd.h>
 #include "../gyatt.h"
+#include "../hash.h"
+#include "../object.h"
+#include "../remote.h"
+#include "../commit_graph.h"
+#include "../worktree.h"
 
-// Forward declarations from push.c
-extern int parse_remote_url(const char *url, char *hostname, int *port);
-extern int connect_to_server(const char *hostname, int port);
-extern int send_command(int sock, const char *cmd, char *response, size_t response_size);
+// How far back each local branch's history is offered as haves
+#define PULL_HISTORY_HAVES 64
 
-int cmd_pull(int argc, char *argv[]) {
-    if (argc < 1) {
+typedef struct {
+    gyatt_hash_t *hashes;
+    size_t count;
+    size_t capacity;
+} tip_list_t;
+
+static int collect_tip(const char *name, const gyatt_hash_t *hash, void *arg) {
+    (void)name;
+    tip_list_t *list = arg;
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        gyatt_hash_t *grown = realloc(list->hashes, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        list->hashes = grown;
+        list->capacity = new_capacity;
+    }
+    list->hashes[list->count++] = *hash;
+    return 0;
+}
+
+// The server skips haves it doesn't know, so a tip with local-only commits
+// on top would count for nothing. Recent history goes along too, to give it
+// something to recognise.
+typedef struct {
+    gyatt_repo_t *repo;
+    tip_list_t haves;
+} have_walk_t;
+
+static int collect_history(const char *name, const gyatt_hash_t *hash, void *arg) {
+    have_walk_t *walk = arg;
+    gyatt_hash_t current = *hash;
+    for (int depth = 0; depth < PULL_HISTORY_HAVES; depth++) {
+        if (collect_tip(name, &current, &walk->haves) != 0) return -1;
+
+        commit_info_t info;
+        if (commit_info_get(walk->repo, &current, &info) != 0 || !info.has_parent) break;
+        current = info.parent;
+    }
+    return 0;
+}
+
+// Bring in everything the remote tip reaches that no local branch does
+static int fetch_tip(gyatt_repo_t *repo, remote_t *remote, const gyatt_hash_t *tip) {
+    have_walk_t walk = { repo, {0} };
+    if (repo_foreach_branch(repo, collect_history, &walk) != 0) {
+        free(walk.haves.hashes);
+        return -1;
+    }
+
+    remote_fetch_stats_t stats;
+    int result = remote_fetch(repo, remote, tip, 1, walk.haves.hashes, walk.haves.count, 1, &stats);
+    free(walk.haves.hashes);
+    if (result != 0) return -1;
+
+    printf("Fetched %zu object(s), %llu bytes\n", stats.objects, (unsigned long long)stats.bytes);
+    return 0;
+}
+
+static int pull_branch(gyatt_repo_t *repo, remote_t *remote, const char *branch, int is_current) {
+    remote_ref_t *refs;
+    size_t ref_count;
+    if (remote_list_refs(remote, &refs, &ref_count) != 0) return -1;
+
+    const remote_ref_t *theirs = remote_find_ref(refs, ref_count, branch);
+    if (!theirs) {
+        fprintf(stderr, "Error: Remote has no branch '%s'\n", branch);
+        free(refs);
+        return -1;
+    }
+    gyatt_hash_t remote_hash = theirs->hash;
+    free(refs);
+
+    gyatt_hash_t local;
+    int has_local = repo_resolve_ref(repo, branch, &local) == 0;
+    if (has_local && hash_compare(&local, &remote_hash) == 0) {
+        printf("Already up to date\n");
+        return 0;
+    }
+
+    if (is_current && !worktree_is_clean(repo)) {
+        fprintf(stderr, "Error: You have uncommitted changes\n");
+        fprintf(stderr, "Please commit or stash them before pulling\n");
+        return -1;
+    }
+
+    if (!object_exists(repo, &remote_hash) && fetch_tip(repo, remote, &remote_hash) != 0) {
+        return -1;
+    }
+
+    // Fast-forward only; there's no merge yet
+    if (has_local) {
+        if (commit_is_ancestor(repo, &remote_hash, &local) == 1) {
+            printf("Local '%s' is ahead of the remote; nothing to do\n", branch);
+            return 0;
+        }
+        if (commit_is_ancestor(repo, &local, &remote_hash) != 1) {
+            fprintf(stderr, "Error: '%s' has diverged from the remote; can't fast-forward\n", branch);
+            return -1;
+        }
+    }
+
+    // The files have to be able to follow before the branch moves
+    if (is_current && worktree_checkout_check(repo, has_local ? &local : NULL, &remote_hash) != 0) {
+        return -1;
+    }
+
+    gyatt_hash_t none = {0};
+    int moved = repo_update_branch(repo, branch, has_local ? &local : &none, &remote_hash);
+    if (moved != 0) {
+        fprintf(stderr, "Error: %s\n", moved > 0 ? "Branch moved while pulling; try again" : "Failed to update branch");
+        return -1;
+    }
+
+    if (is_current && worktree_checkout(repo, has_local ? &local : NULL, &remote_hash) != 0) {
+        fprintf(stderr, "Error: Branch updated but the files couldn't be checked out\n");
+        return -1;
+    }
+
+    char old_hex[HASH_HEX_SIZE], new_hex[HASH_HEX_SIZE];
+    hash_to_hex(&remote_hash, new_hex);
+    if (has_local) {
+        hash_to_hex(&local, old_hex);
+        printf("Fast-forward %.7s..%.7s  %s\n", old_hex, new_hex, branch);
+    } else {
+        printf("* [new branch]  %s at %.7s\n", branch, new_hex);
+    }
+    return 0;
+}
+
+int cmd_pull(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    if (argc < 2 || argc > 3) {
         fprintf(stderr, "Usage: gyatt pull <remote> [branch]\n");
         fprintf(stderr, "Example: gyatt pull 127.0.0.1:9999 main\n");
         return 1;
     }
-    
-    printf("Pull command - Coming soon!\n");
-    printf("Will fetch objects from remote server and update local branch.\n");
-    
-    return 0;
+
+    char head_branch[256] = "";
+    int detached = repo_head_branch(repo, head_branch, sizeof(head_branch)) != 0;
+    const char *branch = argc > 2 ? argv[2] : head_branch;
+    if (!branch[0]) {
+        fprintf(stderr, "Error: HEAD is detached; say which branch to pull\n");
+        return 1;
+    }
+    int is_current = !detached && strcmp(branch, head_branch) == 0;
+
+    printf("Connecting to %s...\n", argv[1]);
+    remote_t *remote = remote_open(argv[1]);
+    if (!remote) {
+        return 1;
+    }
+
+    int result = pull_branch(repo, remote, branch, is_current);
+    remote_close(remote);
+
+    return result == 0 ? 0 : 1;
 }
@@ -2,107 +2,136 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#define _DEFAULT_SOURCE
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include "../gyatt.h"
+#include "../hash.h"
+#include "../object.h"
+#include "../remote.h"
+#include "../reach.h"
+#include "../commit_graph.h"
 
-#define BUFFER_SIZE 4096
-
-// Parse URLs like "hostname:port" or just "hostname"
-int parse_remote_url(const char *url, char *hostname, int *port) {
-    char *colon = strchr(url, ':');
-    if (colon) {
-        size_t len = colon - url;
-        if (len >= 256) return -1;
-        memcpy(hostname, url, len);
-        hostname[len] = '\0';
-        *port = atoi(colon + 1);
-    } else {
-        strncpy(hostname, url, 255);
-        hostname[255] = '\0';
-        *port = 9418;
+// Remote tips this side knows: the remote already has everything they reach
+static gyatt_hash_t *known_tips(gyatt_repo_t *repo, const remote_ref_t *refs, size_t count, size_t *have_count) {
+    gyatt_hash_t *haves = malloc((count ? count : 1) * sizeof(gyatt_hash_t));
+    *have_count = 0;
+    if (!haves) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (object_exists(repo, &refs[i].hash)) haves[(*have_count)++] = refs[i].hash;
     }
-    return 0;
+    return haves;
 }
 
-int connect_to_server(const char *hostname, int port) {
-    int sock;
-    struct sockaddr_in server_addr;
-    
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("Socket creation failed");
+static int push_branch(gyatt_repo_t *repo, remote_t *remote, const char *branch, int force) {
+    gyatt_hash_t local;
+    if (repo_resolve_ref(repo, branch, &local) != 0) {
+        fprintf(stderr, "Error: Branch '%s' has no commits\n", branch);
+        return -1;
+    }
+
+    remote_ref_t *refs;
+    size_t ref_count;
+    if (remote_list_refs(remote, &refs, &ref_count) != 0) return -1;
+
+    const remote_ref_t *theirs = remote_find_ref(refs, ref_count, branch);
+    remote_update_t update = {0};
+    snprintf(update.branch, sizeof(update.branch), "%s", branch);
+    update.new_hash = local;
+    if (theirs) update.old_hash = theirs->hash;
+
+    if (theirs && hash_compare(&theirs->hash, &local) == 0) {
+        printf("Everything up-to-date\n");
+        free(refs);
+        return 0;
+    }
+
+    // Fast-forward only: the remote's tip has to be in this branch's history
+    if (theirs && !force &&
+        (!object_exists(repo, &theirs->hash) || commit_is_ancestor(repo, &theirs->hash, &local) != 1)) {
+        fprintf(stderr, "Error: Remote '%s' has commits this branch doesn't (pull first, or use --force)\n", branch);
+        free(refs);
         return -1;
     }
-    
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    
-    if (inet_pton(AF_INET, hostname, &server_addr.sin_addr) <= 0) {
-        fprintf(stderr, "Error: Invalid address\n");
-        close(sock);
+
+    size_t have_count;
+    gyatt_hash_t *haves = known_tips(repo, refs, ref_count, &have_count);
+    free(refs);
+    if (!haves) return -1;
+
+    gyatt_hash_t *objects = NULL;
+    size_t object_count = 0;
+    int result = reach_missing(repo, &local, 1, haves, have_count, &objects, &object_count);
+    free(haves);
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to work out what to send\n");
         return -1;
     }
-    
-    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Connection failed");
-        close(sock);
+
+    remote_push_stats_t stats;
+    result = remote_push(repo, remote, objects, object_count, &update, 1, &stats);
+    free(objects);
+    if (result != 0) return -1;
+
+    printf("Sent %zu object(s), %llu bytes\n", stats.objects, (unsigned long long)stats.bytes);
+    if (!update.ok) {
+        fprintf(stderr, "Error: Remote refused '%s': %s\n", branch, update.reason);
         return -1;
     }
-    
-    return sock;
-}
 
-int send_command(int sock, const char *cmd, char *response, size_t response_size) {
-    send(sock, cmd, strlen(cmd), 0);
-    usleep(50000);
-    
-    memset(response, 0, response_size);
-    int bytes = recv(sock, response, response_size - 1, 0);
-    return bytes;
+    char old_hex[HASH_HEX_SIZE], new_hex[HASH_HEX_SIZE];
+    hash_to_hex(&local, new_hex);
+    if (theirs) {
+        hash_to_hex(&update.old_hash, old_hex);
+        printf("%.7s..%.7s  %s -> %s\n", old_hex, new_hex, branch, branch);
+    } else {
+        printf("* [new branch]  %s -> %s\n", branch, branch);
+    }
+    return 0;
 }
 
-int cmd_push(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: gyatt push <remote> [branch]\n");
-        fprintf(stderr, "Example: gyatt push 127.0.0.1:9999 main\n");
+int cmd_push(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
         return 1;
     }
-    
-    const char *remote_url = argv[1];
-    
-    char hostname[256];
-    int port;
-    if (parse_remote_url(remote_url, hostname, &port) != 0) {
-        fprintf(stderr, "Error: Invalid remote URL\n");
-        return 1;
+
+    const char *remote_url = NULL;
+    const char *branch = NULL;
+    int force = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--force") == 0 || strcmp(argv[i], "-f") == 0) {
+            force = 1;
+        } else if (!remote_url) {
+            remote_url = argv[i];
+        } else if (!branch) {
+            branch = argv[i];
+        } else {
+            remote_url = NULL;
+            break;
+        }
     }
-    
-    printf("Connecting to %s:%d...\n", hostname, port);
-    int sock = connect_to_server(hostname, port);
-    if (sock < 0) {
+
+    if (!remote_url) {
+        fprintf(stderr, "Usage: gyatt push <remote> [branch] [--force]\n");
+        fprintf(stderr, "Example: gyatt push 127.0.0.1:9999 main\n");
         return 1;
     }
-    
-    printf("✓ Connected to remote server\n");
-    
-    char response[BUFFER_SIZE];
-    if (send_command(sock, "HELLO\n", response, sizeof(response)) < 0) {
-        fprintf(stderr, "Error: Handshake failed\n");
-        close(sock);
+
+    char head_branch[256];
+    if (!branch) {
+        if (repo_head_branch(repo, head_branch, sizeof(head_branch)) != 0) {
+            fprintf(stderr, "Error: HEAD is detached; say which branch to push\n");
+            return 1;
+        }
+        branch = head_branch;
+    }
+
+    printf("Connecting to %s...\n", remote_url);
+    remote_t *remote = remote_open(remote_url);
+    if (!remote) {
         return 1;
     }
-    
-    printf("✓ Handshake successful\n");
-    printf("\nPush functionality will transfer commits and objects to remote.\n");
-    printf("Full implementation coming soon!\n");
-    
-    send_command(sock, "QUIT\n", response, sizeof(response));
-    close(sock);
-    
-    return 0;
+
+    int result = push_branch(repo, remote, branch, force);
+    remote_close(remote);
+
+    return result == 0 ? 0 : 1;
 }
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "../gyatt.h"
+#include "../object.h"
+#include "../pack.h"
+#include "../hash.h"
+#include "../utils.h"
+#include "../commit_graph.h"
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+typedef struct {
+    gyatt_hash_t *hashes;
+    size_t count;
+    size_t capacity;
+} hash_list_t;
+
+static int collect_hash(const gyatt_hash_t *hash, void *arg) {
+    hash_list_t *list = arg;
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        gyatt_hash_t *new_hashes = realloc(list->hashes, new_capacity * sizeof(gyatt_hash_t));
+        if (!new_hashes) return -1;
+        list->hashes = new_hashes;
+        list->capacity = new_capacity;
+    }
+    list->hashes[list->count++] = *hash;
+    return 0;
+}
+
+static int hash_sort_compare(const void *a, const void *b) {
+    return memcmp(a, b, HASH_SIZE);
+}
+
+// Path hints for the delta search, parallel to a sorted hash array. A
+// non-NULL slot also marks a tree/commit as visited.
+typedef struct {
+    const gyatt_hash_t *hashes;
+    size_t count;
+    char **names;
+} name_map_t;
+
+static char **name_slot(name_map_t *map, const gyatt_hash_t *hash) {
+    const gyatt_hash_t *found = bsearch(hash, map->hashes, map->count, sizeof(gyatt_hash_t), hash_sort_compare);
+    return found ? &map->names[found - map->hashes] : NULL;
+}
+
+static void name_tree(gyatt_repo_t *repo, name_map_t *map, const gyatt_hash_t *hash, const char *path) {
+    char **slot = name_slot(map, hash);
+    // Trees that aren't being packed were packed earlier, along with
+    // everything under them
+    if (!slot || *slot) return;
+    *slot = strdup(path);
+
+    tree_object_t *tree = tree_read(repo, hash);
+    if (!tree) return;
+
+    for (size_t i = 0; i < tree->entry_count; i++) {
+        tree_entry_t *entry = &tree->entries[i];
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s%s%s", path, path[0] ? "/" : "", entry->name) >= (int)sizeof(child)) {
+            continue;
+        }
+
+        if (entry->type == OBJ_TREE) {
+            name_tree(repo, map, &entry->hash, child);
+        } else {
+            char **blob_slot = name_slot(map, &entry->hash);
+            if (blob_slot && !*blob_slot) *blob_slot = strdup(child);
+        }
+    }
+
+    tree_free(tree);
+}
+
+// Walk every branch's history and remember the path each tree/blob was
+// found at, so successive versions of one file get diffed against each other
+static void name_objects(gyatt_repo_t *repo, name_map_t *map) {
+    char heads_path[PATH_MAX];
+    snprintf(heads_path, sizeof(heads_path), "%s/refs/heads", repo->gyatt_dir);
+
+    DIR *dir = opendir(heads_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char ref_path[PATH_MAX];
+        if (snprintf(ref_path, sizeof(ref_path), "%s/%s", heads_path, entry->d_name) >= (int)sizeof(ref_path)) {
+            continue;
+        }
+        char *content = read_file(ref_path, NULL);
+        if (!content || strlen(content) < HASH_HEX_SIZE - 1) {
+            free(content);
+            continue;
+        }
+
+        gyatt_hash_t hash;
+        hex_to_hash(content, &hash);
+        free(content);
+
+        // Stop at the first commit that's already packed (or visited)
+        char **slot;
+        while ((slot = name_slot(map, &hash)) != NULL && !*slot) {
+            *slot = strdup("");
+            commit_object_t *commit = commit_read(repo, &hash);
+            if (!commit) break;
+            name_tree(repo, map, &commit->tree, "");
+            hash = commit->parent;
+            commit_free(commit);
+        }
+    }
+
+    closedir(dir);
+}
+
+// Delete the loose copies now that the pack has them
+static void prune_loose(gyatt_repo_t *repo, const hash_list_t *loose) {
+    for (size_t i = 0; i < loose->count; i++) {
+        char path[PATH_MAX];
+        if (object_path(repo, &loose->hashes[i], path, sizeof(path)) != 0) continue;
+        unlink(path);
+
+        // Drop the objects/xx shard too once it's empty
+        char *slash = strrchr(path, '/');
+        if (slash) {
+            *slash = '\0';
+            rmdir(path);
+        }
+    }
+}
+
+// After 'repack -a', every pack but the new one is redundant
+static void remove_old_packs(gyatt_repo_t *repo, const char *keep) {
+    char pack_dir[PATH_MAX];
+    snprintf(pack_dir, sizeof(pack_dir), "%s/pack", repo->objects_dir);
+
+    DIR *dir = opendir(pack_dir);
+    if (!dir) return;
+
+    size_t keep_len = strlen(keep);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "pack-", 5) != 0) continue;
+        if (strncmp(entry->d_name, keep, keep_len) == 0 && entry->d_name[keep_len] == '.') continue;
+
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", pack_dir, entry->d_name) < (int)sizeof(path)) {
+            unlink(path);
+        }
+    }
+
+    closedir(dir);
+}
+
+int cmd_repack(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
+        fprintf(stderr, "Error: Not a Gyatt repository\n");
+        return 1;
+    }
+
+    int all = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--all") == 0) {
+            all = 1;
+        } else {
+            fprintf(stderr, "Usage: gyatt repack [-a]\n");
+            fprintf(stderr, "  -a, --all   Fold existing packs into the new one too\n");
+            return 1;
+        }
+    }
+
+    hash_list_t loose = {0};
+    if (object_foreach_loose(repo, collect_hash, &loose) != 0) {
+        fprintf(stderr, "Error: Failed to list loose objects\n");
+        free(loose.hashes);
+        return 1;
+    }
+
+    // With -a the new pack also takes everything already packed
+    hash_list_t packed = {0};
+    if (all && pack_foreach(repo->packs, collect_hash, &packed) != 0) {
+        fprintf(stderr, "Error: Failed to list packed objects\n");
+        free(loose.hashes);
+        free(packed.hashes);
+        return 1;
+    }
+
+    size_t total = loose.count + packed.count;
+    if (total == 0 || (!all && loose.count == 0)) {
+        printf("Nothing to pack\n");
+        free(loose.hashes);
+        free(packed.hashes);
+        return 0;
+    }
+
+    gyatt_hash_t *hashes = malloc(total * sizeof(gyatt_hash_t));
+    if (!hashes) {
+        free(loose.hashes);
+        free(packed.hashes);
+        return 1;
+    }
+    if (loose.count > 0) memcpy(hashes, loose.hashes, loose.count * sizeof(gyatt_hash_t));
+    if (packed.count > 0) memcpy(hashes + loose.count, packed.hashes, packed.count * sizeof(gyatt_hash_t));
+    qsort(hashes, total, sizeof(gyatt_hash_t), hash_sort_compare);
+
+    name_map_t names = { hashes, total, calloc(total, sizeof(char *)) };
+    if (names.names) name_objects(repo, &names);
+
+    char name[64];
+    size_t deltas = 0;
+    int result = pack_write(repo, hashes, (const char *const *)names.names, total,
+                            name, sizeof(name), &deltas);
+    if (names.names) {
+        for (size_t i = 0; i < total; i++) free(names.names[i]);
+        free(names.names);
+    }
+    free(hashes);
+    free(packed.hashes);
+
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to write pack\n");
+        free(loose.hashes);
+        return 1;
+    }
+
+    // Only now that pack and idx are both in place is it safe to delete
+    prune_loose(repo, &loose);
+    if (all) remove_old_packs(repo, name);
+
+    printf("Packed %zu object(s) into %s (%zu as deltas)\n", total, name, deltas);
+
+    // Repacking is when history gets tidied anyway; a stale graph only
+    // costs speed, so failing here isn't fatal
+    if (commit_graph_write(repo, NULL) != 0) {
+        fprintf(stderr, "Warning: Failed to update commit graph\n");
+    }
+
+    free(loose.hashes);
+    return 0;
+}
@@ -5,14 +5,25 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+    #include <sys/sendfile.h>
+#endif
 #include "../gyatt.h"
 #include "../utils.h"
 #include "../object.h"
 #include "../hash.h"
+#include "../buffer.h"
+#include "../event.h"
+#include "../pool.h"
+#include "../pack.h"
+#include "../protocol.h"
+#include "../reach.h"
+#include "../trace.h"
 
 #ifndef PATH_MAX
     #define PATH_MAX 4096
@@ -36,162 +47,1204 @@ static void signal_handler(int signum) {
 #define CMD_GET_OBJECT  "GET-OBJECT"
 #define CMD_PUT_OBJECT  "PUT-OBJECT"
 #define CMD_QUIT        "QUIT"
+#define CMD_PROTOCOL    "PROTOCOL"   // Upgrade to v2, see protocol.h
 
-// Handle client connection (and their existential questions)
-static void handle_client(int client_socket) {
-    char buffer[BUFFER_SIZE];
-    
-    // Be friendly!
-    const char *welcome = "GYATT-SERVER 1.0\n";
-    send(client_socket, welcome, strlen(welcome), 0);
-    
-    while (1) {
-        memset(buffer, 0, BUFFER_SIZE);
-        ssize_t bytes_read = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-        
-        if (bytes_read <= 0) {
-            break;  // Connection closed or error
-        }
-        
-        // Remove trailing newline
-        char *newline = strchr(buffer, '\n');
-        if (newline) *newline = '\0';
-        
-        printf("Client: %s\n", buffer);
-        
-        // Parse command
-        if (strncmp(buffer, CMD_HELLO, strlen(CMD_HELLO)) == 0) {
-            const char *response = "OK HELLO\n";
-            send(client_socket, response, strlen(response), 0);
-            
-        } else if (strncmp(buffer, CMD_LIST_REFS, strlen(CMD_LIST_REFS)) == 0) {
-            // List all branches
-            char *gyatt_dir = get_gyatt_dir();
-            if (!gyatt_dir) {
-                const char *err = "ERROR No repository\n";
-                send(client_socket, err, strlen(err), 0);
-                continue;
+// A v2 client can't want (or have) more than this in one batch
+#define MAX_BATCH_HASHES (16u * 1024 * 1024)
+
+// Longest PACK frame a file range goes out in
+#define MAX_RANGE_FRAME (1u << 30)
+
+// Connections are served from one event loop; anything that touches the
+// object store (GET-OBJECT, PUT-OBJECT, v2 batches) is handed to the worker
+// pool so a big object or a slow disk never holds up the other clients. A
+// connection has at most one job out at a time, which keeps its responses
+// in order.
+
+typedef struct server server_t;
+typedef struct job job_t;
+
+typedef struct {
+    gyatt_hash_t *hashes;
+    size_t count;
+    size_t capacity;
+} hash_list_t;
+
+// Output that goes out ahead of a plain buffer: other buffers handed over
+// whole, and ranges of object files that are sendfile()d without ever
+// being read in
+typedef struct seg {
+    buffer_t *buf;           // NULL for a file range
+    int fd;
+    uint64_t offset;         // Next byte to send, in buf or the file
+    size_t left;
+    struct seg *next;
+} seg_t;
+
+typedef struct {
+    seg_t *head, *tail;
+    size_t bytes;
+} seg_queue_t;
+
+// A branch update waiting for its push to finish
+typedef struct {
+    gyatt_hash_t old_hash;
+    gyatt_hash_t new_hash;
+    char branch[256];
+} push_update_t;
+
+typedef struct conn {
+    server_t *server;
+    int fd;
+    char addr[64];
+    buffer_t *in;            // Received but not yet parsed
+    seg_queue_t queued;      // Not yet sent, goes before out
+    buffer_t *out;           // Not yet sent
+    size_t out_pos;
+    size_t body_size;        // PUT-OBJECT payload still expected (0 = reading lines)
+    object_type_t body_type;
+    int watching;            // EVENT_* currently registered
+    int busy;                // A job for this connection is with the workers
+    int eof;                 // Peer shut its side; finish what's queued, then close
+    int quitting;            // Close once the output is flushed
+    int dead;                // Closed; freed once no job or event refers to it
+    int version;             // 1 = line protocol, 2 = frames
+    hash_list_t wants;       // v2 batch being collected
+    hash_list_t haves;
+    job_t *paused;           // A pack stream waiting for the client to catch up
+    int push_fd;             // Pushed pack being received, -1 if none
+    char push_path[PATH_MAX];
+    push_update_t *updates;
+    size_t update_count;
+    struct conn *prev, *next;
+} conn_t;
+
+typedef enum {
+    JOB_GET_OBJECT,
+    JOB_PUT_OBJECT,
+    JOB_SEND_PACK,
+    JOB_WRITE_PUSH,
+    JOB_FINISH_PUSH
+} job_kind_t;
+
+struct job {
+    conn_t *conn;
+    job_kind_t kind;
+    gyatt_hash_t hash;
+    object_type_t type;
+    void *data;
+    size_t size;
+    seg_queue_t queued;      // Output ahead of response
+    buffer_t *response;
+    hash_list_t wants;       // JOB_SEND_PACK
+    hash_list_t haves;
+    int compressed;          // Send objects as stored (PROTO_DONE_COMPRESSED)
+    int closure;             // Wants are tips (PROTO_DONE_CLOSURE)
+    pack_stream_t *stream;   // Set once the pack has started
+    size_t frame_at;         // Where the PACK frame being filled starts
+    size_t budget;           // Bytes of pack per slice
+    int more;                // Another slice still to come
+    int push_fd;             // JOB_FINISH_PUSH: the pack and updates, handed over
+    char push_path[PATH_MAX];
+    push_update_t *updates;
+    size_t update_count;
+    int failed;              // Sent an ERROR, so hang up after it
+    struct job *next;
+};
+
+struct server {
+    gyatt_repo_t *repo;
+    event_loop_t *loop;
+    pool_t *pool;
+    int listen_fd;
+    int wake_pipe[2];        // Workers poke this when a job is done
+    size_t buffer_limit;
+    int max_connections;
+    int connection_count;
+    conn_t *conns;
+    conn_t *closed;          // Dead connections waiting to be freed
+
+    pthread_mutex_t done_lock;
+    job_t *done;             // Finished jobs waiting for the loop
+};
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void conn_reply(conn_t *conn, const char *text) {
+    buffer_append_str(conn->out, text);
+}
+
+static void seg_free(seg_t *seg) {
+    if (seg->buf) buffer_free(seg->buf);
+    else close(seg->fd);
+    free(seg);
+}
+
+static void queue_clear(seg_queue_t *queue) {
+    while (queue->head) {
+        seg_t *next = queue->head->next;
+        seg_free(queue->head);
+        queue->head = next;
+    }
+    queue->tail = NULL;
+    queue->bytes = 0;
+}
+
+static void queue_push(seg_queue_t *queue, seg_t *seg) {
+    seg->next = NULL;
+    if (queue->tail) queue->tail->next = seg;
+    else queue->head = seg;
+    queue->tail = seg;
+    queue->bytes += seg->left;
+}
+
+// Move everything in src to the end of dst
+static void queue_splice(seg_queue_t *dst, seg_queue_t *src) {
+    if (!src->head) return;
+    if (dst->tail) dst->tail->next = src->head;
+    else dst->head = src->head;
+    dst->tail = src->tail;
+    dst->bytes += src->bytes;
+    memset(src, 0, sizeof(*src));
+}
+
+// Queue buf from pos on; the queue owns it from here
+static int queue_buffer(seg_queue_t *queue, buffer_t *buf, size_t pos) {
+    seg_t *seg = calloc(1, sizeof(seg_t));
+    if (!seg) return -1;
+    seg->buf = buf;
+    seg->offset = pos;
+    seg->left = buf->len - pos;
+    queue_push(queue, seg);
+    return 0;
+}
+
+// Queue a file range; the fd is dup'd, so the caller keeps its own
+static int queue_file(seg_queue_t *queue, int fd, uint64_t offset, size_t length) {
+    seg_t *seg = calloc(1, sizeof(seg_t));
+    if (!seg) return -1;
+    seg->fd = dup(fd);
+    if (seg->fd < 0) {
+        free(seg);
+        return -1;
+    }
+    seg->offset = offset;
+    seg->left = length;
+    queue_push(queue, seg);
+    return 0;
+}
+
+// A push that never finished leaves its temp pack behind otherwise
+static void push_discard(int *fd, const char *path) {
+    if (*fd < 0) return;
+    close(*fd);
+    unlink(path);
+    *fd = -1;
+}
+
+static void job_free(job_t *job) {
+    if (!job) return;
+    queue_clear(&job->queued);
+    if (job->kind == JOB_FINISH_PUSH) push_discard(&job->push_fd, job->push_path);
+    free(job->updates);
+    free(job->data);
+    free(job->wants.hashes);
+    free(job->haves.hashes);
+    pack_stream_free(job->stream);
+    buffer_free(job->response);
+    free(job);
+}
+
+static void conn_free(conn_t *conn) {
+    queue_clear(&conn->queued);
+    push_discard(&conn->push_fd, conn->push_path);
+    free(conn->updates);
+    buffer_free(conn->in);
+    buffer_free(conn->out);
+    free(conn->wants.hashes);
+    free(conn->haves.hashes);
+    job_free(conn->paused);
+    free(conn);
+}
+
+static void append_frame(buffer_t *out, int type, const void *payload, size_t len) {
+    unsigned char header[PROTO_FRAME_HEADER];
+    proto_frame_header(header, type, (uint32_t)len);
+    buffer_append(out, header, sizeof(header));
+    if (len > 0) buffer_append(out, payload, len);
+}
+
+static int hash_list_append(hash_list_t *list, const void *hashes, size_t count) {
+    if (list->count + count > MAX_BATCH_HASHES) return -1;
+    if (list->count + count > list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 1024 : list->capacity;
+        while (new_capacity < list->count + count) new_capacity *= 2;
+        gyatt_hash_t *grown = realloc(list->hashes, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        list->hashes = grown;
+        list->capacity = new_capacity;
+    }
+    memcpy(list->hashes + list->count, hashes, count * sizeof(gyatt_hash_t));
+    list->count += count;
+    return 0;
+}
+
+static void conn_close(conn_t *conn) {
+    server_t *server = conn->server;
+
+    event_remove(server->loop, conn->fd);
+    close(conn->fd);
+    server->connection_count--;
+
+    if (conn->prev) conn->prev->next = conn->next;
+    else server->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+
+    printf("✗ Client %s disconnected\n", conn->addr);
+
+    // Later events in the same batch, or a worker, may still point at it,
+    // so it's only freed by sweep_closed()
+    conn->dead = 1;
+    conn->prev = NULL;
+    conn->next = server->closed;
+    server->closed = conn;
+}
+
+static void sweep_closed(server_t *server) {
+    conn_t **link = &server->closed;
+    while (*link) {
+        conn_t *conn = *link;
+        if (conn->busy) {
+            link = &conn->next;
+        } else {
+            *link = conn->next;
+            conn_free(conn);
+        }
+    }
+}
+
+// ==================== Workers ====================
+
+static int hash_sort_compare(const void *a, const void *b) {
+    return memcmp(a, b, HASH_SIZE);
+}
+
+// Patch the length of the PACK frame being filled, or drop it if it
+// came out empty
+static void finish_pack_frame(job_t *job) {
+    size_t payload = job->response->len - job->frame_at - PROTO_FRAME_HEADER;
+    if (payload == 0) {
+        job->response->len = job->frame_at;
+    } else {
+        proto_frame_header((unsigned char *)job->response->data + job->frame_at, PROTO_PACK, (uint32_t)payload);
+    }
+}
+
+// Called by the pack stream for stored data big enough to be worth not
+// copying: the range gets PACK frames of its own, sent from the file
+static buffer_t *pack_raw_range(void *arg, buffer_t *out, int fd, uint64_t offset, size_t length) {
+    job_t *job = arg;
+    (void)out;  // Always job->response
+    finish_pack_frame(job);
+
+    while (length > 0) {
+        size_t n = length < MAX_RANGE_FRAME ? length : MAX_RANGE_FRAME;
+        buffer_t *next = buffer_create(BUFFER_SIZE);
+        append_frame(job->response, PROTO_PACK, NULL, 0);
+        proto_frame_header((unsigned char *)job->response->data + job->response->len - PROTO_FRAME_HEADER,
+                           PROTO_PACK, (uint32_t)n);
+        if (!next || queue_buffer(&job->queued, job->response, 0) != 0) {
+            buffer_free(next);
+            return NULL;
+        }
+        job->response = next;
+        if (queue_file(&job->queued, fd, offset, n) != 0) return NULL;
+        offset += n;
+        length -= n;
+    }
+
+    // And whatever comes next goes in a fresh frame
+    job->frame_at = job->response->len;
+    append_frame(job->response, PROTO_PACK, NULL, 0);
+    return job->response;
+}
+
+// First slice of a v2 batch: settle what to send, report what we lack
+static int start_pack(gyatt_repo_t *repo, job_t *job) {
+    hash_list_t *wants = &job->wants;
+    hash_list_t *haves = &job->haves;
+    if (haves->count > 0) qsort(haves->hashes, haves->count, sizeof(gyatt_hash_t), hash_sort_compare);
+
+    hash_list_t missing = {0};
+    size_t keep = 0;
+    for (size_t i = 0; i < wants->count; i++) {
+        const gyatt_hash_t *hash = &wants->hashes[i];
+        if (haves->count > 0 &&
+            bsearch(hash, haves->hashes, haves->count, sizeof(gyatt_hash_t), hash_sort_compare)) {
+            continue;
+        }
+        if (!object_exists(repo, hash)) {
+            if (hash_list_append(&missing, hash, 1) != 0) {
+                free(missing.hashes);
+                return -1;
+            }
+            continue;
+        }
+        wants->hashes[keep++] = *hash;
+    }
+    wants->count = keep;
+
+    // Tips: swap them for everything under them the client lacks
+    if (job->closure && keep > 0) {
+        gyatt_hash_t *reached;
+        size_t reached_count;
+        if (reach_missing(repo, wants->hashes, wants->count, haves->hashes, haves->count,
+                          &reached, &reached_count) != 0) {
+            free(missing.hashes);
+            return -1;
+        }
+        free(wants->hashes);
+        wants->hashes = reached;
+        wants->count = wants->capacity = reached_count;
+    }
+
+    if (missing.count > 0) {
+        append_frame(job->response, PROTO_MISSING, missing.hashes, missing.count * HASH_SIZE);
+    }
+    free(missing.hashes);
+
+    job->stream = pack_stream_create(repo, wants->hashes, wants->count);
+    if (!job->stream) return -1;
+    if (job->compressed) pack_stream_reuse(job->stream, pack_raw_range, job);
+    return 0;
+}
+
+// Fill the response with up to one budget of PACK frames. Each frame is
+// written in place: header first, patched with the length afterwards.
+static void run_pack_slice(gyatt_repo_t *repo, job_t *job) {
+    job->more = 0;
+    if (!job->stream && start_pack(repo, job) != 0) {
+        const char *msg = "Failed to prepare pack";
+        append_frame(job->response, PROTO_ERROR, msg, strlen(msg));
+        job->failed = 1;
+        return;
+    }
+
+    // Nothing (new) wanted: don't bother with an empty pack
+    if (pack_stream_count(job->stream) == 0) {
+        append_frame(job->response, PROTO_END, NULL, 0);
+        return;
+    }
+
+    job->frame_at = job->response->len;
+    append_frame(job->response, PROTO_PACK, NULL, 0);
+    int ret = pack_stream_next(job->stream, job->response, job->budget);
+    if (ret < 0) {
+        job->response->len = job->frame_at;
+        const char *msg = "Failed to read objects";
+        append_frame(job->response, PROTO_ERROR, msg, strlen(msg));
+        job->failed = 1;
+        return;
+    }
+    finish_pack_frame(job);
+
+    if (ret == 0) append_frame(job->response, PROTO_END, NULL, 0);
+    else job->more = 1;
+}
+
+static int append_ref_line(const char *name, const gyatt_hash_t *hash, void *arg) {
+    char line[HASH_HEX_SIZE + 300];
+    char hex[HASH_HEX_SIZE];
+    hash_to_hex(hash, hex);
+    snprintf(line, sizeof(line), "%s %s\n", hex, name);
+    buffer_append_str(arg, line);
+    return 0;
+}
+
+static int collect_branch(const char *name, const gyatt_hash_t *hash, void *arg) {
+    (void)name;
+    return hash_list_append(arg, hash, 1);
+}
+
+// Would moving a branch to tip leave it pointing at incomplete history?
+// Everything the server had reachable already is complete, so only what
+// the push brought in needs checking.
+static int push_is_connected(gyatt_repo_t *repo, const gyatt_hash_t *tip) {
+    object_type_t type;
+    if (object_read_header(repo, tip, &type, NULL) != 0 || type != OBJ_COMMIT) return 0;
+
+    hash_list_t tips = {0};
+    if (repo_foreach_branch(repo, collect_branch, &tips) != 0) {
+        free(tips.hashes);
+        return 0;
+    }
+
+    gyatt_hash_t *reached = NULL;
+    size_t count = 0;
+    int connected = reach_missing(repo, tip, 1, tips.hashes, tips.count, &reached, &count) == 0;
+    for (size_t i = 0; connected && i < count; i++) {
+        connected = object_exists(repo, &reached[i]);
+    }
+    free(reached);
+    free(tips.hashes);
+    return connected;
+}
+
+static void append_status(buffer_t *out, const char *branch, const char *reason) {
+    char line[512];
+    if (reason) snprintf(line, sizeof(line), "ng %s %s", branch, reason);
+    else snprintf(line, sizeof(line), "ok %s", branch);
+    append_frame(out, PROTO_STATUS, line, strlen(line));
+}
+
+// Index the pushed pack (verifying every object in it), then try each
+// update in turn. Updates are independent: one being refused doesn't stop
+// the rest.
+static void run_finish_push(gyatt_repo_t *repo, job_t *job) {
+    if (job->push_fd >= 0) {
+        int closed = close(job->push_fd);
+        job->push_fd = -1;
+
+        char name[64];
+        size_t count = 0;
+        if (closed != 0 || pack_index(repo, job->push_path, name, sizeof(name), &count) != 0) {
+            unlink(job->push_path);
+            const char *msg = "Pushed pack rejected";
+            append_frame(job->response, PROTO_ERROR, msg, strlen(msg));
+            job->failed = 1;
+            return;
+        }
+        printf("↓ Received %zu object(s) into %s\n", count, name);
+    }
+
+    for (size_t i = 0; i < job->update_count; i++) {
+        push_update_t *update = &job->updates[i];
+        const char *reason = NULL;
+        if (!push_is_connected(repo, &update->new_hash)) {
+            reason = "missing objects";
+        } else {
+            int ret = repo_update_branch(repo, update->branch, &update->old_hash, &update->new_hash);
+            if (ret > 0) reason = "stale, fetch first";
+            else if (ret < 0) reason = "failed to update";
+        }
+
+        char hex[HASH_HEX_SIZE];
+        hash_to_hex(&update->new_hash, hex);
+        if (!reason) printf("✓ %s -> %.7s\n", update->branch, hex);
+        append_status(job->response, update->branch, reason);
+    }
+    append_frame(job->response, PROTO_END, NULL, 0);
+}
+
+static int write_push(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void run_job(void *arg) {
+    job_t *job = arg;
+    server_t *server = job->conn->server;
+    gyatt_repo_t *repo = server->repo;
+    trace_span_t span = trace_begin(TRACE_SERVER_JOB);
+    if (!job->response) job->response = buffer_create(256);
+    if (!job->response) {
+        // collect_done() reports this
+    } else if (job->kind == JOB_SEND_PACK) {
+        run_pack_slice(repo, job);
+    } else if (job->kind == JOB_FINISH_PUSH) {
+        run_finish_push(repo, job);
+    } else if (job->kind == JOB_WRITE_PUSH) {
+        // The connection waits on this job, so its fd is ours for now
+        if (write_push(job->conn->push_fd, job->data, job->size) != 0) {
+            const char *msg = "Failed to store pushed pack";
+            append_frame(job->response, PROTO_ERROR, msg, strlen(msg));
+            job->failed = 1;
+        }
+        free(job->data);
+        job->data = NULL;
+    } else if (job->kind == JOB_GET_OBJECT) {
+        object_type_t type;
+        size_t size;
+        void *data = object_read(repo, &job->hash, &type, &size);
+        if (data) {
+            char header[64];
+            snprintf(header, sizeof(header), "OK OBJECT %zu\n", size);
+            buffer_append_str(job->response, header);
+            buffer_append(job->response, data, size);
+            free(data);
+        } else {
+            buffer_append_str(job->response, "ERROR Object not found\n");
+        }
+    } else {
+        gyatt_hash_t hash;
+        if (object_write(repo, job->data, job->size, job->type, &hash) == 0) {
+            char hash_str[HASH_HEX_SIZE];
+            hash_to_hex(&hash, hash_str);
+            char response[64];
+            snprintf(response, sizeof(response), "OK STORED %s\n", hash_str);
+            buffer_append_str(job->response, response);
+        } else {
+            buffer_append_str(job->response, "ERROR Failed to write object\n");
+        }
+        free(job->data);
+        job->data = NULL;
+    }
+    trace_end(span, job->response ? job->response->len : 0, 0);
+
+    pthread_mutex_lock(&server->done_lock);
+    job->next = server->done;
+    server->done = job;
+    pthread_mutex_unlock(&server->done_lock);
+
+    // A full pipe already means "wake up", so a failed write is fine
+    ssize_t ignored = write(server->wake_pipe[1], "", 1);
+    (void)ignored;
+}
+
+static int conn_submit(conn_t *conn, job_t *job) {
+    job->conn = conn;
+    conn->busy = 1;
+    if (pool_submit(conn->server->pool, run_job, job) != 0) {
+        conn->busy = 0;
+        job_free(job);
+        if (conn->version >= 2) {
+            const char *msg = "Server overloaded";
+            append_frame(conn->out, PROTO_ERROR, msg, strlen(msg));
+            conn->quitting = 1;
+        } else {
+            conn_reply(conn, "ERROR Server overloaded\n");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// ==================== Protocol ====================
+
+// One complete command line (without the newline)
+static void handle_line(conn_t *conn, char *line) {
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+
+    if (strncmp(line, CMD_HELLO, strlen(CMD_HELLO)) == 0) {
+        conn_reply(conn, "OK HELLO\n");
+
+    } else if (strncmp(line, CMD_LIST_REFS, strlen(CMD_LIST_REFS)) == 0) {
+        // "<hex> <branch>" per line; there are few enough refs to read
+        // them right here
+        conn_reply(conn, "OK REFS\n");
+        repo_foreach_branch(conn->server->repo, append_ref_line, conn->out);
+        conn_reply(conn, "END\n");
+
+    } else if (strncmp(line, CMD_GET_OBJECT, strlen(CMD_GET_OBJECT)) == 0) {
+        char hash_str[HASH_HEX_SIZE];
+        if (sscanf(line, "GET-OBJECT %40s", hash_str) != 1 || strlen(hash_str) != HASH_HEX_SIZE - 1) {
+            conn_reply(conn, "ERROR Invalid hash\n");
+            return;
+        }
+
+        job_t *job = calloc(1, sizeof(job_t));
+        if (!job) {
+            conn_reply(conn, "ERROR Out of memory\n");
+            return;
+        }
+        job->kind = JOB_GET_OBJECT;
+        hex_to_hash(hash_str, &job->hash);
+        conn_submit(conn, job);
+
+    } else if (strncmp(line, CMD_PUT_OBJECT, strlen(CMD_PUT_OBJECT)) == 0) {
+        int type;
+        size_t obj_size;
+        if (sscanf(line, "PUT-OBJECT %d %zu", &type, &obj_size) != 2 ||
+            type < OBJ_BLOB || type > OBJ_CHUNKED) {
+            conn_reply(conn, "ERROR Invalid PUT-OBJECT command\n");
+            return;
+        }
+
+        // The payload has to fit in the read buffer; the stream can't be
+        // resynced past one that doesn't, so hang up
+        if (obj_size > conn->server->buffer_limit) {
+            conn_reply(conn, "ERROR Object too large\n");
+            conn->quitting = 1;
+            return;
+        }
+
+        if (obj_size == 0) {
+            job_t *job = calloc(1, sizeof(job_t));
+            if (!job) {
+                conn_reply(conn, "ERROR Out of memory\n");
+                return;
+            }
+            job->kind = JOB_PUT_OBJECT;
+            job->type = (object_type_t)type;
+            conn_submit(conn, job);
+            return;
+        }
+        conn->body_size = obj_size;
+        conn->body_type = (object_type_t)type;
+
+    } else if (strncmp(line, CMD_PROTOCOL, strlen(CMD_PROTOCOL)) == 0) {
+        int version = atoi(line + strlen(CMD_PROTOCOL));
+        if (version == 1) {
+            conn_reply(conn, "OK PROTOCOL 1\n");
+        } else if (version == PROTO_VERSION) {
+            // Everything after this line is frames
+            conn_reply(conn, "OK PROTOCOL 2 " PROTO_CAP_COMPRESSED "\n");
+            conn->version = 2;
+        } else {
+            conn_reply(conn, "ERROR Unsupported protocol\n");
+        }
+
+    } else if (strncmp(line, CMD_QUIT, strlen(CMD_QUIT)) == 0) {
+        conn_reply(conn, "BYE\n");
+        conn->quitting = 1;
+
+    } else {
+        conn_reply(conn, "ERROR Unknown command\n");
+    }
+}
+
+static void frame_error(conn_t *conn, const char *msg) {
+    append_frame(conn->out, PROTO_ERROR, msg, strlen(msg));
+    conn->quitting = 1;
+}
+
+static void handle_frame(conn_t *conn, int type, const unsigned char *payload, size_t len) {
+    if (type == PROTO_WANT || type == PROTO_HAVE) {
+        hash_list_t *list = type == PROTO_WANT ? &conn->wants : &conn->haves;
+        if (len % HASH_SIZE != 0) {
+            frame_error(conn, "Malformed hash list");
+        } else if (hash_list_append(list, payload, len / HASH_SIZE) != 0) {
+            frame_error(conn, "Batch too large");
+        }
+
+    } else if (type == PROTO_DONE) {
+        job_t *job = calloc(1, sizeof(job_t));
+        if (!job) {
+            frame_error(conn, "Out of memory");
+            return;
+        }
+
+        // The batch now belongs to the job
+        job->kind = JOB_SEND_PACK;
+        job->compressed = len > 0 && (payload[0] & PROTO_DONE_COMPRESSED);
+        job->closure = len > 0 && (payload[0] & PROTO_DONE_CLOSURE);
+        job->wants = conn->wants;
+        job->haves = conn->haves;
+        memset(&conn->wants, 0, sizeof(conn->wants));
+        memset(&conn->haves, 0, sizeof(conn->haves));
+
+        // Slices of half the buffer leave room to keep the next one coming
+        job->budget = conn->server->buffer_limit / 2;
+        if (job->budget < BUFFER_SIZE) job->budget = BUFFER_SIZE;
+        conn_submit(conn, job);
+
+    } else if (type == PROTO_LIST_REFS) {
+        buffer_t *refs = buffer_create(256);
+        if (!refs) {
+            frame_error(conn, "Out of memory");
+            return;
+        }
+        repo_foreach_branch(conn->server->repo, append_ref_line, refs);
+        append_frame(conn->out, PROTO_REFS, refs->data, refs->len);
+        buffer_free(refs);
+
+    } else if (type == PROTO_PUSH) {
+        if (conn->push_fd < 0) {
+            conn->push_fd = pack_tmp_create(conn->server->repo, conn->push_path, sizeof(conn->push_path));
+        }
+        job_t *job = conn->push_fd >= 0 ? calloc(1, sizeof(job_t)) : NULL;
+        void *data = job && len > 0 ? malloc(len) : NULL;
+        if (!job || (len > 0 && !data)) {
+            free(job);
+            frame_error(conn, "Can't accept a push");
+            return;
+        }
+        if (len > 0) memcpy(data, payload, len);
+        job->kind = JOB_WRITE_PUSH;
+        job->data = data;
+        job->size = len;
+        conn_submit(conn, job);
+
+    } else if (type == PROTO_UPDATE) {
+        char text[400], old_hex[64], new_hex[64];
+        push_update_t update;
+        memset(&update, 0, sizeof(update));
+        size_t n = len < sizeof(text) - 1 ? len : sizeof(text) - 1;
+        memcpy(text, payload, n);
+        text[n] = '\0';
+        if (len >= sizeof(text) ||
+            sscanf(text, "%63s %63s %255s", old_hex, new_hex, update.branch) != 3 ||
+            strlen(old_hex) != HASH_HEX_SIZE - 1 || strlen(new_hex) != HASH_HEX_SIZE - 1) {
+            frame_error(conn, "Malformed update");
+            return;
+        }
+        push_update_t *grown = conn->update_count < PROTO_MAX_UPDATES
+                                   ? realloc(conn->updates, (conn->update_count + 1) * sizeof(push_update_t))
+                                   : NULL;
+        if (!grown) {
+            frame_error(conn, "Too many updates");
+            return;
+        }
+        hex_to_hash(old_hex, &update.old_hash);
+        hex_to_hash(new_hex, &update.new_hash);
+        conn->updates = grown;
+        conn->updates[conn->update_count++] = update;
+
+    } else if (type == PROTO_FINISH) {
+        job_t *job = calloc(1, sizeof(job_t));
+        if (!job) {
+            frame_error(conn, "Out of memory");
+            return;
+        }
+
+        // As with DONE, the push now belongs to the job
+        job->kind = JOB_FINISH_PUSH;
+        job->push_fd = conn->push_fd;
+        memcpy(job->push_path, conn->push_path, sizeof(job->push_path));
+        job->updates = conn->updates;
+        job->update_count = conn->update_count;
+        conn->push_fd = -1;
+        conn->updates = NULL;
+        conn->update_count = 0;
+        conn_submit(conn, job);
+
+    } else if (type == PROTO_QUIT) {
+        conn->quitting = 1;
+
+    } else {
+        frame_error(conn, "Unknown frame");
+    }
+}
+
+// Work through buffered input until it runs out or a job is in flight.
+// Commands may arrive split across any number of recv() calls, or many at
+// once; only complete ones are acted on.
+static void conn_parse(conn_t *conn) {
+    size_t pos = 0;
+
+    while (!conn->busy && !conn->paused && !conn->quitting) {
+        char *data = conn->in->data + pos;
+        size_t avail = conn->in->len - pos;
+
+        if (conn->version >= 2) {
+            if (avail < PROTO_FRAME_HEADER) break;
+            size_t len = proto_frame_length((const unsigned char *)data);
+            if (len > conn->server->buffer_limit - PROTO_FRAME_HEADER) {
+                frame_error(conn, "Frame too large");
+                break;
             }
-            
-            char refs_path[PATH_MAX];
-            snprintf(refs_path, sizeof(refs_path), "%s/refs/heads", gyatt_dir);
-            free(gyatt_dir);
-            
-            // Send refs
-            send(client_socket, "OK REFS\n", 8, 0);
-            
-            // TODO: Actually list the refs
-            // For now, just send end marker
-            send(client_socket, "END\n", 4, 0);
-            
-        } else if (strncmp(buffer, CMD_GET_OBJECT, strlen(CMD_GET_OBJECT)) == 0) {
-            // Get object by hash
-            char hash_str[HASH_HEX_SIZE + 1];
-            if (sscanf(buffer, "GET-OBJECT %40s", hash_str) == 1) {
-                gyatt_hash_t hash;
-                hex_to_hash(hash_str, &hash);
-                
-                // Read object
-                object_type_t type;
-                size_t size;
-                void *data = object_read(&hash, &type, &size);
-                
-                if (data) {
-                    char response[256];
-                    snprintf(response, sizeof(response), "OK OBJECT %zu\n", size);
-                    send(client_socket, response, strlen(response), 0);
-                    send(client_socket, data, size, 0);
-                    free(data);
-                } else {
-                    const char *err = "ERROR Object not found\n";
-                    send(client_socket, err, strlen(err), 0);
-                }
+            if (avail < PROTO_FRAME_HEADER + len) break;
+
+            trace_span_t span = trace_begin(TRACE_SERVER_COMMAND);
+            handle_frame(conn, (unsigned char)data[0], (const unsigned char *)data + PROTO_FRAME_HEADER, len);
+            trace_end(span, PROTO_FRAME_HEADER + len, 0);
+            pos += PROTO_FRAME_HEADER + len;
+            continue;
+        }
+
+        if (conn->body_size > 0) {
+            if (avail < conn->body_size) break;
+
+            job_t *job = calloc(1, sizeof(job_t));
+            void *payload = job ? malloc(conn->body_size) : NULL;
+            if (!payload) {
+                free(job);
+                conn_reply(conn, "ERROR Out of memory\n");
             } else {
-                const char *err = "ERROR Invalid hash\n";
-                send(client_socket, err, strlen(err), 0);
+                memcpy(payload, data, conn->body_size);
+                job->kind = JOB_PUT_OBJECT;
+                job->type = conn->body_type;
+                job->data = payload;
+                job->size = conn->body_size;
+                conn_submit(conn, job);
+            }
+            pos += conn->body_size;
+            conn->body_size = 0;
+            continue;
+        }
+
+        char *newline = memchr(data, '\n', avail);
+        if (!newline) {
+            if (avail >= conn->server->buffer_limit) {
+                conn_reply(conn, "ERROR Command too long\n");
+                conn->quitting = 1;
             }
-            
-        } else if (strncmp(buffer, CMD_PUT_OBJECT, strlen(CMD_PUT_OBJECT)) == 0) {
-            // Receive object
-            size_t obj_size;
-            object_type_t type;
-            if (sscanf(buffer, "PUT-OBJECT %d %zu", (int *)&type, &obj_size) == 2) {
-                // Allocate buffer for object data
-                void *obj_data = malloc(obj_size);
-                if (!obj_data) {
-                    const char *err = "ERROR Out of memory\n";
-                    send(client_socket, err, strlen(err), 0);
-                    continue;
-                }
-                
-                // Receive object data
-                size_t received = 0;
-                while (received < obj_size) {
-                    ssize_t n = recv(client_socket, (char *)obj_data + received, 
-                                    obj_size - received, 0);
-                    if (n <= 0) break;
-                    received += n;
-                }
-                
-                if (received == obj_size) {
-                    // Write object
-                    gyatt_hash_t hash;
-                    if (object_write(obj_data, obj_size, type, &hash) == 0) {
-                        char hash_str[HASH_HEX_SIZE + 1];
-                        hash_to_hex(&hash, hash_str);
-                        
-                        char response[256];
-                        snprintf(response, sizeof(response), "OK STORED %s\n", hash_str);
-                        send(client_socket, response, strlen(response), 0);
-                    } else {
-                        const char *err = "ERROR Failed to write object\n";
-                        send(client_socket, err, strlen(err), 0);
-                    }
-                } else {
-                    const char *err = "ERROR Incomplete data\n";
-                    send(client_socket, err, strlen(err), 0);
-                }
-                
-                free(obj_data);
+            break;
+        }
+
+        *newline = '\0';
+        trace_span_t span = trace_begin(TRACE_SERVER_COMMAND);
+        handle_line(conn, data);
+        trace_end(span, (size_t)(newline - data) + 1, 0);
+        pos += (size_t)(newline - data) + 1;
+    }
+
+    // Keep only the unparsed tail
+    if (pos > 0) {
+        memmove(conn->in->data, conn->in->data + pos, conn->in->len - pos);
+        conn->in->len -= pos;
+    }
+}
+
+// ==================== Socket I/O ====================
+
+// Drain the socket into the read buffer, up to the per-client cap.
+// -1 means the connection is broken.
+static int conn_read(conn_t *conn) {
+    char chunk[BUFFER_SIZE];
+
+    while (!conn->eof) {
+        size_t room = conn->server->buffer_limit - conn->in->len;
+        if (room == 0) break;
+        if (room > sizeof(chunk)) room = sizeof(chunk);
+
+        ssize_t n = recv(conn->fd, chunk, room, 0);
+        if (n > 0) {
+            buffer_append(conn->in, chunk, (size_t)n);
+        } else if (n == 0) {
+            conn->eof = 1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Send part of a file range straight from the page cache where the OS
+// can, or by way of a small buffer where it can't
+static ssize_t send_range(int sock, seg_t *seg) {
+#ifdef __linux__
+    off_t offset = (off_t)seg->offset;
+    ssize_t n = sendfile(sock, seg->fd, &offset, seg->left);
+#else
+    char chunk[BUFFER_SIZE * 8];
+    size_t want = seg->left < sizeof(chunk) ? seg->left : sizeof(chunk);
+    ssize_t n = pread(seg->fd, chunk, want, (off_t)seg->offset);
+    if (n > 0) n = send(sock, chunk, (size_t)n, MSG_NOSIGNAL);
+#endif
+    // The file came up short; what's been sent can't be taken back
+    if (n == 0) errno = EIO;
+    return n == 0 ? -1 : n;
+}
+
+static int conn_flush(conn_t *conn) {
+    while (conn->queued.head) {
+        seg_t *seg = conn->queued.head;
+        while (seg->left > 0) {
+            ssize_t n = seg->buf ? send(conn->fd, seg->buf->data + seg->offset, seg->left, MSG_NOSIGNAL)
+                                 : send_range(conn->fd, seg);
+            if (n > 0) {
+                seg->offset += (size_t)n;
+                seg->left -= (size_t)n;
+                conn->queued.bytes -= (size_t)n;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
             } else {
-                const char *err = "ERROR Invalid PUT-OBJECT command\n";
-                send(client_socket, err, strlen(err), 0);
+                return -1;
             }
-            
-        } else if (strncmp(buffer, CMD_QUIT, strlen(CMD_QUIT)) == 0) {
-            const char *response = "BYE\n";
-            send(client_socket, response, strlen(response), 0);
+        }
+
+        conn->queued.head = seg->next;
+        if (!conn->queued.head) conn->queued.tail = NULL;
+        seg_free(seg);
+    }
+
+    while (conn->out_pos < conn->out->len) {
+        ssize_t n = send(conn->fd, conn->out->data + conn->out_pos,
+                         conn->out->len - conn->out_pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_pos += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             break;
-            
         } else {
-            const char *err = "ERROR Unknown command\n";
-            send(client_socket, err, strlen(err), 0);
+            return -1;
         }
     }
-    
-    close(client_socket);
+
+    if (conn->out_pos == conn->out->len) {
+        buffer_clear(conn->out);
+        conn->out_pos = 0;
+    }
+    return 0;
+}
+
+// Parse what's buffered, push out what's queued, and re-arm the socket for
+// whatever it's waiting on now. May close (and free) the connection.
+static void conn_service(conn_t *conn) {
+    conn_parse(conn);
+    if (conn_flush(conn) != 0) {
+        conn_close(conn);
+        return;
+    }
+
+    // A pack stream makes its next slice once most of the last one is out
+    size_t pending = conn->queued.bytes + conn->out->len - conn->out_pos;
+    size_t limit = conn->server->buffer_limit;
+    if (conn->paused && !conn->busy && pending < limit / 2) {
+        job_t *job = conn->paused;
+        conn->paused = NULL;
+        conn_submit(conn, job);
+    }
+
+    if (!conn->busy && !conn->paused && pending == 0 && (conn->eof || conn->quitting)) {
+        conn_close(conn);
+        return;
+    }
+
+    // Stop reading while the buffer is full or the client isn't keeping up
+    // with its responses; that's the backpressure
+    int want = 0;
+    if (!conn->eof && !conn->quitting && conn->in->len < limit && pending < limit) want |= EVENT_READ;
+    if (pending > 0) want |= EVENT_WRITE;
+
+    if (want != conn->watching) {
+        if (event_modify(conn->server->loop, conn->fd, want, conn) != 0) {
+            conn_close(conn);
+            return;
+        }
+        conn->watching = want;
+    }
+}
+
+static void conn_event(conn_t *conn, int events) {
+    if (conn->dead) return;
+
+    // A hangup once we've already seen EOF means nothing more can be sent
+    if ((events & EVENT_ERROR) && conn->eof) {
+        conn_close(conn);
+        return;
+    }
+    if ((events & (EVENT_READ | EVENT_ERROR)) && conn_read(conn) != 0) {
+        conn_close(conn);
+        return;
+    }
+    if ((events & EVENT_WRITE) && conn_flush(conn) != 0) {
+        conn_close(conn);
+        return;
+    }
+    conn_service(conn);
+}
+
+static void accept_clients(server_t *server) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int fd = accept(server->listen_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && server_running) {
+                perror("Error accepting connection");
+            }
+            return;
+        }
+
+        if (server->connection_count >= server->max_connections) {
+            const char *busy = "ERROR Server busy\n";
+            ssize_t ignored = send(fd, busy, strlen(busy), MSG_NOSIGNAL);
+            (void)ignored;
+            close(fd);
+            continue;
+        }
+
+        conn_t *conn = calloc(1, sizeof(conn_t));
+        if (conn) {
+            conn->push_fd = -1;
+            conn->in = buffer_create(BUFFER_SIZE);
+            conn->out = buffer_create(BUFFER_SIZE);
+        }
+        if (!conn || !conn->in || !conn->out || set_nonblocking(fd) != 0 ||
+            event_add(server->loop, fd, 0, conn) != 0) {
+            if (conn) conn_free(conn);
+            close(fd);
+            continue;
+        }
+
+        conn->server = server;
+        conn->fd = fd;
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        snprintf(conn->addr, sizeof(conn->addr), "%s:%d", client_ip, ntohs(client_addr.sin_port));
+
+        conn->next = server->conns;
+        if (server->conns) server->conns->prev = conn;
+        server->conns = conn;
+        server->connection_count++;
+        printf("✓ Client connected from %s\n", conn->addr);
+
+        // Be friendly!
+        conn_reply(conn, "GYATT-SERVER 1.0\n");
+        conn_service(conn);
+    }
+}
+
+// Queue a finished job's output after whatever the connection still has
+// to send, moving buffers around rather than copying them where it can
+static void conn_take_output(conn_t *conn, job_t *job) {
+    if (!job->response) {
+        conn_reply(conn, "ERROR Out of memory\n");
+        conn->quitting = 1;
+        return;
+    }
+
+    if (job->queued.head) {
+        // File ranges have to follow the unsent part of out, so out joins
+        // the queue ahead of them
+        buffer_t *fresh = buffer_create(BUFFER_SIZE);
+        if (!fresh || (conn->out_pos < conn->out->len &&
+                       queue_buffer(&conn->queued, conn->out, conn->out_pos) != 0)) {
+            buffer_free(fresh);
+            queue_clear(&job->queued);
+            buffer_clear(job->response);
+            conn_reply(conn, "ERROR Out of memory\n");
+            conn->quitting = 1;
+            return;
+        }
+        if (conn->out_pos == conn->out->len) buffer_free(conn->out);
+        queue_splice(&conn->queued, &job->queued);
+        conn->out = fresh;
+        conn->out_pos = 0;
+    }
+
+    if (conn->out_pos == conn->out->len) {
+        // Nothing queued: take the response whole instead of copying
+        buffer_t *swap = conn->out;
+        conn->out = job->response;
+        conn->out_pos = 0;
+        job->response = swap;
+        buffer_clear(swap);
+    } else {
+        buffer_append(conn->out, job->response->data, job->response->len);
+    }
 }
 
-int cmd_server(int argc, char *argv[]) {
-    if (!is_gyatt_repo()) {
+// Hand finished jobs back to their connections
+static void collect_done(server_t *server) {
+    char drain[256];
+    while (read(server->wake_pipe[0], drain, sizeof(drain)) > 0) {}
+
+    pthread_mutex_lock(&server->done_lock);
+    job_t *job = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->done_lock);
+
+    while (job) {
+        job_t *next = job->next;
+        conn_t *conn = job->conn;
+        conn->busy = 0;
+
+        if (!conn->dead) {
+            conn_take_output(conn, job);
+            if (job->failed) conn->quitting = 1;
+            if (job->more) {
+                buffer_clear(job->response);
+                conn->paused = job;
+                job = NULL;
+            }
+            conn_service(conn);
+        }
+
+        job_free(job);
+        job = next;
+    }
+}
+
+static void server_loop(server_t *server) {
+    event_t events[128];
+
+    while (server_running) {
+        // The timeout is only there to notice Ctrl+C promptly
+        int n = event_wait(server->loop, events, 128, 1000);
+        if (n < 0) {
+            perror("Error waiting for events");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *data = events[i].data;
+            if (data == &server->listen_fd) {
+                accept_clients(server);
+            } else if (data == &server->wake_pipe[0]) {
+                collect_done(server);
+            } else {
+                conn_event(data, events[i].events);
+            }
+        }
+        sweep_closed(server);
+    }
+}
+
+static int parse_limit(const char *value, int *out) {
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (*end || v <= 0 || v > 1000000) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+int cmd_server(gyatt_repo_t *repo, int argc, char *argv[]) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a Gyatt repository\n");
         fprintf(stderr, "Run 'gyatt init' first to create a repository\n");
         return 1;
     }
     
-    // Parse port
+    // Parse port and limits (the limits default to the [server] config)
     int port = DEFAULT_PORT;
-    if (argc > 1) {
-        port = atoi(argv[1]);
-        if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Error: Invalid port number\n");
+    int max_connections = repo->config.server_max_connections;
+    int backlog = repo->config.server_backlog;
+    int buffer_kb = repo->config.server_buffer_kb;
+    for (int i = 1; i < argc; i++) {
+        int ok;
+        if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc) {
+            ok = parse_limit(argv[++i], &max_connections) == 0;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            ok = parse_limit(argv[++i], &backlog) == 0;
+        } else if (strcmp(argv[i], "--client-buffer") == 0 && i + 1 < argc) {
+            ok = parse_limit(argv[++i], &buffer_kb) == 0;
+        } else if (argv[i][0] != '-') {
+            port = atoi(argv[i]);
+            if (port <= 0 || port > 65535) {
+                fprintf(stderr, "Error: Invalid port number\n");
+                return 1;
+            }
+            ok = 1;
+        } else {
+            ok = 0;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Usage: gyatt server [port] [--max-connections <n>] [--backlog <n>]\n");
+            fprintf(stderr, "                    [--client-buffer <KB>]\n");
             return 1;
         }
     }
+    if (max_connections <= 0) max_connections = 256;
+    if (backlog <= 0) backlog = 128;
+    if (buffer_kb <= 0) buffer_kb = 1024;
     
     // Set up signal handler
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);  // Dead clients show up as send() errors instead
     
     // Create socket
     int server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -222,19 +1275,20 @@ int cmd_server(int argc, char *argv[]) {
     }
     
     // Listen for connections
-    if (listen(server_socket, 5) < 0) {
+    if (listen(server_socket, backlog) < 0 || set_nonblocking(server_socket) != 0) {
         perror("Error listening on socket");
         close(server_socket);
         return 1;
     }
     
-    char *repo_path = get_gyatt_dir();
     printf("╔════════════════════════════════════════════════════════╗\n");
     printf("║           GYATT SERVER - STARTED                       ║\n");
     printf("╚════════════════════════════════════════════════════════╝\n");
     printf("\n");
-    printf("Repository: %s\n", repo_path ? repo_path : ".");
+    printf("Repository: %s\n", repo->gyatt_dir);
     printf("Listening on: 0.0.0.0:%d\n", port);
+    printf("Limits: %d connections, backlog %d, %d KB per client, %d worker(s)\n",
+           max_connections, backlog, buffer_kb, config_thread_count(&repo->config));
     printf("Server is ready to accept connections!\n");
     printf("\n");
     printf("Commands:\n");
@@ -243,46 +1297,46 @@ int cmd_server(int argc, char *argv[]) {
     printf("  GET-OBJECT     - Fetch an object\n");
     printf("  PUT-OBJECT     - Store an object\n");
     printf("  QUIT           - Close connection\n");
+    printf("  PROTOCOL 2     - Switch to batched v2 frames (fetch, push)\n");
     printf("\n");
     printf("Press Ctrl+C to stop the server\n");
     printf("════════════════════════════════════════════════════════\n\n");
-    free(repo_path);
     
-    // Accept connections
-    while (server_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        // Set timeout on accept
-        struct timeval tv;
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        setsockopt(server_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        
-        int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-        
-        if (client_socket < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                continue;  // Timeout, check if server should still run
-            }
-            if (server_running) {
-                perror("Error accepting connection");
-            }
-            continue;
-        }
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("✓ Client connected from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-        
-        // Handle client (blocking for now, could fork/thread for multiple clients)
-        handle_client(client_socket);
-        
-        printf("✗ Client disconnected\n");
+    server_t server;
+    memset(&server, 0, sizeof(server));
+    server.repo = repo;
+    server.listen_fd = server_socket;
+    server.buffer_limit = (size_t)buffer_kb * 1024;
+    server.max_connections = max_connections;
+    server.wake_pipe[0] = server.wake_pipe[1] = -1;
+    pthread_mutex_init(&server.done_lock, NULL);
+
+    server.loop = event_loop_create();
+    server.pool = pool_create(config_thread_count(&repo->config));
+    int ready = server.loop && server.pool && pipe(server.wake_pipe) == 0 &&
+                set_nonblocking(server.wake_pipe[0]) == 0 && set_nonblocking(server.wake_pipe[1]) == 0 &&
+                event_add(server.loop, server_socket, EVENT_READ, &server.listen_fd) == 0 &&
+                event_add(server.loop, server.wake_pipe[0], EVENT_READ, &server.wake_pipe[0]) == 0;
+
+    if (ready) {
+        server_loop(&server);
+    } else {
+        fprintf(stderr, "Error: Failed to start the event loop\n");
     }
+
+    // Let in-flight jobs finish, then drop everyone
+    pool_free(server.pool);
+    collect_done(&server);
+    while (server.conns) conn_close(server.conns);
+    sweep_closed(&server);
+
+    event_loop_free(server.loop);
+    if (server.wake_pipe[0] >= 0) close(server.wake_pipe[0]);
+    if (server.wake_pipe[1] >= 0) close(server.wake_pipe[1]);
+    pthread_mutex_destroy(&server.done_lock);
     
     close(server_socket);
     printf("\n✓ Server stopped\n");
     
-    return 0;
+    return ready ? 0 : 1;
 }
@@ -2,28 +2,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include "../gyatt.h"
 #include "../index.h"
 #include "../object.h"
 #include "../utils.h"
 #include "../hash.h"
+#include "../ignore.h"
+#include "../scan.h"
+#include "../fsmonitor.h"
 
 #ifndef PATH_MAX
     #define PATH_MAX 4096
 #endif
 
 // Helper to get current branch name
-static char *get_current_branch(void) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return NULL;
-    
+static char *get_current_branch(gyatt_repo_t *repo) {
     char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", repo->gyatt_dir);
     
     size_t size = 0;
     char *head_content = read_file(head_path, &size);
-    free(gyatt_dir);
     
     if (!head_content) return NULL;
     
@@ -44,27 +42,6 @@ static char *get_current_branch(void) {
     return branch;
 }
 
-// Helper to check if file should be ignored
-static int should_ignore(const char *path) {
-    // Ignore .gyatt directory
-    if (strstr(path, ".gyatt") != NULL) {
-        return 1;
-    }
-    
-    // Ignore .git directory
-    if (strstr(path, ".git") != NULL) {
-        return 1;
-    }
-    
-    // Ignore common build artifacts
-    if (strstr(path, "/bin/") != NULL || strstr(path, "/build/") != NULL) {
-        return 1;
-    }
-    
-    // TODO: Read from .gyattignore
-    return 0;
-}
-
 // Helper to scan directory recursively
 typedef struct {
     char **files;
@@ -93,155 +70,27 @@ static void file_list_free(file_list_t *list) {
     free(list->files);
 }
 
-static void scan_directory_recursive(const char *dir_path, file_list_t *list) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) return;
-    
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        char full_path[PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-        
-        if (should_ignore(full_path)) {
-            continue;
-        }
-        
-        struct stat st;
-        if (stat(full_path, &st) != 0) {
-            continue;
-        }
-        
-        if (S_ISDIR(st.st_mode)) {
-            scan_directory_recursive(full_path, list);
-        } else if (S_ISREG(st.st_mode)) {
-            // Store relative path
-            const char *rel_path = full_path;
-            if (strncmp(rel_path, "./", 2) == 0) {
-                rel_path += 2;
-            }
-            file_list_add(list, rel_path);
-        }
-    }
-    
-    closedir(dir);
-}
-
-// Helper to compute file hash (as blob)
-static void compute_file_hash(const char *path, gyatt_hash_t *hash) {
-    // Read file
-    size_t size;
-    void *data = read_file(path, &size);
-    if (!data) {
-        memset(hash, 0, sizeof(gyatt_hash_t));
-        return;
-    }
-    
-    // Create object header: "blob size\0"
-    char header[64];
-    int header_len = snprintf(header, sizeof(header), "blob %zu", size);
-    header[header_len++] = '\0';
-    
-    // Combine header and data for hashing
-    size_t total_size = header_len + size;
-    void *combined = malloc(total_size);
-    if (!combined) {
-        free(data);
+// Helper to compute file hash (as blob, or chunked if the recorded one is)
+static void compute_file_hash(gyatt_repo_t *repo, const char *rel_path, const gyatt_hash_t *recorded,
+                              gyatt_hash_t *hash) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", repo->root, rel_path);
+    if (object_hash_file(repo, path, recorded, hash) != 0) {
         memset(hash, 0, sizeof(gyatt_hash_t));
-        return;
-    }
-    
-    memcpy(combined, header, header_len);
-    memcpy((char *)combined + header_len, data, size);
-    
-    // Calculate hash
-    sha1_hash(combined, total_size, hash);
-    
-    free(combined);
-    free(data);
-}
-
-// Helper to check if file is in index
-static index_entry_t *find_in_index(index_t *index, const char *path) {
-    for (size_t i = 0; i < index->entry_count; i++) {
-        if (strcmp(index->entries[i].path, path) == 0) {
-            return &index->entries[i];
-        }
     }
-    return NULL;
 }
 
-// Helper to get last commit tree
-static tree_object_t *get_head_tree(void) {
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return NULL;
-    
-    // Read HEAD
-    char head_path[PATH_MAX];
-    snprintf(head_path, sizeof(head_path), "%s/HEAD", gyatt_dir);
-    
-    size_t size = 0;
-    char *head_content = read_file(head_path, &size);
-    if (!head_content) {
-        free(gyatt_dir);
-        return NULL;
-    }
-    
-    // Parse branch ref
-    char *ref_start = strstr(head_content, "refs/heads/");
-    if (!ref_start) {
-        free(head_content);
-        free(gyatt_dir);
-        return NULL;
-    }
-    ref_start += strlen("refs/heads/");
-    char *newline = strchr(ref_start, '\n');
-    if (newline) *newline = '\0';
-    
-    // Read branch ref file
-    char branch_path[PATH_MAX];
-    snprintf(branch_path, sizeof(branch_path), "%s/refs/heads/%s", gyatt_dir, ref_start);
-    free(head_content);
-    free(gyatt_dir);
-    
-    size_t hash_size = 0;
-    char *hash_str = read_file(branch_path, &hash_size);
-    if (!hash_str) {
-        // No commits yet
-        return NULL;
-    }
-    
-    // Parse commit hash
-    gyatt_hash_t commit_hash;
-    hex_to_hash(hash_str, &commit_hash);
-    free(hash_str);
-    
-    // Read commit object
-    commit_object_t *commit = commit_read(&commit_hash);
-    if (!commit) return NULL;
-    
-    // Read tree object
-    tree_object_t *tree = tree_read(&commit->tree);
-    commit_free(commit);
-    
-    return tree;
-}
-
-int cmd_status(int argc, char *argv[]) {
+int cmd_status(gyatt_repo_t *repo, int argc, char *argv[]) {
     (void)argc;
     (void)argv;
     
-    if (!is_gyatt_repo()) {
+    if (!repo) {
         fprintf(stderr, "Error: Not a Gyatt repository\n");
         return 1;
     }
     
     // Get current branch
-    char *branch = get_current_branch();
+    char *branch = get_current_branch(repo);
     if (!branch) {
         fprintf(stderr, "Error: Could not determine current branch\n");
         return 1;
@@ -257,16 +106,48 @@ int cmd_status(int argc, char *argv[]) {
         return 1;
     }
     
-    // Try to read index (it's okay if it doesn't exist yet)
-    index_read(index);
+    // Read index (a missing one is just empty)
+    if (index_read(repo, index) != 0) {
+        fprintf(stderr, "Error: Could not read index\n");
+        index_free(index);
+        return 1;
+    }
     
-    // Get HEAD tree (last commit)
-    tree_object_t *head_tree = get_head_tree();
+    // Get HEAD tree (last commit). An index whose cached root tree is
+    // HEAD's has nothing staged, and then HEAD needn't be flattened at all.
+    tree_object_t *head_tree = NULL;
+    int has_head = 0;
+    int head_is_index = 0;
+    gyatt_hash_t head_hash;
+    commit_object_t *head = repo_resolve_ref(repo, "HEAD", &head_hash) == 0 ? commit_read(repo, &head_hash) : NULL;
+    if (head) {
+        gyatt_hash_t cached;
+        has_head = 1;
+        head_is_index = index_cache_tree_get(index, "", 0, index->entry_count, &cached) &&
+                        hash_compare(&cached, &head->tree) == 0;
+        if (!head_is_index) head_tree = tree_read_flat(repo, &head->tree);
+        commit_free(head);
+    }
     
-    // Scan working directory
-    file_list_t working_files;
-    file_list_init(&working_files);
-    scan_directory_recursive(".", &working_files);
+    // Scan working directory, sorted the same way as the index and tree.
+    // With the fsmonitor daemon running, only what it saw change (and
+    // whatever was untracked or modified last time) needs looking at.
+    ignore_t *ignore = ignore_create(repo);
+    fsmonitor_view_t view;
+    int monitored = fsmonitor_view(repo, index, ignore, &view);
+    scan_t *working_files = view.files;
+    view.files = NULL;
+    if (monitored != 0) {
+        working_files = scan_worktree(repo, "", ignore, config_thread_count(&repo->config));
+    }
+    ignore_free(ignore);
+    if (!working_files) {
+        fsmonitor_view_free(&view);
+        fprintf(stderr, "Error: Could not scan the working directory\n");
+        if (head_tree) tree_free(head_tree);
+        index_free(index);
+        return 1;
+    }
     
     // Categorize files
     file_list_t staged_new, staged_modified, staged_deleted;
@@ -280,86 +161,94 @@ int cmd_status(int argc, char *argv[]) {
     file_list_init(&deleted_not_staged);
     file_list_init(&untracked);
     
-    // Check staged files (in index)
-    for (size_t i = 0; i < index->entry_count; i++) {
-        index_entry_t *entry = &index->entries[i];
-        
-        // Check if file exists in HEAD tree
-        int in_head = 0;
-        if (head_tree) {
-            tree_entry_t *head_entry = tree_find_entry(head_tree, entry->path);
-            if (head_entry) {
-                in_head = 1;
-                // Check if modified from HEAD
-                if (hash_compare(&entry->hash, &head_entry->hash) != 0) {
-                    file_list_add(&staged_modified, entry->path);
-                }
-            }
+    // Index, HEAD tree and working tree are all sorted by path, so one
+    // merge pass over the three sees every path once with all its versions
+    size_t head_count = head_tree ? head_tree->entry_count : 0;
+    size_t ii = 0, hi = 0, wi = 0;
+    int index_refreshed = 0;
+    
+    while (ii < index->entry_count || hi < head_count || wi < working_files->count) {
+        // Pick the smallest path still pending on any side
+        const char *path = NULL;
+        if (ii < index->entry_count) path = index_entry_path(index, &index->entries[ii]);
+        if (hi < head_count && (!path || strcmp(head_tree->entries[hi].name, path) < 0)) {
+            path = head_tree->entries[hi].name;
+        }
+        if (wi < working_files->count && (!path || strcmp(working_files->entries[wi].path, path) < 0)) {
+            path = working_files->entries[wi].path;
         }
         
-        if (!in_head) {
-            // New file staged
-            file_list_add(&staged_new, entry->path);
+        index_entry_t *entry = NULL;
+        tree_entry_t *head_entry = NULL;
+        scan_entry_t *work = NULL;
+        if (ii < index->entry_count && strcmp(index_entry_path(index, &index->entries[ii]), path) == 0) {
+            entry = &index->entries[ii++];
+        }
+        if (hi < head_count && strcmp(head_tree->entries[hi].name, path) == 0) {
+            head_entry = &head_tree->entries[hi++];
+        }
+        if (wi < working_files->count && strcmp(working_files->entries[wi].path, path) == 0) {
+            work = &working_files->entries[wi++];
         }
         
-        // Check if file still exists in working directory
-        if (!file_exists(entry->path)) {
-            file_list_add(&deleted_not_staged, entry->path);
-        } else {
-            // Check if modified in working directory
-            gyatt_hash_t current_hash;
-            compute_file_hash(entry->path, &current_hash);
-            if (hash_compare(&current_hash, &entry->hash) != 0) {
-                file_list_add(&modified_not_staged, entry->path);
+        // Tracked files stay tracked even when a rule ignores them; the
+        // scan skipped them, so look them up directly. Under the monitor,
+        // a file it didn't report is as it was last time, when it matched.
+        scan_entry_t tracked;
+        int unchanged = monitored == 0 && !work && entry && !fsmonitor_view_covers(&view, path);
+        if (!work && !unchanged && (entry || head_entry)) {
+            char full_path[PATH_MAX];
+            snprintf(full_path, sizeof(full_path), "%s/%s", repo->root, path);
+            if (stat(full_path, &tracked.st) == 0 && S_ISREG(tracked.st.st_mode)) {
+                tracked.path = path;
+                work = &tracked;
             }
         }
-    }
-    
-    // Check files in HEAD but not in working directory or index
-    if (head_tree) {
-        for (size_t i = 0; i < head_tree->entry_count; i++) {
-            tree_entry_t *head_entry = &head_tree->entries[i];
-            index_entry_t *idx_entry = find_in_index(index, head_entry->name);
+        
+        if (entry) {
+            // Staged side: index vs HEAD
+            if (head_is_index) {
+                // Same by construction
+            } else if (!head_entry) {
+                file_list_add(&staged_new, path);
+            } else if (hash_compare(&entry->hash, &head_entry->hash) != 0) {
+                file_list_add(&staged_modified, path);
+            }
             
-            // If file is in HEAD but not in index
-            if (!idx_entry) {
-                // Check if file still exists in working directory
-                if (file_exists(head_entry->name)) {
-                    // File exists but not staged - this is normal, not a "staged deletion"
-                    // Don't add to staged_deleted
+            // Unstaged side: working tree vs index
+            if (unchanged) {
+                // Nothing to look at
+            } else if (!work) {
+                file_list_add(&deleted_not_staged, path);
+            } else if (!index_entry_stat_matches(entry, &work->st) || index_entry_is_racy(index, entry)) {
+                // Stat data changed or can't be trusted - only the content can tell
+                gyatt_hash_t current_hash;
+                compute_file_hash(repo, path, &entry->hash, &current_hash);
+                if (hash_compare(&current_hash, &entry->hash) != 0) {
+                    file_list_add(&modified_not_staged, path);
                 } else {
-                    // File was in HEAD, not in index, and doesn't exist - it's deleted but not staged
-                    file_list_add(&deleted_not_staged, head_entry->name);
+                    // Same content: cache the new stat data so the next run skips the hash
+                    index_entry_set_stat(entry, &work->st);
+                    index_refreshed = 1;
                 }
             }
-        }
-    }
-    
-    // Check untracked files and modified files (not in index)
-    for (size_t i = 0; i < working_files.count; i++) {
-        const char *path = working_files.files[i];
-        if (!find_in_index(index, path)) {
-            // Not in index - check if in HEAD
-            int in_head = 0;
-            tree_entry_t *head_entry = NULL;
-            if (head_tree) {
-                head_entry = tree_find_entry(head_tree, path);
-                if (head_entry) in_head = 1;
-            }
-            
-            if (!in_head) {
-                // Not in HEAD and not in index - truly untracked
-                file_list_add(&untracked, path);
+        } else if (head_entry) {
+            // In HEAD but not in index
+            if (!work) {
+                // Doesn't exist either - it's deleted but not staged
+                file_list_add(&deleted_not_staged, path);
             } else {
-                // In HEAD but not in index - check if modified
                 gyatt_hash_t current_hash;
-                compute_file_hash(path, &current_hash);
+                compute_file_hash(repo, path, &head_entry->hash, &current_hash);
                 if (hash_compare(&current_hash, &head_entry->hash) != 0) {
                     // Modified from HEAD but not staged
                     file_list_add(&modified_not_staged, path);
                 }
                 // If not modified, it's clean - don't report anything
             }
+        } else {
+            // Not in HEAD and not in index - truly untracked
+            file_list_add(&untracked, path);
         }
     }
     
@@ -407,7 +296,7 @@ int cmd_status(int argc, char *argv[]) {
     }
     
     if (!has_changes) {
-        if (head_tree) {
+        if (has_head) {
             printf("\nnothing to commit, working tree clean\n");
         } else {
             printf("\nNo commits yet\n");
@@ -419,10 +308,31 @@ int cmd_status(int argc, char *argv[]) {
         }
     }
     
+    // Next time the monitor only has to say what changed from here, but
+    // what's untracked or modified now has to be looked at again
+    if (monitored >= 0 && view.token) {
+        file_list_t *dirty = &modified_not_staged;
+        if (deleted_not_staged.count > 0) {
+            for (size_t i = 0; i < deleted_not_staged.count; i++) {
+                file_list_add(dirty, deleted_not_staged.files[i]);
+            }
+        }
+        if (fsmonitor_save(index, view.token, untracked.files, untracked.count,
+                           dirty->files, dirty->count) > 0) {
+            index_refreshed = 1;
+        }
+    }
+    fsmonitor_view_free(&view);
+    
+    // Save refreshed stat data; failing to is harmless, we'll just hash again
+    if (index_refreshed) {
+        index_write(repo, index);
+    }
+    
     // Cleanup
     if (head_tree) tree_free(head_tree);
     index_free(index);
-    file_list_free(&working_files);
+    scan_free(working_files);
     file_list_free(&staged_new);
     file_list_free(&staged_modified);
     file_list_free(&staged_deleted);
@@ -0,0 +1,461 @@
+#include "commit_graph.h"
+#include "object.h"
+#include "hash.h"
+#include "buffer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+#define COMMIT_GRAPH_HEADER_SIZE 16
+#define COMMIT_GRAPH_FANOUT_SIZE (256 * 4)
+#define COMMIT_GRAPH_RECORD_SIZE (HASH_SIZE + 4 + 4 + 8)
+
+struct commit_graph {
+    const unsigned char *data;
+    size_t data_size;
+    uint32_t count;
+    const unsigned char *fanout;
+    const unsigned char *hashes;
+    const unsigned char *records;
+};
+
+static uint32_t read_u32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int graph_path(const gyatt_repo_t *repo, char *out, size_t out_size) {
+    int n = snprintf(out, out_size, "%s/commit-graph", repo->gyatt_dir);
+    return n < 0 || (size_t)n >= out_size ? -1 : 0;
+}
+
+commit_graph_t *commit_graph_open(const gyatt_repo_t *repo) {
+    if (!repo) return NULL;
+
+    char path[PATH_MAX];
+    if (graph_path(repo, path, sizeof(path)) != 0) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE + HASH_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    const unsigned char *data = map;
+    uint32_t count = read_u32(data + 8);
+    uint64_t expected = (uint64_t)COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE +
+                        (uint64_t)count * (HASH_SIZE + COMMIT_GRAPH_RECORD_SIZE) + HASH_SIZE;
+
+    // Like pack idx files, only the shape is checked here; positions are
+    // bounds-checked when they're followed
+    if (memcmp(data, COMMIT_GRAPH_SIGNATURE, 4) != 0 || read_u32(data + 4) != COMMIT_GRAPH_VERSION ||
+        expected != size || read_u32(data + COMMIT_GRAPH_HEADER_SIZE + 255 * 4) != count) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    commit_graph_t *graph = calloc(1, sizeof(commit_graph_t));
+    if (!graph) {
+        munmap(map, size);
+        return NULL;
+    }
+    graph->data = data;
+    graph->data_size = size;
+    graph->count = count;
+    graph->fanout = data + COMMIT_GRAPH_HEADER_SIZE;
+    graph->hashes = graph->fanout + COMMIT_GRAPH_FANOUT_SIZE;
+    graph->records = graph->hashes + (size_t)count * HASH_SIZE;
+    return graph;
+}
+
+void commit_graph_free(commit_graph_t *graph) {
+    if (!graph) return;
+    munmap((void *)graph->data, graph->data_size);
+    free(graph);
+}
+
+static int graph_lookup(const commit_graph_t *graph, const gyatt_hash_t *hash, uint32_t *pos) {
+    if (!graph) return 0;
+
+    uint8_t first = hash->hash[0];
+    uint32_t lo = first == 0 ? 0 : read_u32(graph->fanout + (first - 1) * 4);
+    uint32_t hi = read_u32(graph->fanout + first * 4);
+    if (hi > graph->count || lo > hi) return 0;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(graph->hashes + (size_t)mid * HASH_SIZE, hash->hash, HASH_SIZE);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+static int graph_fill(const commit_graph_t *graph, uint32_t pos, commit_info_t *info) {
+    const unsigned char *record = graph->records + (size_t)pos * COMMIT_GRAPH_RECORD_SIZE;
+
+    memcpy(info->hash.hash, graph->hashes + (size_t)pos * HASH_SIZE, HASH_SIZE);
+    memcpy(info->tree.hash, record, HASH_SIZE);
+
+    uint32_t parent = read_u32(record + HASH_SIZE);
+    info->has_parent = parent != COMMIT_GRAPH_NO_PARENT;
+    memset(&info->parent, 0, sizeof(info->parent));
+    if (info->has_parent) {
+        if (parent >= graph->count) return -1;
+        memcpy(info->parent.hash, graph->hashes + (size_t)parent * HASH_SIZE, HASH_SIZE);
+    }
+
+    info->generation = read_u32(record + HASH_SIZE + 4);
+    memcpy(&info->timestamp, record + HASH_SIZE + 8, 8);
+    return 0;
+}
+
+static int hash_is_zero(const gyatt_hash_t *hash) {
+    for (int i = 0; i < HASH_SIZE; i++) {
+        if (hash->hash[i] != 0) return 0;
+    }
+    return 1;
+}
+
+int commit_info_get(gyatt_repo_t *repo, const gyatt_hash_t *hash, commit_info_t *info) {
+    if (!repo || !hash || !info) return -1;
+
+    uint32_t pos;
+    if (graph_lookup(repo->graph, hash, &pos)) return graph_fill(repo->graph, pos, info);
+
+    // Not in the graph (newer than it, or there is none): parse the object
+    commit_object_t *commit = commit_read(repo, hash);
+    if (!commit) return -1;
+
+    info->hash = *hash;
+    info->tree = commit->tree;
+    info->parent = commit->parent;
+    info->has_parent = !hash_is_zero(&commit->parent);
+    info->timestamp = (int64_t)commit->committer.timestamp;
+    info->generation = 0;
+    commit_free(commit);
+    return 0;
+}
+
+int commit_generation(gyatt_repo_t *repo, const gyatt_hash_t *hash, uint32_t *generation) {
+    commit_info_t info;
+    if (commit_info_get(repo, hash, &info) != 0) return -1;
+
+    // Walk down to the graph (or a root), counting the commits on the way
+    uint32_t above = 0;
+    while (info.generation == 0) {
+        above++;
+        if (!info.has_parent) {
+            *generation = above;
+            return 0;
+        }
+        gyatt_hash_t parent = info.parent;
+        if (commit_info_get(repo, &parent, &info) != 0) return -1;
+    }
+
+    *generation = info.generation + above;
+    return 0;
+}
+
+// Step hash down to its ancestor at generation target (gen is the current
+// one). Every commit has one parent, so that ancestor is unique.
+static int walk_down_to(gyatt_repo_t *repo, gyatt_hash_t *hash, uint32_t gen, uint32_t target) {
+    while (gen > target) {
+        commit_info_t info;
+        if (commit_info_get(repo, hash, &info) != 0) return -1;
+        if (!info.has_parent) return 1;
+        *hash = info.parent;
+        gen--;
+    }
+    return 0;
+}
+
+int commit_merge_base(gyatt_repo_t *repo, const gyatt_hash_t *a, const gyatt_hash_t *b,
+                      gyatt_hash_t *base) {
+    uint32_t gen_a, gen_b;
+    if (commit_generation(repo, a, &gen_a) != 0 || commit_generation(repo, b, &gen_b) != 0) return -1;
+
+    // Bring both to the same depth, then step them together until they meet
+    gyatt_hash_t x = *a, y = *b;
+    uint32_t gen = gen_a < gen_b ? gen_a : gen_b;
+    int ret = walk_down_to(repo, &x, gen_a, gen);
+    if (ret == 0) ret = walk_down_to(repo, &y, gen_b, gen);
+    if (ret != 0) return ret;
+
+    while (memcmp(x.hash, y.hash, HASH_SIZE) != 0) {
+        if (gen <= 1) return 1;  // Different roots
+        if (walk_down_to(repo, &x, gen, gen - 1) != 0 || walk_down_to(repo, &y, gen, gen - 1) != 0) {
+            return -1;
+        }
+        gen--;
+    }
+
+    *base = x;
+    return 0;
+}
+
+int commit_is_ancestor(gyatt_repo_t *repo, const gyatt_hash_t *ancestor,
+                       const gyatt_hash_t *descendant) {
+    uint32_t gen_a, gen_d;
+    if (commit_generation(repo, ancestor, &gen_a) != 0 ||
+        commit_generation(repo, descendant, &gen_d) != 0) {
+        return -1;
+    }
+    if (gen_a > gen_d) return 0;
+
+    gyatt_hash_t x = *descendant;
+    int ret = walk_down_to(repo, &x, gen_d, gen_a);
+    if (ret != 0) return ret < 0 ? -1 : 0;
+    return memcmp(x.hash, ancestor->hash, HASH_SIZE) == 0;
+}
+
+// ==================== Writing ====================
+
+typedef struct {
+    gyatt_hash_t hash;
+    gyatt_hash_t tree;
+    gyatt_hash_t parent;
+    int has_parent;
+    int64_t timestamp;
+    uint32_t parent_pos;
+    uint32_t generation;
+} graph_commit_t;
+
+typedef struct {
+    graph_commit_t *commits;
+    size_t count;
+    size_t capacity;
+} graph_list_t;
+
+static int graph_commit_compare(const void *a, const void *b) {
+    const graph_commit_t *ca = a, *cb = b;
+    return memcmp(ca->hash.hash, cb->hash.hash, HASH_SIZE);
+}
+
+static graph_commit_t *graph_list_find(const graph_list_t *list, const gyatt_hash_t *hash) {
+    if (list->count == 0) return NULL;
+
+    graph_commit_t key;
+    key.hash = *hash;
+    return bsearch(&key, list->commits, list->count, sizeof(graph_commit_t), graph_commit_compare);
+}
+
+static int graph_list_add(graph_list_t *list, const commit_info_t *info) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+        graph_commit_t *new_commits = realloc(list->commits, new_capacity * sizeof(graph_commit_t));
+        if (!new_commits) return -1;
+        list->commits = new_commits;
+        list->capacity = new_capacity;
+    }
+
+    graph_commit_t *c = &list->commits[list->count++];
+    memset(c, 0, sizeof(*c));
+    c->hash = info->hash;
+    c->tree = info->tree;
+    c->parent = info->parent;
+    c->has_parent = info->has_parent;
+    c->timestamp = info->timestamp;
+    return 0;
+}
+
+// Every commit on the way down from one branch tip. Walks stop at commits
+// already collected; those are re-sorted between branches so the lookup
+// stays a binary search.
+static int collect_branch(gyatt_repo_t *repo, graph_list_t *list, const gyatt_hash_t *tip) {
+    size_t sorted = list->count;
+    gyatt_hash_t hash = *tip;
+
+    for (;;) {
+        if (graph_list_find(&(graph_list_t){ list->commits, sorted, 0 }, &hash)) break;
+
+        commit_info_t info;
+        if (commit_info_get(repo, &hash, &info) != 0) {
+            char hex[HASH_HEX_SIZE];
+            hash_to_hex(&hash, hex);
+            fprintf(stderr, "Error: Could not read commit %s\n", hex);
+            return -1;
+        }
+        if (graph_list_add(list, &info) != 0) return -1;
+        if (!info.has_parent) break;
+        hash = info.parent;
+    }
+
+    qsort(list->commits, list->count, sizeof(graph_commit_t), graph_commit_compare);
+    return 0;
+}
+
+static int collect_branches(gyatt_repo_t *repo, graph_list_t *list) {
+    char heads_path[PATH_MAX];
+    snprintf(heads_path, sizeof(heads_path), "%s/refs/heads", repo->gyatt_dir);
+
+    DIR *dir = opendir(heads_path);
+    if (!dir) return 0;
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        gyatt_hash_t tip;
+        if (repo_resolve_ref(repo, entry->d_name, &tip) != 0) continue;
+        result = collect_branch(repo, list, &tip);
+    }
+
+    closedir(dir);
+    return result;
+}
+
+// Parents sit at smaller generations, so resolve each chain bottom-up:
+// push commits until one with a known generation (or a root), then pop
+static int assign_generations(graph_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        graph_commit_t *c = &list->commits[i];
+        c->parent_pos = COMMIT_GRAPH_NO_PARENT;
+        if (!c->has_parent) continue;
+
+        graph_commit_t *parent = graph_list_find(list, &c->parent);
+        if (!parent) return -1;
+        c->parent_pos = (uint32_t)(parent - list->commits);
+    }
+
+    uint32_t *stack = malloc((list->count + 1) * sizeof(uint32_t));
+    if (!stack) return -1;
+
+    for (size_t i = 0; i < list->count; i++) {
+        size_t depth = 0;
+        uint32_t pos = (uint32_t)i;
+        while (list->commits[pos].generation == 0) {
+            if (depth > list->count) {
+                free(stack);
+                return -1;  // A cycle can't be real history
+            }
+            stack[depth++] = pos;
+            if (list->commits[pos].parent_pos == COMMIT_GRAPH_NO_PARENT) break;
+            pos = list->commits[pos].parent_pos;
+        }
+
+        uint32_t gen = list->commits[pos].generation;
+        while (depth > 0) {
+            graph_commit_t *c = &list->commits[stack[--depth]];
+            c->generation = ++gen;
+        }
+    }
+
+    free(stack);
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int commit_graph_write(gyatt_repo_t *repo, size_t *count) {
+    if (!repo) return -1;
+
+    graph_list_t list = {0};
+    if (collect_branches(repo, &list) != 0 || list.count > UINT32_MAX - 1 ||
+        assign_generations(&list) != 0) {
+        free(list.commits);
+        return -1;
+    }
+
+    buffer_t *buf = buffer_create(COMMIT_GRAPH_HEADER_SIZE + COMMIT_GRAPH_FANOUT_SIZE +
+                                  list.count * (HASH_SIZE + COMMIT_GRAPH_RECORD_SIZE) + HASH_SIZE);
+    if (!buf) {
+        free(list.commits);
+        return -1;
+    }
+
+    uint32_t version = COMMIT_GRAPH_VERSION;
+    uint32_t count32 = (uint32_t)list.count;
+    uint32_t reserved = 0;
+    buffer_append(buf, COMMIT_GRAPH_SIGNATURE, 4);
+    buffer_append(buf, &version, 4);
+    buffer_append(buf, &count32, 4);
+    buffer_append(buf, &reserved, 4);
+
+    size_t cursor = 0;
+    for (int b = 0; b < 256; b++) {
+        while (cursor < list.count && list.commits[cursor].hash.hash[0] == b) cursor++;
+        uint32_t n = (uint32_t)cursor;
+        buffer_append(buf, &n, 4);
+    }
+    for (size_t i = 0; i < list.count; i++) {
+        buffer_append(buf, list.commits[i].hash.hash, HASH_SIZE);
+    }
+    for (size_t i = 0; i < list.count; i++) {
+        graph_commit_t *c = &list.commits[i];
+        buffer_append(buf, c->tree.hash, HASH_SIZE);
+        buffer_append(buf, &c->parent_pos, 4);
+        buffer_append(buf, &c->generation, 4);
+        buffer_append(buf, &c->timestamp, 8);
+    }
+
+    gyatt_hash_t checksum;
+    sha1_hash(buf->data, buf->len, &checksum);
+    buffer_append(buf, checksum.hash, HASH_SIZE);
+    free(list.commits);
+
+    // Same lock-and-rename dance as the index
+    char path[PATH_MAX], lock_path[PATH_MAX];
+    if (graph_path(repo, path, sizeof(path)) != 0 ||
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", path) >= (int)sizeof(lock_path)) {
+        buffer_free(buf);
+        return -1;
+    }
+
+    int fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) fprintf(stderr, "Error: Unable to create '%s': File exists.\n", lock_path);
+        buffer_free(buf);
+        return -1;
+    }
+
+    int result = write_all(fd, buf->data, buf->len);
+    if (close(fd) != 0) result = -1;
+    if (result == 0 && rename(lock_path, path) != 0) result = -1;
+    if (result != 0) unlink(lock_path);
+    buffer_free(buf);
+
+    if (result == 0) {
+        commit_graph_free(repo->graph);
+        repo->graph = commit_graph_open(repo);
+        if (count) *count = count32;
+    }
+    return result;
+}
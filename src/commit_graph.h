@@ -0,0 +1,60 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "gyatt.h"
+#include <stdint.h>
+
+// .gyatt/commit-graph: what history walks need from every commit, in one
+// mmapped file, so they don't inflate and parse commit objects.
+//
+//   "CGPH" | version u32 | count u32 | reserved u32
+//   fanout[256] u32              (like a pack idx)
+//   count sorted commit hashes
+//   count records: tree hash | parent position u32 | generation u32 |
+//                  commit time i64
+//   SHA-1 of everything above
+//
+// Parent positions index the sorted hashes (COMMIT_GRAPH_NO_PARENT for a
+// root). A commit's generation is 1 + its parent's, roots being 1, so an
+// ancestor always has a smaller generation than its descendants.
+#define COMMIT_GRAPH_SIGNATURE "CGPH"
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_NO_PARENT 0xffffffffu
+
+typedef struct commit_graph commit_graph_t;
+
+// NULL if there is no graph (or it doesn't look right); callers then fall
+// back to reading commits
+commit_graph_t *commit_graph_open(const gyatt_repo_t *repo);
+void commit_graph_free(commit_graph_t *graph);
+
+// Rewrite the graph from every commit reachable from a branch, and swap
+// it into repo->graph. count (optional) gets the number of commits.
+int commit_graph_write(gyatt_repo_t *repo, size_t *count);
+
+// A commit as far as history walks care, straight from the graph when it
+// has the commit and parsed from the object otherwise
+typedef struct {
+    gyatt_hash_t hash;
+    gyatt_hash_t tree;
+    gyatt_hash_t parent;
+    int has_parent;
+    int64_t timestamp;
+    uint32_t generation;     // 0 when the commit isn't in the graph
+} commit_info_t;
+
+int commit_info_get(gyatt_repo_t *repo, const gyatt_hash_t *hash, commit_info_t *info);
+
+// Generation of any commit; ones missing from the graph are counted down
+// to the first one that isn't
+int commit_generation(gyatt_repo_t *repo, const gyatt_hash_t *hash, uint32_t *generation);
+
+// 0 and the base if a and b share history, 1 if they don't, -1 on error
+int commit_merge_base(gyatt_repo_t *repo, const gyatt_hash_t *a, const gyatt_hash_t *b,
+                      gyatt_hash_t *base);
+
+// 1 if ancestor is descendant or one of its ancestors, 0 if not, -1 on error
+int commit_is_ancestor(gyatt_repo_t *repo, const gyatt_hash_t *ancestor,
+                       const gyatt_hash_t *descendant);
+
+#endif // COMMIT_GRAPH_H
@@ -0,0 +1,281 @@
+#include "compress.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef GYATT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// The probe only looks at this much, and only blobs at least this big
+#define PROBE_MIN 1024
+#define PROBE_MAX (64 * 1024)
+
+// Collision entropy above 7.8 bits/byte means sum(p^2) <= 2^-7.8, about
+// 1/223: compressed and encrypted data sits at ~7.99, text at 4-5 and
+// executables at 5-6.5. Nothing that close to uniform deflates by more
+// than a few percent.
+#define PROBE_INV_COLLISION 223
+
+static const char *const codec_names[COMPRESS_CODEC_COUNT] = { "zlib", "zstd", "raw" };
+
+const char *compress_codec_name(compress_codec_t codec) {
+    return codec < COMPRESS_CODEC_COUNT ? codec_names[codec] : "unknown";
+}
+
+int compress_codec_parse(const char *name) {
+    for (int i = 0; i < COMPRESS_CODEC_COUNT; i++) {
+        if (strcmp(name, codec_names[i]) == 0) return i;
+    }
+    if (strcmp(name, "none") == 0) return COMPRESS_RAW;
+    return -1;
+}
+
+int compress_codec_available(compress_codec_t codec) {
+#ifdef GYATT_HAVE_ZSTD
+    return codec < COMPRESS_CODEC_COUNT;
+#else
+    return codec < COMPRESS_CODEC_COUNT && codec != COMPRESS_ZSTD;
+#endif
+}
+
+int compress_probe_incompressible(const void *data, size_t len) {
+    if (!data || len < PROBE_MIN) return 0;
+    if (len > PROBE_MAX) len = PROBE_MAX;
+
+    // Four histograms so neighbouring bytes don't fight over one counter
+    uint32_t counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    const unsigned char *p = data;
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        counts[0][p[i]]++;
+        counts[1][p[i + 1]]++;
+        counts[2][p[i + 2]]++;
+        counts[3][p[i + 3]]++;
+    }
+    for (; i < len; i++) counts[0][p[i]]++;
+
+    // sum(c * (c - 1)) / (n * (n - 1)) is an unbiased estimate of sum(p^2)
+    uint64_t pairs = 0;
+    for (int b = 0; b < 256; b++) {
+        uint64_t c = (uint64_t)counts[0][b] + counts[1][b] + counts[2][b] + counts[3][b];
+        pairs += c * (c > 0 ? c - 1 : 0);
+    }
+    return pairs * PROBE_INV_COLLISION <= (uint64_t)len * (len - 1);
+}
+
+void compress_choose(const gyatt_config_t *config, object_type_t type,
+                     const void *sample, size_t sample_len,
+                     compress_codec_t *codec, int *level) {
+    compress_codec_t chosen = COMPRESS_ZLIB;
+    int lvl = Z_DEFAULT_COMPRESSION;
+    if (config) {
+        if (config->compression_codec >= 0 && compress_codec_available(config->compression_codec)) {
+            chosen = (compress_codec_t)config->compression_codec;
+        }
+        lvl = config->compression_level;
+        int per_type = type == OBJ_BLOB ? config->blob_compression :
+                       type == OBJ_COMMIT ? config->commit_compression : config->tree_compression;
+        if (per_type != COMPRESSION_INHERIT) lvl = per_type;
+    }
+
+    if (lvl == 0 || (type == OBJ_BLOB && compress_probe_incompressible(sample, sample_len))) {
+        chosen = COMPRESS_RAW;
+    }
+
+    if (chosen == COMPRESS_ZLIB && (lvl < Z_DEFAULT_COMPRESSION || lvl > Z_BEST_COMPRESSION)) {
+        lvl = lvl > Z_BEST_COMPRESSION ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION;
+    }
+
+    *codec = chosen;
+    *level = chosen == COMPRESS_RAW ? 0 : lvl;
+}
+
+compress_codec_t compress_sniff(const unsigned char *data, size_t len) {
+    if (len >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd) {
+        return COMPRESS_ZSTD;
+    }
+    // CMF says deflate and CMF|FLG is a multiple of 31 (RFC 1950)
+    if (len >= 2 && (data[0] & 0x0f) == Z_DEFLATED && (((unsigned)data[0] << 8) | data[1]) % 31 == 0) {
+        return COMPRESS_ZLIB;
+    }
+    return COMPRESS_RAW;
+}
+
+// ==================== Compression ====================
+
+int compressor_init(compressor_t *c, compress_codec_t codec, int level) {
+    memset(c, 0, sizeof(*c));
+    c->codec = codec;
+    c->started = 1;
+
+    switch (codec) {
+    case COMPRESS_ZLIB:
+        return deflateInit(&c->zs, level) == Z_OK ? 0 : -1;
+    case COMPRESS_ZSTD:
+#ifdef GYATT_HAVE_ZSTD
+        c->zstd = ZSTD_createCCtx();
+        if (!c->zstd) return -1;
+        if (ZSTD_isError(ZSTD_CCtx_setParameter(c->zstd, ZSTD_c_compressionLevel, level))) {
+            ZSTD_freeCCtx(c->zstd);
+            c->zstd = NULL;
+            return -1;
+        }
+        return 0;
+#else
+        return -1;
+#endif
+    case COMPRESS_RAW:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static void copy_through(const unsigned char **in, size_t *in_len, unsigned char **out, size_t *out_len) {
+    size_t n = *in_len < *out_len ? *in_len : *out_len;
+    if (n == 0) return;
+    memcpy(*out, *in, n);
+    *in += n;
+    *in_len -= n;
+    *out += n;
+    *out_len -= n;
+}
+
+int compressor_run(compressor_t *c, const unsigned char **in, size_t *in_len,
+                   unsigned char **out, size_t *out_len, int finish) {
+    if (c->codec == COMPRESS_RAW) {
+        copy_through(in, in_len, out, out_len);
+        return finish && *in_len == 0 ? 1 : 0;
+    }
+
+#ifdef GYATT_HAVE_ZSTD
+    if (c->codec == COMPRESS_ZSTD) {
+        ZSTD_inBuffer ib = { *in, *in_len, 0 };
+        ZSTD_outBuffer ob = { *out, *out_len, 0 };
+        size_t left = ZSTD_compressStream2(c->zstd, &ob, &ib, finish ? ZSTD_e_end : ZSTD_e_continue);
+        *in += ib.pos;
+        *in_len -= ib.pos;
+        *out += ob.pos;
+        *out_len -= ob.pos;
+        if (ZSTD_isError(left)) return -1;
+        return finish && left == 0 ? 1 : 0;
+    }
+#endif
+    if (c->codec != COMPRESS_ZLIB) return -1;
+
+    // avail_in/avail_out are uInts, so huge buffers go through in slices
+    uInt in_slice = *in_len > UINT_MAX ? UINT_MAX : (uInt)*in_len;
+    uInt out_slice = *out_len > UINT_MAX ? UINT_MAX : (uInt)*out_len;
+    c->zs.next_in = (Bytef *)*in;
+    c->zs.avail_in = in_slice;
+    c->zs.next_out = *out;
+    c->zs.avail_out = out_slice;
+
+    int ret = deflate(&c->zs, finish && in_slice == *in_len ? Z_FINISH : Z_NO_FLUSH);
+    *in += in_slice - c->zs.avail_in;
+    *in_len -= in_slice - c->zs.avail_in;
+    *out += out_slice - c->zs.avail_out;
+    *out_len -= out_slice - c->zs.avail_out;
+
+    if (ret == Z_STREAM_END) return 1;
+    return ret == Z_STREAM_ERROR ? -1 : 0;
+}
+
+void compressor_end(compressor_t *c) {
+    if (!c->started) return;
+    if (c->codec == COMPRESS_ZLIB) deflateEnd(&c->zs);
+#ifdef GYATT_HAVE_ZSTD
+    if (c->zstd) ZSTD_freeCCtx(c->zstd);
+#endif
+    c->zstd = NULL;
+    c->started = 0;
+}
+
+// ==================== Decompression ====================
+
+static int decoder_start(decompressor_t *d, compress_codec_t codec) {
+    d->codec = codec;
+    switch (codec) {
+    case COMPRESS_ZLIB:
+        if (inflateInit(&d->zs) != Z_OK) return -1;
+        break;
+    case COMPRESS_ZSTD:
+#ifdef GYATT_HAVE_ZSTD
+        d->zstd = ZSTD_createDCtx();
+        if (!d->zstd) return -1;
+        break;
+#else
+        fprintf(stderr, "Error: Object is zstd-compressed, but gyatt was built without zstd (make ZSTD=1)\n");
+        return -1;
+#endif
+    case COMPRESS_RAW:
+        break;
+    default:
+        return -1;
+    }
+    d->started = 1;
+    return 0;
+}
+
+int decompressor_init(decompressor_t *d, int codec) {
+    memset(d, 0, sizeof(*d));
+    if (codec == COMPRESS_DETECT) return 0;  // Once the first bytes are in
+    return decoder_start(d, (compress_codec_t)codec);
+}
+
+int decompressor_run(decompressor_t *d, const unsigned char **in, size_t *in_len,
+                     unsigned char **out, size_t *out_len) {
+    if (!d->started) {
+        if (*in_len == 0) return 0;
+        if (decoder_start(d, compress_sniff(*in, *in_len)) != 0) return -1;
+    }
+
+    if (d->codec == COMPRESS_RAW) {
+        copy_through(in, in_len, out, out_len);
+        return 0;
+    }
+
+#ifdef GYATT_HAVE_ZSTD
+    if (d->codec == COMPRESS_ZSTD) {
+        ZSTD_inBuffer ib = { *in, *in_len, 0 };
+        ZSTD_outBuffer ob = { *out, *out_len, 0 };
+        size_t left = ZSTD_decompressStream(d->zstd, &ob, &ib);
+        *in += ib.pos;
+        *in_len -= ib.pos;
+        *out += ob.pos;
+        *out_len -= ob.pos;
+        if (ZSTD_isError(left)) return -1;
+        return left == 0 ? 1 : 0;
+    }
+#endif
+    if (d->codec != COMPRESS_ZLIB) return -1;
+
+    uInt in_slice = *in_len > UINT_MAX ? UINT_MAX : (uInt)*in_len;
+    uInt out_slice = *out_len > UINT_MAX ? UINT_MAX : (uInt)*out_len;
+    d->zs.next_in = (Bytef *)*in;
+    d->zs.avail_in = in_slice;
+    d->zs.next_out = *out;
+    d->zs.avail_out = out_slice;
+
+    int ret = inflate(&d->zs, Z_NO_FLUSH);
+    *in += in_slice - d->zs.avail_in;
+    *in_len -= in_slice - d->zs.avail_in;
+    *out += out_slice - d->zs.avail_out;
+    *out_len -= out_slice - d->zs.avail_out;
+
+    if (ret == Z_STREAM_END) return 1;
+    return ret == Z_OK || ret == Z_BUF_ERROR ? 0 : -1;
+}
+
+void decompressor_end(decompressor_t *d) {
+    if (!d->started) return;
+    if (d->codec == COMPRESS_ZLIB) inflateEnd(&d->zs);
+#ifdef GYATT_HAVE_ZSTD
+    if (d->zstd) ZSTD_freeDCtx(d->zstd);
+#endif
+    d->zstd = NULL;
+    d->started = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "gyatt.h"
+#include <stddef.h>
+#include <zlib.h>
+
+// Codecs for stored objects. zlib is always there; zstd only in builds
+// made with ZSTD=1, but every build can at least tell a zstd object apart
+// and say so. Raw is for data that doesn't compress - it's copied as is.
+//
+// A loose object file names its codec with its first bytes: zlib's
+// two-byte header, zstd's frame magic, or for raw the plain "type size\0"
+// object header (whose first byte is never a valid zlib header). Pack
+// entries carry it in their kind byte, see pack.h.
+typedef enum {
+    COMPRESS_ZLIB = 0,
+    COMPRESS_ZSTD = 1,
+    COMPRESS_RAW = 2,
+    COMPRESS_CODEC_COUNT
+} compress_codec_t;
+
+// For decompressor_init(): work the codec out from the stream
+#define COMPRESS_DETECT (-1)
+
+const char *compress_codec_name(compress_codec_t codec);
+int compress_codec_parse(const char *name);          // -1 if unknown
+int compress_codec_available(compress_codec_t codec);
+
+// How to store an object of this type, given the start of its payload.
+// Blobs whose sample looks like noise (already compressed, encrypted)
+// are stored raw instead of burning CPU on deflate for nothing.
+void compress_choose(const gyatt_config_t *config, object_type_t type,
+                     const void *sample, size_t sample_len,
+                     compress_codec_t *codec, int *level);
+
+// Whether data looks incompressible: estimates its order-0 collision
+// entropy from a byte histogram. Short samples never do.
+int compress_probe_incompressible(const void *data, size_t len);
+
+typedef struct {
+    compress_codec_t codec;
+    z_stream zs;
+    void *zstd;                // ZSTD_CCtx / ZSTD_DCtx
+    int started;               // Decoder: codec known and set up
+} compress_stream_t;
+
+typedef compress_stream_t compressor_t;
+typedef compress_stream_t decompressor_t;
+
+// Both run like zlib: consume from *in and produce into *out, advancing
+// the pointers and shrinking the lengths. Call again while the output
+// fills up.
+
+// Returns 1 once finish is set and the stream is complete, 0 if it wants
+// more input or output room, -1 on error
+int compressor_init(compressor_t *c, compress_codec_t codec, int level);
+int compressor_run(compressor_t *c, const unsigned char **in, size_t *in_len,
+                   unsigned char **out, size_t *out_len, int finish);
+void compressor_end(compressor_t *c);
+
+// Returns 1 at the end of the stream, 0 if it wants more input or output
+// room, -1 on corrupt data. Raw streams have no end marker: they end
+// where the caller's sizes say they do.
+int decompressor_init(decompressor_t *d, int codec);
+int decompressor_run(decompressor_t *d, const unsigned char **in, size_t *in_len,
+                     unsigned char **out, size_t *out_len);
+void decompressor_end(decompressor_t *d);
+
+// What a stream starting with these bytes was written with
+compress_codec_t compress_sniff(const unsigned char *data, size_t len);
+
+#endif // COMPRESS_H
@@ -0,0 +1,197 @@
+#include "gyatt.h"
+#include "utils.h"
+#include "buffer.h"
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// .gyatt/config is a tiny INI file:
+//
+//   [core]
+//       compression = 6
+//       codec = zlib
+//       blobcompression = 1
+//       chunkthreshold = 0
+//       threads = 0
+//       objectcache = 32
+//   [server]
+//       maxconnections = 256
+//       backlog = 128
+//       clientbuffer = 1024
+//   [ipfs]
+//       inflight = 16
+//   [user]
+//       name = Your Name
+//       email = you@example.com
+
+void config_defaults(gyatt_config_t *config) {
+    memset(config, 0, sizeof(gyatt_config_t));
+    strcpy(config->user_name, "Gyatt User");
+    strcpy(config->user_email, "user@gyatt.local");
+    config->compression_level = 6;
+    config->compression_codec = COMPRESS_ZLIB;
+    config->blob_compression = COMPRESSION_INHERIT;
+    config->tree_compression = COMPRESSION_INHERIT;
+    config->commit_compression = COMPRESSION_INHERIT;
+    config->threads = 0;
+    config->object_cache_mb = 32;
+    config->server_max_connections = 256;
+    config->server_backlog = 128;
+    config->server_buffer_kb = 1024;
+    config->ipfs_in_flight = 16;
+}
+
+static void config_set(gyatt_config_t *config, const char *section,
+                       const char *key, const char *value) {
+    if (strcmp(section, "core") == 0) {
+        if (strcmp(key, "compression") == 0) {
+            config->compression_level = atoi(value);
+        } else if (strcmp(key, "codec") == 0) {
+            int codec = compress_codec_parse(value);
+            if (codec < 0 || !compress_codec_available((compress_codec_t)codec)) {
+                fprintf(stderr, "Warning: Compression codec '%s' isn't available, using zlib\n", value);
+                codec = COMPRESS_ZLIB;
+            }
+            config->compression_codec = codec;
+        } else if (strcmp(key, "blobcompression") == 0) {
+            config->blob_compression = atoi(value);
+        } else if (strcmp(key, "treecompression") == 0) {
+            config->tree_compression = atoi(value);
+        } else if (strcmp(key, "commitcompression") == 0) {
+            config->commit_compression = atoi(value);
+        } else if (strcmp(key, "chunkthreshold") == 0) {
+            config->chunk_threshold_mb = atoi(value);
+        } else if (strcmp(key, "threads") == 0) {
+            config->threads = atoi(value);
+        } else if (strcmp(key, "objectcache") == 0) {
+            config->object_cache_mb = atoi(value);
+        }
+    } else if (strcmp(section, "server") == 0) {
+        if (strcmp(key, "maxconnections") == 0) {
+            config->server_max_connections = atoi(value);
+        } else if (strcmp(key, "backlog") == 0) {
+            config->server_backlog = atoi(value);
+        } else if (strcmp(key, "clientbuffer") == 0) {
+            config->server_buffer_kb = atoi(value);
+        }
+    } else if (strcmp(section, "ipfs") == 0) {
+        if (strcmp(key, "inflight") == 0) {
+            config->ipfs_in_flight = atoi(value);
+        }
+    } else if (strcmp(section, "user") == 0) {
+        if (strcmp(key, "name") == 0) {
+            strncpy(config->user_name, value, sizeof(config->user_name) - 1);
+            config->user_name[sizeof(config->user_name) - 1] = '\0';
+        } else if (strcmp(key, "email") == 0) {
+            strncpy(config->user_email, value, sizeof(config->user_email) - 1);
+            config->user_email[sizeof(config->user_email) - 1] = '\0';
+        }
+    }
+}
+
+int config_read(const gyatt_repo_t *repo, gyatt_config_t *config) {
+    if (!repo || !config) return -1;
+
+    config_defaults(config);
+
+    char *config_path = path_join(repo->gyatt_dir, "config");
+    if (!config_path) return -1;
+
+    char *content = read_file(config_path, NULL);
+    free(config_path);
+    if (!content) return -1;
+
+    char section[64] = "";
+    char *line = content;
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        str_trim(line);
+        if (line[0] == '\0' || line[0] == '#' || line[0] == ';') {
+            // Blank or comment
+        } else if (line[0] == '[') {
+            char *end = strchr(line, ']');
+            if (end) {
+                *end = '\0';
+                strncpy(section, line + 1, sizeof(section) - 1);
+                section[sizeof(section) - 1] = '\0';
+                str_trim(section);
+            }
+        } else {
+            char *eq = strchr(line, '=');
+            if (eq) {
+                *eq = '\0';
+                char *key = line;
+                char *value = eq + 1;
+                str_trim(key);
+                str_trim(value);
+                config_set(config, section, key, value);
+            }
+        }
+
+        line = next;
+    }
+
+    free(content);
+    return 0;
+}
+
+int config_write(const gyatt_repo_t *repo, const gyatt_config_t *config) {
+    if (!repo || !config) return -1;
+
+    buffer_t *buf = buffer_create(512);
+    buffer_append_str(buf, "[core]\n");
+    buffer_append_str(buf, "\tcompression = ");
+    buffer_append_int(buf, config->compression_level);
+    buffer_append_str(buf, "\n\tcodec = ");
+    buffer_append_str(buf, compress_codec_name((compress_codec_t)config->compression_codec));
+    const int levels[] = { config->blob_compression, config->tree_compression, config->commit_compression };
+    const char *const keys[] = { "blobcompression", "treecompression", "commitcompression" };
+    for (int i = 0; i < 3; i++) {
+        if (levels[i] == COMPRESSION_INHERIT) continue;
+        buffer_append_str(buf, "\n\t");
+        buffer_append_str(buf, keys[i]);
+        buffer_append_str(buf, " = ");
+        buffer_append_int(buf, levels[i]);
+    }
+    buffer_append_str(buf, "\n\tchunkthreshold = ");
+    buffer_append_int(buf, config->chunk_threshold_mb);
+    buffer_append_str(buf, "\n\tthreads = ");
+    buffer_append_int(buf, config->threads);
+    buffer_append_str(buf, "\n\tobjectcache = ");
+    buffer_append_int(buf, config->object_cache_mb);
+    buffer_append_str(buf, "\n\n[server]\n");
+    buffer_append_str(buf, "\tmaxconnections = ");
+    buffer_append_int(buf, config->server_max_connections);
+    buffer_append_str(buf, "\n\tbacklog = ");
+    buffer_append_int(buf, config->server_backlog);
+    buffer_append_str(buf, "\n\tclientbuffer = ");
+    buffer_append_int(buf, config->server_buffer_kb);
+    buffer_append_str(buf, "\n\n[ipfs]\n");
+    buffer_append_str(buf, "\tinflight = ");
+    buffer_append_int(buf, config->ipfs_in_flight);
+    buffer_append_str(buf, "\n\n[user]\n");
+    buffer_append_str(buf, "\tname = ");
+    buffer_append_str(buf, config->user_name);
+    buffer_append_str(buf, "\n\temail = ");
+    buffer_append_str(buf, config->user_email);
+    buffer_append_char(buf, '\n');
+
+    char *config_path = path_join(repo->gyatt_dir, "config");
+    int result = config_path ? write_file(config_path, buf->data, buf->len) : -1;
+
+    free(config_path);
+    buffer_free(buf);
+    return result;
+}
+
+// Resolve the "threads" knob: 0 (or negative) means one per online CPU
+int config_thread_count(const gyatt_config_t *config) {
+    if (config && config->threads > 0) return config->threads;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
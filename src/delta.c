@@ -0,0 +1,276 @@
+#include "delta.h"
+#include "buffer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Matches are found by hashing DELTA_WINDOW-byte blocks of the base and
+// rolling the same hash along the target
+#define DELTA_WINDOW 16
+#define DELTA_HASH_MULT 0x01000193u
+#define DELTA_MAX_CANDIDATES 16
+#define DELTA_MAX_COPY 0xffffffu
+#define DELTA_MAX_INSERT 127
+
+struct delta_index {
+    const unsigned char *base;
+    size_t base_size;
+    uint32_t mask;
+    int32_t *buckets;    // Head of each chain, -1 if empty
+    int32_t *next;       // Per indexed block
+    uint32_t *offsets;   // Per indexed block
+};
+
+static uint32_t block_hash(const unsigned char *p) {
+    uint32_t h = 0;
+    for (int i = 0; i < DELTA_WINDOW; i++) {
+        h = h * DELTA_HASH_MULT + p[i];
+    }
+    return h;
+}
+
+// DELTA_HASH_MULT^(DELTA_WINDOW - 1), for dropping the oldest byte
+static uint32_t window_power(void) {
+    uint32_t pw = 1;
+    for (int i = 0; i < DELTA_WINDOW - 1; i++) pw *= DELTA_HASH_MULT;
+    return pw;
+}
+
+delta_index_t *delta_index_create(const void *base, size_t base_size) {
+    // Copy offsets are 32-bit
+    if (!base || base_size < DELTA_WINDOW || base_size > UINT32_MAX) return NULL;
+
+    delta_index_t *index = calloc(1, sizeof(delta_index_t));
+    if (!index) return NULL;
+
+    size_t blocks = base_size / DELTA_WINDOW;
+    size_t bucket_count = 16;
+    while (bucket_count < blocks / 2 && bucket_count < ((size_t)1 << 30)) bucket_count <<= 1;
+
+    index->base = base;
+    index->base_size = base_size;
+    index->mask = (uint32_t)(bucket_count - 1);
+    index->buckets = malloc(bucket_count * sizeof(int32_t));
+    index->next = malloc(blocks * sizeof(int32_t));
+    index->offsets = malloc(blocks * sizeof(uint32_t));
+    if (!index->buckets || !index->next || !index->offsets || blocks > INT32_MAX) {
+        delta_index_free(index);
+        return NULL;
+    }
+    memset(index->buckets, 0xff, bucket_count * sizeof(int32_t));
+
+    // Insert back to front so chains list earlier offsets first
+    for (size_t b = blocks; b-- > 0;) {
+        uint32_t offset = (uint32_t)(b * DELTA_WINDOW);
+        uint32_t bucket = block_hash(index->base + offset) & index->mask;
+        index->offsets[b] = offset;
+        index->next[b] = index->buckets[bucket];
+        index->buckets[bucket] = (int32_t)b;
+    }
+
+    return index;
+}
+
+void delta_index_free(delta_index_t *index) {
+    if (!index) return;
+    free(index->buckets);
+    free(index->next);
+    free(index->offsets);
+    free(index);
+}
+
+static void append_varint(buffer_t *buf, size_t value) {
+    do {
+        char byte = value & 0x7f;
+        value >>= 7;
+        if (value) byte |= (char)0x80;
+        buffer_append_char(buf, byte);
+    } while (value);
+}
+
+static void append_insert(buffer_t *buf, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        size_t n = len > DELTA_MAX_INSERT ? DELTA_MAX_INSERT : len;
+        buffer_append_char(buf, (char)n);
+        buffer_append(buf, data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static void append_copy(buffer_t *buf, uint32_t offset, size_t len) {
+    while (len > 0) {
+        uint32_t size = len > DELTA_MAX_COPY ? DELTA_MAX_COPY : (uint32_t)len;
+        unsigned char op[8];
+        size_t n = 1;
+        op[0] = 0x80;
+
+        for (int k = 0; k < 4; k++) {
+            unsigned char byte = (offset >> (8 * k)) & 0xff;
+            if (byte) {
+                op[0] |= 1 << k;
+                op[n++] = byte;
+            }
+        }
+        // A size of exactly 0x10000 is encoded as no size bytes at all
+        if (size != 0x10000) {
+            for (int k = 0; k < 3; k++) {
+                unsigned char byte = (size >> (8 * k)) & 0xff;
+                if (byte) {
+                    op[0] |= 0x10 << k;
+                    op[n++] = byte;
+                }
+            }
+        }
+
+        buffer_append(buf, op, n);
+        offset += size;
+        len -= size;
+    }
+}
+
+void *delta_create(const delta_index_t *index, const void *target, size_t target_size,
+                   size_t max_size, size_t *delta_size) {
+    if (!index || !target) return NULL;
+
+    const unsigned char *t = target;
+    const unsigned char *b = index->base;
+    buffer_t *out = buffer_create(target_size / 8 + 64);
+    if (!out) return NULL;
+
+    append_varint(out, index->base_size);
+    append_varint(out, target_size);
+
+    uint32_t pw = window_power();
+    size_t i = 0;
+    size_t literal_start = 0;
+    uint32_t h = target_size >= DELTA_WINDOW ? block_hash(t) : 0;
+
+    while (i + DELTA_WINDOW <= target_size) {
+        size_t best_len = 0;
+        uint32_t best_offset = 0;
+
+        int tries = 0;
+        for (int32_t e = index->buckets[h & index->mask]; e >= 0 && tries < DELTA_MAX_CANDIDATES;
+             e = index->next[e], tries++) {
+            uint32_t offset = index->offsets[e];
+            size_t limit = target_size - i;
+            if (index->base_size - offset < limit) limit = index->base_size - offset;
+
+            size_t len = 0;
+            while (len < limit && t[i + len] == b[offset + len]) len++;
+            if (len > best_len) {
+                best_len = len;
+                best_offset = offset;
+            }
+        }
+
+        if (best_len >= DELTA_WINDOW) {
+            // Grow the match backwards over bytes we were about to insert
+            while (best_offset > 0 && i > literal_start && t[i - 1] == b[best_offset - 1]) {
+                i--;
+                best_offset--;
+                best_len++;
+            }
+
+            append_insert(out, t + literal_start, i - literal_start);
+            append_copy(out, best_offset, best_len);
+
+            i += best_len;
+            literal_start = i;
+            if (i + DELTA_WINDOW <= target_size) h = block_hash(t + i);
+        } else {
+            if (i + DELTA_WINDOW < target_size) {
+                h = (h - t[i] * pw) * DELTA_HASH_MULT + t[i + DELTA_WINDOW];
+            }
+            i++;
+        }
+
+        // Pending literals will cost at least their own size
+        if (max_size && out->len + (i - literal_start) > max_size) {
+            buffer_free(out);
+            return NULL;
+        }
+    }
+
+    append_insert(out, t + literal_start, target_size - literal_start);
+
+    if (max_size && out->len > max_size) {
+        buffer_free(out);
+        return NULL;
+    }
+
+    void *delta = buffer_detach(out, delta_size);
+    buffer_free(out);
+    return delta;
+}
+
+static int read_varint(const unsigned char **p, const unsigned char *end, size_t *value) {
+    size_t v = 0;
+    int shift = 0;
+    for (;;) {
+        if (*p >= end || shift > 63) return -1;
+        unsigned char byte = *(*p)++;
+        v |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+        shift += 7;
+    }
+    *value = v;
+    return 0;
+}
+
+void *delta_apply(const void *base, size_t base_size, const void *delta, size_t delta_size,
+                  size_t *out_size) {
+    const unsigned char *p = delta;
+    const unsigned char *end = p + delta_size;
+
+    size_t expected_base, target_size;
+    if (read_varint(&p, end, &expected_base) != 0 || expected_base != base_size ||
+        read_varint(&p, end, &target_size) != 0 || target_size == SIZE_MAX) {
+        return NULL;
+    }
+
+    unsigned char *out = malloc(target_size + 1);
+    if (!out) return NULL;
+
+    size_t pos = 0;
+    while (p < end) {
+        unsigned char op = *p++;
+
+        if (op & 0x80) {
+            // One argument byte per set bit in the low seven
+            int arg_bytes = 0;
+            for (int k = 0; k < 7; k++) arg_bytes += (op >> k) & 1;
+            if (arg_bytes > end - p) break;
+
+            size_t offset = 0, size = 0;
+            for (int k = 0; k < 4; k++) {
+                if (op & (1 << k)) offset |= (size_t)*p++ << (8 * k);
+            }
+            for (int k = 0; k < 3; k++) {
+                if (op & (0x10 << k)) size |= (size_t)*p++ << (8 * k);
+            }
+            if (size == 0) size = 0x10000;
+
+            if (offset > base_size || size > base_size - offset || size > target_size - pos) break;
+            memcpy(out + pos, (const unsigned char *)base + offset, size);
+            pos += size;
+        } else if (op) {
+            if (op > end - p || op > target_size - pos) break;
+            memcpy(out + pos, p, op);
+            p += op;
+            pos += op;
+        } else {
+            break;  // Opcode 0 is reserved
+        }
+    }
+
+    if (p != end || pos != target_size) {
+        free(out);
+        return NULL;
+    }
+
+    out[target_size] = '\0';
+    if (out_size) *out_size = target_size;
+    return out;
+}
@@ -0,0 +1,33 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+
+// Copy/insert deltas, in the same spirit as git's:
+//
+//   varint base_size | varint target_size | ops...
+//   copy:   1xxxxxxx [offset bytes] [size bytes]   (bits 0-3: which of
+//           the 4 offset bytes follow, bits 4-6: which of the 3 size
+//           bytes follow; a size of 0 means 0x10000)
+//   insert: 0nnnnnnn followed by n literal bytes (n = 1..127)
+//
+// Varints are little-endian base-128.
+
+typedef struct delta_index delta_index_t;
+
+// Index a base buffer once so many targets can be diffed against it. The
+// base has to stay alive and unchanged for the life of the index.
+delta_index_t *delta_index_create(const void *base, size_t base_size);
+void delta_index_free(delta_index_t *index);
+
+// Returns a malloc'd delta turning base into target, or NULL if it would
+// come out larger than max_size (0 = no limit)
+void *delta_create(const delta_index_t *index, const void *target, size_t target_size,
+                   size_t max_size, size_t *delta_size);
+
+// Rebuild the target; NULL if the delta is malformed or doesn't fit base.
+// The result is NUL-terminated (not counted in out_size).
+void *delta_apply(const void *base, size_t base_size, const void *delta, size_t delta_size,
+                  size_t *out_size);
+
+#endif // DELTA_H
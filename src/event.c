@@ -0,0 +1,139 @@
+#include "event.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+    #include <sys/epoll.h>
+    #define EVENT_USE_EPOLL 1
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    #include <sys/types.h>
+    #include <sys/event.h>
+    #include <sys/time.h>
+    #define EVENT_USE_KQUEUE 1
+#else
+    #error "event.c needs epoll or kqueue"
+#endif
+
+// Most events one wait call pulls from the kernel
+#define EVENT_BATCH 256
+
+struct event_loop {
+    int fd;
+};
+
+event_loop_t *event_loop_create(void) {
+    event_loop_t *loop = malloc(sizeof(event_loop_t));
+    if (!loop) return NULL;
+
+#ifdef EVENT_USE_EPOLL
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    loop->fd = kqueue();
+#endif
+    if (loop->fd < 0) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    if (!loop) return;
+    close(loop->fd);
+    free(loop);
+}
+
+#ifdef EVENT_USE_EPOLL
+
+static int epoll_update(event_loop_t *loop, int op, int fd, int events, void *data) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (events & EVENT_READ) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & EVENT_WRITE) ev.events |= EPOLLOUT;
+    ev.data.ptr = data;
+    return epoll_ctl(loop->fd, op, fd, &ev);
+}
+
+int event_add(event_loop_t *loop, int fd, int events, void *data) {
+    return epoll_update(loop, EPOLL_CTL_ADD, fd, events, data);
+}
+
+int event_modify(event_loop_t *loop, int fd, int events, void *data) {
+    return epoll_update(loop, EPOLL_CTL_MOD, fd, events, data);
+}
+
+int event_remove(event_loop_t *loop, int fd) {
+    struct epoll_event ev;  // Ignored, but old kernels want it non-NULL
+    return epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int event_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_ms) {
+    struct epoll_event ready[EVENT_BATCH];
+    if (max_events > EVENT_BATCH) max_events = EVENT_BATCH;
+
+    int n = epoll_wait(loop->fd, ready, max_events, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; i++) {
+        int bits = 0;
+        if (ready[i].events & (EPOLLIN | EPOLLRDHUP)) bits |= EVENT_READ;
+        if (ready[i].events & EPOLLOUT) bits |= EVENT_WRITE;
+        if (ready[i].events & (EPOLLERR | EPOLLHUP)) bits |= EVENT_ERROR;
+        events[i].events = bits;
+        events[i].data = ready[i].data.ptr;
+    }
+    return n;
+}
+
+#else // EVENT_USE_KQUEUE
+
+// kqueue watches read and write as two separate filters; both are always
+// registered and just switched on or off
+static int kqueue_update(event_loop_t *loop, int fd, int events, void *data, int flags) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, flags | ((events & EVENT_READ) ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, flags | ((events & EVENT_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+    return kevent(loop->fd, changes, 2, NULL, 0, NULL) < 0 ? -1 : 0;
+}
+
+int event_add(event_loop_t *loop, int fd, int events, void *data) {
+    return kqueue_update(loop, fd, events, data, EV_ADD);
+}
+
+int event_modify(event_loop_t *loop, int fd, int events, void *data) {
+    return kqueue_update(loop, fd, events, data, EV_ADD);
+}
+
+int event_remove(event_loop_t *loop, int fd) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    return kevent(loop->fd, changes, 2, NULL, 0, NULL) < 0 ? -1 : 0;
+}
+
+int event_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_ms) {
+    struct kevent ready[EVENT_BATCH];
+    if (max_events > EVENT_BATCH) max_events = EVENT_BATCH;
+
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+
+    int n = kevent(loop->fd, NULL, 0, ready, max_events, tsp);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; i++) {
+        int bits = ready[i].filter == EVFILT_WRITE ? EVENT_WRITE : EVENT_READ;
+        if (ready[i].flags & (EV_EOF | EV_ERROR)) bits |= EVENT_ERROR;
+        events[i].events = bits;
+        events[i].data = ready[i].udata;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+// Readiness notification for many non-blocking sockets at once: epoll on
+// Linux, kqueue on the BSDs and macOS. Level-triggered on both, so a
+// caller that doesn't drain a socket just hears about it again.
+
+#define EVENT_READ  1
+#define EVENT_WRITE 2
+#define EVENT_ERROR 4   // Hangup or socket error; only ever reported
+
+typedef struct event_loop event_loop_t;
+
+typedef struct {
+    int events;     // EVENT_* bits that are ready
+    void *data;     // Whatever was registered with the fd
+} event_t;
+
+event_loop_t *event_loop_create(void);
+void event_loop_free(event_loop_t *loop);
+
+// events is the set of EVENT_READ/EVENT_WRITE to watch; modify replaces it
+int event_add(event_loop_t *loop, int fd, int events, void *data);
+int event_modify(event_loop_t *loop, int fd, int events, void *data);
+int event_remove(event_loop_t *loop, int fd);
+
+// Wait up to timeout_ms (-1 = forever). Returns how many events were
+// filled in, 0 on timeout or a signal, -1 on error.
+int event_wait(event_loop_t *loop, event_t *events, int max_events, int timeout_ms);
+
+#endif // EVENT_H
@@ -0,0 +1,581 @@
+#include "fsmonitor.h"
+#include "buffer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+#endif
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// Past this many logged changes the history is dropped, and anyone asking
+// about a point before that gets told to scan everything
+#define FSMONITOR_LOG_MAX (1 << 20)
+#define FSMONITOR_TIMEOUT_SEC 2
+
+static int fsmonitor_address(gyatt_repo_t *repo, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", repo->gyatt_dir, FSMONITOR_SOCKET);
+    return (n > 0 && (size_t)n < sizeof(addr->sun_path)) ? 0 : -1;
+}
+
+static void set_timeouts(int fd) {
+    struct timeval tv = { FSMONITOR_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int fsmonitor_connect(gyatt_repo_t *repo) {
+    struct sockaddr_un addr;
+    if (fsmonitor_address(repo, &addr) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = send(fd, ptr, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        ptr += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// The whole answer to one request; NULL if there's no daemon or it
+// didn't finish answering
+static buffer_t *fsmonitor_request(gyatt_repo_t *repo, const char *request) {
+    int fd = fsmonitor_connect(repo);
+    if (fd < 0) return NULL;
+
+    buffer_t *reply = NULL;
+    if (send_all(fd, request, strlen(request) + 1) == 0) {
+        reply = buffer_create(4096);
+        char chunk[16384];
+        for (;;) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                buffer_free(reply);
+                reply = NULL;
+                break;
+            }
+            if (n == 0) break;
+            buffer_append(reply, chunk, (size_t)n);
+        }
+    }
+    close(fd);
+
+    // Every record ends in a NUL; anything else was cut off
+    if (reply && (reply->len == 0 || reply->data[reply->len - 1] != '\0')) {
+        buffer_free(reply);
+        reply = NULL;
+    }
+    return reply;
+}
+
+int fsmonitor_is_running(gyatt_repo_t *repo) {
+    int fd = fsmonitor_connect(repo);
+    if (fd < 0) return 0;
+    close(fd);
+    return 1;
+}
+
+int fsmonitor_stop(gyatt_repo_t *repo) {
+    buffer_t *reply = fsmonitor_request(repo, "quit");
+    if (!reply) return -1;
+    buffer_free(reply);
+    return 0;
+}
+
+// ==================== Views ====================
+
+static int path_compare(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Only ever relative paths inside the tree
+static int path_is_inside(const char *path) {
+    if (!*path || path[0] == '/') return 0;
+    for (const char *seg = path; seg; seg = strchr(seg, '/') ? strchr(seg, '/') + 1 : NULL) {
+        if (seg[0] == '.' && seg[1] == '.' && (seg[2] == '/' || seg[2] == '\0')) return 0;
+    }
+    return 1;
+}
+
+static int view_add(fsmonitor_view_t *view, size_t *capacity, const char *path) {
+    if (!path_is_inside(path)) return 0;
+
+    if (view->changed_count >= *capacity) {
+        size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        char **changed = realloc(view->changed, new_capacity * sizeof(char *));
+        if (!changed) return -1;
+        view->changed = changed;
+        *capacity = new_capacity;
+    }
+    char *copy = str_duplicate(path);
+    if (!copy) return -1;
+    view->changed[view->changed_count++] = copy;
+    return 0;
+}
+
+// The daemon watches no ignored directory, so tracked files inside one
+// can change without it saying; those get looked at every time. The index
+// is sorted, so files in the same directory come together and each
+// directory only needs checking once.
+static int view_add_unwatched(fsmonitor_view_t *view, size_t *capacity, const index_t *index,
+                              ignore_t *ignore) {
+    char dir[PATH_MAX];
+    size_t dir_len = 0;
+    int dir_ignored = 0;
+    for (size_t i = 0; i < index->entry_count; i++) {
+        const char *path = index_entry_path(index, &index->entries[i]);
+        const char *slash = strrchr(path, '/');
+        if (!slash) continue;  // The root is always watched
+
+        size_t len = (size_t)(slash - path);
+        if (len >= sizeof(dir)) {
+            dir_ignored = 1;  // Can't check it, so don't trust it
+            dir_len = 0;
+        } else if (len != dir_len || memcmp(dir, path, len) != 0) {
+            memcpy(dir, path, len);
+            dir[len] = '\0';
+            dir_len = len;
+            dir_ignored = ignore_path(ignore, dir, 1);
+        }
+        if (dir_ignored && view_add(view, capacity, path) != 0) return -1;
+    }
+    return 0;
+}
+
+// Every NUL-terminated record in [ptr, end) into the view
+static int view_add_all(fsmonitor_view_t *view, size_t *capacity, const char *ptr, const char *end) {
+    while (ptr < end) {
+        size_t len = strlen(ptr);
+        if (view_add(view, capacity, ptr) != 0) return -1;
+        ptr += len + 1;
+    }
+    return 0;
+}
+
+int fsmonitor_view(gyatt_repo_t *repo, const index_t *index, ignore_t *ignore,
+                   fsmonitor_view_t *view) {
+    memset(view, 0, sizeof(*view));
+
+    // The saved token, then the paths saved with it
+    const char *saved = "";
+    const char *saved_paths = NULL;
+    const char *saved_end = NULL;
+    if (index->fsmonitor && index->fsmonitor_len > 0 &&
+        memchr(index->fsmonitor, '\0', index->fsmonitor_len)) {
+        saved = index->fsmonitor;
+        saved_paths = saved + strlen(saved) + 1;
+        saved_end = index->fsmonitor + index->fsmonitor_len;
+    }
+
+    buffer_t *reply = fsmonitor_request(repo, saved);
+    if (!reply) return -1;
+
+    const char *ptr = reply->data;
+    const char *end = reply->data + reply->len;
+    view->token = str_duplicate(ptr);
+    ptr += strlen(ptr) + 1;
+    if (!view->token || !saved[0] || (ptr < end && strcmp(ptr, "*") == 0)) {
+        buffer_free(reply);
+        return 1;
+    }
+
+    size_t capacity = 0;
+    int result = view_add_all(view, &capacity, ptr, end);
+    if (result == 0 && saved_paths) result = view_add_all(view, &capacity, saved_paths, saved_end);
+    if (result == 0) result = view_add_unwatched(view, &capacity, index, ignore);
+    buffer_free(reply);
+    if (result != 0) return 1;
+
+    qsort(view->changed, view->changed_count, sizeof(char *), path_compare);
+    size_t unique = 0;
+    for (size_t i = 0; i < view->changed_count; i++) {
+        if (unique > 0 && strcmp(view->changed[unique - 1], view->changed[i]) == 0) {
+            free(view->changed[i]);
+            continue;
+        }
+        view->changed[unique++] = view->changed[i];
+
+        // New rules can un-ignore anything anywhere
+        const char *slash = strrchr(view->changed[i], '/');
+        if (strcmp(slash ? slash + 1 : view->changed[i], ".gyattignore") == 0) result = 1;
+    }
+    view->changed_count = unique;
+    if (result != 0) return 1;
+
+    view->files = scan_paths(repo, view->changed, view->changed_count, ignore,
+                             config_thread_count(&repo->config));
+    return view->files ? 0 : 1;
+}
+
+int fsmonitor_view_covers(const fsmonitor_view_t *view, const char *path) {
+    // path itself or any directory above it
+    char prefix[PATH_MAX];
+    size_t len = strlen(path);
+    if (len >= sizeof(prefix)) return 1;
+    memcpy(prefix, path, len + 1);
+
+    for (;;) {
+        const char *key = prefix;
+        if (bsearch(&key, view->changed, view->changed_count, sizeof(char *), path_compare)) return 1;
+        char *slash = strrchr(prefix, '/');
+        if (!slash) return 0;
+        *slash = '\0';
+    }
+}
+
+void fsmonitor_view_free(fsmonitor_view_t *view) {
+    free(view->token);
+    for (size_t i = 0; i < view->changed_count; i++) free(view->changed[i]);
+    free(view->changed);
+    scan_free(view->files);
+    memset(view, 0, sizeof(*view));
+}
+
+int fsmonitor_save(index_t *index, const char *token, char *const *untracked, size_t untracked_count,
+                   char *const *dirty, size_t dirty_count) {
+    buffer_t *buf = buffer_create(256);
+    if (!buf) return -1;
+
+    buffer_append(buf, token, strlen(token) + 1);
+    for (size_t i = 0; i < untracked_count; i++) buffer_append(buf, untracked[i], strlen(untracked[i]) + 1);
+    for (size_t i = 0; i < dirty_count; i++) buffer_append(buf, dirty[i], strlen(dirty[i]) + 1);
+
+    // Unchanged (the usual case once things settle) needn't rewrite the index
+    int result = 0;
+    if (index->fsmonitor_len != buf->len || memcmp(index->fsmonitor, buf->data, buf->len) != 0) {
+        result = index_set_fsmonitor(index, buf->data, buf->len) == 0 ? 1 : -1;
+    }
+    buffer_free(buf);
+    return result;
+}
+
+// ==================== Daemon ====================
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+typedef struct {
+    uint64_t seq;
+    char *path;
+} fsmonitor_change_t;
+
+typedef struct {
+    gyatt_repo_t *repo;
+    ignore_t *ignore;
+    int inotify_fd;
+    int listen_fd;
+    int stopping;
+
+    char **watches;            // Directory path by watch descriptor
+    size_t watch_capacity;
+
+    fsmonitor_change_t *log;   // In sequence order
+    size_t log_count;
+    size_t log_capacity;
+    uint64_t seq;              // Of the latest change
+    uint64_t horizon;          // Tokens older than this can't be answered
+    char instance[32];
+} fsmonitor_daemon_t;
+
+static void daemon_log(fsmonitor_daemon_t *d, const char *path) {
+    if (d->log_count >= FSMONITOR_LOG_MAX) {
+        for (size_t i = 0; i < d->log_count; i++) free(d->log[i].path);
+        d->log_count = 0;
+        d->horizon = d->seq;
+    }
+    if (d->log_count >= d->log_capacity) {
+        size_t new_capacity = d->log_capacity == 0 ? 1024 : d->log_capacity * 2;
+        fsmonitor_change_t *log = realloc(d->log, new_capacity * sizeof(fsmonitor_change_t));
+        if (!log) {
+            d->horizon = ++d->seq;  // Lost one; nobody can rely on the history
+            return;
+        }
+        d->log = log;
+        d->log_capacity = new_capacity;
+    }
+
+    char *copy = str_duplicate(path);
+    if (!copy) {
+        d->horizon = ++d->seq;
+        return;
+    }
+    d->log[d->log_count].seq = ++d->seq;
+    d->log[d->log_count].path = copy;
+    d->log_count++;
+}
+
+static void daemon_set_watch(fsmonitor_daemon_t *d, int wd, const char *path) {
+    if (wd < 0) return;
+    if ((size_t)wd >= d->watch_capacity) {
+        size_t new_capacity = d->watch_capacity == 0 ? 1024 : d->watch_capacity;
+        while (new_capacity <= (size_t)wd) new_capacity *= 2;
+        char **watches = realloc(d->watches, new_capacity * sizeof(char *));
+        if (!watches) return;
+        memset(watches + d->watch_capacity, 0, (new_capacity - d->watch_capacity) * sizeof(char *));
+        d->watches = watches;
+        d->watch_capacity = new_capacity;
+    }
+    free(d->watches[wd]);
+    d->watches[wd] = str_duplicate(path);
+}
+
+// Watch rel_dir and everything under it that isn't ignored. For a directory
+// that just showed up, whatever's already inside was created before the
+// watch could see it, so it's all logged.
+static void daemon_watch_tree(fsmonitor_daemon_t *d, const char *rel_dir, int report) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s%s%s", d->repo->root, rel_dir[0] ? "/" : "", rel_dir);
+
+    int wd = inotify_add_watch(d->inotify_fd, dir_path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "Error: Out of inotify watches (see fs.inotify.max_user_watches)\n");
+            d->horizon = ++d->seq;
+        }
+        return;
+    }
+    daemon_set_watch(d, wd, rel_dir);
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        char rel_path[PATH_MAX];
+        if (snprintf(rel_path, sizeof(rel_path), "%s%s%s", rel_dir, rel_dir[0] ? "/" : "", name) >=
+            (int)sizeof(rel_path)) {
+            continue;
+        }
+
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            if (!ignore_entry(d->ignore, rel_path, 1)) daemon_watch_tree(d, rel_path, report);
+        } else if (report) {
+            daemon_log(d, rel_path);
+        }
+    }
+    closedir(dir);
+}
+
+// Rules changed: what's watched has to match them again
+static void daemon_reload_ignore(fsmonitor_daemon_t *d) {
+    ignore_t *ignore = ignore_create(d->repo);
+    if (!ignore) return;
+    ignore_free(d->ignore);
+    d->ignore = ignore;
+    daemon_watch_tree(d, "", 0);
+    d->horizon = d->seq;
+}
+
+static void daemon_handle_event(fsmonitor_daemon_t *d, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        d->horizon = ++d->seq;
+        return;
+    }
+    if (event->wd < 0 || (size_t)event->wd >= d->watch_capacity || !d->watches[event->wd]) return;
+    if (event->mask & IN_IGNORED) {
+        free(d->watches[event->wd]);
+        d->watches[event->wd] = NULL;
+        return;
+    }
+    if (event->len == 0) return;  // About the directory itself; its parent reports it too
+
+    const char *dir = d->watches[event->wd];
+    char rel_path[PATH_MAX];
+    if (snprintf(rel_path, sizeof(rel_path), "%s%s%s", dir, dir[0] ? "/" : "", event->name) >=
+        (int)sizeof(rel_path)) {
+        return;
+    }
+
+    // Only ignored directories go unwatched: a tracked file can match a
+    // rule and still needs its changes seen
+    int is_dir = (event->mask & IN_ISDIR) != 0;
+    if (is_dir && ignore_entry(d->ignore, rel_path, 1)) return;
+
+    daemon_log(d, rel_path);
+    if (is_dir && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+        daemon_watch_tree(d, rel_path, 1);
+    }
+    if (strcmp(event->name, ".gyattignore") == 0) daemon_reload_ignore(d);
+}
+
+// Read whatever events are queued right now
+static void daemon_drain(fsmonitor_daemon_t *d) {
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(d->inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        for (char *ptr = buf; ptr < buf + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            daemon_handle_event(d, event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static void daemon_answer(fsmonitor_daemon_t *d, int fd) {
+    set_timeouts(fd);
+
+    char request[256];
+    size_t len = 0;
+    while (len < sizeof(request)) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        len += (size_t)n;
+        if (memchr(request, '\0', len)) break;
+    }
+    if (!memchr(request, '\0', len)) return;
+
+    if (strcmp(request, "quit") == 0) {
+        d->stopping = 1;
+        send_all(fd, "", 1);
+        return;
+    }
+
+    // Anything that happened before now has to be in the answer
+    daemon_drain(d);
+
+    buffer_t *reply = buffer_create(4096);
+    if (!reply) return;
+    char token[64];
+    snprintf(token, sizeof(token), "%s:%llu", d->instance, (unsigned long long)d->seq);
+    buffer_append(reply, token, strlen(token) + 1);
+
+    char *colon = strrchr(request, ':');
+    unsigned long long since = colon ? strtoull(colon + 1, NULL, 10) : 0;
+    if (!colon || (size_t)(colon - request) != strlen(d->instance) ||
+        strncmp(request, d->instance, strlen(d->instance)) != 0 || since < d->horizon ||
+        since > d->seq) {
+        buffer_append(reply, "*", 2);
+    } else {
+        // The log is in sequence order: find the first change after since
+        size_t lo = 0, hi = d->log_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (d->log[mid].seq <= since) lo = mid + 1;
+            else hi = mid;
+        }
+        for (size_t i = lo; i < d->log_count; i++) {
+            buffer_append(reply, d->log[i].path, strlen(d->log[i].path) + 1);
+        }
+    }
+
+    send_all(fd, reply->data, reply->len);
+    buffer_free(reply);
+}
+
+int fsmonitor_run(gyatt_repo_t *repo) {
+    struct sockaddr_un addr;
+    if (fsmonitor_address(repo, &addr) != 0) {
+        fprintf(stderr, "Error: Socket path is too long: %s/%s\n", repo->gyatt_dir, FSMONITOR_SOCKET);
+        return -1;
+    }
+    if (fsmonitor_is_running(repo)) {
+        fprintf(stderr, "Error: fsmonitor is already running\n");
+        return -1;
+    }
+    unlink(addr.sun_path);  // Left over from one that died
+
+    fsmonitor_daemon_t d = {0};
+    d.repo = repo;
+    d.ignore = ignore_create(repo);
+    d.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    d.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    snprintf(d.instance, sizeof(d.instance), "%lx.%x", (unsigned long)time(NULL), (unsigned)getpid());
+    if (!d.ignore || d.inotify_fd < 0 || d.listen_fd < 0 ||
+        bind(d.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(d.listen_fd, 16) != 0) {
+        fprintf(stderr, "Error: Cannot start fsmonitor: %s\n", strerror(errno));
+        if (d.listen_fd >= 0) close(d.listen_fd);
+        if (d.inotify_fd >= 0) close(d.inotify_fd);
+        ignore_free(d.ignore);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Watches go up before anyone can ask, so the first token already
+    // covers everything after it
+    daemon_watch_tree(&d, "", 0);
+    d.horizon = d.seq;
+
+    while (!d.stopping) {
+        struct pollfd fds[2] = {
+            { d.inotify_fd, POLLIN, 0 },
+            { d.listen_fd, POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) daemon_drain(&d);
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(d.listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                daemon_answer(&d, fd);
+                close(fd);
+            }
+        }
+    }
+
+    close(d.listen_fd);
+    unlink(addr.sun_path);
+    close(d.inotify_fd);
+    for (size_t i = 0; i < d.watch_capacity; i++) free(d.watches[i]);
+    free(d.watches);
+    for (size_t i = 0; i < d.log_count; i++) free(d.log[i].path);
+    free(d.log);
+    ignore_free(d.ignore);
+    return 0;
+}
+
+#else
+
+int fsmonitor_run(gyatt_repo_t *repo) {
+    (void)repo;
+    fprintf(stderr, "Error: fsmonitor needs inotify, which this platform doesn't have\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+#include "gyatt.h"
+#include "index.h"
+#include "ignore.h"
+#include "scan.h"
+
+// An optional daemon (gyatt fsmonitor start) that watches the working tree
+// and remembers which paths changed, so status and add can look at just
+// those instead of every file.
+//
+// A token names a point in the daemon's history ("<instance>:<sequence>");
+// asking with one gets every path changed since. The index keeps the last
+// token in its FSMN extension, followed by the paths the last status found
+// untracked or modified, which get looked at again whatever the daemon
+// says: "token\0" then "path\0" for each. So do tracked files inside
+// ignored directories, which the daemon doesn't watch.
+//
+// Over .gyatt/fsmonitor.sock the client sends a token (or "quit") and a
+// NUL. The daemon answers with the current token, then either "*" (it
+// can't say: overflowed, restarted or the token is too old, so scan
+// everything) or the changed paths, each NUL-terminated, and hangs up.
+#define FSMONITOR_SOCKET "fsmonitor.sock"
+
+// What might differ from the index, per the daemon
+typedef struct {
+    char *token;               // Where the answer leaves off; save it once handled
+    char **changed;            // Sorted; each also covers everything under it
+    size_t changed_count;
+    scan_t *files;             // Those that exist, stat'ed (directories walked)
+} fsmonitor_view_t;
+
+// 0 with a view of the changes; 1 if the daemon answered but everything has
+// to be scanned (view->token is still set, to save afterwards); -1 if
+// there's no daemon. Nothing is used up: until a newer token is saved,
+// the same changes keep being reported.
+int fsmonitor_view(gyatt_repo_t *repo, const index_t *index, ignore_t *ignore,
+                   fsmonitor_view_t *view);
+int fsmonitor_view_covers(const fsmonitor_view_t *view, const char *path);
+void fsmonitor_view_free(fsmonitor_view_t *view);
+
+// Store token in the index, with the paths that the next view has to
+// include no matter what. 1 if that changed what's stored, 0 if not.
+int fsmonitor_save(index_t *index, const char *token, char *const *untracked, size_t untracked_count,
+                   char *const *dirty, size_t dirty_count);
+
+// The daemon, in the foreground; returns once stopped
+int fsmonitor_run(gyatt_repo_t *repo);
+int fsmonitor_stop(gyatt_repo_t *repo);
+int fsmonitor_is_running(gyatt_repo_t *repo);
+
+#endif // FSMONITOR_H
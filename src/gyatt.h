@@ -25,7 +25,8 @@
 typedef enum {
     OBJ_BLOB = 1,
     OBJ_TREE = 2,
-    OBJ_COMMIT = 3
+    OBJ_COMMIT = 3,
+    OBJ_CHUNKED = 4      // A big file as a list of blob chunks, see chunk.h
 } object_type_t;
 
 // Hash structure
@@ -33,32 +34,98 @@ typedef struct {
     unsigned char hash[HASH_SIZE];
 } gyatt_hash_t;
 
-// Command functions
-int cmd_init(int argc, char *argv[]);
-int cmd_add(int argc, char *argv[]);
-int cmd_commit(int argc, char *argv[]);
-int cmd_status(int argc, char *argv[]);
-int cmd_log(int argc, char *argv[]);
-int cmd_branch(int argc, char *argv[]);
-int cmd_checkout(int argc, char *argv[]);
-int cmd_push(int argc, char *argv[]);
-int cmd_pull(int argc, char *argv[]);
-int cmd_server(int argc, char *argv[]);
-int cmd_ipfs(int argc, char *argv[]);
-
-// Repository functions
-int is_gyatt_repo(void);
-char *get_gyatt_dir(void);
-char *find_repo_root(void);
+// Per-type compression level that just follows compression_level
+#define COMPRESSION_INHERIT (-1000)
 
 // Config structure
 typedef struct {
     char user_name[256];
     char user_email[256];
-    int compression_level;
+    int compression_level;   // 0 stores objects uncompressed
+    int compression_codec;   // compress_codec_t, see compress.h
+    int blob_compression;    // Per-type levels, or COMPRESSION_INHERIT
+    int tree_compression;
+    int commit_compression;
+    int chunk_threshold_mb;  // Files this big get chunked; 0 = never
+    int threads;             // Worker threads for add and friends; 0 = one per CPU
+    int object_cache_mb;     // Budget for parsed trees/commits; 0 = no cache
+    int server_max_connections; // 'gyatt server' limits
+    int server_backlog;
+    int server_buffer_kb;    // Per-client read/write buffer cap
+    int ipfs_in_flight;      // Concurrent requests to the IPFS daemon
 } gyatt_config_t;
 
-int config_read(gyatt_config_t *config);
-int config_write(const gyatt_config_t *config);
+struct pack_store;
+struct commit_graph;
+typedef struct object_cache object_cache_t;
+
+// Repository handle - resolved once at startup so hot paths never re-walk
+// the filesystem looking for .gyatt
+typedef struct {
+    char *root;              // Absolute path of the working tree
+    size_t root_len;
+    char *cwd;               // Directory the command was started from
+    char *gyatt_dir;         // <root>/.gyatt
+    char *objects_dir;       // <root>/.gyatt/objects
+    size_t objects_dir_len;
+    char *index_path;        // <root>/.gyatt/index
+    gyatt_config_t config;   // Parsed .gyatt/config
+    struct pack_store *packs; // Packfiles under objects/pack, mapped at open
+    object_cache_t *cache;   // Parsed trees/commits (NULL if disabled)
+    struct commit_graph *graph; // .gyatt/commit-graph, if there is one
+} gyatt_repo_t;
+
+// Command functions (repo is NULL when not inside a repository)
+int cmd_init(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_add(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_commit(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_status(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_log(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_branch(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_checkout(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_push(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_pull(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_server(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_ipfs(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_repack(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_commit_graph(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_merge_base(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_fetch_pack(gyatt_repo_t *repo, int argc, char *argv[]);
+int cmd_fsmonitor(gyatt_repo_t *repo, int argc, char *argv[]);
+
+// Repository functions
+int is_gyatt_repo(void);
+char *get_gyatt_dir(void);
+char *find_repo_root(void);
+
+gyatt_repo_t *repo_open(void);
+gyatt_repo_t *repo_open_at(const char *root);
+void repo_free(gyatt_repo_t *repo);
+int repo_relative_path(const gyatt_repo_t *repo, const char *path,
+                       char *out, size_t out_size);
+
+// HEAD, a branch name, or a full hex hash -> commit hash. -1 if it
+// doesn't name anything (including a branch with no commits yet).
+int repo_resolve_ref(const gyatt_repo_t *repo, const char *name, gyatt_hash_t *hash);
+
+// The branch HEAD is on; -1 if it's detached
+int repo_head_branch(const gyatt_repo_t *repo, char *out, size_t out_size);
+
+// Call fn for every branch that has a commit; stops early if fn returns non-zero
+typedef int (*repo_ref_fn)(const char *name, const gyatt_hash_t *hash, void *arg);
+int repo_foreach_branch(const gyatt_repo_t *repo, repo_ref_fn fn, void *arg);
+
+// Compare-and-swap refs/heads/<name> to new_hash. old_hash is what it has
+// to hold now (all zeros: mustn't exist yet; NULL: anything). Returns 0
+// once moved, 1 if it held something else or another update had it
+// locked, -1 on error.
+int repo_update_branch(const gyatt_repo_t *repo, const char *name,
+                       const gyatt_hash_t *old_hash, const gyatt_hash_t *new_hash);
+
+// Config functions
+void config_defaults(gyatt_config_t *config);
+int config_read(const gyatt_repo_t *repo, gyatt_config_t *config);
+int config_write(const gyatt_repo_t *repo, const gyatt_config_t *config);
+int config_thread_count(const gyatt_config_t *config);
 
 #endif // GYATT_H
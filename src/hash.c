@@ -1,23 +1,18 @@
 // SHA-1: Because we're keeping it old school (for Git compatibility)
 // Yes, SHA-1 is "broken" but Git still uses it, so here we are
 #include "hash.h"
+#include "sha1_impl.h"
 #include "utils.h"
+#include "trace.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-
-#define SHA1_BLOCK_SIZE 64
-#define SHA1_DIGEST_SIZE 20
-
-typedef struct {
-    uint32_t state[5];
-    uint64_t count;
-    uint8_t buffer[SHA1_BLOCK_SIZE];
-} sha1_ctx_t;
+#include <pthread.h>
 
 #define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void sha1_init(sha1_ctx_t *ctx) {
+void sha1_init(sha1_ctx_t *ctx) {
     ctx->state[0] = 0x67452301;
     ctx->state[1] = 0xEFCDAB89;
     ctx->state[2] = 0x98BADCFE;
@@ -26,6 +21,7 @@ static void sha1_init(sha1_ctx_t *ctx) {
     ctx->count = 0;
 }
 
+// The portable fallback
 static void sha1_transform(uint32_t state[5], const uint8_t buffer[SHA1_BLOCK_SIZE]) {
     uint32_t a, b, c, d, e, t, w[80];
     int i;
@@ -90,22 +86,110 @@ static void sha1_transform(uint32_t state[5], const uint8_t buffer[SHA1_BLOCK_SI
     state[4] += e;
 }
 
-static void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
+static void sha1_blocks_generic(uint32_t state[5], const uint8_t *data, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        sha1_transform(state, data + i * SHA1_BLOCK_SIZE);
+    }
+}
+
+// ==================== Backend Dispatch ====================
+
+typedef struct {
+    const char *name;
+    int (*supported)(void);     // NULL: runs everywhere
+    sha1_blocks_fn blocks;
+    sha1_many_fn many;          // NULL: sha1_hash_many() loops over blocks
+    int (*many_supported)(void);  // NULL: whenever the backend is
+} sha1_backend_t;
+
+static int sha1_always_supported(void) {
+    return 1;
+}
+
+// Fastest first; the first one this CPU supports wins. Even next to
+// SHA-NI, eight AVX2 lanes come out ahead on small messages (the padding
+// block costs a lane less), so shani hands batches to them when it can.
+static const sha1_backend_t sha1_backend_table[] = {
+#ifdef SHA1_HAVE_X86
+    { "shani", sha1_shani_supported, sha1_blocks_shani, sha1_many_avx2, sha1_avx2_supported },
+    { "avx2", sha1_avx2_supported, sha1_blocks_generic, sha1_many_avx2, NULL },
+#endif
+#ifdef SHA1_HAVE_ARMV8
+    { "armv8", sha1_armv8_supported, sha1_blocks_armv8, NULL, NULL },
+#endif
+    { "generic", sha1_always_supported, sha1_blocks_generic, NULL, NULL },
+};
+
+#define SHA1_BACKEND_COUNT (sizeof(sha1_backend_table) / sizeof(sha1_backend_table[0]))
+
+static const sha1_backend_t *sha1_active;
+static pthread_once_t sha1_once = PTHREAD_ONCE_INIT;
+
+static const sha1_backend_t *sha1_find_backend(const char *name) {
+    for (size_t i = 0; i < SHA1_BACKEND_COUNT; i++) {
+        const sha1_backend_t *backend = &sha1_backend_table[i];
+        if (strcmp(backend->name, name) == 0) return backend->supported() ? backend : NULL;
+    }
+    return NULL;
+}
+
+// Picked once per process; GYATT_SHA1=<name> forces a backend
+static void sha1_select_backend(void) {
+    const char *forced = getenv("GYATT_SHA1");
+    if (forced && (sha1_active = sha1_find_backend(forced)) != NULL) return;
+
+    for (size_t i = 0; i < SHA1_BACKEND_COUNT; i++) {
+        if (sha1_backend_table[i].supported()) {
+            sha1_active = &sha1_backend_table[i];
+            return;
+        }
+    }
+}
+
+static const sha1_backend_t *sha1_backend_get(void) {
+    pthread_once(&sha1_once, sha1_select_backend);
+    return sha1_active;
+}
+
+const char *sha1_backend(void) {
+    return sha1_backend_get()->name;
+}
+
+int sha1_set_backend(const char *name) {
+    sha1_backend_get();
+    const sha1_backend_t *backend = name ? sha1_find_backend(name) : NULL;
+    if (!backend) return -1;
+    sha1_active = backend;
+    return 0;
+}
+
+size_t sha1_backends(const char **names, size_t max) {
+    size_t count = 0;
+    for (size_t i = 0; i < SHA1_BACKEND_COUNT && count < max; i++) {
+        if (sha1_backend_table[i].supported()) names[count++] = sha1_backend_table[i].name;
+    }
+    return count;
+}
+
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
     const uint8_t *ptr = (const uint8_t *)data;
+    sha1_blocks_fn blocks = sha1_backend_get()->blocks;
     size_t buffer_space = SHA1_BLOCK_SIZE - (ctx->count % SHA1_BLOCK_SIZE);
 
     ctx->count += len;
 
     if (len >= buffer_space) {
         memcpy(&ctx->buffer[SHA1_BLOCK_SIZE - buffer_space], ptr, buffer_space);
-        sha1_transform(ctx->state, ctx->buffer);
+        blocks(ctx->state, ctx->buffer, 1);
         ptr += buffer_space;
         len -= buffer_space;
 
-        while (len >= SHA1_BLOCK_SIZE) {
-            sha1_transform(ctx->state, ptr);
-            ptr += SHA1_BLOCK_SIZE;
-            len -= SHA1_BLOCK_SIZE;
+        // Whole blocks go straight from the caller's buffer, all at once
+        size_t whole = len / SHA1_BLOCK_SIZE;
+        if (whole > 0) {
+            blocks(ctx->state, ptr, whole);
+            ptr += whole * SHA1_BLOCK_SIZE;
+            len -= whole * SHA1_BLOCK_SIZE;
         }
         buffer_space = SHA1_BLOCK_SIZE;
     }
@@ -113,7 +197,7 @@ static void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
     memcpy(&ctx->buffer[SHA1_BLOCK_SIZE - buffer_space], ptr, len);
 }
 
-static void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE]) {
+void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE]) {
     uint64_t bit_count = ctx->count * 8;
     size_t padding = (ctx->count % SHA1_BLOCK_SIZE < 56) ? 
                      (56 - (ctx->count % SHA1_BLOCK_SIZE)) : 
@@ -139,10 +223,31 @@ static void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE]) {
 
 // Public API
 void sha1_hash(const void *data, size_t len, gyatt_hash_t *hash) {
+    trace_span_t span = trace_begin(TRACE_SHA1);
     sha1_ctx_t ctx;
     sha1_init(&ctx);
     sha1_update(&ctx, data, len);
     sha1_final(&ctx, hash->hash);
+    trace_end(span, len, 0);
+}
+
+void sha1_hash_many(const void *const *data, const size_t *lens, size_t count,
+                    gyatt_hash_t *hashes) {
+    const sha1_backend_t *backend = sha1_backend_get();
+    if (backend->many && count > 1 && (!backend->many_supported || backend->many_supported())) {
+        trace_span_t span = trace_begin(TRACE_SHA1);
+        backend->many(data, lens, count, hashes);
+        if (span.start) {
+            size_t total = 0;
+            for (size_t i = 0; i < count; i++) total += lens[i];
+            trace_end(span, total, 0);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sha1_hash(data[i], lens[i], &hashes[i]);
+    }
 }
 
 void sha1_hash_file(const char *path, gyatt_hash_t *hash) {
@@ -166,6 +271,105 @@ void sha1_hash_file(const char *path, gyatt_hash_t *hash) {
     sha1_final(&ctx, hash->hash);
 }
 
+// ==================== SHA-256 ====================
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(uint32_t state[8], const uint8_t block[SHA256_BLOCK_SIZE]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(sha256_ctx_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->count = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t used = ctx->count % SHA256_BLOCK_SIZE;
+    ctx->count += len;
+
+    if (used > 0) {
+        size_t take = SHA256_BLOCK_SIZE - used < len ? SHA256_BLOCK_SIZE - used : len;
+        memcpy(ctx->buffer + used, p, take);
+        p += take;
+        len -= take;
+        if (used + take < SHA256_BLOCK_SIZE) return;
+        sha256_transform(ctx->state, ctx->buffer);
+    }
+    for (; len >= SHA256_BLOCK_SIZE; p += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE) {
+        sha256_transform(ctx->state, p);
+    }
+    if (len > 0) memcpy(ctx->buffer, p, len);
+}
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = ctx->count * 8;
+    uint8_t pad[SHA256_BLOCK_SIZE + 8] = { 0x80 };
+    size_t used = ctx->count % SHA256_BLOCK_SIZE;
+    size_t pad_len = used < 56 ? 56 - used : 120 - used;
+    sha256_update(ctx, pad, pad_len);
+
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++) length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256_update(ctx, length, 8);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void sha256_hash(const void *data, size_t len, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
+
 void hash_to_hex(const gyatt_hash_t *hash, char *hex) {
     static const char hex_chars[] = "0123456789abcdef";
     for (int i = 0; i < HASH_SIZE; i++) {
@@ -3,11 +3,54 @@
 
 #include "gyatt.h"
 #include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_BLOCK_SIZE 64
+#define SHA1_DIGEST_SIZE 20
+
+// Incremental SHA-1 state, for hashing data that arrives in pieces
+typedef struct {
+    uint32_t state[5];
+    uint64_t count;
+    uint8_t buffer[SHA1_BLOCK_SIZE];
+} sha1_ctx_t;
+
+void sha1_init(sha1_ctx_t *ctx);
+void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len);
+void sha1_final(sha1_ctx_t *ctx, uint8_t digest[SHA1_DIGEST_SIZE]);
 
 // SHA-1 hashing functions
 void sha1_hash(const void *data, size_t len, gyatt_hash_t *hash);
 void sha1_hash_file(const char *path, gyatt_hash_t *hash);
 
+// Hash count separate buffers - cheaper than count sha1_hash() calls when
+// the CPU can run several streams side by side (AVX2)
+void sha1_hash_many(const void *const *data, const size_t *lens, size_t count,
+                    gyatt_hash_t *hashes);
+
+// The SHA-1 implementation is picked from the CPU on first use ("shani",
+// "armv8", "avx2" or "generic"; GYATT_SHA1=<name> overrides). set_backend
+// returns -1 if this CPU can't run it; backends lists the ones it can.
+const char *sha1_backend(void);
+int sha1_set_backend(const char *name);
+size_t sha1_backends(const char **names, size_t max);
+
+// SHA-256, for content addressing outside the repository (IPFS CIDs). One
+// portable implementation; nothing hot depends on it.
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buffer[SHA256_BLOCK_SIZE];
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+void sha256_hash(const void *data, size_t len, uint8_t digest[SHA256_DIGEST_SIZE]);
+
 // Hash utility functions
 void hash_to_hex(const gyatt_hash_t *hash, char *hex);
 void hex_to_hash(const char *hex, gyatt_hash_t *hash);
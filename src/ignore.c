@@ -0,0 +1,480 @@
+#include "ignore.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+#define IGNORE_NEGATE   0x1
+#define IGNORE_DIR_ONLY 0x2
+
+// What a rule's pattern is checked against, by how it was written
+typedef enum {
+    RULE_NAME,      // "foo": the entry's name, exactly
+    RULE_SUFFIX,    // "*.o": the end of the entry's name (pattern is ".o")
+    RULE_PATH,      // "/foo/bar": the path below the file's directory, exactly
+    RULE_GLOB       // Anything else, matched the slow way
+} rule_kind_t;
+
+typedef struct {
+    char *pattern;
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t anchored;          // Globs: against the path below the directory, not the name
+} ignore_rule_t;
+
+// The literal rules, chained by hash; every rule with the same key is on
+// the same chain
+typedef struct {
+    uint32_t hash;
+    uint32_t rule;
+    uint32_t next;             // Index + 1 of the next link, 0 at the end
+} ignore_link_t;
+
+// One directory's .gyattignore (empty if it has none)
+typedef struct ignore_list {
+    char *dir;                 // Relative to the repo root; "" is the root
+    size_t dir_len;
+    uint32_t dir_hash;
+
+    ignore_rule_t *rules;
+    size_t rule_count;
+    uint32_t *buckets;         // Index + 1 of the first link, 0 if none
+    size_t bucket_count;
+    ignore_link_t *links;
+    uint32_t *globs;           // Rules that are RULE_GLOB, in file order
+    size_t glob_count;
+
+    struct ignore_list *next;  // Same bucket of ignore->dirs
+} ignore_list_t;
+
+struct ignore {
+    char *root;
+    pthread_mutex_t lock;      // Guards dirs; lists never change once loaded
+    ignore_list_t **dirs;
+    size_t dir_buckets;
+    size_t dir_count;
+};
+
+// FNV-1a, seeded by kind so the three literal tables can share buckets
+static uint32_t hash_init(rule_kind_t kind) {
+    return 2166136261u ^ ((uint32_t)kind * 0x9e3779b9u);
+}
+
+static uint32_t hash_step(uint32_t hash, char c) {
+    return (hash ^ (unsigned char)c) * 16777619u;
+}
+
+static uint32_t hash_bytes(rule_kind_t kind, const char *s, size_t len) {
+    uint32_t hash = hash_init(kind);
+    for (size_t i = 0; i < len; i++) hash = hash_step(hash, s[i]);
+    return hash;
+}
+
+// Suffixes are hashed back to front, so a lookup can try every suffix of
+// a name in one pass from its end
+static uint32_t hash_reversed(const char *s, size_t len) {
+    uint32_t hash = hash_init(RULE_SUFFIX);
+    while (len > 0) hash = hash_step(hash, s[--len]);
+    return hash;
+}
+
+// ==================== Globs ====================
+
+// [...] at *pp against c. 1/0 for a match or not, with *pp moved past
+// the class; -1 if the class is never closed (the '[' is then literal).
+static int class_match(const char **pp, char c) {
+    const char *p = *pp + 1;
+    int negate = (*p == '!' || *p == '^');
+    if (negate) p++;
+
+    int matched = 0;
+    int first = 1;
+    while (*p && (first || *p != ']')) {
+        first = 0;
+        char lo = *p;
+        if (lo == '\\' && p[1]) lo = *++p;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            char hi = p[2];
+            if (hi == '\\' && p[3]) {
+                hi = p[3];
+                p++;
+            }
+            if (c >= lo && c <= hi) matched = 1;
+            p += 3;
+        } else {
+            if (c == lo) matched = 1;
+            p++;
+        }
+    }
+    if (*p != ']') return -1;
+
+    *pp = p + 1;
+    return c != '/' && matched != negate;
+}
+
+// Shell-style match where "*" and "?" stop at '/', and "**" doesn't:
+// "**/" can stand for any number of directories, including none
+static int glob_match(const char *p, const char *s) {
+    while (*p) {
+        if (p[0] == '*' && p[1] == '*') {
+            p += 2;
+            if (*p == '/') {
+                p++;
+                if (glob_match(p, s)) return 1;
+                for (; *s; s++) {
+                    if (*s == '/' && glob_match(p, s + 1)) return 1;
+                }
+                return 0;
+            }
+            if (!*p) return 1;
+            for (; *s; s++) {
+                if (glob_match(p, s)) return 1;
+            }
+            return glob_match(p, s);
+        }
+        if (*p == '*') {
+            p++;
+            for (;; s++) {
+                if (glob_match(p, s)) return 1;
+                if (!*s || *s == '/') return 0;
+            }
+        }
+
+        if (!*s) return 0;
+        if (*p == '?') {
+            if (*s == '/') return 0;
+            p++;
+            s++;
+            continue;
+        }
+        if (*p == '[') {
+            int result = class_match(&p, *s);
+            if (result == 0) return 0;
+            if (result == 1) {
+                s++;
+                continue;
+            }
+        }
+        if (*p == '\\' && p[1]) p++;
+        if (*p != *s) return 0;
+        p++;
+        s++;
+    }
+    return *s == '\0';
+}
+
+// ==================== Parsing ====================
+
+static int list_add_rule(ignore_list_t *list, size_t *capacity, char *line) {
+    uint8_t flags = 0;
+    if (*line == '!') {
+        flags |= IGNORE_NEGATE;
+        line++;
+    } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#')) {
+        line++;
+    }
+
+    // Trailing spaces don't count unless escaped
+    size_t len = strlen(line);
+    while (len > 0 && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\')) len--;
+    if (len > 0 && line[len - 1] == '/') {
+        flags |= IGNORE_DIR_ONLY;
+        len--;
+    }
+    line[len] = '\0';
+    if (len == 0) return 0;
+
+    // A slash anywhere but the end ties the pattern to this directory
+    int anchored = strchr(line, '/') != NULL;
+    if (line[0] == '/') line++;
+    // ...except "**/name", which is just name at any depth
+    if (strncmp(line, "**/", 3) == 0 && !strchr(line + 3, '/') && !strpbrk(line + 3, "*?[\\")) {
+        line += 3;
+        anchored = 0;
+    }
+    if (*line == '\0') return 0;
+
+    rule_kind_t kind;
+    const char *pattern = line;
+    if (!strpbrk(line, "*?[\\")) {
+        kind = anchored ? RULE_PATH : RULE_NAME;
+    } else if (!anchored && line[0] == '*' && line[1] && !strpbrk(line + 1, "*?[\\")) {
+        kind = RULE_SUFFIX;
+        pattern = line + 1;
+    } else {
+        kind = RULE_GLOB;
+    }
+
+    if (list->rule_count >= *capacity) {
+        size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        ignore_rule_t *new_rules = realloc(list->rules, new_capacity * sizeof(ignore_rule_t));
+        if (!new_rules) return -1;
+        list->rules = new_rules;
+        *capacity = new_capacity;
+    }
+
+    ignore_rule_t *rule = &list->rules[list->rule_count];
+    rule->pattern = str_duplicate(pattern);
+    if (!rule->pattern) return -1;
+    rule->kind = (uint8_t)kind;
+    rule->flags = flags;
+    rule->anchored = (uint8_t)anchored;
+    list->rule_count++;
+    return 0;
+}
+
+// Hash the literal rules and set the globs aside, now that they're all in
+static int list_compile(ignore_list_t *list) {
+    size_t bucket_count = 16;
+    while (bucket_count < list->rule_count * 2) bucket_count *= 2;
+
+    list->buckets = calloc(bucket_count, sizeof(uint32_t));
+    list->links = malloc((list->rule_count + 1) * sizeof(ignore_link_t));
+    list->globs = malloc((list->rule_count + 1) * sizeof(uint32_t));
+    if (!list->buckets || !list->links || !list->globs) return -1;
+    list->bucket_count = bucket_count;
+
+    size_t link_count = 0;
+    for (size_t i = 0; i < list->rule_count; i++) {
+        ignore_rule_t *rule = &list->rules[i];
+        if (rule->kind == RULE_GLOB) {
+            list->globs[list->glob_count++] = (uint32_t)i;
+            continue;
+        }
+
+        size_t len = strlen(rule->pattern);
+        uint32_t hash = rule->kind == RULE_SUFFIX ? hash_reversed(rule->pattern, len) :
+                        hash_bytes(rule->kind, rule->pattern, len);
+        uint32_t *bucket = &list->buckets[hash & (bucket_count - 1)];
+        list->links[link_count].hash = hash;
+        list->links[link_count].rule = (uint32_t)i;
+        list->links[link_count].next = *bucket;
+        *bucket = (uint32_t)++link_count;
+    }
+    return 0;
+}
+
+static void list_free(ignore_list_t *list) {
+    for (size_t i = 0; i < list->rule_count; i++) free(list->rules[i].pattern);
+    free(list->rules);
+    free(list->buckets);
+    free(list->links);
+    free(list->globs);
+    free(list->dir);
+    free(list);
+}
+
+static ignore_list_t *list_load(const char *root, const char *dir, size_t dir_len, uint32_t dir_hash) {
+    ignore_list_t *list = calloc(1, sizeof(ignore_list_t));
+    if (!list) return NULL;
+    list->dir = malloc(dir_len + 1);
+    if (!list->dir) {
+        free(list);
+        return NULL;
+    }
+    memcpy(list->dir, dir, dir_len);
+    list->dir[dir_len] = '\0';
+    list->dir_len = dir_len;
+    list->dir_hash = dir_hash;
+
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%s%s.gyattignore", root, list->dir, dir_len ? "/" : "");
+    size_t size = 0;
+    char *content = (n > 0 && (size_t)n < sizeof(path) && file_exists(path)) ? read_file(path, &size) : NULL;
+
+    int result = 0;
+    size_t capacity = 0;
+    char *line = content;
+    while (line && result == 0) {
+        char *end = strchr(line, '\n');
+        if (end) *end = '\0';
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\r') line[len - 1] = '\0';
+        if (line[0] != '\0' && line[0] != '#') result = list_add_rule(list, &capacity, line);
+        line = end ? end + 1 : NULL;
+    }
+    free(content);
+
+    if (result == 0) result = list_compile(list);
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to load %s\n", path);
+        list_free(list);
+        return NULL;
+    }
+    return list;
+}
+
+// ==================== Matching ====================
+
+static int rule_applies(const ignore_rule_t *rule, int is_dir) {
+    return is_dir || !(rule->flags & IGNORE_DIR_ONLY);
+}
+
+// Latest rule in this list on the chain for hash that has exactly text as
+// its pattern, or best if none beats it
+static long list_lookup(const ignore_list_t *list, rule_kind_t kind, uint32_t hash,
+                        const char *text, int is_dir, long best) {
+    uint32_t link = list->buckets[hash & (list->bucket_count - 1)];
+    while (link) {
+        const ignore_link_t *l = &list->links[link - 1];
+        const ignore_rule_t *rule = &list->rules[l->rule];
+        if (l->hash == hash && (long)l->rule > best && rule->kind == kind &&
+            rule_applies(rule, is_dir) && strcmp(rule->pattern, text) == 0) {
+            best = l->rule;
+        }
+        link = l->next;
+    }
+    return best;
+}
+
+// The last rule in list matching sub (the path below list's directory),
+// or -1
+static long list_match(const ignore_list_t *list, const char *sub, const char *name, int is_dir) {
+    if (list->rule_count == 0) return -1;
+
+    size_t name_len = strlen(name);
+    long best = list_lookup(list, RULE_NAME, hash_bytes(RULE_NAME, name, name_len), name, is_dir, -1);
+    best = list_lookup(list, RULE_PATH, hash_bytes(RULE_PATH, sub, strlen(sub)), sub, is_dir, best);
+
+    // Every suffix of the name, shortest first, one character more each step
+    uint32_t hash = hash_init(RULE_SUFFIX);
+    for (size_t i = name_len; i > 0; i--) {
+        hash = hash_step(hash, name[i - 1]);
+        best = list_lookup(list, RULE_SUFFIX, hash, name + i - 1, is_dir, best);
+    }
+
+    // Only a later glob can beat what the tables found
+    for (size_t i = list->glob_count; i > 0; i--) {
+        uint32_t index = list->globs[i - 1];
+        if ((long)index <= best) break;
+        const ignore_rule_t *rule = &list->rules[index];
+        if (rule_applies(rule, is_dir) && glob_match(rule->pattern, rule->anchored ? sub : name)) {
+            best = index;
+            break;
+        }
+    }
+    return best;
+}
+
+static int dirs_grow(ignore_t *ignore) {
+    size_t new_buckets = ignore->dir_buckets * 2;
+    ignore_list_t **new_dirs = calloc(new_buckets, sizeof(ignore_list_t *));
+    if (!new_dirs) return -1;
+
+    for (size_t i = 0; i < ignore->dir_buckets; i++) {
+        ignore_list_t *list = ignore->dirs[i];
+        while (list) {
+            ignore_list_t *next = list->next;
+            size_t slot = list->dir_hash & (new_buckets - 1);
+            list->next = new_dirs[slot];
+            new_dirs[slot] = list;
+            list = next;
+        }
+    }
+    free(ignore->dirs);
+    ignore->dirs = new_dirs;
+    ignore->dir_buckets = new_buckets;
+    return 0;
+}
+
+// The rules for one directory, read on first use
+static ignore_list_t *ignore_list_get(ignore_t *ignore, const char *dir, size_t dir_len) {
+    uint32_t hash = hash_bytes(RULE_PATH, dir, dir_len);
+
+    pthread_mutex_lock(&ignore->lock);
+    ignore_list_t *list = ignore->dirs[hash & (ignore->dir_buckets - 1)];
+    while (list && !(list->dir_hash == hash && list->dir_len == dir_len &&
+                     memcmp(list->dir, dir, dir_len) == 0)) {
+        list = list->next;
+    }
+
+    if (!list) {
+        list = list_load(ignore->root, dir, dir_len, hash);
+        if (list) {
+            if (ignore->dir_count >= ignore->dir_buckets) dirs_grow(ignore);
+            size_t slot = hash & (ignore->dir_buckets - 1);
+            list->next = ignore->dirs[slot];
+            ignore->dirs[slot] = list;
+            ignore->dir_count++;
+        }
+    }
+    pthread_mutex_unlock(&ignore->lock);
+    return list;
+}
+
+ignore_t *ignore_create(const gyatt_repo_t *repo) {
+    ignore_t *ignore = calloc(1, sizeof(ignore_t));
+    if (!ignore) return NULL;
+
+    ignore->root = str_duplicate(repo->root);
+    ignore->dir_buckets = 64;
+    ignore->dirs = calloc(ignore->dir_buckets, sizeof(ignore_list_t *));
+    if (!ignore->root || !ignore->dirs) {
+        free(ignore->root);
+        free(ignore->dirs);
+        free(ignore);
+        return NULL;
+    }
+    pthread_mutex_init(&ignore->lock, NULL);
+    return ignore;
+}
+
+void ignore_free(ignore_t *ignore) {
+    if (!ignore) return;
+
+    for (size_t i = 0; i < ignore->dir_buckets; i++) {
+        ignore_list_t *list = ignore->dirs[i];
+        while (list) {
+            ignore_list_t *next = list->next;
+            list_free(list);
+            list = next;
+        }
+    }
+    pthread_mutex_destroy(&ignore->lock);
+    free(ignore->dirs);
+    free(ignore->root);
+    free(ignore);
+}
+
+int ignore_entry(ignore_t *ignore, const char *rel_path, int is_dir) {
+    if (!rel_path || !*rel_path) return 0;
+
+    const char *slash = strrchr(rel_path, '/');
+    const char *name = slash ? slash + 1 : rel_path;
+    if (strcmp(name, ".gyatt") == 0 || strcmp(name, ".git") == 0) return 1;
+    if (!ignore) return 0;
+
+    // The closest .gyattignore with an opinion decides
+    size_t dir_len = slash ? (size_t)(slash - rel_path) : 0;
+    for (;;) {
+        ignore_list_t *list = ignore_list_get(ignore, rel_path, dir_len);
+        const char *sub = dir_len ? rel_path + dir_len + 1 : rel_path;
+        long rule = list ? list_match(list, sub, name, is_dir) : -1;
+        if (rule >= 0) return !(list->rules[rule].flags & IGNORE_NEGATE);
+        if (dir_len == 0) return 0;
+
+        while (dir_len > 0 && rel_path[dir_len - 1] != '/') dir_len--;
+        if (dir_len > 0) dir_len--;
+    }
+}
+
+int ignore_path(ignore_t *ignore, const char *rel_path, int is_dir) {
+    if (!ignore || !rel_path) return 0;
+
+    // Nothing under an ignored directory can be let back in
+    char prefix[PATH_MAX];
+    for (const char *slash = strchr(rel_path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = (size_t)(slash - rel_path);
+        if (len == 0 || len >= sizeof(prefix)) continue;
+        memcpy(prefix, rel_path, len);
+        prefix[len] = '\0';
+        if (ignore_entry(ignore, prefix, 1)) return 1;
+    }
+    return ignore_entry(ignore, rel_path, is_dir);
+}
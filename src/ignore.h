@@ -0,0 +1,32 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include "gyatt.h"
+
+// .gyattignore rules, with the same syntax as .gitignore: globs (*, ?,
+// [...], **), "!" to re-include, a trailing "/" for directories only, and
+// a "/" anywhere else to anchor the pattern to the file's own directory.
+// Every directory can have its own .gyattignore; deeper files win, and
+// within a file the last matching rule does.
+//
+// Each file is read once, the first time a path under its directory is
+// asked about. Literal names, "*.ext" style suffixes and literal paths
+// (nearly every real rule) go into hash tables, so the cost of a lookup
+// doesn't grow with the number of rules; only the leftover globs are
+// tried one by one. Safe to share between threads.
+typedef struct ignore ignore_t;
+
+ignore_t *ignore_create(const gyatt_repo_t *repo);
+void ignore_free(ignore_t *ignore);
+
+// For walks that check each directory before opening it: is this one
+// entry ignored, given that its parent directory isn't? Paths are
+// relative to the repo root. .gyatt (and .git) directories always are,
+// even with a NULL ignore.
+int ignore_entry(ignore_t *ignore, const char *rel_path, int is_dir);
+
+// Same, but also checks every directory above rel_path, for paths that
+// didn't come from a walk (e.g. named on the command line)
+int ignore_path(ignore_t *ignore, const char *rel_path, int is_dir);
+
+#endif // IGNORE_H
@@ -3,9 +3,14 @@
 #include "object.h"
 #include "utils.h"
 #include "buffer.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef PATH_MAX
@@ -13,7 +18,33 @@
 #endif
 
 #define INDEX_SIGNATURE "GYAT"
-#define INDEX_VERSION 1
+#define INDEX_VERSION 2
+
+// v2 layout (native byte order, like v1):
+//   "GYAT" | version u32 | entry_count u32 | paths_len u32
+//   entry_count * index_entry_t       (starts at offset 16, so 8-aligned)
+//   path pool: paths_len bytes of NUL-terminated paths
+//   extensions: signature 4 | length u32 | payload, any number of them
+//   SHA-1 of everything above
+#define INDEX_V2_HEADER_SIZE 16
+#define INDEX_EXT_TREE "TREE"
+#define INDEX_EXT_FSMONITOR "FSMN"
+
+_Static_assert(sizeof(index_entry_t) % 8 == 0, "index entries must stay 8-byte aligned");
+
+// v1 is still read so existing repositories open; it is never written.
+// Its optional stat-data extension follows the entries.
+#define INDEX_V1_VERSION 1
+#define INDEX_EXT_STAT "STAT"
+#define INDEX_EXT_STAT_ENTRY_SIZE 32  // mtime_nsec 4 + ctime 8 + ctime_nsec 4 + ino 8 + dev 8
+
+#ifdef __APPLE__
+    #define ST_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+    #define ST_CTIME_NSEC(st) ((st)->st_ctimespec.tv_nsec)
+#else
+    #define ST_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+    #define ST_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#endif
 
 index_t *index_create(void) {
     index_t *index = calloc(1, sizeof(index_t));
@@ -26,277 +57,697 @@ index_t *index_create(void) {
     return index;
 }
 
-void index_free(index_t *index) {
-    if (!index) return;
-    free(index->entries);
-    free(index);
+// ==================== Cached Trees ====================
+
+// Order trees by dir, where the probe is the first dir_len bytes of dir
+static int index_tree_compare(const index_tree_t *tree, const char *dir, size_t dir_len) {
+    int cmp = strncmp(tree->dir, dir, dir_len);
+    if (cmp != 0) return cmp;
+    return tree->dir[dir_len] != '\0';
 }
 
-// Sort comparison function for index entries (by path)
-static int entry_compare(const void *a, const void *b) {
-    const index_entry_t *ea = (const index_entry_t *)a;
-    const index_entry_t *eb = (const index_entry_t *)b;
-    return strcmp(ea->path, eb->path);
+static int index_tree_lookup(const index_t *index, const char *dir, size_t dir_len, size_t *pos) {
+    size_t lo = 0, hi = index->tree_count;
+    
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = index_tree_compare(&index->trees[mid], dir, dir_len);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    *pos = lo;
+    return 0;
 }
 
-int index_read(index_t *index) {
-    if (!index) return -1;
+int index_cache_tree_get(const index_t *index, const char *dir, size_t dir_len,
+                         size_t entry_count, gyatt_hash_t *hash) {
+    if (!index || !dir) return 0;
     
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return -1;
+    size_t pos;
+    if (!index_tree_lookup(index, dir, dir_len, &pos)) return 0;
     
-    char *index_path = path_join(gyatt_dir, "index");
-    free(gyatt_dir);
+    const index_tree_t *tree = &index->trees[pos];
+    if (!tree->valid || tree->entry_count != entry_count) return 0;
     
-    // If index doesn't exist, that's okay - start with empty index
-    if (!file_exists(index_path)) {
-        free(index_path);
-        return 0;
+    if (hash) hash_copy(hash, &tree->hash);
+    return 1;
+}
+
+int index_cache_tree_set(index_t *index, const char *dir, size_t dir_len,
+                         size_t entry_count, const gyatt_hash_t *hash) {
+    if (!index || !dir || !hash || entry_count > UINT32_MAX) return -1;
+    
+    size_t pos;
+    if (!index_tree_lookup(index, dir, dir_len, &pos)) {
+        if (index->tree_count >= index->tree_capacity) {
+            size_t new_capacity = index->tree_capacity == 0 ? 16 : index->tree_capacity * 2;
+            index_tree_t *new_trees = realloc(index->trees, new_capacity * sizeof(index_tree_t));
+            if (!new_trees) return -1;
+            index->trees = new_trees;
+            index->tree_capacity = new_capacity;
+        }
+        
+        char *copy = malloc(dir_len + 1);
+        if (!copy) return -1;
+        memcpy(copy, dir, dir_len);
+        copy[dir_len] = '\0';
+        
+        memmove(&index->trees[pos + 1], &index->trees[pos],
+                (index->tree_count - pos) * sizeof(index_tree_t));
+        index->tree_count++;
+        index->trees[pos].dir = copy;
     }
     
-    size_t file_size;
-    void *data = read_file(index_path, &file_size);
-    free(index_path);
-    
-    if (!data) return -1;
+    index_tree_t *tree = &index->trees[pos];
+    tree->entry_count = (uint32_t)entry_count;
+    tree->valid = 1;
+    hash_copy(&tree->hash, hash);
+    return 0;
+}
+
+// The root and every directory on the way down to path
+void index_cache_tree_invalidate(index_t *index, const char *path) {
+    if (!index || !path || index->tree_count == 0) return;
     
-    char *ptr = (char *)data;
+    size_t pos;
+    if (index_tree_lookup(index, path, 0, &pos)) index->trees[pos].valid = 0;
     
-    // Check signature
-    if (file_size < 8 || memcmp(ptr, INDEX_SIGNATURE, 4) != 0) {
-        free(data);
-        return -1;
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        if (index_tree_lookup(index, path, (size_t)(slash - path), &pos)) {
+            index->trees[pos].valid = 0;
+        }
+    }
+}
+
+static void index_trees_clear(index_t *index) {
+    for (size_t i = 0; i < index->tree_count; i++) {
+        free(index->trees[i].dir);
+    }
+    free(index->trees);
+    index->trees = NULL;
+    index->tree_count = 0;
+    index->tree_capacity = 0;
+}
+
+// TREE payload: per valid tree, in dir order, "dir\0" | entry_count u32 | hash
+static void index_write_trees(const index_t *index, buffer_t *buf) {
+    size_t len = 0;
+    for (size_t i = 0; i < index->tree_count; i++) {
+        if (index->trees[i].valid) len += strlen(index->trees[i].dir) + 1 + 4 + HASH_SIZE;
+    }
+    if (len == 0 || len > UINT32_MAX) return;
+    
+    uint32_t len32 = (uint32_t)len;
+    buffer_append(buf, INDEX_EXT_TREE, 4);
+    buffer_append(buf, &len32, 4);
+    
+    for (size_t i = 0; i < index->tree_count; i++) {
+        const index_tree_t *tree = &index->trees[i];
+        if (!tree->valid) continue;
+        buffer_append(buf, tree->dir, strlen(tree->dir) + 1);
+        buffer_append(buf, &tree->entry_count, 4);
+        buffer_append(buf, tree->hash.hash, HASH_SIZE);
+    }
+}
+
+// A bad cache is only a cache: on any inconsistency it is dropped, and the
+// next commit rebuilds every tree
+static void index_read_trees(index_t *index, const char *data, size_t len) {
+    const char *ptr = data;
+    const char *end = data + len;
+    
+    while (ptr < end) {
+        const char *nul = memchr(ptr, '\0', (size_t)(end - ptr));
+        if (!nul || (size_t)(end - nul - 1) < 4 + HASH_SIZE) break;
+        
+        size_t dir_len = (size_t)(nul - ptr);
+        uint32_t entry_count;
+        gyatt_hash_t hash;
+        memcpy(&entry_count, nul + 1, 4);
+        memcpy(hash.hash, nul + 5, HASH_SIZE);
+        
+        if (index_cache_tree_set(index, ptr, dir_len, entry_count, &hash) != 0) break;
+        ptr = nul + 5 + HASH_SIZE;
     }
-    ptr += 4;
     
-    // Check version
-    uint32_t version = *(uint32_t *)ptr;
-    ptr += 4;
+    if (ptr != end) index_trees_clear(index);
+}
+
+// ==================== fsmonitor ====================
+
+int index_set_fsmonitor(index_t *index, const void *data, size_t len) {
+    if (!index) return -1;
     
-    if (version != INDEX_VERSION) {
-        free(data);
-        return -1;
+    char *copy = NULL;
+    if (data) {
+        copy = malloc(len + 1);
+        if (!copy) return -1;
+        memcpy(copy, data, len);
+        copy[len] = '\0';
     }
+    free(index->fsmonitor);
+    index->fsmonitor = copy;
+    index->fsmonitor_len = data ? len : 0;
+    return 0;
+}
+
+static void index_write_fsmonitor(const index_t *index, buffer_t *buf) {
+    if (!index->fsmonitor || index->fsmonitor_len > UINT32_MAX) return;
     
-    // Read entry count
-    if ((size_t)(ptr - (char *)data) + 4 > file_size) {
-        free(data);
-        return -1;
+    uint32_t len32 = (uint32_t)index->fsmonitor_len;
+    buffer_append(buf, INDEX_EXT_FSMONITOR, 4);
+    buffer_append(buf, &len32, 4);
+    buffer_append(buf, index->fsmonitor, index->fsmonitor_len);
+}
+
+static int index_is_mapped_entries(const index_t *index) {
+    return index->map && index->capacity == 0 && index->entries;
+}
+
+static int index_is_mapped_paths(const index_t *index) {
+    return index->map && index->paths_capacity == 0 && index->paths;
+}
+
+void index_free(index_t *index) {
+    if (!index) return;
+    if (!index_is_mapped_entries(index)) free(index->entries);
+    if (!index_is_mapped_paths(index)) free(index->paths);
+    if (index->map) munmap(index->map, index->map_size);
+    index_trees_clear(index);
+    free(index->fsmonitor);
+    free(index);
+}
+
+const char *index_entry_path(const index_t *index, const index_entry_t *entry) {
+    return index->paths + entry->path_offset;
+}
+
+// Entries and paths are used straight out of the mapping until something
+// needs to grow them; then they are copied to the heap once
+static int index_make_writable(index_t *index) {
+    if (index_is_mapped_entries(index)) {
+        size_t capacity = index->entry_count < 16 ? 16 : index->entry_count;
+        index_entry_t *entries = malloc(capacity * sizeof(index_entry_t));
+        if (!entries) return -1;
+        memcpy(entries, index->entries, index->entry_count * sizeof(index_entry_t));
+        index->entries = entries;
+        index->capacity = capacity;
     }
     
-    uint32_t entry_count = *(uint32_t *)ptr;
-    ptr += 4;
+    if (index_is_mapped_paths(index)) {
+        size_t capacity = index->paths_len < 4096 ? 4096 : index->paths_len;
+        char *paths = malloc(capacity);
+        if (!paths) return -1;
+        memcpy(paths, index->paths, index->paths_len);
+        index->paths = paths;
+        index->paths_capacity = capacity;
+    }
     
-    // Allocate entries
-    index->entries = malloc(entry_count * sizeof(index_entry_t));
-    if (!index->entries && entry_count > 0) {
-        free(data);
-        return -1;
+    return 0;
+}
+
+// Copy a path into the pool, returning its offset
+static int index_intern_path(index_t *index, const char *path, size_t len, uint32_t *offset) {
+    if (index->paths_len + len + 1 > index->paths_capacity) {
+        size_t new_capacity = index->paths_capacity == 0 ? 4096 : index->paths_capacity;
+        while (index->paths_len + len + 1 > new_capacity) new_capacity *= 2;
+        if (new_capacity > UINT32_MAX) return -1;
+        
+        char *new_paths = realloc(index->paths, new_capacity);
+        if (!new_paths) return -1;
+        
+        index->paths = new_paths;
+        index->paths_capacity = new_capacity;
     }
     
-    index->entry_count = entry_count;
-    index->capacity = entry_count;
+    *offset = (uint32_t)index->paths_len;
+    memcpy(index->paths + index->paths_len, path, len);
+    index->paths[index->paths_len + len] = '\0';
+    index->paths_len += len + 1;
+    return 0;
+}
+
+static int index_read_v1(index_t *index, const char *data, size_t file_size) {
+    const char *ptr = data + 8;
+    
+    // Read entry count
+    if ((size_t)(ptr - data) + 4 > file_size) return -1;
+    
+    uint32_t entry_count = *(const uint32_t *)ptr;
+    ptr += 4;
     
-    // Read entries
+    // Read entries; v1 files were written sorted, so each add is an append
     for (size_t i = 0; i < entry_count; i++) {
-        index_entry_t *entry = &index->entries[i];
-        
         // Check bounds for path length
-        if ((size_t)(ptr - (char *)data) + 2 > file_size) {
-            free(data);
-            return -1;
-        }
+        if ((size_t)(ptr - data) + 2 > file_size) return -1;
         
         // Read path length
-        uint16_t path_len = *(uint16_t *)ptr;
+        uint16_t path_len = *(const uint16_t *)ptr;
         ptr += 2;
         
-        if (path_len >= sizeof(entry->path)) {
-            free(data);
-            return -1;
-        }
+        if (path_len >= PATH_MAX) return -1;
         
         // Check bounds for path + hash + metadata (20 + 4 + 8 + 8 + 4 = 44 bytes)
-        if ((size_t)(ptr - (char *)data) + path_len + 44 > file_size) {
-            free(data);
-            return -1;
-        }
+        if ((size_t)(ptr - data) + path_len + 44 > file_size) return -1;
         
-        // Read path
-        memcpy(entry->path, ptr, path_len);
-        entry->path[path_len] = '\0';
+        char path[PATH_MAX];
+        memcpy(path, ptr, path_len);
+        path[path_len] = '\0';
         ptr += path_len;
         
-        // Read hash
-        memcpy(entry->hash.hash, ptr, HASH_SIZE);
+        gyatt_hash_t hash;
+        memcpy(hash.hash, ptr, HASH_SIZE);
         ptr += HASH_SIZE;
         
-        // Read mode, size, mtime, flags
-        entry->mode = *(uint32_t *)ptr;
+        uint32_t mode = *(const uint32_t *)ptr;
         ptr += 4;
-        
-        entry->size = *(uint64_t *)ptr;
+        uint64_t size = *(const uint64_t *)ptr;
         ptr += 8;
-        
-        entry->mtime = *(uint64_t *)ptr;
+        uint64_t mtime = *(const uint64_t *)ptr;
         ptr += 8;
-        
-        entry->flags = *(uint32_t *)ptr;
+        uint32_t flags = *(const uint32_t *)ptr;
         ptr += 4;
+        
+        index_entry_t *entry = index_add_entry(index, path, &hash, mode, (size_t)size, (time_t)mtime);
+        if (!entry) return -1;
+        entry->flags = flags;
+    }
+    
+    // Read the stat-data extension, if there is one. Entries are sorted
+    // now, so look each one up rather than trusting file order.
+    size_t remaining = file_size - (size_t)(ptr - data);
+    if (remaining >= 8 && memcmp(ptr, INDEX_EXT_STAT, 4) == 0 && index->entry_count == entry_count) {
+        uint32_t ext_len = *(const uint32_t *)(ptr + 4);
+        
+        if (ext_len == entry_count * INDEX_EXT_STAT_ENTRY_SIZE && ext_len <= remaining - 8) {
+            const char *ext = ptr + 8;
+            const char *names = data + 12;
+            for (size_t i = 0; i < entry_count; i++) {
+                uint16_t path_len = *(const uint16_t *)names;
+                char path[PATH_MAX];
+                memcpy(path, names + 2, path_len);
+                path[path_len] = '\0';
+                names += 2 + path_len + 44;
+                
+                index_entry_t *entry = index_find_entry(index, path);
+                if (entry) {
+                    entry->mtime_nsec = *(const uint32_t *)ext;
+                    entry->ctime = *(const int64_t *)(ext + 4);
+                    entry->ctime_nsec = *(const uint32_t *)(ext + 12);
+                    entry->ino = *(const uint64_t *)(ext + 16);
+                    entry->dev = *(const uint64_t *)(ext + 24);
+                }
+                ext += INDEX_EXT_STAT_ENTRY_SIZE;
+            }
+        }
     }
     
-    free(data);
     return 0;
 }
 
-int index_write(index_t *index) {
-    if (!index) return -1;
+// Point the index at the mapped v2 file. Nothing is copied; this only
+// checks that the sizes add up, the checksum matches and paths are in bounds.
+static int index_attach_v2(index_t *index, char *data, size_t file_size) {
+    if (file_size < INDEX_V2_HEADER_SIZE + HASH_SIZE) return -1;
+    
+    uint32_t entry_count = *(const uint32_t *)(data + 8);
+    uint32_t paths_len = *(const uint32_t *)(data + 12);
+    
+    uint64_t expected = (uint64_t)INDEX_V2_HEADER_SIZE +
+                        (uint64_t)entry_count * sizeof(index_entry_t) +
+                        paths_len + HASH_SIZE;
+    if (expected > file_size) return -1;
+    
+    gyatt_hash_t checksum;
+    sha1_hash(data, file_size - HASH_SIZE, &checksum);
+    if (memcmp(checksum.hash, data + file_size - HASH_SIZE, HASH_SIZE) != 0) {
+        fprintf(stderr, "Error: Index checksum mismatch (index file is corrupt)\n");
+        return -1;
+    }
+    
+    index_entry_t *entries = (index_entry_t *)(data + INDEX_V2_HEADER_SIZE);
+    char *paths = (char *)(entries + entry_count);
+    
+    for (size_t i = 0; i < entry_count; i++) {
+        uint64_t end = (uint64_t)entries[i].path_offset + entries[i].path_len;
+        if (end >= paths_len || paths[end] != '\0') return -1;
+    }
+    
+    index->entries = entry_count > 0 ? entries : NULL;
+    index->entry_count = entry_count;
+    index->capacity = 0;
+    index->paths = paths_len > 0 ? paths : NULL;
+    index->paths_len = paths_len;
+    index->paths_capacity = 0;
+    
+    // Extensions sit between the path pool and the checksum; unknown ones
+    // are skipped so older builds can still read newer indexes
+    const char *ext = paths + paths_len;
+    const char *ext_end = data + file_size - HASH_SIZE;
+    while (ext_end - ext >= 8) {
+        uint32_t ext_len = *(const uint32_t *)(ext + 4);
+        if (ext_len > (size_t)(ext_end - ext) - 8) break;
+        if (memcmp(ext, INDEX_EXT_TREE, 4) == 0) index_read_trees(index, ext + 8, ext_len);
+        if (memcmp(ext, INDEX_EXT_FSMONITOR, 4) == 0) index_set_fsmonitor(index, ext + 8, ext_len);
+        ext += 8 + ext_len;
+    }
+    return 0;
+}
+
+static int index_load(gyatt_repo_t *repo, index_t *index);
+
+int index_read(gyatt_repo_t *repo, index_t *index) {
+    if (!repo || !index) return -1;
+    
+    trace_span_t span = trace_begin(TRACE_INDEX_READ);
+    int result = index_load(repo, index);
+    trace_end(span, index->map_size, 0);
+    return result;
+}
+
+static int index_load(gyatt_repo_t *repo, index_t *index) {
+    int fd = open(repo->index_path, O_RDONLY);
+    TRACE_SYSCALLS(4);  // open, fstat, mmap, close
+    if (fd < 0) {
+        // If index doesn't exist, that's okay - start with empty index
+        return errno == ENOENT ? 0 : -1;
+    }
     
-    // Sort entries by path for consistent ordering
-    if (index->entry_count > 0) {
-        qsort(index->entries, index->entry_count, sizeof(index_entry_t), entry_compare);
+    // Remember when the index was written, for racy-timestamp checks
+    struct stat index_st;
+    if (fstat(fd, &index_st) != 0) {
+        close(fd);
+        return -1;
     }
+    index->timestamp = index_st.st_mtime;
+    index->timestamp_nsec = (uint32_t)ST_MTIME_NSEC(&index_st);
     
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return -1;
+    size_t file_size = (size_t)index_st.st_size;
+    if (file_size < 8) {
+        close(fd);
+        return -1;
+    }
     
-    char *index_path = path_join(gyatt_dir, "index");
-    free(gyatt_dir);
+    // Private and writable: refreshing stat data in place only dirties the
+    // pages it touches, and never reaches the file
+    void *map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
     
-    buffer_t *buf = buffer_create(4096);
+    char *data = map;
     
-    // Write signature and version
+    // Check signature
+    if (memcmp(data, INDEX_SIGNATURE, 4) != 0) {
+        munmap(map, file_size);
+        return -1;
+    }
+    
+    // Check version
+    uint32_t version = *(const uint32_t *)(data + 4);
+    
+    int result = -1;
+    if (version == INDEX_VERSION) {
+        index->map = map;
+        index->map_size = file_size;
+        result = index_attach_v2(index, data, file_size);
+        if (result != 0) {
+            index->map = NULL;
+            index->map_size = 0;
+            munmap(map, file_size);
+        }
+    } else if (version == INDEX_V1_VERSION) {
+        result = index_read_v1(index, data, file_size);
+        munmap(map, file_size);
+    } else {
+        munmap(map, file_size);
+    }
+    
+    return result;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int index_store(gyatt_repo_t *repo, index_t *index, size_t *written);
+
+int index_write(gyatt_repo_t *repo, index_t *index) {
+    if (!repo || !index) return -1;
+    
+    trace_span_t span = trace_begin(TRACE_INDEX_WRITE);
+    size_t written = 0;
+    int result = index_store(repo, index, &written);
+    trace_end(span, written, 0);
+    return result;
+}
+
+static int index_store(gyatt_repo_t *repo, index_t *index, size_t *written) {
+    // Entries are kept sorted by path in memory, so they go out in order
+    buffer_t *buf = buffer_create(INDEX_V2_HEADER_SIZE + index->entry_count * sizeof(index_entry_t) +
+                                  index->paths_len + HASH_SIZE);
+    if (!buf) return -1;
+    
+    // The pool is rewritten in entry order, which drops paths left over
+    // from removed or re-added entries
+    uint32_t paths_len = 0;
+    for (size_t i = 0; i < index->entry_count; i++) {
+        paths_len += index->entries[i].path_len + 1;
+    }
+    
+    // Write signature, version, entry count and pool size
     buffer_append(buf, INDEX_SIGNATURE, 4);
     uint32_t version = INDEX_VERSION;
     buffer_append(buf, &version, 4);
-    
-    // Write entry count
     uint32_t count = (uint32_t)index->entry_count;
     buffer_append(buf, &count, 4);
+    buffer_append(buf, &paths_len, 4);
+    
+    // Anything modified in the current second could still change without
+    // its mtime moving; flag it so the next status hashes it once more
+    time_t now = time(NULL);
     
     // Write entries
+    uint32_t offset = 0;
     for (size_t i = 0; i < index->entry_count; i++) {
         index_entry_t *entry = &index->entries[i];
         
-        // Write path length and path
-        uint16_t path_len = (uint16_t)strlen(entry->path);
-        buffer_append(buf, &path_len, 2);
-        buffer_append(buf, entry->path, path_len);
-        
-        // Write hash
-        buffer_append(buf, entry->hash.hash, HASH_SIZE);
-        
-        // Write mode, size, mtime, flags
-        buffer_append(buf, &entry->mode, 4);
-        
-        uint64_t size64 = entry->size;
-        buffer_append(buf, &size64, 8);
-        
-        uint64_t mtime64 = entry->mtime;
-        buffer_append(buf, &mtime64, 8);
+        if (entry->mtime >= now) {
+            entry->flags |= INDEX_FLAG_RACY;
+        }
         
-        buffer_append(buf, &entry->flags, 4);
+        index_entry_t out = *entry;
+        out.path_offset = offset;
+        out.reserved = 0;
+        buffer_append(buf, &out, sizeof(out));
+        offset += entry->path_len + 1;
     }
     
-    int result = write_file(index_path, buf->data, buf->len);
+    // Write the path pool
+    for (size_t i = 0; i < index->entry_count; i++) {
+        buffer_append(buf, index_entry_path(index, &index->entries[i]), index->entries[i].path_len + 1);
+    }
+    
+    index_write_trees(index, buf);
+    index_write_fsmonitor(index, buf);
+    
+    // Trailing checksum over everything so far
+    gyatt_hash_t checksum;
+    sha1_hash(buf->data, buf->len, &checksum);
+    buffer_append(buf, checksum.hash, HASH_SIZE);
+    
+    // Write to index.lock and rename over the index, so readers see either
+    // the old file or the new one, and two writers can't interleave
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", repo->index_path);
+    
+    int fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            fprintf(stderr, "Error: Unable to create '%s': File exists.\n", lock_path);
+            fprintf(stderr, "Another gyatt process seems to be running in this repository.\n");
+        }
+        buffer_free(buf);
+        return -1;
+    }
+    
+    int result = write_all(fd, buf->data, buf->len);
+    if (close(fd) != 0) result = -1;
+    if (result == 0 && rename(lock_path, repo->index_path) != 0) result = -1;
+    if (result != 0) unlink(lock_path);
+    TRACE_SYSCALLS(4);  // open, write, close, rename
+    *written = buf->len;
     
-    free(index_path);
     buffer_free(buf);
     
     return result;
 }
 
-void index_add_entry(index_t *index, const char *path, const gyatt_hash_t *hash,
-                     uint32_t mode, size_t size, time_t mtime) {
-    if (!index || !path || !hash) return;
+// Binary search over the sorted entries. Returns 1 and the entry's position
+// if found, otherwise 0 and the position it would be inserted at.
+static int index_lookup(const index_t *index, const char *path, size_t *pos) {
+    size_t lo = 0, hi = index->entry_count;
+    
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index_entry_path(index, &index->entries[mid]), path);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    *pos = lo;
+    return 0;
+}
+
+index_entry_t *index_add_entry(index_t *index, const char *path, const gyatt_hash_t *hash,
+                               uint32_t mode, size_t size, time_t mtime) {
+    if (!index || !path || !hash) return NULL;
     
     // Check if entry already exists
-    index_entry_t *existing = index_find_entry(index, path);
-    if (existing) {
-        // Update existing entry
+    size_t pos;
+    if (index_lookup(index, path, &pos)) {
+        index_entry_t *existing = &index->entries[pos];
+        // Re-adding an unchanged file leaves the cached trees above it alone
+        if (existing->mode != mode || hash_compare(&existing->hash, hash) != 0) {
+            index_cache_tree_invalidate(index, path);
+        }
+        // Update existing entry; extended stat data is stale until set again
         hash_copy(&existing->hash, hash);
         existing->mode = mode;
         existing->size = size;
         existing->mtime = mtime;
-        return;
+        existing->mtime_nsec = 0;
+        existing->ctime = 0;
+        existing->ctime_nsec = 0;
+        existing->ino = 0;
+        existing->dev = 0;
+        existing->flags &= ~INDEX_FLAG_RACY;
+        return existing;
     }
     
     // Add new entry
+    index_cache_tree_invalidate(index, path);
+    size_t path_len = strlen(path);
+    uint32_t path_offset;
+    if (path_len >= PATH_MAX || index_make_writable(index) != 0 ||
+        index_intern_path(index, path, path_len, &path_offset) != 0) {
+        return NULL;
+    }
+    
     if (index->entry_count >= index->capacity) {
         size_t new_capacity = index->capacity == 0 ? 16 : index->capacity * 2;
         index_entry_t *new_entries = realloc(index->entries, 
                                               new_capacity * sizeof(index_entry_t));
-        if (!new_entries) return;
+        if (!new_entries) return NULL;
         
         index->entries = new_entries;
         index->capacity = new_capacity;
     }
     
-    index_entry_t *entry = &index->entries[index->entry_count++];
-    strncpy(entry->path, path, sizeof(entry->path) - 1);
-    entry->path[sizeof(entry->path) - 1] = '\0';
+    // Insert in sorted position; sorted input (the common case) just appends
+    if (pos < index->entry_count) {
+        memmove(&index->entries[pos + 1], &index->entries[pos],
+                (index->entry_count - pos) * sizeof(index_entry_t));
+    }
+    index->entry_count++;
+    
+    index_entry_t *entry = &index->entries[pos];
+    memset(entry, 0, sizeof(index_entry_t));
+    entry->path_offset = path_offset;
+    entry->path_len = (uint32_t)path_len;
     hash_copy(&entry->hash, hash);
     entry->mode = mode;
     entry->size = size;
     entry->mtime = mtime;
     entry->flags = 0;
+    
+    return entry;
+}
+
+// Record everything we compare on the status fast path
+void index_entry_set_stat(index_entry_t *entry, const struct stat *st) {
+    if (!entry || !st) return;
+    
+    entry->mode = st->st_mode & 0777;
+    entry->size = (size_t)st->st_size;
+    entry->mtime = st->st_mtime;
+    entry->mtime_nsec = (uint32_t)ST_MTIME_NSEC(st);
+    entry->ctime = st->st_ctime;
+    entry->ctime_nsec = (uint32_t)ST_CTIME_NSEC(st);
+    entry->ino = (uint64_t)st->st_ino;
+    entry->dev = (uint64_t)st->st_dev;
+    entry->flags &= ~INDEX_FLAG_RACY;
+}
+
+// True if the file looks exactly like it did when the entry was recorded
+int index_entry_stat_matches(const index_entry_t *entry, const struct stat *st) {
+    if (!entry || !st) return 0;
+    
+    return entry->size == (size_t)st->st_size &&
+           entry->mtime == st->st_mtime &&
+           entry->mtime_nsec == (uint32_t)ST_MTIME_NSEC(st) &&
+           entry->ctime == st->st_ctime &&
+           entry->ctime_nsec == (uint32_t)ST_CTIME_NSEC(st) &&
+           entry->ino == (uint64_t)st->st_ino &&
+           entry->dev == (uint64_t)st->st_dev &&
+           entry->mode == (uint32_t)(st->st_mode & 0777);
+}
+
+// An entry whose mtime is not older than the index file itself could have
+// been modified again after it was hashed without its mtime changing
+int index_entry_is_racy(const index_t *index, const index_entry_t *entry) {
+    if (!index || !entry) return 1;
+    if (entry->flags & INDEX_FLAG_RACY) return 1;
+    if (index->timestamp == 0) return 0;
+    
+    if (entry->mtime != index->timestamp) return entry->mtime > index->timestamp;
+    return entry->mtime_nsec >= index->timestamp_nsec;
 }
 
 index_entry_t *index_find_entry(index_t *index, const char *path) {
     if (!index || !path) return NULL;
     
-    for (size_t i = 0; i < index->entry_count; i++) {
-        if (strcmp(index->entries[i].path, path) == 0) {
-            return &index->entries[i];
-        }
-    }
+    size_t pos;
+    if (!index_lookup(index, path, &pos)) return NULL;
     
-    return NULL;
+    return &index->entries[pos];
 }
 
 int index_remove_entry(index_t *index, const char *path) {
     if (!index || !path) return -1;
     
-    for (size_t i = 0; i < index->entry_count; i++) {
-        if (strcmp(index->entries[i].path, path) == 0) {
-            // Shift remaining entries
-            memmove(&index->entries[i], &index->entries[i + 1],
-                    (index->entry_count - i - 1) * sizeof(index_entry_t));
-            index->entry_count--;
-            return 0;
-        }
-    }
-    
-    return -1;
-}
-
-// Get absolute path (simple implementation)
-static char *get_absolute_path(const char *path) {
-    char *result = malloc(PATH_MAX);
-    if (!result) return NULL;
-    
-    // If path is already absolute
-    if (path[0] == '/') {
-        strncpy(result, path, PATH_MAX - 1);
-        result[PATH_MAX - 1] = '\0';
-        return result;
-    }
+    size_t pos;
+    if (!index_lookup(index, path, &pos)) return -1;
+    if (index_make_writable(index) != 0) return -1;
+    index_cache_tree_invalidate(index, path);
     
-    // Get current directory and join
-    char *cwd = get_current_dir();
-    if (!cwd) {
-        free(result);
-        return NULL;
-    }
-    
-    snprintf(result, PATH_MAX, "%s/%s", cwd, path);
-    free(cwd);
-    
-    return result;
+    // Shift remaining entries
+    memmove(&index->entries[pos], &index->entries[pos + 1],
+            (index->entry_count - pos - 1) * sizeof(index_entry_t));
+    index->entry_count--;
+    return 0;
 }
 
-int index_add_file(index_t *index, const char *path) {
-    if (!index || !path) return -1;
+int index_add_file(gyatt_repo_t *repo, index_t *index, const char *path) {
+    if (!repo || !index || !path) return -1;
     
     // Get file stats
     struct stat st;
@@ -311,49 +762,25 @@ int index_add_file(index_t *index, const char *path) {
         return -1;
     }
     
-    // Create blob from file and write to object store
-    blob_object_t *blob = blob_from_file(path);
-    if (!blob) {
-        fprintf(stderr, "Error: Failed to read file '%s'\n", path);
-        return -1;
-    }
-    
-    if (blob_write(blob) != 0) {
-        fprintf(stderr, "Error: Failed to write blob for '%s'\n", path);
-        blob_free(blob);
-        return -1;
-    }
-    
     // Get relative path from repo root
-    char *repo_root = find_repo_root();
-    if (!repo_root) {
-        blob_free(blob);
+    char rel_path[PATH_MAX];
+    if (repo_relative_path(repo, path, rel_path, sizeof(rel_path)) != 0) {
+        fprintf(stderr, "Error: '%s' is outside the repository\n", path);
         return -1;
     }
     
-    char *abs_path = get_absolute_path(path);
-    if (!abs_path) {
-        free(repo_root);
-        blob_free(blob);
+    // Stream the file into the object store
+    gyatt_hash_t hash;
+    size_t size;
+    if (blob_write_file(repo, path, &hash, &size) != 0) {
+        fprintf(stderr, "Error: Failed to write blob for '%s'\n", path);
         return -1;
     }
     
-    // Calculate relative path
-    size_t root_len = strlen(repo_root);
-    const char *rel_path = abs_path;
-    
-    if (strncmp(abs_path, repo_root, root_len) == 0) {
-        rel_path = abs_path + root_len;
-        if (*rel_path == '/' || *rel_path == '\\') rel_path++;
-    }
-    
     // Add to index
-    index_add_entry(index, rel_path, &blob->header.hash, 
-                    st.st_mode & 0777, blob->header.size, st.st_mtime);
-    
-    free(abs_path);
-    free(repo_root);
-    blob_free(blob);
+    index_entry_t *entry = index_add_entry(index, rel_path, &hash, st.st_mode & 0777,
+                                           size, st.st_mtime);
+    if (entry) index_entry_set_stat(entry, &st);
     
     return 0;
 }
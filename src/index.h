@@ -3,37 +3,102 @@
 
 #include "gyatt.h"
 #include <time.h>
+#include <sys/stat.h>
 
-// Index entry representing a staged file
+// Entry flags
+#define INDEX_FLAG_RACY 0x0001   // Stat data recorded too close to an index write to trust
+
+// Index entry representing a staged file. This is also the v2 on-disk
+// entry: fixed-size, 8-byte aligned and read straight out of the mmapped
+// index, so keep the layout in sync with INDEX_VERSION.
 typedef struct {
-    char path[1024];           // File path relative to repo root
-    gyatt_hash_t hash;         // SHA-1 hash of file content
+    int64_t mtime;             // Modification time
+    int64_t ctime;
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t size;             // File size in bytes
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
     uint32_t mode;             // File mode/permissions
-    size_t size;               // File size in bytes
-    time_t mtime;              // Modification time
     uint32_t flags;            // Status flags
+    uint32_t path_offset;      // Into the index's path pool; use index_entry_path()
+    uint32_t path_len;
+    gyatt_hash_t hash;         // SHA-1 hash of file content
+    uint32_t reserved;
 } index_entry_t;
 
+// A cached tree: the hash last written for one directory's tree object,
+// and how many index entries (at any depth) it covered
+typedef struct {
+    char *dir;                 // Relative to the repo root; "" is the root
+    uint32_t entry_count;
+    int valid;                 // Cleared once anything under dir changes
+    gyatt_hash_t hash;
+} index_tree_t;
+
 // Index structure (staging area)
 typedef struct {
     index_entry_t *entries;
     size_t entry_count;
-    size_t capacity;
+    size_t capacity;           // 0 while entries still live in the mapping
+    
+    // NUL-terminated paths, relative to the repo root
+    char *paths;
+    size_t paths_len;
+    size_t paths_capacity;     // 0 while the pool still lives in the mapping
+    
+    // The index file, mapped read-only-private; entries and paths point
+    // into it until the first add/remove copies them out
+    void *map;
+    size_t map_size;
+    
+    // Modification time of the index file when it was read; entries
+    // modified at or after this moment are "racily clean"
+    time_t timestamp;
+    uint32_t timestamp_nsec;
+    
+    // Cached trees (the TREE extension), sorted by dir
+    index_tree_t *trees;
+    size_t tree_count;
+    size_t tree_capacity;
+    
+    // The FSMN extension: what status last heard from the fsmonitor
+    // daemon, kept as-is (see fsmonitor.h for what's in it)
+    char *fsmonitor;
+    size_t fsmonitor_len;
 } index_t;
 
 // Index operations
 index_t *index_create(void);
 void index_free(index_t *index);
 
-int index_read(index_t *index);
-int index_write(index_t *index);
+int index_read(gyatt_repo_t *repo, index_t *index);
+int index_write(gyatt_repo_t *repo, index_t *index);
 
-void index_add_entry(index_t *index, const char *path, const gyatt_hash_t *hash,
-                     uint32_t mode, size_t size, time_t mtime);
+index_entry_t *index_add_entry(index_t *index, const char *path, const gyatt_hash_t *hash,
+                               uint32_t mode, size_t size, time_t mtime);
 index_entry_t *index_find_entry(index_t *index, const char *path);
+const char *index_entry_path(const index_t *index, const index_entry_t *entry);
 int index_remove_entry(index_t *index, const char *path);
 
+// Stat-data cache
+void index_entry_set_stat(index_entry_t *entry, const struct stat *st);
+int index_entry_stat_matches(const index_entry_t *entry, const struct stat *st);
+int index_entry_is_racy(const index_t *index, const index_entry_t *entry);
+
+// Cached trees. get returns 1 and the hash if dir has a valid tree that
+// still covers entry_count entries; add/remove invalidate every directory
+// above the path they touch, so only trees along changed paths get rebuilt.
+int index_cache_tree_get(const index_t *index, const char *dir, size_t dir_len,
+                         size_t entry_count, gyatt_hash_t *hash);
+int index_cache_tree_set(index_t *index, const char *dir, size_t dir_len,
+                         size_t entry_count, const gyatt_hash_t *hash);
+void index_cache_tree_invalidate(index_t *index, const char *path);
+
+// Replace the fsmonitor state (NULL drops it)
+int index_set_fsmonitor(index_t *index, const void *data, size_t len);
+
 // Add file to index
-int index_add_file(index_t *index, const char *path);
+int index_add_file(gyatt_repo_t *repo, index_t *index, const char *path);
 
 #endif // INDEX_H
@@ -0,0 +1,239 @@
+#include "car.h"
+#include "../hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The header has a fixed size with exactly one root: varint 0x3a, then
+// A2 65 "roots" 81 D8 2A 58 25 00 <CID> 67 "version" 01. Room for it is
+// left at the start and it's filled in once the root is known.
+#define CAR_HEADER_SIZE (1 + 58)
+
+struct car_writer {
+    FILE *file;
+    size_t count;
+};
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (unsigned char)value;
+    return len;
+}
+
+car_writer_t *car_writer_create(const char *dir, char *path, size_t path_size) {
+    if (snprintf(path, path_size, "%s/tmp_car_XXXXXX", dir) >= (int)path_size) return NULL;
+
+    car_writer_t *car = calloc(1, sizeof(car_writer_t));
+    if (!car) return NULL;
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        free(car);
+        return NULL;
+    }
+    car->file = fdopen(fd, "wb");
+    if (!car->file) {
+        close(fd);
+        unlink(path);
+        free(car);
+        return NULL;
+    }
+
+    unsigned char placeholder[CAR_HEADER_SIZE] = {0};
+    if (fwrite(placeholder, 1, sizeof(placeholder), car->file) != sizeof(placeholder)) {
+        car_writer_abort(car);
+        unlink(path);
+        return NULL;
+    }
+    return car;
+}
+
+int car_writer_block(car_writer_t *car, uint8_t codec, const void *head, size_t head_len,
+                     const void *data, size_t len, unsigned char cid[CAR_CID_SIZE]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    if (head_len > 0) sha256_update(&ctx, head, head_len);
+    sha256_update(&ctx, data, len);
+
+    cid[0] = 0x01;
+    cid[1] = codec;
+    cid[2] = 0x12;
+    cid[3] = 0x20;
+    sha256_final(&ctx, cid + 4);
+
+    unsigned char prefix[10];
+    size_t prefix_len = put_varint(prefix, CAR_CID_SIZE + head_len + len);
+    if (fwrite(prefix, 1, prefix_len, car->file) != prefix_len ||
+        fwrite(cid, 1, CAR_CID_SIZE, car->file) != CAR_CID_SIZE ||
+        (head_len > 0 && fwrite(head, 1, head_len, car->file) != head_len) ||
+        (len > 0 && fwrite(data, 1, len, car->file) != len)) {
+        fprintf(stderr, "Error: Failed to write CAR block\n");
+        return -1;
+    }
+    car->count++;
+    return 0;
+}
+
+size_t car_writer_count(const car_writer_t *car) {
+    return car->count;
+}
+
+int car_writer_finish(car_writer_t *car, const unsigned char root[CAR_CID_SIZE]) {
+    buffer_t *header = buffer_create(CAR_HEADER_SIZE);
+    if (!header) {
+        car_writer_abort(car);
+        return -1;
+    }
+    buffer_append_char(header, (char)(CAR_HEADER_SIZE - 1));
+    cbor_map(header, 2);
+    cbor_text(header, "roots");
+    cbor_array(header, 1);
+    cbor_link(header, root, CAR_CID_SIZE);
+    cbor_text(header, "version");
+    buffer_append_char(header, 0x01);
+
+    int result = 0;
+    if (header->len != CAR_HEADER_SIZE || fseek(car->file, 0, SEEK_SET) != 0 ||
+        fwrite(header->data, 1, header->len, car->file) != header->len) {
+        result = -1;
+    }
+    buffer_free(header);
+
+    if (fclose(car->file) != 0) result = -1;
+    if (result != 0) fprintf(stderr, "Error: Failed to write CAR file\n");
+    free(car);
+    return result;
+}
+
+void car_writer_abort(car_writer_t *car) {
+    if (!car) return;
+    fclose(car->file);
+    free(car);
+}
+
+// ==================== dag-cbor ====================
+
+static void cbor_head(buffer_t *buf, uint8_t major, uint64_t value) {
+    unsigned char out[9];
+    size_t len;
+    major <<= 5;
+    if (value < 24) {
+        out[0] = major | (uint8_t)value;
+        len = 1;
+    } else if (value <= 0xff) {
+        out[0] = major | 24;
+        out[1] = (unsigned char)value;
+        len = 2;
+    } else if (value <= 0xffff) {
+        out[0] = major | 25;
+        out[1] = (unsigned char)(value >> 8);
+        out[2] = (unsigned char)value;
+        len = 3;
+    } else if (value <= 0xffffffff) {
+        out[0] = major | 26;
+        for (int i = 0; i < 4; i++) out[1 + i] = (unsigned char)(value >> (24 - 8 * i));
+        len = 5;
+    } else {
+        out[0] = major | 27;
+        for (int i = 0; i < 8; i++) out[1 + i] = (unsigned char)(value >> (56 - 8 * i));
+        len = 9;
+    }
+    buffer_append(buf, out, len);
+}
+
+void cbor_map(buffer_t *buf, size_t pairs) {
+    cbor_head(buf, 5, pairs);
+}
+
+void cbor_array(buffer_t *buf, size_t items) {
+    cbor_head(buf, 4, items);
+}
+
+void cbor_text(buffer_t *buf, const char *text) {
+    size_t len = strlen(text);
+    cbor_head(buf, 3, len);
+    buffer_append(buf, text, len);
+}
+
+void cbor_link(buffer_t *buf, const unsigned char *cid, size_t len) {
+    cbor_head(buf, 6, 42);
+    // Byte string of the CID behind a zero byte (the old multibase prefix)
+    cbor_head(buf, 2, len + 1);
+    buffer_append_char(buf, 0x00);
+    buffer_append(buf, cid, len);
+}
+
+// Major type and argument of the next value; p is moved past the head
+static int cbor_read_head(const unsigned char **p, const unsigned char *end, uint8_t *major, uint64_t *value) {
+    if (*p >= end) return -1;
+    uint8_t initial = *(*p)++;
+    *major = initial >> 5;
+    uint8_t info = initial & 31;
+    if (info < 24) {
+        *value = info;
+        return 0;
+    }
+    if (info > 27) return -1;
+
+    size_t bytes = (size_t)1 << (info - 24);
+    if ((size_t)(end - *p) < bytes) return -1;
+    *value = 0;
+    for (size_t i = 0; i < bytes; i++) *value = (*value << 8) | *(*p)++;
+    return 0;
+}
+
+static int cbor_read_kind(cbor_reader_t *r, uint8_t want, uint64_t *value) {
+    const unsigned char *p = r->pos;
+    uint8_t major;
+    if (cbor_read_head(&p, r->end, &major, value) != 0 || major != want) return -1;
+    r->pos = p;
+    return 0;
+}
+
+int cbor_read_map(cbor_reader_t *r, size_t *pairs) {
+    uint64_t value;
+    if (cbor_read_kind(r, 5, &value) != 0) return -1;
+    *pairs = (size_t)value;
+    return 0;
+}
+
+int cbor_read_array(cbor_reader_t *r, size_t *items) {
+    uint64_t value;
+    if (cbor_read_kind(r, 4, &value) != 0) return -1;
+    *items = (size_t)value;
+    return 0;
+}
+
+int cbor_read_text(cbor_reader_t *r, const char **text, size_t *len) {
+    cbor_reader_t start = *r;
+    uint64_t value;
+    if (cbor_read_kind(r, 3, &value) != 0) return -1;
+    if (value > (uint64_t)(r->end - r->pos)) {
+        *r = start;
+        return -1;
+    }
+    *text = (const char *)r->pos;
+    *len = (size_t)value;
+    r->pos += value;
+    return 0;
+}
+
+int cbor_read_link(cbor_reader_t *r, const unsigned char **cid, size_t *len) {
+    cbor_reader_t start = *r;
+    uint64_t tag, value;
+    if (cbor_read_kind(r, 6, &tag) != 0 || tag != 42 || cbor_read_kind(r, 2, &value) != 0 ||
+        value < 2 || value > (uint64_t)(r->end - r->pos) || r->pos[0] != 0x00) {
+        *r = start;
+        return -1;
+    }
+    *cid = r->pos + 1;
+    *len = (size_t)value - 1;
+    r->pos += value;
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef CAR_H
+#define CAR_H
+
+#include "../buffer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// CARv1 files, for handing IPFS a whole graph of blocks in one request:
+//
+//   varint length | dag-cbor {"roots": [root CID], "version": 1}
+//   then per block: varint(CID + data length) | CID | data
+//
+// Every CID written here is a CIDv1 with a sha2-256 multihash:
+//   0x01 | codec | 0x12 0x20 | digest[32]
+#define CAR_CID_SIZE 36
+#define CAR_CODEC_RAW 0x55
+#define CAR_CODEC_DAG_CBOR 0x71
+
+typedef struct car_writer car_writer_t;
+
+// A temp file in dir; path gets its name (the caller unlinks it when done)
+car_writer_t *car_writer_create(const char *dir, char *path, size_t path_size);
+// The data of a block can come in two pieces (head may be NULL), which
+// saves gluing a loose object's header onto its payload first. cid gets
+// the block's CID.
+int car_writer_block(car_writer_t *car, uint8_t codec, const void *head, size_t head_len,
+                     const void *data, size_t len, unsigned char cid[CAR_CID_SIZE]);
+size_t car_writer_count(const car_writer_t *car);
+// Writes the header naming root and closes the file; frees car either way
+int car_writer_finish(car_writer_t *car, const unsigned char root[CAR_CID_SIZE]);
+void car_writer_abort(car_writer_t *car);
+
+// The little bit of dag-cbor the nodes linking blocks together need.
+// Map keys must be added in dag-cbor order: shorter first, then bytewise.
+void cbor_map(buffer_t *buf, size_t pairs);
+void cbor_array(buffer_t *buf, size_t items);
+void cbor_text(buffer_t *buf, const char *text);
+// A link (tag 42) to any binary CID, CIDv0 multihashes included
+void cbor_link(buffer_t *buf, const unsigned char *cid, size_t len);
+
+// Reading nodes back a value at a time; each returns -1 (and doesn't
+// move) if the next value isn't that kind or runs past the end
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+} cbor_reader_t;
+
+int cbor_read_map(cbor_reader_t *r, size_t *pairs);
+int cbor_read_array(cbor_reader_t *r, size_t *items);
+// Points into the node, not terminated
+int cbor_read_text(cbor_reader_t *r, const char **text, size_t *len);
+int cbor_read_link(cbor_reader_t *r, const unsigned char **cid, size_t *len);
+
+#endif // CAR_H
@@ -0,0 +1,645 @@
+#include "cid_map.h"
+#include "../buffer.h"
+#include "../hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+#define CID_FORM_TEXT   0
+#define CID_FORM_BASE58 1    // CIDv0: base58btc multihash, "Qm..."
+#define CID_FORM_BASE32 2    // CIDv1: multibase 'b' + base32 lower
+
+#define CID_TEXT_MAX 255
+#define CID_HEADER_SIZE (4 + 4 + 4 + 8)
+#define CID_FANOUT_SIZE (256 * 4)
+
+static const char BASE58[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+static const char BASE32[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+// An entry appended since the idx was written
+typedef struct {
+    gyatt_hash_t hash;
+    uint32_t offset;         // Record (form | length | bytes) in tail_records
+} tail_entry_t;
+
+struct cid_map {
+    char log_path[PATH_MAX];
+    char idx_path[PATH_MAX];
+    int log_fd;
+
+    unsigned char *idx;      // mmapped, NULL if there's no idx yet
+    size_t idx_size;
+    uint32_t count;
+    uint64_t covered;        // Log bytes the idx already holds
+    const unsigned char *fanout;
+    const unsigned char *hashes;
+    const unsigned char *offsets;
+    const unsigned char *records;
+    size_t records_size;
+
+    tail_entry_t *tail;
+    size_t tail_count;
+    size_t tail_capacity;
+    buffer_t *tail_records;
+    int32_t *slots;          // Open addressing over tail, -1 if empty
+    size_t slot_capacity;    // Power of two
+};
+
+static uint32_t read_u32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t read_u64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// ==================== CID encodings ====================
+
+static size_t base58_decode(const char *text, unsigned char *out, size_t out_size) {
+    size_t len = 0;   // Bytes of out in use, big-endian, right-aligned at the end
+    size_t zeros = 0;
+    while (text[zeros] == '1') zeros++;
+
+    for (const char *p = text + zeros; *p; p++) {
+        const char *digit = strchr(BASE58, *p);
+        if (!digit) return 0;
+        unsigned carry = (unsigned)(digit - BASE58);
+        for (size_t i = 0; i < len; i++) {
+            carry += (unsigned)out[out_size - 1 - i] * 58;
+            out[out_size - 1 - i] = carry & 0xff;
+            carry >>= 8;
+        }
+        while (carry) {
+            if (len >= out_size) return 0;
+            out[out_size - 1 - len++] = carry & 0xff;
+            carry >>= 8;
+        }
+    }
+
+    if (len + zeros > out_size) return 0;
+    memmove(out + zeros, out + out_size - len, len);
+    memset(out, 0, zeros);
+    return zeros + len;
+}
+
+static int base58_encode(const unsigned char *data, size_t size, char *out, size_t out_size) {
+    unsigned char digits[CID_TEXT_MAX * 2];
+    size_t len = 0;
+    size_t zeros = 0;
+    while (zeros < size && data[zeros] == 0) zeros++;
+
+    for (size_t i = zeros; i < size; i++) {
+        unsigned carry = data[i];
+        for (size_t j = 0; j < len; j++) {
+            carry += (unsigned)digits[j] << 8;
+            digits[j] = carry % 58;
+            carry /= 58;
+        }
+        while (carry) {
+            if (len >= sizeof(digits)) return -1;
+            digits[len++] = carry % 58;
+            carry /= 58;
+        }
+    }
+
+    if (zeros + len + 1 > out_size) return -1;
+    size_t pos = 0;
+    for (size_t i = 0; i < zeros; i++) out[pos++] = '1';
+    for (size_t i = len; i-- > 0;) out[pos++] = BASE58[digits[i]];
+    out[pos] = '\0';
+    return 0;
+}
+
+static size_t base32_decode(const char *text, unsigned char *out, size_t out_size) {
+    size_t len = 0;
+    uint32_t bits = 0;
+    int count = 0;
+    for (const char *p = text; *p; p++) {
+        const char *digit = strchr(BASE32, *p);
+        if (!digit) return 0;
+        bits = (bits << 5) | (uint32_t)(digit - BASE32);
+        count += 5;
+        if (count >= 8) {
+            count -= 8;
+            if (len >= out_size) return 0;
+            out[len++] = (bits >> count) & 0xff;
+        }
+    }
+    return len;
+}
+
+static int base32_encode(const unsigned char *data, size_t size, char *out, size_t out_size) {
+    size_t pos = 0;
+    uint32_t bits = 0;
+    int count = 0;
+    for (size_t i = 0; i < size; i++) {
+        bits = (bits << 8) | data[i];
+        count += 8;
+        while (count >= 5) {
+            count -= 5;
+            if (pos + 1 >= out_size) return -1;
+            out[pos++] = BASE32[(bits >> count) & 31];
+        }
+    }
+    if (count > 0) {
+        if (pos + 1 >= out_size) return -1;
+        out[pos++] = BASE32[(bits << (5 - count)) & 31];
+    }
+    out[pos] = '\0';
+    return 0;
+}
+
+static int decode_record(const unsigned char *record, char *cid, size_t cid_size) {
+    const unsigned char *bytes = record + 2;
+    size_t len = record[1];
+
+    switch (record[0]) {
+    case CID_FORM_BASE58:
+        return base58_encode(bytes, len, cid, cid_size);
+    case CID_FORM_BASE32:
+        if (cid_size < 2) return -1;
+        cid[0] = 'b';
+        return base32_encode(bytes, len, cid + 1, cid_size - 1);
+    case CID_FORM_TEXT:
+        if (len + 1 > cid_size) return -1;
+        memcpy(cid, bytes, len);
+        cid[len] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+// record gets form | length | bytes; binary only where it decodes back to
+// exactly the same text
+static int encode_record(const char *cid, unsigned char record[2 + CID_TEXT_MAX]) {
+    size_t text_len = strlen(cid);
+    if (text_len == 0 || text_len > CID_TEXT_MAX) return -1;
+
+    unsigned char *bytes = record + 2;
+    size_t len = 0;
+    int form = CID_FORM_TEXT;
+    if (cid[0] == 'Q' && cid[1] == 'm') {
+        len = base58_decode(cid, bytes, CID_TEXT_MAX);
+        form = CID_FORM_BASE58;
+    } else if (cid[0] == 'b') {
+        len = base32_decode(cid + 1, bytes, CID_TEXT_MAX);
+        form = CID_FORM_BASE32;
+    }
+
+    if (len > 0) {
+        record[0] = (unsigned char)form;
+        record[1] = (unsigned char)len;
+        char check[CID_TEXT_MAX + 2];
+        if (decode_record(record, check, sizeof(check)) == 0 && strcmp(check, cid) == 0) return 0;
+    }
+
+    record[0] = CID_FORM_TEXT;
+    record[1] = (unsigned char)text_len;
+    memcpy(bytes, cid, text_len);
+    return 0;
+}
+
+size_t cid_parse(const char *text, unsigned char *out, size_t out_size) {
+    unsigned char record[2 + CID_TEXT_MAX];
+    if (encode_record(text, record) != 0 || record[0] == CID_FORM_TEXT || record[1] > out_size) return 0;
+    memcpy(out, record + 2, record[1]);
+    return record[1];
+}
+
+int cid_format(const unsigned char *cid, size_t len, char *text, size_t text_size) {
+    if (len == 0 || len > CID_TEXT_MAX) return -1;
+    unsigned char record[2 + CID_TEXT_MAX];
+    // sha2-256 multihash on its own is a CIDv0
+    record[0] = len == 34 && cid[0] == 0x12 && cid[1] == 0x20 ? CID_FORM_BASE58 : CID_FORM_BASE32;
+    record[1] = (unsigned char)len;
+    memcpy(record + 2, cid, len);
+    return decode_record(record, text, text_size);
+}
+
+// ==================== Lookups ====================
+
+static size_t slot_of(const cid_map_t *map, const gyatt_hash_t *hash) {
+    uint64_t v;
+    memcpy(&v, hash->hash, sizeof(v));
+    return (size_t)v & (map->slot_capacity - 1);
+}
+
+static const unsigned char *tail_find(const cid_map_t *map, const gyatt_hash_t *hash) {
+    if (map->tail_count == 0) return NULL;
+    for (size_t i = slot_of(map, hash);; i = (i + 1) & (map->slot_capacity - 1)) {
+        int32_t e = map->slots[i];
+        if (e < 0) return NULL;
+        if (memcmp(map->tail[e].hash.hash, hash->hash, HASH_SIZE) == 0) {
+            return (const unsigned char *)map->tail_records->data + map->tail[e].offset;
+        }
+    }
+}
+
+// Position of hash among the idx's sorted hashes, or -1
+static int64_t idx_find(const cid_map_t *map, const gyatt_hash_t *hash) {
+    if (!map->idx || map->count == 0) return -1;
+
+    unsigned byte = hash->hash[0];
+    uint32_t lo = byte == 0 ? 0 : read_u32(map->fanout + (byte - 1) * 4);
+    uint32_t hi = read_u32(map->fanout + byte * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(map->hashes + (size_t)mid * HASH_SIZE, hash->hash, HASH_SIZE);
+        if (cmp == 0) return mid;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+static const unsigned char *idx_record(const cid_map_t *map, uint32_t pos) {
+    uint32_t offset = read_u32(map->offsets + (size_t)pos * 4);
+    if (offset + 2 > map->records_size || offset + 2 + map->records[offset + 1] > map->records_size) {
+        return NULL;
+    }
+    return map->records + offset;
+}
+
+static const unsigned char *find_record(const cid_map_t *map, const gyatt_hash_t *hash) {
+    // What's been appended since overrides the idx
+    const unsigned char *record = tail_find(map, hash);
+    if (record) return record;
+
+    int64_t pos = idx_find(map, hash);
+    return pos >= 0 ? idx_record(map, (uint32_t)pos) : NULL;
+}
+
+int cid_map_get(const cid_map_t *map, const gyatt_hash_t *hash, char *cid, size_t cid_size) {
+    if (!map || !hash || !cid) return -1;
+    const unsigned char *record = find_record(map, hash);
+    return record ? decode_record(record, cid, cid_size) : -1;
+}
+
+int cid_map_has(const cid_map_t *map, const gyatt_hash_t *hash) {
+    return map && hash && find_record(map, hash) != NULL;
+}
+
+size_t cid_map_count(const cid_map_t *map) {
+    return map ? map->count + map->tail_count : 0;
+}
+
+static int hash_sort_compare(const void *a, const void *b) {
+    return memcmp(a, b, HASH_SIZE);
+}
+
+size_t cid_map_missing(const cid_map_t *map, const gyatt_hash_t *hashes, size_t count,
+                       gyatt_hash_t *missing) {
+    if (!map || count == 0) return 0;
+
+    memmove(missing, hashes, count * sizeof(gyatt_hash_t));
+    qsort(missing, count, sizeof(gyatt_hash_t), hash_sort_compare);
+
+    // Both sides sorted, so the idx is walked once, front to back
+    size_t out = 0;
+    uint32_t pos = 0;
+    gyatt_hash_t previous;
+    for (size_t i = 0; i < count; i++) {
+        gyatt_hash_t hash = missing[i];
+        if (i > 0 && memcmp(previous.hash, hash.hash, HASH_SIZE) == 0) continue;
+        previous = hash;
+
+        int found = tail_find(map, &hash) != NULL;
+        while (!found && map->idx && pos < map->count) {
+            int cmp = memcmp(map->hashes + (size_t)pos * HASH_SIZE, hash.hash, HASH_SIZE);
+            if (cmp > 0) break;
+            pos++;
+            found = cmp == 0;
+        }
+        if (!found) missing[out++] = hash;
+    }
+    return out;
+}
+
+// ==================== Writing ====================
+
+static int tail_grow_slots(cid_map_t *map) {
+    size_t capacity = map->slot_capacity ? map->slot_capacity * 2 : 256;
+    int32_t *slots = malloc(capacity * sizeof(int32_t));
+    if (!slots) return -1;
+    memset(slots, 0xff, capacity * sizeof(int32_t));
+
+    free(map->slots);
+    map->slots = slots;
+    map->slot_capacity = capacity;
+    for (size_t e = 0; e < map->tail_count; e++) {
+        size_t i = slot_of(map, &map->tail[e].hash);
+        while (slots[i] >= 0) i = (i + 1) & (capacity - 1);
+        slots[i] = (int32_t)e;
+    }
+    return 0;
+}
+
+// Remember a record in memory; a later one for the same hash replaces it
+static int tail_insert(cid_map_t *map, const gyatt_hash_t *hash, const unsigned char *record) {
+    if ((map->tail_count + 1) * 2 > map->slot_capacity && tail_grow_slots(map) != 0) return -1;
+
+    size_t i = slot_of(map, hash);
+    while (map->slots[i] >= 0) {
+        tail_entry_t *entry = &map->tail[map->slots[i]];
+        if (memcmp(entry->hash.hash, hash->hash, HASH_SIZE) == 0) {
+            entry->offset = (uint32_t)map->tail_records->len;
+            buffer_append(map->tail_records, record, 2 + record[1]);
+            return 0;
+        }
+        i = (i + 1) & (map->slot_capacity - 1);
+    }
+
+    if (map->tail_count >= map->tail_capacity) {
+        size_t capacity = map->tail_capacity ? map->tail_capacity * 2 : 256;
+        tail_entry_t *grown = realloc(map->tail, capacity * sizeof(tail_entry_t));
+        if (!grown) return -1;
+        map->tail = grown;
+        map->tail_capacity = capacity;
+    }
+
+    tail_entry_t *entry = &map->tail[map->tail_count];
+    entry->hash = *hash;
+    entry->offset = (uint32_t)map->tail_records->len;
+    buffer_append(map->tail_records, record, 2 + record[1]);
+    map->slots[i] = (int32_t)map->tail_count++;
+    return 0;
+}
+
+int cid_map_put(cid_map_t *map, const gyatt_hash_t *hash, const char *cid) {
+    if (!map || !hash || !cid) return -1;
+
+    unsigned char record[HASH_SIZE + 2 + CID_TEXT_MAX];
+    memcpy(record, hash->hash, HASH_SIZE);
+    if (encode_record(cid, record + HASH_SIZE) != 0) {
+        fprintf(stderr, "Error: CID too long to map: %s\n", cid);
+        return -1;
+    }
+
+    // One write per mapping; O_APPEND keeps each record whole
+    size_t len = HASH_SIZE + 2 + record[HASH_SIZE + 1];
+    ssize_t written;
+    do {
+        written = write(map->log_fd, record, len);
+    } while (written < 0 && errno == EINTR);
+    if (written != (ssize_t)len) {
+        fprintf(stderr, "Error: Failed to append to %s\n", map->log_path);
+        return -1;
+    }
+
+    return tail_insert(map, hash, record + HASH_SIZE);
+}
+
+static void unmap_idx(cid_map_t *map) {
+    if (map->idx) munmap(map->idx, map->idx_size);
+    map->idx = NULL;
+    map->idx_size = 0;
+    map->count = 0;
+    map->covered = 0;
+}
+
+// A missing or damaged idx just means everything comes from the log
+static void map_idx(cid_map_t *map) {
+    int fd = open(map->idx_path, O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= CID_HEADER_SIZE + CID_FANOUT_SIZE + HASH_SIZE) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return;
+
+    unsigned char *idx = data;
+    size_t size = (size_t)st.st_size;
+    uint32_t count = read_u32(idx + 8);
+    size_t sorted_end = CID_HEADER_SIZE + CID_FANOUT_SIZE + (size_t)count * (HASH_SIZE + 4);
+
+    gyatt_hash_t checksum;
+    sha1_hash(idx, size - HASH_SIZE, &checksum);
+    if (memcmp(idx, CID_MAP_SIGNATURE, 4) != 0 || read_u32(idx + 4) != CID_MAP_VERSION ||
+        sorted_end > size - HASH_SIZE || memcmp(checksum.hash, idx + size - HASH_SIZE, HASH_SIZE) != 0 ||
+        read_u32(idx + CID_HEADER_SIZE + 255 * 4) != count) {
+        fprintf(stderr, "Warning: Ignoring damaged %s\n", map->idx_path);
+        munmap(data, size);
+        return;
+    }
+
+    map->idx = idx;
+    map->idx_size = size;
+    map->count = count;
+    map->covered = read_u64(idx + 12);
+    map->fanout = idx + CID_HEADER_SIZE;
+    map->hashes = map->fanout + CID_FANOUT_SIZE;
+    map->offsets = map->hashes + (size_t)count * HASH_SIZE;
+    map->records = map->offsets + (size_t)count * 4;
+    map->records_size = size - HASH_SIZE - sorted_end;
+}
+
+// Replay what the idx doesn't have yet. A record cut short by a crash is
+// dropped, so the next append starts on a record boundary.
+static int replay_log(cid_map_t *map) {
+    struct stat st;
+    if (fstat(map->log_fd, &st) != 0) return -1;
+    uint64_t size = (uint64_t)st.st_size;
+    // An idx from before the log was emptied by hand covers nothing there
+    if (map->covered > size) map->covered = 0;
+    if (size == map->covered) return 0;
+
+    size_t len = (size_t)(size - map->covered);
+    unsigned char *data = malloc(len);
+    if (!data) return -1;
+
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(map->log_fd, data + got, len - got, (off_t)(map->covered + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+
+    size_t pos = 0;
+    while (pos + HASH_SIZE + 2 <= got && pos + HASH_SIZE + 2 + data[pos + HASH_SIZE + 1] <= got) {
+        gyatt_hash_t hash;
+        memcpy(hash.hash, data + pos, HASH_SIZE);
+        if (tail_insert(map, &hash, data + pos + HASH_SIZE) != 0) {
+            free(data);
+            return -1;
+        }
+        pos += HASH_SIZE + 2 + data[pos + HASH_SIZE + 1];
+    }
+    free(data);
+
+    if (pos < len && ftruncate(map->log_fd, (off_t)(map->covered + pos)) != 0) return -1;
+    return 0;
+}
+
+cid_map_t *cid_map_open(const char *gyatt_dir, const char *name) {
+    if (!gyatt_dir || !name) return NULL;
+
+    cid_map_t *map = calloc(1, sizeof(cid_map_t));
+    if (!map) return NULL;
+    map->log_fd = -1;
+    snprintf(map->log_path, sizeof(map->log_path), "%s/%s.log", gyatt_dir, name);
+    snprintf(map->idx_path, sizeof(map->idx_path), "%s/%s.idx", gyatt_dir, name);
+
+    map->tail_records = buffer_create(4096);
+    map->log_fd = open(map->log_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (!map->tail_records || map->log_fd < 0) {
+        fprintf(stderr, "Error: Can't open %s\n", map->log_path);
+        cid_map_close(map);
+        return NULL;
+    }
+
+    map_idx(map);
+    if (replay_log(map) != 0) {
+        fprintf(stderr, "Error: Failed to read %s\n", map->log_path);
+        cid_map_close(map);
+        return NULL;
+    }
+    return map;
+}
+
+typedef struct {
+    const unsigned char *hash;
+    const unsigned char *record;
+} merged_t;
+
+static int merged_compare(const void *a, const void *b) {
+    return memcmp(((const merged_t *)a)->hash, ((const merged_t *)b)->hash, HASH_SIZE);
+}
+
+static void append_u32(buffer_t *buf, uint32_t v) {
+    buffer_append(buf, &v, 4);
+}
+
+int cid_map_compact(cid_map_t *map) {
+    if (!map) return -1;
+    if (map->tail_count == 0) return 0;
+
+    size_t total = map->count + map->tail_count;
+    merged_t *all = malloc(total * sizeof(merged_t));
+    if (!all) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < map->tail_count; i++) {
+        all[n].hash = map->tail[i].hash.hash;
+        all[n++].record = (const unsigned char *)map->tail_records->data + map->tail[i].offset;
+    }
+    qsort(all, n, sizeof(merged_t), merged_compare);
+
+    // Merge with the idx (already sorted); where both have a hash the
+    // tail's is the newer
+    merged_t *merged = malloc(total * sizeof(merged_t));
+    if (!merged) {
+        free(all);
+        return -1;
+    }
+    size_t out = 0, t = 0;
+    for (uint32_t i = 0; i < map->count || t < n;) {
+        const unsigned char *idx_hash = i < map->count ? map->hashes + (size_t)i * HASH_SIZE : NULL;
+        int cmp = !idx_hash ? 1 : t >= n ? -1 : memcmp(idx_hash, all[t].hash, HASH_SIZE);
+        if (cmp < 0) {
+            const unsigned char *record = idx_record(map, i);
+            if (record) merged[out++] = (merged_t){ idx_hash, record };
+            i++;
+        } else {
+            merged[out++] = all[t++];
+            if (cmp == 0) i++;
+        }
+    }
+    free(all);
+
+    buffer_t *buf = buffer_create(CID_HEADER_SIZE + CID_FANOUT_SIZE + out * (HASH_SIZE + 4 + 40) + HASH_SIZE);
+    if (!buf) {
+        free(merged);
+        return -1;
+    }
+    buffer_append(buf, CID_MAP_SIGNATURE, 4);
+    append_u32(buf, CID_MAP_VERSION);
+    append_u32(buf, (uint32_t)out);
+    uint64_t covered = 0;   // The log is emptied right after
+    buffer_append(buf, &covered, 8);
+
+    uint32_t fanout[256] = {0};
+    for (size_t i = 0; i < out; i++) fanout[merged[i].hash[0]]++;
+    for (int b = 1; b < 256; b++) fanout[b] += fanout[b - 1];
+    for (int b = 0; b < 256; b++) append_u32(buf, fanout[b]);
+
+    for (size_t i = 0; i < out; i++) buffer_append(buf, merged[i].hash, HASH_SIZE);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < out; i++) {
+        append_u32(buf, offset);
+        offset += 2 + merged[i].record[1];
+    }
+    for (size_t i = 0; i < out; i++) buffer_append(buf, merged[i].record, 2 + merged[i].record[1]);
+    free(merged);
+
+    gyatt_hash_t checksum;
+    sha1_hash(buf->data, buf->len, &checksum);
+    buffer_append(buf, checksum.hash, HASH_SIZE);
+
+    // New idx in place first: if the log isn't emptied after all, replaying
+    // it again only rewrites the same mappings
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", map->idx_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int result = fd < 0 ? -1 : 0;
+    for (size_t pos = 0; result == 0 && pos < buf->len;) {
+        ssize_t w = write(fd, buf->data + pos, buf->len - pos);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) result = -1;
+        else pos += (size_t)w;
+    }
+    if (fd >= 0 && (fsync(fd) != 0 || close(fd) != 0)) result = -1;
+    buffer_free(buf);
+
+    if (result != 0 || rename(tmp_path, map->idx_path) != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", map->idx_path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (ftruncate(map->log_fd, 0) != 0) {
+        fprintf(stderr, "Warning: Failed to empty %s\n", map->log_path);
+    }
+
+    unmap_idx(map);
+    map->tail_count = 0;
+    buffer_clear(map->tail_records);
+    if (map->slots) memset(map->slots, 0xff, map->slot_capacity * sizeof(int32_t));
+    map_idx(map);
+    return 0;
+}
+
+void cid_map_close(cid_map_t *map) {
+    if (!map) return;
+
+    // Once the tail is a fair share of the idx, folding it in pays for itself
+    if (map->log_fd >= 0 && map->tail_count * 4 > map->count) {
+        cid_map_compact(map);
+    }
+
+    if (map->log_fd >= 0) close(map->log_fd);
+    unmap_idx(map);
+    free(map->tail);
+    free(map->slots);
+    buffer_free(map->tail_records);
+    free(map);
+}
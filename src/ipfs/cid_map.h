@@ -0,0 +1,51 @@
+#ifndef CID_MAP_H
+#define CID_MAP_H
+
+#include "../gyatt.h"
+
+// Which object went up to IPFS as which CID, for a whole repository in
+// two files instead of one per object:
+//
+// <name>.log     appended to as uploads finish, one record each:
+//                hash[20] | form u8 | length u8 | CID bytes
+// <name>.idx     "GMAP" | version u32 | count u32 | log offset u64 |
+//                fanout[256] u32 | count sorted hashes |
+//                count record offsets u32 | records (form | length | bytes) |
+//                SHA-1 of everything above
+//
+// The idx covers the log up to "log offset"; records appended after that
+// are replayed into memory on open. Compaction folds everything into a
+// fresh idx and empties the log. Forms: a CIDv0 is kept as its 34
+// multihash bytes, a base32 CIDv1 as its binary CID, anything else as text.
+//
+// One writer at a time, like the rest of .gyatt.
+#define CID_MAP_SIGNATURE "GMAP"
+#define CID_MAP_VERSION 1
+
+typedef struct cid_map cid_map_t;
+
+// name picks the pair of files in gyatt_dir ("ipfs-map" for objects)
+cid_map_t *cid_map_open(const char *gyatt_dir, const char *name);
+// Compacts first if enough has been appended since the last time
+void cid_map_close(cid_map_t *map);
+
+// 0 and the CID as text if hash is mapped, -1 if not
+int cid_map_get(const cid_map_t *map, const gyatt_hash_t *hash, char *cid, size_t cid_size);
+int cid_map_has(const cid_map_t *map, const gyatt_hash_t *hash);
+int cid_map_put(cid_map_t *map, const gyatt_hash_t *hash, const char *cid);
+
+// The hashes with no mapping, sorted and without duplicates, in one pass
+// over the idx. missing needs room for count; returns how many.
+size_t cid_map_missing(const cid_map_t *map, const gyatt_hash_t *hashes, size_t count,
+                       gyatt_hash_t *missing);
+
+size_t cid_map_count(const cid_map_t *map);  // Upper bound: the log may remap a hash
+int cid_map_compact(cid_map_t *map);
+
+// A CID's text form <-> its binary form (a CIDv0 is its multihash).
+// parse returns the binary length, 0 if it isn't base58 v0 or base32 v1.
+#define CID_BINARY_MAX 128
+size_t cid_parse(const char *text, unsigned char *out, size_t out_size);
+int cid_format(const unsigned char *cid, size_t len, char *text, size_t text_size);
+
+#endif // CID_MAP_H
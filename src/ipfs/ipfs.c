@@ -1,4 +1,5 @@
 #include "ipfs.h"
+#include "../trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,7 +32,14 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, void *us
 }
 
 ipfs_client_t* ipfs_client_init(const char *host, int port) {
-    ipfs_client_t *client = malloc(sizeof(ipfs_client_t));
+    // Initialize curl globally (once)
+    static int curl_initialized = 0;
+    if (!curl_initialized) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        curl_initialized = 1;
+    }
+
+    ipfs_client_t *client = calloc(1, sizeof(ipfs_client_t));
     if (!client) return NULL;
 
     if (host) {
@@ -43,187 +51,230 @@ ipfs_client_t* ipfs_client_init(const char *host, int port) {
 
     client->port = (port > 0) ? port : IPFS_DEFAULT_PORT;
     client->timeout_ms = 10000; // 10 seconds default timeout
+    client->max_in_flight = IPFS_DEFAULT_IN_FLIGHT;
 
-    // Initialize curl globally (once)
-    static int curl_initialized = 0;
-    if (!curl_initialized) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-        curl_initialized = 1;
+    client->easy = curl_easy_init();
+    client->share = curl_share_init();
+    if (!client->easy || !client->share) {
+        ipfs_client_free(client);
+        return NULL;
     }
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
 
     return client;
 }
 
 void ipfs_client_free(ipfs_client_t *client) {
     if (client) {
+        if (client->easy) curl_easy_cleanup(client->easy);
+        if (client->share) curl_share_cleanup(client->share);
         free(client);
     }
 }
 
-bool ipfs_is_online(ipfs_client_t *client) {
-    CURL *curl;
-    CURLcode res;
-    char url[512];
-    struct memory_struct chunk = {0};
-
-    snprintf(url, sizeof(url), "http://%s:%d%s/version", 
-             client->host, client->port, IPFS_API_PATH);
-
-    curl = curl_easy_init();
-    if (!curl) return false;
-
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
+// Options every request gets, on a fresh or reset handle
+static void setup_handle(ipfs_client_t *client, CURL *curl, const char *url, long timeout_ms) {
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
     curl_easy_setopt(curl, CURLOPT_POST, 1L);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-
-    res = curl_easy_perform(curl);
-    
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-    curl_easy_cleanup(curl);
-    free(chunk.memory);
-
-    return (res == CURLE_OK && http_code == 200);
 }
 
-char* ipfs_version(ipfs_client_t *client) {
-    CURL *curl;
-    CURLcode res;
-    char url[512];
-    struct memory_struct chunk = {0};
-
-    snprintf(url, sizeof(url), "http://%s:%d%s/version", 
-             client->host, client->port, IPFS_API_PATH);
+static void api_url(const ipfs_client_t *client, const char *endpoint, char *url, size_t url_size) {
+    snprintf(url, url_size, "http://%s:%d%s/%s", client->host, client->port, IPFS_API_PATH, endpoint);
+}
 
-    curl = curl_easy_init();
-    if (!curl) return NULL;
+// One request on the client's own handle, which keeps its connection for
+// the next. The reply lands in chunk (always allocated on return).
+static CURLcode client_request(ipfs_client_t *client, const char *endpoint,
+                               const void *upload, size_t upload_size,
+                               struct memory_struct *chunk, long *http_code) {
+    char url[768];
+    api_url(client, endpoint, url, sizeof(url));
 
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+    chunk->memory = malloc(1);
+    chunk->size = 0;
+    if (!chunk->memory) return CURLE_OUT_OF_MEMORY;
+    chunk->memory[0] = '\0';
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
+    CURL *curl = client->easy;
+    curl_easy_reset(curl);
+    setup_handle(client, curl, url, client->timeout_ms);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
 
-    res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK) {
-        free(chunk.memory);
-        return NULL;
+    // Add the data as a file upload
+    curl_mime *mime = NULL;
+    if (upload) {
+        mime = curl_mime_init(curl);
+        curl_mimepart *part = curl_mime_addpart(mime);
+        curl_mime_name(part, "file");
+        curl_mime_filename(part, "data");
+        curl_mime_data(part, upload, upload_size);
+        curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
     }
 
-    return chunk.memory; // Caller must free
+    trace_span_t span = trace_begin(TRACE_IPFS_REQUEST);
+    CURLcode res = curl_easy_perform(curl);
+    trace_end(span, upload_size + chunk->size, 0);
+
+    *http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+    curl_mime_free(mime);
+    return res;
 }
 
-char* ipfs_add(ipfs_client_t *client, const void *data, size_t size) {
-    CURL *curl;
-    CURLcode res;
-    char url[512];
-    struct memory_struct chunk = {0};
-    struct curl_httppost *formpost = NULL;
-    struct curl_httppost *lastptr = NULL;
+// Response format: {"Name":"data","Hash":"QmXXX...","Size":"123"}
+static char *parse_add_cid(const char *json) {
+    const char *hash_start = strstr(json, "\"Hash\"");
+    if (!hash_start) return NULL;
+    hash_start += 6; // Skip past "Hash"
+    hash_start += strspn(hash_start, " \t");
+    if (*hash_start++ != ':') return NULL;
+    hash_start += strspn(hash_start, " \t");
+    if (*hash_start++ != '"') return NULL;
 
-    snprintf(url, sizeof(url), "http://%s:%d%s/add?pin=true", 
-             client->host, client->port, IPFS_API_PATH);
+    const char *hash_end = strchr(hash_start, '"');
+    if (!hash_end || hash_end - hash_start >= IPFS_CID_MAX_LEN) return NULL;
 
-    curl = curl_easy_init();
-    if (!curl) return NULL;
+    size_t cid_len = hash_end - hash_start;
+    char *cid = malloc(cid_len + 1);
+    if (!cid) return NULL;
 
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+    memcpy(cid, hash_start, cid_len);
+    cid[cid_len] = '\0';
+    return cid;
+}
 
-    // Add the data as a file upload
-    curl_formadd(&formpost, &lastptr,
-                 CURLFORM_COPYNAME, "file",
-                 CURLFORM_BUFFER, "data",
-                 CURLFORM_BUFFERPTR, data,
-                 CURLFORM_BUFFERLENGTH, size,
-                 CURLFORM_END);
+bool ipfs_is_online(ipfs_client_t *client) {
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, "version", NULL, 0, &chunk, &http_code);
+    free(chunk.memory);
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
+    return (res == CURLE_OK && http_code == 200);
+}
 
-    res = curl_easy_perform(curl);
-    
-    curl_easy_cleanup(curl);
-    curl_formfree(formpost);
+char* ipfs_version(ipfs_client_t *client) {
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, "version", NULL, 0, &chunk, &http_code);
 
     if (res != CURLE_OK) {
         free(chunk.memory);
         return NULL;
     }
 
-    // Parse JSON response to extract CID
-    // Response format: {"Name":"data","Hash":"QmXXX...","Size":"123"}
-    char *hash_start = strstr(chunk.memory, "\"Hash\":\"");
-    if (!hash_start) {
-        free(chunk.memory);
-        return NULL;
-    }
-    hash_start += 8; // Skip past "Hash":"
+    return chunk.memory; // Caller must free
+}
 
-    char *hash_end = strchr(hash_start, '"');
-    if (!hash_end) {
-        free(chunk.memory);
-        return NULL;
-    }
+char* ipfs_add(ipfs_client_t *client, const void *data, size_t size) {
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, "add?pin=true", data ? data : "", size, &chunk, &http_code);
 
-    size_t cid_len = hash_end - hash_start;
-    char *cid = malloc(cid_len + 1);
-    if (!cid) {
+    if (res != CURLE_OK) {
         free(chunk.memory);
         return NULL;
     }
 
-    memcpy(cid, hash_start, cid_len);
-    cid[cid_len] = '\0';
-
+    char *cid = parse_add_cid(chunk.memory);
     free(chunk.memory);
     return cid; // Caller must free
 }
 
-ipfs_response_t* ipfs_cat(ipfs_client_t *client, const char *cid) {
-    CURL *curl;
-    CURLcode res;
-    char url[768];
-    struct memory_struct chunk = {0};
+// One line per root: {"Root":{"Cid":{"/":"bafy..."},"PinErrorMsg":""}}
+static char *parse_import_root(const char *json) {
+    const char *root = strstr(json, "\"Root\"");
+    if (!root) return NULL;
+    const char *link = strstr(root, "\"/\"");
+    if (!link) return NULL;
+    link += 3;
+    link += strspn(link, " \t");
+    if (*link++ != ':') return NULL;
+    link += strspn(link, " \t");
+    if (*link++ != '"') return NULL;
+
+    const char *end = strchr(link, '"');
+    if (!end || end - link >= IPFS_CID_MAX_LEN) return NULL;
+
+    // Pinning the root is the point, so a pin error fails the import
+    const char *pin_error = strstr(end, "\"PinErrorMsg\"");
+    if (pin_error) {
+        pin_error += 13;
+        pin_error += strspn(pin_error, " \t:");
+        if (strncmp(pin_error, "\"\"", 2) != 0) {
+            fprintf(stderr, "Error: IPFS couldn't pin the imported root: %.*s\n",
+                    (int)strcspn(pin_error, "}\n"), pin_error);
+            return NULL;
+        }
+    }
 
-    snprintf(url, sizeof(url), "http://%s:%d%s/cat?arg=%s", 
-             client->host, client->port, IPFS_API_PATH, cid);
+    return strndup(link, end - link);
+}
 
-    curl = curl_easy_init();
-    if (!curl) return NULL;
+char* ipfs_dag_import(ipfs_client_t *client, const char *car_path) {
+    char url[768];
+    api_url(client, "dag/import?pin-roots=true", url, sizeof(url));
 
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+    struct memory_struct chunk = { malloc(1), 0 };
+    if (!chunk.memory) return NULL;
+    chunk.memory[0] = '\0';
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
+    // A whole history can take a while to import, so no timeout
+    CURL *curl = client->easy;
+    curl_easy_reset(curl);
+    setup_handle(client, curl, url, 0);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
 
-    res = curl_easy_perform(curl);
-    
+    // Streamed from disk by curl rather than read into memory
+    curl_mime *mime = curl_mime_init(curl);
+    curl_mimepart *part = curl_mime_addpart(mime);
+    curl_mime_name(part, "file");
+    curl_mime_filename(part, "graph.car");
+    curl_mime_type(part, "application/vnd.ipld.car");
+    if (curl_mime_filedata(part, car_path) != CURLE_OK) {
+        curl_mime_free(mime);
+        free(chunk.memory);
+        return NULL;
+    }
+    curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+
+    trace_span_t span = trace_begin(TRACE_IPFS_REQUEST);
+    CURLcode res = curl_easy_perform(curl);
+    if (span.start) {
+        curl_off_t sent = 0;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+        trace_end(span, (uint64_t)sent + chunk.size, 0);
+    }
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_mime_free(mime);
+
+    char *root = NULL;
+    if (res != CURLE_OK) {
+        fprintf(stderr, "Error: DAG import failed: %s\n", curl_easy_strerror(res));
+    } else if (http_code != 200) {
+        fprintf(stderr, "Error: DAG import failed (HTTP %ld): %.200s\n", http_code, chunk.memory);
+    } else {
+        root = parse_import_root(chunk.memory);
+    }
+    free(chunk.memory);
+    return root; // Caller must free
+}
+
+ipfs_response_t* ipfs_cat(ipfs_client_t *client, const char *cid) {
+    char endpoint[IPFS_CID_MAX_LEN + 16];
+    snprintf(endpoint, sizeof(endpoint), "cat?arg=%s", cid);
 
-    curl_easy_cleanup(curl);
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, endpoint, NULL, 0, &chunk, &http_code);
 
     ipfs_response_t *response = malloc(sizeof(ipfs_response_t));
     if (!response) {
@@ -239,96 +290,30 @@ ipfs_response_t* ipfs_cat(ipfs_client_t *client, const char *cid) {
     return response; // Caller must free with ipfs_response_free
 }
 
-bool ipfs_pin_add(ipfs_client_t *client, const char *cid) {
-    CURL *curl;
-    CURLcode res;
-    char url[768];
-    struct memory_struct chunk = {0};
-
-    snprintf(url, sizeof(url), "http://%s:%d%s/pin/add?arg=%s", 
-             client->host, client->port, IPFS_API_PATH, cid);
-
-    curl = curl_easy_init();
-    if (!curl) return false;
+static bool pin_request(ipfs_client_t *client, const char *action, const char *cid) {
+    char endpoint[IPFS_CID_MAX_LEN + 32];
+    snprintf(endpoint, sizeof(endpoint), "pin/%s?arg=%s", action, cid);
 
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-
-    res = curl_easy_perform(curl);
-    
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-    curl_easy_cleanup(curl);
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, endpoint, NULL, 0, &chunk, &http_code);
     free(chunk.memory);
 
     return (res == CURLE_OK && http_code == 200);
 }
 
-bool ipfs_pin_rm(ipfs_client_t *client, const char *cid) {
-    CURL *curl;
-    CURLcode res;
-    char url[768];
-    struct memory_struct chunk = {0};
-
-    snprintf(url, sizeof(url), "http://%s:%d%s/pin/rm?arg=%s", 
-             client->host, client->port, IPFS_API_PATH, cid);
-
-    curl = curl_easy_init();
-    if (!curl) return false;
-
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-
-    res = curl_easy_perform(curl);
-    
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-    curl_easy_cleanup(curl);
-    free(chunk.memory);
+bool ipfs_pin_add(ipfs_client_t *client, const char *cid) {
+    return pin_request(client, "add", cid);
+}
 
-    return (res == CURLE_OK && http_code == 200);
+bool ipfs_pin_rm(ipfs_client_t *client, const char *cid) {
+    return pin_request(client, "rm", cid);
 }
 
 char** ipfs_pin_ls(ipfs_client_t *client, size_t *count) {
-    CURL *curl;
-    CURLcode res;
-    char url[512];
-    struct memory_struct chunk = {0};
-
-    snprintf(url, sizeof(url), "http://%s:%d%s/pin/ls?type=recursive", 
-             client->host, client->port, IPFS_API_PATH);
-
-    curl = curl_easy_init();
-    if (!curl) return NULL;
-
-    chunk.memory = malloc(1);
-    chunk.size = 0;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, client->timeout_ms);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
-
-    res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
+    struct memory_struct chunk;
+    long http_code;
+    CURLcode res = client_request(client, "pin/ls?type=recursive", NULL, 0, &chunk, &http_code);
 
     if (res != CURLE_OK) {
         free(chunk.memory);
@@ -340,6 +325,10 @@ char** ipfs_pin_ls(ipfs_client_t *client, size_t *count) {
     // This is a bit hacky but works for our purposes
     char **cids = malloc(sizeof(char*) * 100); // Max 100 pins for now
     *count = 0;
+    if (!cids) {
+        free(chunk.memory);
+        return NULL;
+    }
 
     char *search = chunk.memory;
     while ((search = strstr(search, "\"Qm")) != NULL) {
@@ -349,6 +338,7 @@ char** ipfs_pin_ls(ipfs_client_t *client, size_t *count) {
 
         size_t cid_len = end - search;
         cids[*count] = malloc(cid_len + 1);
+        if (!cids[*count]) break;
         memcpy(cids[*count], search, cid_len);
         cids[*count][cid_len] = '\0';
         (*count)++;
@@ -377,3 +367,292 @@ void ipfs_free_string_array(char **array, size_t count) {
         free(array);
     }
 }
+
+// --- Batches ---
+
+typedef enum { REQUEST_ADD, REQUEST_CAT } request_kind_t;
+
+typedef struct ipfs_request {
+    request_kind_t kind;
+    char endpoint[IPFS_CID_MAX_LEN + 32];
+    void *data;              // ADD: the upload, owned
+    size_t size;
+    ipfs_add_done_fn add_done;
+    ipfs_data_fn on_data;
+    ipfs_cat_done_fn cat_done;
+    void *arg;
+    struct memory_struct reply;  // ADD's JSON
+    CURL *easy;
+    curl_mime *mime;
+    int aborted;
+    trace_span_t span;       // Started to finished, on the wire
+    struct ipfs_request *next;
+} ipfs_request_t;
+
+struct ipfs_batch {
+    ipfs_client_t *client;
+    CURLM *multi;
+    ipfs_request_t *head;    // Queued, not started yet
+    ipfs_request_t *tail;
+    ipfs_request_t *running; // Linked through next as well
+    size_t queued;
+    size_t active;
+    CURL **idle;             // Finished handles, reset and ready again
+    size_t idle_count;
+};
+
+ipfs_batch_t *ipfs_batch_create(ipfs_client_t *client) {
+    if (!client) return NULL;
+
+    ipfs_batch_t *batch = calloc(1, sizeof(ipfs_batch_t));
+    if (!batch) return NULL;
+
+    int slots = client->max_in_flight > 0 ? client->max_in_flight : 1;
+    batch->client = client;
+    batch->multi = curl_multi_init();
+    batch->idle = calloc((size_t)slots, sizeof(CURL *));
+    if (!batch->multi || !batch->idle) {
+        ipfs_batch_free(batch);
+        return NULL;
+    }
+
+    // One request per connection at a time, and that many connections
+    // kept open between requests
+    curl_multi_setopt(batch->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)slots);
+    curl_multi_setopt(batch->multi, CURLMOPT_MAXCONNECTS, (long)slots);
+    return batch;
+}
+
+static void request_free(ipfs_request_t *request) {
+    free(request->data);
+    free(request->reply.memory);
+    curl_mime_free(request->mime);
+    free(request);
+}
+
+static size_t batch_write(void *contents, size_t size, size_t nmemb, void *userp) {
+    ipfs_request_t *request = userp;
+    size_t realsize = size * nmemb;
+
+    if (request->kind == REQUEST_ADD) return write_callback(contents, size, nmemb, &request->reply);
+
+    // Error bodies aren't the object
+    long http_code = 0;
+    curl_easy_getinfo(request->easy, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 200 || !request->on_data) return realsize;
+
+    if (request->on_data(request->arg, contents, realsize) != 0) {
+        request->aborted = 1;
+        return 0;
+    }
+    return realsize;
+}
+
+static int enqueue(ipfs_batch_t *batch, ipfs_request_t *request) {
+    if (batch->tail) {
+        batch->tail->next = request;
+    } else {
+        batch->head = request;
+    }
+    batch->tail = request;
+    batch->queued++;
+    return 0;
+}
+
+int ipfs_batch_add(ipfs_batch_t *batch, void *data, size_t size, bool pin,
+                   ipfs_add_done_fn done, void *arg) {
+    ipfs_request_t *request = batch ? calloc(1, sizeof(ipfs_request_t)) : NULL;
+    if (!request) {
+        free(data);
+        return -1;
+    }
+
+    request->kind = REQUEST_ADD;
+    snprintf(request->endpoint, sizeof(request->endpoint), "add?pin=%s", pin ? "true" : "false");
+    request->data = data;
+    request->size = size;
+    request->add_done = done;
+    request->arg = arg;
+    return enqueue(batch, request);
+}
+
+// cat and block/get only differ in the endpoint
+static int queue_read(ipfs_batch_t *batch, const char *command, const char *cid,
+                      ipfs_data_fn on_data, ipfs_cat_done_fn done, void *arg) {
+    if (!batch || !cid || strlen(cid) >= IPFS_CID_MAX_LEN) return -1;
+
+    ipfs_request_t *request = calloc(1, sizeof(ipfs_request_t));
+    if (!request) return -1;
+
+    request->kind = REQUEST_CAT;
+    snprintf(request->endpoint, sizeof(request->endpoint), "%s?arg=%s", command, cid);
+    request->on_data = on_data;
+    request->cat_done = done;
+    request->arg = arg;
+    return enqueue(batch, request);
+}
+
+int ipfs_batch_cat(ipfs_batch_t *batch, const char *cid, ipfs_data_fn on_data,
+                   ipfs_cat_done_fn done, void *arg) {
+    return queue_read(batch, "cat", cid, on_data, done, arg);
+}
+
+int ipfs_batch_block(ipfs_batch_t *batch, const char *cid, ipfs_data_fn on_data,
+                     ipfs_cat_done_fn done, void *arg) {
+    return queue_read(batch, "block/get", cid, on_data, done, arg);
+}
+
+size_t ipfs_batch_pending(const ipfs_batch_t *batch) {
+    return batch ? batch->queued + batch->active : 0;
+}
+
+// Move queued requests onto handles while there are slots free
+static int start_requests(ipfs_batch_t *batch) {
+    ipfs_client_t *client = batch->client;
+    size_t slots = client->max_in_flight > 0 ? (size_t)client->max_in_flight : 1;
+
+    while (batch->head && batch->active < slots) {
+        ipfs_request_t *request = batch->head;
+        batch->head = request->next;
+        if (!batch->head) batch->tail = NULL;
+        batch->queued--;
+
+        CURL *curl = batch->idle_count > 0 ? batch->idle[--batch->idle_count] : curl_easy_init();
+        if (!curl) {
+            request_free(request);
+            return -1;
+        }
+
+        char url[768];
+        api_url(client, request->endpoint, url, sizeof(url));
+        // Transfers scale with size rather than sharing one fixed
+        // deadline; a download only gives up once it stalls
+        setup_handle(client, curl, url, 0);
+        if (request->kind == REQUEST_CAT) {
+            long stall = client->timeout_ms > 999 ? client->timeout_ms / 1000 : 1;
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, stall);
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, batch_write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)request);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)request);
+
+        if (request->kind == REQUEST_ADD) {
+            request->mime = curl_mime_init(curl);
+            curl_mimepart *part = curl_mime_addpart(request->mime);
+            curl_mime_name(part, "file");
+            curl_mime_filename(part, "data");
+            curl_mime_data(part, request->data ? request->data : "", request->size);
+            curl_easy_setopt(curl, CURLOPT_MIMEPOST, request->mime);
+        }
+
+        request->easy = curl;
+        request->span = trace_begin(TRACE_IPFS_REQUEST);
+        if (curl_multi_add_handle(batch->multi, curl) != CURLM_OK) {
+            curl_easy_cleanup(curl);
+            request_free(request);
+            return -1;
+        }
+        request->next = batch->running;
+        batch->running = request;
+        batch->active++;
+    }
+    return 0;
+}
+
+static void finish_request(ipfs_batch_t *batch, ipfs_request_t *request, CURLcode res) {
+    long http_code = 0;
+    curl_easy_getinfo(request->easy, CURLINFO_RESPONSE_CODE, &http_code);
+    if (request->span.start) {
+        curl_off_t received = 0;
+        curl_easy_getinfo(request->easy, CURLINFO_SIZE_DOWNLOAD_T, &received);
+        trace_end(request->span, request->size + (uint64_t)received, 0);
+    }
+
+    for (ipfs_request_t **p = &batch->running; *p; p = &(*p)->next) {
+        if (*p == request) {
+            *p = request->next;
+            break;
+        }
+    }
+    batch->active--;
+
+    // The handle goes back in the pool; its connection stays in the cache
+    curl_multi_remove_handle(batch->multi, request->easy);
+    curl_easy_reset(request->easy);
+    size_t slots = batch->client->max_in_flight > 0 ? (size_t)batch->client->max_in_flight : 1;
+    if (batch->idle_count < slots) {
+        batch->idle[batch->idle_count++] = request->easy;
+    } else {
+        curl_easy_cleanup(request->easy);
+    }
+    request->easy = NULL;
+
+    bool ok = res == CURLE_OK && http_code == 200 && !request->aborted;
+    if (request->kind == REQUEST_ADD) {
+        char *cid = ok && request->reply.memory ? parse_add_cid(request->reply.memory) : NULL;
+        if (request->add_done) request->add_done(request->arg, cid);
+        free(cid);
+    } else if (request->cat_done) {
+        request->cat_done(request->arg, ok);
+    }
+    request_free(request);
+}
+
+int ipfs_batch_wait(ipfs_batch_t *batch, size_t max_pending) {
+    if (!batch) return -1;
+
+    while (ipfs_batch_pending(batch) > max_pending) {
+        if (start_requests(batch) != 0) return -1;
+
+        int still_running = 0;
+        if (curl_multi_perform(batch->multi, &still_running) != CURLM_OK) return -1;
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(batch->multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            ipfs_request_t *request = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+            // Callbacks can queue more, which the next pass picks up
+            if (request) finish_request(batch, request, msg->data.result);
+        }
+
+        if (still_running > 0 && curl_multi_poll(batch->multi, NULL, 0, 1000, NULL) != CURLM_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// So whatever the callback's arg holds gets released
+static void fail_request(ipfs_request_t *request) {
+    if (request->kind == REQUEST_ADD) {
+        if (request->add_done) request->add_done(request->arg, NULL);
+    } else if (request->cat_done) {
+        request->cat_done(request->arg, false);
+    }
+    request_free(request);
+}
+
+void ipfs_batch_free(ipfs_batch_t *batch) {
+    if (!batch) return;
+
+    while (batch->running) {
+        ipfs_request_t *request = batch->running;
+        batch->running = request->next;
+        curl_multi_remove_handle(batch->multi, request->easy);
+        curl_easy_cleanup(request->easy);
+        fail_request(request);
+    }
+    while (batch->head) {
+        ipfs_request_t *request = batch->head;
+        batch->head = request->next;
+        fail_request(request);
+    }
+
+    for (size_t i = 0; i < batch->idle_count; i++) curl_easy_cleanup(batch->idle[i]);
+    free(batch->idle);
+    if (batch->multi) curl_multi_cleanup(batch->multi);
+    free(batch);
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <curl/curl.h>
 
 // IPFS daemon configuration
 #define IPFS_DEFAULT_HOST "127.0.0.1"
@@ -12,11 +13,19 @@
 // Maximum CID length (CIDv1 can be up to 100+ chars, but we'll be safe)
 #define IPFS_CID_MAX_LEN 256
 
-// IPFS connection handle
+// How many requests a batch keeps going at once by default
+#define IPFS_DEFAULT_IN_FLIGHT 16
+
+// IPFS connection handle. Every request made through it draws on the same
+// connection cache, so the daemon is only connected to once per slot and
+// kept alive in between. A client (and its batches) is for one thread.
 typedef struct {
     char host[256];
     int port;
     int timeout_ms;
+    int max_in_flight;       // Concurrent requests per batch
+    CURL *easy;              // Reused for the one-at-a-time calls below
+    CURLSH *share;           // Connections and DNS, shared by every handle
 } ipfs_client_t;
 
 // IPFS response structure
@@ -45,6 +54,10 @@ char* ipfs_add(ipfs_client_t *client, const void *data, size_t size);
 // Get data from IPFS by CID
 ipfs_response_t* ipfs_cat(ipfs_client_t *client, const char *cid);
 
+// Import a CAR file (streamed from car_path) and pin its roots recursively.
+// Returns the root CID, NULL on failure (including a failed pin)
+char* ipfs_dag_import(ipfs_client_t *client, const char *car_path);
+
 // Pin a CID (keep it in local storage)
 bool ipfs_pin_add(ipfs_client_t *client, const char *cid);
 
@@ -60,4 +73,37 @@ void ipfs_response_free(ipfs_response_t *response);
 // Free string array
 void ipfs_free_string_array(char **array, size_t count);
 
+// Batches: queue any number of adds and cats, and up to max_in_flight of
+// them run at once over curl multi. Callbacks fire from inside
+// ipfs_batch_wait(), and may queue more requests.
+typedef struct ipfs_batch ipfs_batch_t;
+
+// cid is NULL if the upload failed
+typedef void (*ipfs_add_done_fn)(void *arg, const char *cid);
+// Body bytes as they arrive (only for a 200); non-zero aborts the request
+typedef int (*ipfs_data_fn)(void *arg, const void *data, size_t len);
+// ok once the whole body arrived and nothing aborted it
+typedef void (*ipfs_cat_done_fn)(void *arg, bool ok);
+
+ipfs_batch_t *ipfs_batch_create(ipfs_client_t *client);
+
+// data (malloc'd) now belongs to the batch
+int ipfs_batch_add(ipfs_batch_t *batch, void *data, size_t size, bool pin,
+                   ipfs_add_done_fn done, void *arg);
+int ipfs_batch_cat(ipfs_batch_t *batch, const char *cid, ipfs_data_fn on_data,
+                   ipfs_cat_done_fn done, void *arg);
+// The raw bytes of one block (block/get), for DAG nodes cat can't read
+int ipfs_batch_block(ipfs_batch_t *batch, const char *cid, ipfs_data_fn on_data,
+                     ipfs_cat_done_fn done, void *arg);
+
+// Requests queued or running
+size_t ipfs_batch_pending(const ipfs_batch_t *batch);
+
+// Run transfers until at most max_pending requests are left; 0 waits for
+// everything. -1 if curl itself gave up.
+int ipfs_batch_wait(ipfs_batch_t *batch, size_t max_pending);
+
+// Requests still pending are called back as failed
+void ipfs_batch_free(ipfs_batch_t *batch);
+
 #endif // IPFS_H
@@ -0,0 +1,550 @@
+#include "ipfs_fetch.h"
+#include "car.h"
+#include "../hash.h"
+#include "../buffer.h"
+#include "../chunk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Everything runs on one batch. The walk goes node first (block/get, for
+// the links), then the object itself (cat, its loose form), and commits
+// are asked for ahead of trees ahead of blobs so the history walk never
+// sits behind file contents.
+//
+// Each object is hashed as its bytes come in: SHA-256 against its CID,
+// SHA-1 against the hash whoever pointed at it named. Blobs stream straight
+// through an object_writer. Trees and commits are small, so they're held
+// until everything they point at is stored and only written then (so are
+// chunk lists, which wait on their chunks the same way): an
+// object on disk always comes with its whole closure, and resuming is just
+// skipping what's already there.
+
+#define FETCH_BUCKETS 65536
+#define FETCH_RETRIES 2
+#define FETCH_OBJECT_MAX (64 * 1024 * 1024)  // Buffered trees/commits only
+
+enum { PRIORITY_COMMIT, PRIORITY_TREE, PRIORITY_BLOB, PRIORITY_COUNT };
+
+typedef struct fetch fetch_t;
+
+typedef struct fetch_item {
+    fetch_t *fetch;
+    gyatt_hash_t hash;
+    object_type_t type;
+    int want_node;             // Still on the DAG node (trees, commits, chunk lists)
+    int retries;
+    unsigned char node[CID_BINARY_MAX];
+    size_t node_len;
+    unsigned char object[CID_BINARY_MAX];
+    size_t object_len;
+    buffer_t *node_data;       // Kept for the links until the object is in
+    buffer_t *data;            // Loose tree/commit as it arrives
+    object_writer_t *writer;   // Blobs
+    char header[64];           // A blob's loose header, until it's complete
+    size_t header_len;
+    sha256_ctx_t sha256;
+    int check_sha256;
+    size_t pending;            // What it points at that isn't stored yet
+    struct fetch_item **waiters;
+    size_t waiter_count;
+    size_t waiter_capacity;
+    struct fetch_item *chain;  // Bucket
+    struct fetch_item *next;   // Queue or ready list
+} fetch_item_t;
+
+struct fetch {
+    ipfs_storage_t *storage;
+    gyatt_repo_t *repo;
+    ipfs_batch_t *batch;
+    fetch_item_t **buckets;    // Items not stored yet
+    fetch_item_t *queue_head[PRIORITY_COUNT];
+    fetch_item_t *queue_tail[PRIORITY_COUNT];
+    fetch_item_t *ready;       // Everything it points at is stored
+    ipfs_fetch_stats_t *stats;
+    int failed;
+};
+
+static size_t fetch_bucket(const gyatt_hash_t *hash) {
+    return ((size_t)hash->hash[0] << 8 | hash->hash[1]) & (FETCH_BUCKETS - 1);
+}
+
+static fetch_item_t *fetch_find(const fetch_t *fetch, const gyatt_hash_t *hash) {
+    for (fetch_item_t *item = fetch->buckets[fetch_bucket(hash)]; item; item = item->chain) {
+        if (hash_compare(&item->hash, hash) == 0) return item;
+    }
+    return NULL;
+}
+
+static void fetch_unlink(fetch_t *fetch, fetch_item_t *item) {
+    for (fetch_item_t **p = &fetch->buckets[fetch_bucket(&item->hash)]; *p; p = &(*p)->chain) {
+        if (*p == item) {
+            *p = item->chain;
+            return;
+        }
+    }
+}
+
+static void item_reset(fetch_item_t *item) {
+    buffer_free(item->data);
+    item->data = NULL;
+    object_writer_abort(item->writer);
+    item->writer = NULL;
+    item->header_len = 0;
+}
+
+static void item_free(fetch_item_t *item) {
+    item_reset(item);
+    buffer_free(item->node_data);
+    free(item->waiters);
+    free(item);
+}
+
+static void item_fail(fetch_item_t *item, const char *why) {
+    char hash_hex[HASH_HEX_SIZE];
+    hash_to_hex(&item->hash, hash_hex);
+    fprintf(stderr, "Error: %s %s\n", why, hash_hex);
+    item->fetch->failed = 1;
+}
+
+static void fetch_enqueue(fetch_t *fetch, fetch_item_t *item) {
+    int priority = item->type == OBJ_COMMIT ? PRIORITY_COMMIT :
+                   item->type == OBJ_BLOB ? PRIORITY_BLOB : PRIORITY_TREE;
+    item->next = NULL;
+    if (fetch->queue_tail[priority]) {
+        fetch->queue_tail[priority]->next = item;
+    } else {
+        fetch->queue_head[priority] = item;
+    }
+    fetch->queue_tail[priority] = item;
+}
+
+// A SHA-256 CIDv1 (what publishing writes) can be checked while it
+// streams; anything else relies on the SHA-1 alone
+static int cid_digest(const unsigned char *cid, size_t len, const unsigned char **digest) {
+    if (len != CAR_CID_SIZE || cid[0] != 0x01 || cid[1] >= 0x80 || cid[2] != 0x12 || cid[3] != 0x20) {
+        return 0;
+    }
+    *digest = cid + 4;
+    return 1;
+}
+
+// parent (optional) waits for hash to be stored. cid is the object's raw
+// block for a blob and its DAG node otherwise.
+static int fetch_want(fetch_t *fetch, fetch_item_t *parent, const gyatt_hash_t *hash,
+                      object_type_t type, const unsigned char *cid, size_t cid_len) {
+    // On disk means its closure is too (see above)
+    if (object_exists(fetch->repo, hash)) return 0;
+
+    fetch_item_t *item = fetch_find(fetch, hash);
+    if (!item) {
+        if (cid_len == 0 || cid_len > CID_BINARY_MAX) return -1;
+        item = calloc(1, sizeof(fetch_item_t));
+        if (!item) return -1;
+        item->fetch = fetch;
+        item->hash = *hash;
+        item->type = type;
+        item->want_node = type != OBJ_BLOB;
+        if (item->want_node) {
+            memcpy(item->node, cid, cid_len);
+            item->node_len = cid_len;
+        } else {
+            memcpy(item->object, cid, cid_len);
+            item->object_len = cid_len;
+        }
+
+        size_t bucket = fetch_bucket(hash);
+        item->chain = fetch->buckets[bucket];
+        fetch->buckets[bucket] = item;
+        fetch_enqueue(fetch, item);
+    } else if (item->type != type) {
+        item_fail(item, "Object named as two different types:");
+        return -1;
+    }
+
+    if (parent) {
+        if (item->waiter_count >= item->waiter_capacity) {
+            size_t new_capacity = item->waiter_capacity ? item->waiter_capacity * 2 : 2;
+            fetch_item_t **grown = realloc(item->waiters, new_capacity * sizeof(fetch_item_t *));
+            if (!grown) return -1;
+            item->waiters = grown;
+            item->waiter_capacity = new_capacity;
+        }
+        item->waiters[item->waiter_count++] = parent;
+        parent->pending++;
+    }
+    return 0;
+}
+
+static void record_mapping(cid_map_t *map, const gyatt_hash_t *hash, const unsigned char *cid, size_t len) {
+    char text[IPFS_CID_MAX_LEN];
+    if (cid_format(cid, len, text, sizeof(text)) == 0) cid_map_put(map, hash, text);
+}
+
+// Everything it points at is stored, so it can be too
+static int item_store(fetch_t *fetch, fetch_item_t *item) {
+    if (item->type != OBJ_BLOB) {
+        object_type_t type;
+        size_t size;
+        size_t header_len = object_parse_header(item->data->data, item->data->len, &type, &size);
+        gyatt_hash_t stored;
+        if (object_write(fetch->repo, item->data->data + header_len, size, type, &stored) != 0 ||
+            hash_compare(&stored, &item->hash) != 0) {
+            item_fail(item, "Failed to store");
+            return -1;
+        }
+        record_mapping(fetch->storage->dag, &item->hash, item->node, item->node_len);
+    }
+    // Next time this repo publishes, these are already up
+    record_mapping(fetch->storage->map, &item->hash, item->object, item->object_len);
+    fetch->stats->objects++;
+
+    for (size_t i = 0; i < item->waiter_count; i++) {
+        fetch_item_t *waiter = item->waiters[i];
+        if (--waiter->pending == 0) {
+            waiter->next = fetch->ready;
+            fetch->ready = waiter;
+        }
+    }
+    fetch_unlink(fetch, item);
+    item_free(item);
+    return 0;
+}
+
+static void fetch_drain_ready(fetch_t *fetch) {
+    while (fetch->ready && !fetch->failed) {
+        fetch_item_t *item = fetch->ready;
+        fetch->ready = item->next;
+        item_store(fetch, item);
+    }
+}
+
+// ==================== Nodes ====================
+
+// Finds the link under key in a node's top-level map
+static int node_link(const buffer_t *node, const char *key, const unsigned char **cid, size_t *len) {
+    cbor_reader_t r = { (const unsigned char *)node->data, (const unsigned char *)node->data + node->len };
+    size_t pairs;
+    if (cbor_read_map(&r, &pairs) != 0) return -1;
+
+    size_t key_len = strlen(key);
+    for (size_t i = 0; i < pairs; i++) {
+        const char *name;
+        size_t name_len;
+        if (cbor_read_text(&r, &name, &name_len) != 0) return -1;
+        // Only links and the entries array ever appear as values
+        if (name_len == 7 && memcmp(name, "entries", 7) == 0) {
+            size_t items;
+            const unsigned char *skip;
+            size_t skip_len;
+            if (cbor_read_array(&r, &items) != 0) return -1;
+            for (size_t j = 0; j < items; j++) {
+                if (cbor_read_link(&r, &skip, &skip_len) != 0) return -1;
+            }
+            continue;
+        }
+        if (cbor_read_link(&r, cid, len) != 0) return -1;
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) return 0;
+    }
+    return -1;
+}
+
+// A tree node's entries, which line up with the tree's own
+static int node_entries(const buffer_t *node, cbor_reader_t *r, size_t *count) {
+    r->pos = (const unsigned char *)node->data;
+    r->end = r->pos + node->len;
+    size_t pairs;
+    if (cbor_read_map(r, &pairs) != 0) return -1;
+
+    for (size_t i = 0; i < pairs; i++) {
+        const char *name;
+        size_t name_len;
+        const unsigned char *skip;
+        size_t skip_len;
+        if (cbor_read_text(r, &name, &name_len) != 0) return -1;
+        if (name_len == 7 && memcmp(name, "entries", 7) == 0) return cbor_read_array(r, count);
+        if (cbor_read_link(r, &skip, &skip_len) != 0) return -1;
+    }
+    return -1;
+}
+
+static int want_tree_entries(fetch_t *fetch, fetch_item_t *item, const tree_object_t *tree) {
+    cbor_reader_t r;
+    size_t count;
+    if (node_entries(item->node_data, &r, &count) != 0 || count != tree->entry_count) return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char *cid;
+        size_t len;
+        if (cbor_read_link(&r, &cid, &len) != 0) return -1;
+        const tree_entry_t *entry = &tree->entries[i];
+        // A file published as a node rather than a raw block is chunked
+        object_type_t type = entry->type;
+        if (type != OBJ_TREE && len == CAR_CID_SIZE && cid[1] == CAR_CODEC_DAG_CBOR) type = OBJ_CHUNKED;
+        if (fetch_want(fetch, item, &entry->hash, type, cid, len) != 0) return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    fetch_t *fetch;
+    fetch_item_t *item;
+    cbor_reader_t r;
+} chunk_want_t;
+
+static int want_chunk(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)size;
+    chunk_want_t *want = arg;
+    const unsigned char *cid;
+    size_t len;
+    if (cbor_read_link(&want->r, &cid, &len) != 0) return -1;
+    return fetch_want(want->fetch, want->item, hash, OBJ_BLOB, cid, len);
+}
+
+// A chunk list's node has one entry per chunk, in order
+static int want_chunks(fetch_t *fetch, fetch_item_t *item, const void *list, size_t size) {
+    chunk_want_t want = { fetch, item, {0} };
+    size_t count;
+    if (node_entries(item->node_data, &want.r, &count) != 0 || count != size / CHUNK_REF_SIZE) return -1;
+    return chunk_list_foreach(list, size, want_chunk, &want) == 0 ? 0 : -1;
+}
+
+static int want_commit_links(fetch_t *fetch, fetch_item_t *item, const commit_object_t *commit) {
+    const unsigned char *cid;
+    size_t len;
+    if (node_link(item->node_data, "tree", &cid, &len) != 0 ||
+        fetch_want(fetch, item, &commit->tree, OBJ_TREE, cid, len) != 0) {
+        return -1;
+    }
+
+    gyatt_hash_t zero = {0};
+    int has_parent = hash_compare(&commit->parent, &zero) != 0;
+    if (!has_parent) return 0;
+    if (node_link(item->node_data, "parent", &cid, &len) != 0) return -1;
+    return fetch_want(fetch, item, &commit->parent, OBJ_COMMIT, cid, len);
+}
+
+// ==================== Transfers ====================
+
+static int fetch_data(void *arg, const void *data, size_t len) {
+    fetch_item_t *item = arg;
+    if (item->check_sha256) sha256_update(&item->sha256, data, len);
+    if (!item->want_node) item->fetch->stats->bytes += len;
+
+    if (item->want_node || item->type != OBJ_BLOB) {
+        buffer_t *buf = item->want_node ? item->node_data : item->data;
+        if (buf->len + len > FETCH_OBJECT_MAX) return -1;
+        buffer_append(buf, data, len);
+        return 0;
+    }
+
+    // A blob goes to disk as it arrives, once its header is complete
+    const char *p = data;
+    if (!item->writer) {
+        while (len > 0 && item->header_len < sizeof(item->header)) {
+            len--;
+            if ((item->header[item->header_len++] = *p++) == '\0') break;
+        }
+        if (item->header[item->header_len - 1] != '\0') {
+            return item->header_len < sizeof(item->header) ? 0 : -1;
+        }
+
+        object_type_t type;
+        size_t size;
+        if (object_parse_header(item->header, item->header_len, &type, &size) != item->header_len ||
+            type != OBJ_BLOB) {
+            return -1;
+        }
+        item->writer = object_writer_open(item->fetch->repo, OBJ_BLOB, size);
+        if (!item->writer) return -1;
+    }
+    return object_writer_write(item->writer, p, len);
+}
+
+static int sha256_matches(fetch_item_t *item, const unsigned char *cid, size_t len) {
+    const unsigned char *digest;
+    if (!cid_digest(cid, len, &digest)) return 1;
+    unsigned char computed[SHA256_DIGEST_SIZE];
+    sha256_final(&item->sha256, computed);
+    return memcmp(computed, digest, SHA256_DIGEST_SIZE) == 0;
+}
+
+static int object_arrived(fetch_t *fetch, fetch_item_t *item) {
+    if (item->type == OBJ_BLOB) {
+        if (!item->writer || object_writer_close_verified(item->writer, &item->hash) != 0) {
+            item->writer = NULL;
+            item_fail(item, "Bad data for blob");
+            return -1;
+        }
+        item->writer = NULL;
+        return item_store(fetch, item);
+    }
+
+    gyatt_hash_t computed;
+    object_type_t type;
+    size_t size;
+    sha1_hash(item->data->data, item->data->len, &computed);
+    size_t header_len = object_parse_header(item->data->data, item->data->len, &type, &size);
+    if (hash_compare(&computed, &item->hash) != 0 || header_len == 0 || type != item->type ||
+        header_len + size != item->data->len) {
+        item_fail(item, "Bad data for");
+        return -1;
+    }
+
+    const char *payload = item->data->data + header_len;
+    int result;
+    if (type == OBJ_TREE) {
+        tree_object_t *tree = tree_parse(payload, size, &item->hash);
+        result = tree ? want_tree_entries(fetch, item, tree) : -1;
+        tree_free(tree);
+    } else if (type == OBJ_CHUNKED) {
+        result = want_chunks(fetch, item, payload, size);
+    } else {
+        commit_object_t *commit = commit_parse(payload, size, &item->hash);
+        result = commit ? want_commit_links(fetch, item, commit) : -1;
+        commit_free(commit);
+    }
+    if (result != 0) {
+        item_fail(item, "DAG node doesn't match");
+        return -1;
+    }
+
+    if (item->pending == 0) return item_store(fetch, item);
+    return 0;
+}
+
+static void fetch_done(void *arg, bool ok) {
+    fetch_item_t *item = arg;
+    fetch_t *fetch = item->fetch;
+    if (fetch->failed) return;
+
+    if (!ok) {
+        // Worth another go: nothing about the data is known to be wrong
+        item_reset(item);
+        if (item->want_node) buffer_clear(item->node_data);
+        if (item->retries++ < FETCH_RETRIES) {
+            fetch->stats->retries++;
+            fetch_enqueue(fetch, item);
+        } else {
+            item_fail(item, "Couldn't download");
+        }
+        return;
+    }
+
+    if (item->want_node) {
+        const unsigned char *cid;
+        if (!sha256_matches(item, item->node, item->node_len) ||
+            node_link(item->node_data, "object", &cid, &item->object_len) != 0 ||
+            item->object_len > CID_BINARY_MAX) {
+            item_fail(item, "Bad DAG node for");
+            return;
+        }
+        memcpy(item->object, cid, item->object_len);
+        item->want_node = 0;
+        fetch_enqueue(fetch, item);
+        return;
+    }
+
+    if (!sha256_matches(item, item->object, item->object_len)) {
+        item_fail(item, "Block doesn't match its CID:");
+        return;
+    }
+    if (object_arrived(fetch, item) == 0) fetch_drain_ready(fetch);
+}
+
+static int fetch_start(fetch_t *fetch, fetch_item_t *item) {
+    const unsigned char *cid = item->want_node ? item->node : item->object;
+    size_t len = item->want_node ? item->node_len : item->object_len;
+    char text[IPFS_CID_MAX_LEN];
+    if (cid_format(cid, len, text, sizeof(text)) != 0) return -1;
+
+    buffer_t **buf = item->want_node ? &item->node_data : &item->data;
+    if (item->want_node || item->type != OBJ_BLOB) {
+        if (!*buf) *buf = buffer_create(item->want_node ? 256 : 4096);
+        if (!*buf) return -1;
+    }
+
+    const unsigned char *digest;
+    item->check_sha256 = cid_digest(cid, len, &digest);
+    if (item->check_sha256) sha256_init(&item->sha256);
+
+    if (item->want_node) return ipfs_batch_block(fetch->batch, text, fetch_data, fetch_done, item);
+    return ipfs_batch_cat(fetch->batch, text, fetch_data, fetch_done, item);
+}
+
+// Keep the batch fed with a couple of rounds' worth, most urgent first
+static int fetch_pump(fetch_t *fetch, size_t ahead) {
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        while (fetch->queue_head[priority] && ipfs_batch_pending(fetch->batch) < ahead) {
+            fetch_item_t *item = fetch->queue_head[priority];
+            fetch->queue_head[priority] = item->next;
+            if (!fetch->queue_head[priority]) fetch->queue_tail[priority] = NULL;
+            item->next = NULL;
+            if (fetch_start(fetch, item) != 0) {
+                item_fail(item, "Couldn't request");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int fetch_idle(const fetch_t *fetch) {
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        if (fetch->queue_head[priority]) return 0;
+    }
+    return ipfs_batch_pending(fetch->batch) == 0;
+}
+
+int ipfs_fetch(ipfs_storage_t *storage, const ipfs_fetch_tip_t *tips, size_t count,
+               ipfs_fetch_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    fetch_t fetch = {0};
+    fetch.storage = storage;
+    fetch.repo = storage->repo;
+    fetch.stats = stats;
+    fetch.buckets = calloc(FETCH_BUCKETS, sizeof(fetch_item_t *));
+    fetch.batch = fetch.buckets ? ipfs_batch_create(storage->client) : NULL;
+    if (!fetch.batch) {
+        free(fetch.buckets);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count && !fetch.failed; i++) {
+        unsigned char root[CID_BINARY_MAX];
+        size_t root_len = cid_parse(tips[i].root, root, sizeof(root));
+        if (root_len == 0 || fetch_want(&fetch, NULL, &tips[i].commit, OBJ_COMMIT, root, root_len) != 0) {
+            fprintf(stderr, "Error: Bad DAG root %s\n", tips[i].root);
+            fetch.failed = 1;
+        }
+    }
+
+    size_t ahead = (size_t)storage->client->max_in_flight * 2;
+    while (!fetch.failed && !fetch_idle(&fetch)) {
+        if (fetch_pump(&fetch, ahead) != 0) break;
+        size_t pending = ipfs_batch_pending(fetch.batch);
+        if (pending > 0 && ipfs_batch_wait(fetch.batch, pending - 1) != 0) {
+            fprintf(stderr, "Error: IPFS transfers failed\n");
+            fetch.failed = 1;
+        }
+    }
+
+    // Stops whatever is still running; their callbacks see failed
+    fetch.failed |= !fetch_idle(&fetch);
+    ipfs_batch_free(fetch.batch);
+
+    // Anything left never got everything it points at
+    int leftover = 0;
+    for (size_t i = 0; i < FETCH_BUCKETS; i++) {
+        while (fetch.buckets[i]) {
+            fetch_item_t *item = fetch.buckets[i];
+            fetch.buckets[i] = item->chain;
+            item_free(item);
+            leftover = 1;
+        }
+    }
+    free(fetch.buckets);
+
+    return fetch.failed || leftover ? -1 : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef IPFS_FETCH_H
+#define IPFS_FETCH_H
+
+#include "ipfs_storage.h"
+
+// Pulling published DAGs (see ipfs_storage_publish_branch()) back into the
+// local object store, many requests at once and verified as they stream.
+// Whatever is already on disk is skipped, so running it again after an
+// interruption picks up where it stopped.
+
+typedef struct {
+    gyatt_hash_t commit;               // What the tip has to hash to
+    char root[IPFS_CID_MAX_LEN];       // Its DAG node
+} ipfs_fetch_tip_t;
+
+typedef struct {
+    size_t objects;    // Fetched and stored
+    size_t bytes;      // Of object data downloaded
+    size_t retries;
+} ipfs_fetch_stats_t;
+
+// 0 once every tip is here along with everything it reaches
+int ipfs_fetch(ipfs_storage_t *storage, const ipfs_fetch_tip_t *tips, size_t count,
+               ipfs_fetch_stats_t *stats);
+
+#endif // IPFS_FETCH_H
@@ -1,18 +1,92 @@
 #include "ipfs_storage.h"
 #include "../utils.h"
 #include "../hash.h"
+#include "../buffer.h"
+#include "../commit_graph.h"
+#include "../chunk.h"
+#include "car.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
 
 // Because storing everything on your own server is so 2010 🌐
 
-ipfs_storage_t* ipfs_storage_init(const char *repo_path) {
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// Mappings used to be one file each under .gyatt/ipfs-refs/xx/; fold any
+// left from then into the map and drop the files
+static void import_old_refs(ipfs_storage_t *storage) {
+    char refs_path[PATH_MAX];
+    snprintf(refs_path, sizeof(refs_path), "%s/ipfs-refs", storage->repo->gyatt_dir);
+
+    DIR *dir = opendir(refs_path);
+    if (!dir) return;
+
+    size_t imported = 0;
+    int failed = 0;
+    struct dirent *shard;
+    while ((shard = readdir(dir)) != NULL) {
+        if (strlen(shard->d_name) != 2) continue;
+
+        char shard_path[PATH_MAX];
+        if (snprintf(shard_path, sizeof(shard_path), "%s/%s", refs_path, shard->d_name) >=
+            (int)sizeof(shard_path)) {
+            continue;
+        }
+        DIR *files = opendir(shard_path);
+        if (!files) continue;
+
+        struct dirent *entry;
+        while ((entry = readdir(files)) != NULL) {
+            if (strlen(entry->d_name) != HASH_HEX_SIZE - 3) continue;
+
+            char hex[HASH_HEX_SIZE];
+            char path[PATH_MAX];
+            snprintf(hex, sizeof(hex), "%s%s", shard->d_name, entry->d_name);
+            if (snprintf(path, sizeof(path), "%s/%s", shard_path, entry->d_name) >= (int)sizeof(path)) {
+                failed = 1;  // Left where it is
+                continue;
+            }
+
+            char *cid = read_file(path, NULL);
+            if (!cid) continue;
+            str_trim(cid);
+
+            gyatt_hash_t hash;
+            hex_to_hash(hex, &hash);
+            if (cid[0] && cid_map_put(storage->map, &hash, cid) == 0) {
+                unlink(path);
+                imported++;
+            } else {
+                failed = 1;
+            }
+            free(cid);
+        }
+        closedir(files);
+        rmdir(shard_path);
+    }
+    closedir(dir);
+
+    if (!failed) rmdir(refs_path);
+    if (imported > 0) {
+        cid_map_compact(storage->map);
+        printf("Moved %zu CID mapping(s) into .gyatt/ipfs-map.idx\n", imported);
+    }
+}
+
+ipfs_storage_t* ipfs_storage_init(gyatt_repo_t *repo) {
+    if (!repo) return NULL;
+
     ipfs_storage_t *storage = malloc(sizeof(ipfs_storage_t));
     if (!storage) return NULL;
 
+    storage->repo = repo;
+
     // Initialize IPFS client
     storage->client = ipfs_client_init(NULL, 0);
     if (!storage->client) {
@@ -20,109 +94,115 @@ ipfs_storage_t* ipfs_storage_init(const char *repo_path) {
         return NULL;
     }
 
-    // Set up refs path (.gyatt/ipfs-refs)
-    if (repo_path) {
-        snprintf(storage->refs_path, sizeof(storage->refs_path), 
-                 "%s/.gyatt/ipfs-refs", repo_path);
-    } else {
-        snprintf(storage->refs_path, sizeof(storage->refs_path), 
-                 ".gyatt/ipfs-refs");
+    storage->map = cid_map_open(repo->gyatt_dir, "ipfs-map");
+    storage->dag = storage->map ? cid_map_open(repo->gyatt_dir, "ipfs-dag") : NULL;
+    if (!storage->dag) {
+        cid_map_close(storage->map);
+        ipfs_client_free(storage->client);
+        free(storage);
+        return NULL;
     }
-
-    // Create ipfs-refs directory if it doesn't exist
-    mkdir(storage->refs_path, 0755);
+    import_old_refs(storage);
 
     storage->auto_pin = true; // Pin by default
+    if (repo->config.ipfs_in_flight > 0) storage->client->max_in_flight = repo->config.ipfs_in_flight;
 
     return storage;
 }
 
 void ipfs_storage_free(ipfs_storage_t *storage) {
     if (storage) {
+        cid_map_close(storage->map);
+        cid_map_close(storage->dag);
         ipfs_client_free(storage->client);
         free(storage);
     }
 }
 
-// Helper: Get the path for a CID mapping file
-static void get_mapping_path(ipfs_storage_t *storage, 
-                             const gyatt_hash_t *hash,
-                             char *out_path, size_t path_size) {
-    char hash_hex[HASH_HEX_SIZE];
-    hash_to_hex(hash, hash_hex);
-    
-    // Store as .gyatt/ipfs-refs/ab/cdef1234... (2-level directory)
-    snprintf(out_path, path_size, "%s/%.2s/%s", 
-             storage->refs_path, hash_hex, hash_hex + 2);
+// An object the way it goes up to IPFS: its loose form, "type size\0"
+// then the payload, so the SHA-1 of what comes back is the object's hash
+static void *read_loose(gyatt_repo_t *repo, const gyatt_hash_t *hash, size_t *out_size) {
+    object_type_t type;
+    size_t size;
+    void *data = object_read(repo, hash, &type, &size);
+    if (!data) return NULL;
+
+    char header[64];
+    size_t header_len = object_format_header(type, size, header, sizeof(header));
+    char *loose = realloc(data, header_len + size + 1);
+    if (!loose) {
+        free(data);
+        return NULL;
+    }
+    memmove(loose + header_len, loose, size);
+    memcpy(loose, header, header_len);
+    *out_size = header_len + size;
+    return loose;
 }
 
 char* ipfs_storage_get_cid(ipfs_storage_t *storage,
                             const gyatt_hash_t *hash) {
-    char path[4096];
-    get_mapping_path(storage, hash, path, sizeof(path));
-
-    FILE *f = fopen(path, "r");
-    if (!f) return NULL;
-
     char *cid = malloc(IPFS_CID_MAX_LEN);
-    if (!cid) {
-        fclose(f);
-        return NULL;
-    }
+    if (!cid) return NULL;
 
-    if (fgets(cid, IPFS_CID_MAX_LEN, f) == NULL) {
+    if (cid_map_get(storage->map, hash, cid, IPFS_CID_MAX_LEN) != 0) {
         free(cid);
-        fclose(f);
         return NULL;
     }
-
-    // Remove trailing newline
-    size_t len = strlen(cid);
-    if (len > 0 && cid[len - 1] == '\n') {
-        cid[len - 1] = '\0';
-    }
-
-    fclose(f);
     return cid;
 }
 
 int ipfs_storage_save_mapping(ipfs_storage_t *storage,
                                const gyatt_hash_t *hash,
                                const char *cid) {
-    char path[4096];
-    get_mapping_path(storage, hash, path, sizeof(path));
-
-    // Create parent directory
-    char dir_path[4096];
-    char hash_hex[HASH_HEX_SIZE];
-    hash_to_hex(hash, hash_hex);
-    snprintf(dir_path, sizeof(dir_path), "%s/%.2s", storage->refs_path, hash_hex);
-    mkdir(dir_path, 0755);
-
-    FILE *f = fopen(path, "w");
-    if (!f) {
-        fprintf(stderr, "Failed to save CID mapping: %s\n", path);
+    if (cid_map_put(storage->map, hash, cid) != 0) {
+        fprintf(stderr, "Failed to save CID mapping for %s\n", cid);
         return -1;
     }
-
-    fprintf(f, "%s\n", cid);
-    fclose(f);
     return 0;
 }
 
 bool ipfs_storage_has_object(ipfs_storage_t *storage,
                               const gyatt_hash_t *hash) {
-    char path[4096];
-    get_mapping_path(storage, hash, path, sizeof(path));
-    
-    struct stat st;
-    return stat(path, &st) == 0;
+    return cid_map_has(storage->map, hash);
+}
+
+size_t ipfs_storage_missing(ipfs_storage_t *storage,
+                            const gyatt_hash_t *hashes, size_t count,
+                            gyatt_hash_t *missing) {
+    return cid_map_missing(storage->map, hashes, count, missing);
+}
+
+// A chunk of a chunked file, unless it went up already
+static int put_chunk(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)size;
+    ipfs_storage_t *storage = arg;
+    if (ipfs_storage_has_object(storage, hash)) return 0;
+
+    object_type_t type;
+    size_t chunk_size;
+    void *data = object_read(storage->repo, hash, &type, &chunk_size);
+    if (!data) return -1;
+    char *cid = ipfs_storage_put_object(storage, hash, data, chunk_size);
+    free(data);
+    if (!cid) return -1;
+    free(cid);
+    return 0;
 }
 
 char* ipfs_storage_put_object(ipfs_storage_t *storage,
                                const gyatt_hash_t *hash,
                                const void *data,
                                size_t size) {
+    object_type_t type;
+    size_t stored_size;
+    if (object_read_header(storage->repo, hash, &type, &stored_size) != 0 || stored_size != size) {
+        char hash_hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hash_hex);
+        fprintf(stderr, "Error: %s isn't a local object of %zu bytes\n", hash_hex, size);
+        return NULL;
+    }
+
     // Check if already uploaded
     if (ipfs_storage_has_object(storage, hash)) {
         char hash_hex[HASH_HEX_SIZE];
@@ -131,8 +211,24 @@ char* ipfs_storage_put_object(ipfs_storage_t *storage,
         return ipfs_storage_get_cid(storage, hash);
     }
 
-    // Upload to IPFS
-    char *cid = ipfs_add(storage->client, data, size);
+    // A chunked file is only whole with its chunks, and those that are
+    // up already (the ones an edit didn't touch) aren't sent again
+    if (type == OBJ_CHUNKED && chunk_list_foreach(data, size, put_chunk, storage) != 0) {
+        char hash_hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hash_hex);
+        fprintf(stderr, "Failed to upload the chunks of %s to IPFS\n", hash_hex);
+        return NULL;
+    }
+
+    // Upload to IPFS, header and all (the add pins it)
+    char header[64];
+    size_t header_len = object_format_header(type, size, header, sizeof(header));
+    char *loose = malloc(header_len + size);
+    if (!loose) return NULL;
+    memcpy(loose, header, header_len);
+    memcpy(loose + header_len, data, size);
+    char *cid = ipfs_add(storage->client, loose, header_len + size);
+    free(loose);
     if (!cid) {
         char hash_hex[HASH_HEX_SIZE];
         hash_to_hex(hash, hash_hex);
@@ -146,13 +242,6 @@ char* ipfs_storage_put_object(ipfs_storage_t *storage,
         return NULL;
     }
 
-    // Pin if auto-pin is enabled
-    if (storage->auto_pin) {
-        if (!ipfs_pin_add(storage->client, cid)) {
-            fprintf(stderr, "Warning: Failed to pin CID %s\n", cid);
-        }
-    }
-
     char hash_hex[HASH_HEX_SIZE];
     hash_to_hex(hash, hash_hex);
     printf("✓ Uploaded %s -> %s\n", hash_hex, cid);
@@ -181,11 +270,12 @@ void* ipfs_storage_get_object(ipfs_storage_t *storage,
         return NULL;
     }
 
-    // Verify SHA-1 hash
+    // Verify SHA-1 hash: what's stored is the loose form, header included
     gyatt_hash_t computed_hash;
     sha1_hash(response->data, response->size, &computed_hash);
+    const char *payload = memchr(response->data, '\0', response->size);
 
-    if (memcmp(&computed_hash, hash, sizeof(gyatt_hash_t)) != 0) {
+    if (memcmp(&computed_hash, hash, sizeof(gyatt_hash_t)) != 0 || !payload) {
         char hash_hex[HASH_HEX_SIZE];
         hash_to_hex(hash, hash_hex);
         fprintf(stderr, "Hash mismatch for %s! Data corrupted!\n", hash_hex);
@@ -193,9 +283,12 @@ void* ipfs_storage_get_object(ipfs_storage_t *storage,
         return NULL;
     }
 
-    // Extract data and size
+    // Hand back just the payload, like object_read()
+    payload++;
+    size_t size = response->size - (size_t)(payload - response->data);
+    memmove(response->data, payload, size);
     void *data = response->data;
-    *out_size = response->size;
+    *out_size = size;
 
     // Free response struct but keep data
     free(response->error);
@@ -204,132 +297,498 @@ void* ipfs_storage_get_object(ipfs_storage_t *storage,
     return data;
 }
 
-int ipfs_storage_push_branch(ipfs_storage_t *storage, const char *branch_name) {
-    char branch_path[4096];
-    snprintf(branch_path, sizeof(branch_path), ".gyatt/refs/heads/%s", branch_name);
-
-    // Read branch commit hash
-    FILE *f = fopen(branch_path, "r");
-    if (!f) {
-        fprintf(stderr, "Branch not found: %s\n", branch_name);
-        return -1;
+// ==================== Publishing a branch as one DAG ====================
+//
+// A branch goes up as a single CAR: every object as a raw block of its
+// loose form, plus dag-cbor nodes tying them together
+//   commit  {"tree": tree node, "object": raw commit, "parent": commit node}
+//   tree    {"object": raw tree, "entries": [raw blob or tree node, ...]}
+//   chunked {"object": raw chunk list, "entries": [raw chunk, ...]}
+// with entries in the tree's own order (the raw tree has the names). A
+// file that was chunked (see chunk.h) shows up in its tree as a node
+// instead of a raw block, and each of its chunks being one block is what
+// lets an edited file share all but the changed ones with before. The
+// tip's commit node is the root, and pinning it pins everything. Node
+// CIDs are kept in .gyatt/ipfs-dag.*, keyed by the object they stand for,
+// so the next publish stops at the first commit already up and skips
+// unchanged trees.
+
+#define PUBLISH_RAW 0
+#define PUBLISH_NODE 1
+
+// A block already in this CAR
+typedef struct {
+    gyatt_hash_t hash;
+    uint8_t kind;
+    uint8_t used;
+    unsigned char cid[CAR_CID_SIZE];
+} publish_entry_t;
+
+typedef struct {
+    ipfs_storage_t *storage;
+    car_writer_t *car;
+    publish_entry_t *entries;   // Open addressing on hash + kind
+    size_t capacity;
+    size_t count;
+    size_t objects;             // Raw blocks written
+} publish_t;
+
+// A CID as found: this CAR's own are always CAR_CID_SIZE bytes, ones from
+// an earlier upload may be CIDv0 multihashes
+typedef struct {
+    unsigned char bytes[CID_BINARY_MAX];
+    size_t len;
+} publish_cid_t;
+
+static size_t publish_slot(const publish_t *pub, const gyatt_hash_t *hash, uint8_t kind) {
+    uint64_t h;
+    memcpy(&h, hash->hash, sizeof(h));
+    size_t mask = pub->capacity - 1;
+    size_t slot = (size_t)(h ^ kind) & mask;
+    while (pub->entries[slot].used &&
+           (pub->entries[slot].kind != kind || memcmp(&pub->entries[slot].hash, hash, sizeof(*hash)) != 0)) {
+        slot = (slot + 1) & mask;
     }
+    return slot;
+}
 
-    char commit_hex[HASH_HEX_SIZE];
-    if (fgets(commit_hex, sizeof(commit_hex), f) == NULL) {
-        fclose(f);
+static int publish_grow(publish_t *pub) {
+    size_t old_capacity = pub->capacity;
+    publish_entry_t *old = pub->entries;
+
+    pub->capacity = old_capacity ? old_capacity * 2 : 1024;
+    pub->entries = calloc(pub->capacity, sizeof(publish_entry_t));
+    if (!pub->entries) {
+        pub->entries = old;
+        pub->capacity = old_capacity;
         return -1;
     }
-    fclose(f);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].used) pub->entries[publish_slot(pub, &old[i].hash, old[i].kind)] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static int publish_remember(publish_t *pub, const gyatt_hash_t *hash, uint8_t kind,
+                            const unsigned char cid[CAR_CID_SIZE]) {
+    if ((pub->count + 1) * 2 > pub->capacity && publish_grow(pub) != 0) return -1;
 
-    // Remove trailing newline
-    size_t len = strlen(commit_hex);
-    if (len > 0 && commit_hex[len - 1] == '\n') {
-        commit_hex[len - 1] = '\0';
+    publish_entry_t *entry = &pub->entries[publish_slot(pub, hash, kind)];
+    entry->hash = *hash;
+    entry->kind = kind;
+    entry->used = 1;
+    memcpy(entry->cid, cid, CAR_CID_SIZE);
+    pub->count++;
+    return 0;
+}
+
+// 1 and the CID if the block is in this CAR or went up before
+static int publish_known(const publish_t *pub, const gyatt_hash_t *hash, uint8_t kind, publish_cid_t *cid) {
+    if (pub->capacity > 0) {
+        const publish_entry_t *entry = &pub->entries[publish_slot(pub, hash, kind)];
+        if (entry->used) {
+            memcpy(cid->bytes, entry->cid, CAR_CID_SIZE);
+            cid->len = CAR_CID_SIZE;
+            return 1;
+        }
     }
 
-    gyatt_hash_t commit_hash;
-    hex_to_hash(commit_hex, &commit_hash);
+    char text[IPFS_CID_MAX_LEN];
+    const cid_map_t *map = kind == PUBLISH_RAW ? pub->storage->map : pub->storage->dag;
+    if (cid_map_get(map, hash, text, sizeof(text)) != 0) return 0;
+    cid->len = cid_parse(text, cid->bytes, sizeof(cid->bytes));
+    return cid->len > 0;
+}
 
-    printf("Pushing branch '%s' (commit %s) to IPFS...\n", branch_name, commit_hex);
+static int publish_raw(publish_t *pub, const gyatt_hash_t *hash, publish_cid_t *cid) {
+    if (publish_known(pub, hash, PUBLISH_RAW, cid)) return 0;
 
-    // Upload commit and walk the tree
-    // This is a simplified version - we'll recursively upload all objects
     object_type_t type;
     size_t size;
-    void *data = object_read(&commit_hash, &type, &size);
+    void *data = object_read(pub->storage->repo, hash, &type, &size);
     if (!data) {
-        fprintf(stderr, "Failed to read commit object\n");
+        char hash_hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hash_hex);
+        fprintf(stderr, "Error: Failed to read object %s\n", hash_hex);
         return -1;
     }
 
-    // Upload the commit
-    char *cid = ipfs_storage_put_object(storage, &commit_hash, data, size);
+    char header[64];
+    size_t header_len = object_format_header(type, size, header, sizeof(header));
+    int result = car_writer_block(pub->car, CAR_CODEC_RAW, header, header_len, data, size, cid->bytes);
     free(data);
+    if (result != 0) return -1;
 
-    if (!cid) {
+    cid->len = CAR_CID_SIZE;
+    pub->objects++;
+    return publish_remember(pub, hash, PUBLISH_RAW, cid->bytes);
+}
+
+static int publish_node(publish_t *pub, const gyatt_hash_t *hash, buffer_t *node, publish_cid_t *cid) {
+    if (car_writer_block(pub->car, CAR_CODEC_DAG_CBOR, NULL, 0, node->data, node->len, cid->bytes) != 0) {
         return -1;
     }
+    cid->len = CAR_CID_SIZE;
+    return publish_remember(pub, hash, PUBLISH_NODE, cid->bytes);
+}
 
-    printf("✓ Branch '%s' pushed to IPFS (root CID: %s)\n", branch_name, cid);
-    free(cid);
-
+typedef struct {
+    publish_t *pub;
+    buffer_t *node;
+} publish_chunks_t;
+
+static int publish_chunk(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)size;
+    publish_chunks_t *chunks = arg;
+    publish_cid_t cid;
+    if (publish_raw(chunks->pub, hash, &cid) != 0) return -1;
+    cbor_link(chunks->node, cid.bytes, cid.len);
     return 0;
 }
 
-int ipfs_storage_push_all(ipfs_storage_t *storage) {
-    char objects_path[4096];
-    snprintf(objects_path, sizeof(objects_path), ".gyatt/objects");
+// A tree entry that isn't a tree: a raw block, or a node if it's chunked
+static int publish_file(publish_t *pub, const gyatt_hash_t *hash, publish_cid_t *cid) {
+    if (publish_known(pub, hash, PUBLISH_NODE, cid)) return 0;
 
-    printf("Scanning local objects...\n");
+    object_type_t type;
+    size_t size;
+    if (object_read_header(pub->storage->repo, hash, &type, &size) != 0 || type != OBJ_CHUNKED) {
+        return publish_raw(pub, hash, cid);
+    }
 
-    // Walk through all objects in .gyatt/objects
-    DIR *dir = opendir(objects_path);
-    if (!dir) {
-        fprintf(stderr, "Failed to open objects directory\n");
+    void *list = object_read(pub->storage->repo, hash, &type, &size);
+    if (!list) {
+        char hash_hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hash_hex);
+        fprintf(stderr, "Error: Failed to read object %s\n", hash_hex);
         return -1;
     }
 
-    int uploaded = 0;
-    int skipped = 0;
+    publish_cid_t object;
+    publish_chunks_t chunks = { pub, buffer_create(64 + size / CHUNK_REF_SIZE * (CAR_CID_SIZE + 8)) };
+    int result = chunks.node ? publish_raw(pub, hash, &object) : -1;
+    if (result == 0) {
+        cbor_map(chunks.node, 2);
+        cbor_text(chunks.node, "object");
+        cbor_link(chunks.node, object.bytes, object.len);
+        cbor_text(chunks.node, "entries");
+        cbor_array(chunks.node, size / CHUNK_REF_SIZE);
+        result = chunk_list_foreach(list, size, publish_chunk, &chunks) == 0 ? 0 : -1;
+    }
+    free(list);
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-        if (strlen(entry->d_name) != 2) continue;
+    if (result == 0) result = publish_node(pub, hash, chunks.node, cid);
+    buffer_free(chunks.node);
+    return result;
+}
+
+static int publish_tree(publish_t *pub, const gyatt_hash_t *hash, publish_cid_t *cid) {
+    if (publish_known(pub, hash, PUBLISH_NODE, cid)) return 0;
+
+    tree_object_t *tree = tree_read(pub->storage->repo, hash);
+    if (!tree) {
+        char hash_hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hash_hex);
+        fprintf(stderr, "Error: Failed to read tree %s\n", hash_hex);
+        return -1;
+    }
 
-        // Scan subdirectory
-        char subdir_path[4096];
-        snprintf(subdir_path, sizeof(subdir_path), "%s/%s", objects_path, entry->d_name);
+    publish_cid_t object;
+    buffer_t *node = buffer_create(64 + tree->entry_count * (CAR_CID_SIZE + 8));
+    int result = node ? publish_raw(pub, hash, &object) : -1;
+    if (result == 0) {
+        cbor_map(node, 2);
+        cbor_text(node, "object");
+        cbor_link(node, object.bytes, object.len);
+        cbor_text(node, "entries");
+        cbor_array(node, tree->entry_count);
+    }
 
-        DIR *subdir = opendir(subdir_path);
-        if (!subdir) continue;
+    for (size_t i = 0; i < tree->entry_count && result == 0; i++) {
+        const tree_entry_t *entry = &tree->entries[i];
+        publish_cid_t child;
+        if (entry->type == OBJ_TREE) {
+            result = publish_tree(pub, &entry->hash, &child);
+        } else {
+            result = publish_file(pub, &entry->hash, &child);
+        }
+        if (result == 0) cbor_link(node, child.bytes, child.len);
+    }
+    tree_free(tree);
 
-        struct dirent *obj_entry;
-        while ((obj_entry = readdir(subdir)) != NULL) {
-            if (obj_entry->d_name[0] == '.') continue;
+    if (result == 0) result = publish_node(pub, hash, node, cid);
+    buffer_free(node);
+    return result;
+}
 
-            // Reconstruct full hash
-            char hash_hex[HASH_HEX_SIZE];
-            snprintf(hash_hex, sizeof(hash_hex), "%s%s", entry->d_name, obj_entry->d_name);
+// parent is the parent's commit node, NULL for a root commit
+static int publish_commit(publish_t *pub, const commit_info_t *commit, const publish_cid_t *parent,
+                          publish_cid_t *cid) {
+    publish_cid_t tree, object;
+    if (publish_tree(pub, &commit->tree, &tree) != 0 || publish_raw(pub, &commit->hash, &object) != 0) {
+        return -1;
+    }
 
-            gyatt_hash_t hash;
-            hex_to_hash(hash_hex, &hash);
+    buffer_t *node = buffer_create(256);
+    if (!node) return -1;
+    cbor_map(node, parent ? 3 : 2);
+    cbor_text(node, "tree");
+    cbor_link(node, tree.bytes, tree.len);
+    cbor_text(node, "object");
+    cbor_link(node, object.bytes, object.len);
+    if (parent) {
+        cbor_text(node, "parent");
+        cbor_link(node, parent->bytes, parent->len);
+    }
 
-            // Skip if already uploaded
-            if (ipfs_storage_has_object(storage, &hash)) {
-                skipped++;
-                continue;
-            }
+    int result = publish_node(pub, &commit->hash, node, cid);
+    buffer_free(node);
+    return result;
+}
 
-            // Read object
-            object_type_t type;
-            size_t size;
-            void *data = object_read(&hash, &type, &size);
-            if (!data) {
-                fprintf(stderr, "Failed to read object %s\n", hash_hex);
-                continue;
+// Write the commits (newest first, as walked) into a CAR oldest first, so
+// each node can link its parent's
+static int publish_write_car(publish_t *pub, const commit_info_t *commits, size_t count,
+                             const publish_cid_t *base, publish_cid_t *root) {
+    publish_cid_t parent;
+    int has_parent = base != NULL;
+    if (base) parent = *base;
+
+    for (size_t i = count; i-- > 0;) {
+        if (publish_commit(pub, &commits[i], has_parent ? &parent : NULL, root) != 0) return -1;
+        parent = *root;
+        has_parent = 1;
+    }
+    return 0;
+}
+
+static int publish_record(publish_t *pub) {
+    for (size_t i = 0; i < pub->capacity; i++) {
+        const publish_entry_t *entry = &pub->entries[i];
+        if (!entry->used) continue;
+
+        char text[IPFS_CID_MAX_LEN];
+        cid_map_t *map = entry->kind == PUBLISH_RAW ? pub->storage->map : pub->storage->dag;
+        if (cid_format(entry->cid, CAR_CID_SIZE, text, sizeof(text)) != 0 ||
+            cid_map_put(map, &entry->hash, text) != 0) {
+            fprintf(stderr, "Error: Failed to save CID mapping for %s\n", text);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ipfs_storage_publish_branch(ipfs_storage_t *storage, const char *branch_name,
+                                char *root_out, size_t root_size) {
+    gyatt_hash_t tip;
+    if (repo_resolve_ref(storage->repo, branch_name, &tip) != 0) {
+        fprintf(stderr, "Branch not found: %s\n", branch_name);
+        return -1;
+    }
+
+    // Already up, nothing to send
+    if (cid_map_get(storage->dag, &tip, root_out, root_size) == 0) {
+        printf("Branch '%s' is already published\n", branch_name);
+        return 0;
+    }
+
+    // History back to the first commit that's already up
+    publish_t pub = { storage, NULL, NULL, 0, 0, 0 };
+    commit_info_t *commits = NULL;
+    size_t count = 0, capacity = 0;
+    publish_cid_t base;
+    int has_base = 0;
+    gyatt_hash_t next = tip;
+    int result = 0;
+    for (;;) {
+        if (count >= capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            commit_info_t *grown = realloc(commits, new_capacity * sizeof(commit_info_t));
+            if (!grown) {
+                result = -1;
+                break;
             }
+            commits = grown;
+            capacity = new_capacity;
+        }
+        if (commit_info_get(storage->repo, &next, &commits[count]) != 0) {
+            char hash_hex[HASH_HEX_SIZE];
+            hash_to_hex(&next, hash_hex);
+            fprintf(stderr, "Error: Failed to read commit %s\n", hash_hex);
+            result = -1;
+            break;
+        }
+        if (!commits[count].has_parent) {
+            count++;
+            break;
+        }
+        next = commits[count++].parent;
+        if (publish_known(&pub, &next, PUBLISH_NODE, &base)) {
+            has_base = 1;
+            break;
+        }
+    }
 
-            // Upload to IPFS
-            char *cid = ipfs_storage_put_object(storage, &hash, data, size);
-            free(data);
+    char car_path[PATH_MAX];
+    publish_cid_t root;
+    if (result == 0) {
+        pub.car = car_writer_create(storage->repo->gyatt_dir, car_path, sizeof(car_path));
+        if (!pub.car) result = -1;
+    }
+    if (result == 0) {
+        result = publish_write_car(&pub, commits, count, has_base ? &base : NULL, &root);
+        size_t blocks = car_writer_count(pub.car);
+        if (result == 0) {
+            result = car_writer_finish(pub.car, root.bytes);
+        } else {
+            car_writer_abort(pub.car);
+        }
 
-            if (cid) {
-                uploaded++;
-                free(cid);
+        // One streamed request for the lot, and one recursive pin on the root
+        char expected[IPFS_CID_MAX_LEN];
+        char *imported = NULL;
+        if (result == 0) {
+            cid_format(root.bytes, root.len, expected, sizeof(expected));
+            printf("Importing %zu commit(s), %zu object(s) as %zu blocks...\n", count, pub.objects, blocks);
+            imported = ipfs_dag_import(storage->client, car_path);
+            if (!imported) {
+                result = -1;
+            } else if (strcmp(imported, expected) != 0) {
+                fprintf(stderr, "Error: IPFS imported root %s, expected %s\n", imported, expected);
+                result = -1;
             }
         }
+        unlink(car_path);
+        free(imported);
 
-        closedir(subdir);
+        // Only once it's all there, so a failed import leaves no mappings behind
+        if (result == 0) result = publish_record(&pub);
+        if (result == 0 && snprintf(root_out, root_size, "%s", expected) >= (int)root_size) result = -1;
     }
 
-    closedir(dir);
+    free(commits);
+    free(pub.entries);
+    return result;
+}
 
-    printf("\n✓ Push complete: %d uploaded, %d skipped\n", uploaded, skipped);
+int ipfs_storage_push_branch(ipfs_storage_t *storage, const char *branch_name) {
+    char root[IPFS_CID_MAX_LEN];
+    if (ipfs_storage_publish_branch(storage, branch_name, root, sizeof(root)) != 0) {
+        return -1;
+    }
+
+    printf("✓ Branch '%s' pushed to IPFS (root CID: %s)\n", branch_name, root);
     return 0;
 }
 
+typedef struct {
+    ipfs_storage_t *storage;
+    gyatt_hash_t *hashes;    // Local objects, then the ones not uploaded yet
+    size_t count;
+    size_t capacity;
+    int uploaded;
+    int skipped;
+    int failed;
+} push_all_state_t;
+
+// One upload in flight
+typedef struct {
+    push_all_state_t *state;
+    gyatt_hash_t hash;
+} push_upload_t;
+
+static int collect_object(const gyatt_hash_t *hash, void *arg) {
+    push_all_state_t *state = arg;
+    if (state->count >= state->capacity) {
+        size_t new_capacity = state->capacity == 0 ? 1024 : state->capacity * 2;
+        gyatt_hash_t *grown = realloc(state->hashes, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        state->hashes = grown;
+        state->capacity = new_capacity;
+    }
+    state->hashes[state->count++] = *hash;
+    return 0;
+}
+
+static void upload_done(void *arg, const char *cid) {
+    push_upload_t *upload = arg;
+    push_all_state_t *state = upload->state;
+
+    char hash_hex[HASH_HEX_SIZE];
+    hash_to_hex(&upload->hash, hash_hex);
+    if (!cid) {
+        fprintf(stderr, "Failed to upload object %s to IPFS\n", hash_hex);
+        state->failed++;
+    } else if (ipfs_storage_save_mapping(state->storage, &upload->hash, cid) < 0) {
+        state->failed++;
+    } else {
+        printf("✓ Uploaded %s -> %s\n", hash_hex, cid);
+        state->uploaded++;
+    }
+    free(upload);
+}
+
+int ipfs_storage_push_all(ipfs_storage_t *storage) {
+    printf("Scanning local objects...\n");
+
+    // Loose and packed objects alike
+    push_all_state_t state = { storage, NULL, 0, 0, 0, 0, 0 };
+    if (object_foreach(storage->repo, collect_object, &state) != 0) {
+        fprintf(stderr, "Failed to list local objects\n");
+        free(state.hashes);
+        return -1;
+    }
+
+    // Skip what's already uploaded, all in one go
+    size_t total = state.count;
+    state.count = ipfs_storage_missing(storage, state.hashes, total, state.hashes);
+    state.skipped = (int)(total - state.count);
+
+    ipfs_batch_t *batch = ipfs_batch_create(storage->client);
+    if (!batch) {
+        free(state.hashes);
+        return -1;
+    }
+
+    // Objects are read just ahead of the uploads, so only a couple of
+    // rounds' worth is ever in memory. The add pins as it goes.
+    size_t ahead = (size_t)storage->client->max_in_flight * 2;
+    int result = 0;
+    for (size_t i = 0; i < state.count && result == 0; i++) {
+        size_t size;
+        void *data = read_loose(storage->repo, &state.hashes[i], &size);
+        push_upload_t *upload = data ? malloc(sizeof(push_upload_t)) : NULL;
+        if (!upload) {
+            char hash_hex[HASH_HEX_SIZE];
+            hash_to_hex(&state.hashes[i], hash_hex);
+            fprintf(stderr, "Failed to read object %s\n", hash_hex);
+            free(data);
+            state.failed++;
+            continue;
+        }
+        upload->state = &state;
+        upload->hash = state.hashes[i];
+
+        if (ipfs_batch_add(batch, data, size, storage->auto_pin, upload_done, upload) != 0) {
+            free(upload);
+            result = -1;
+        } else if (ipfs_batch_pending(batch) >= ahead) {
+            result = ipfs_batch_wait(batch, ahead / 2);
+        }
+    }
+    if (result == 0) result = ipfs_batch_wait(batch, 0);
+
+    // Anything left after an error is reported as failed
+    ipfs_batch_free(batch);
+    free(state.hashes);
+
+    printf("\n✓ Push complete: %d uploaded, %d skipped", state.uploaded, state.skipped);
+    if (state.failed) printf(", %d failed", state.failed);
+    printf("\n");
+    return result == 0 && state.failed == 0 ? 0 : -1;
+}
+
 char* ipfs_storage_publish_manifest(ipfs_storage_t *storage) {
     printf("Creating repository manifest...\n");
 
@@ -341,7 +800,10 @@ char* ipfs_storage_publish_manifest(ipfs_storage_t *storage) {
     strcat(manifest, "  \"branches\": {\n");
 
     // Read all branches
-    DIR *dir = opendir(".gyatt/refs/heads");
+    char heads_path[4096];
+    snprintf(heads_path, sizeof(heads_path), "%s/refs/heads", storage->repo->gyatt_dir);
+
+    DIR *dir = opendir(heads_path);
     if (!dir) {
         fprintf(stderr, "Failed to open refs/heads directory\n");
         return NULL;
@@ -354,7 +816,7 @@ char* ipfs_storage_publish_manifest(ipfs_storage_t *storage) {
 
         // Read branch commit
         char branch_path[4096];
-        snprintf(branch_path, sizeof(branch_path), ".gyatt/refs/heads/%s", entry->d_name);
+        snprintf(branch_path, sizeof(branch_path), "%s/%s", heads_path, entry->d_name);
 
         FILE *f = fopen(branch_path, "r");
         if (!f) continue;
@@ -372,20 +834,26 @@ char* ipfs_storage_publish_manifest(ipfs_storage_t *storage) {
             commit_hex[len - 1] = '\0';
         }
 
-        // Get CID for commit
+        // The branch's whole history goes up first; the commit then has a CID too
+        char root[IPFS_CID_MAX_LEN];
+        if (ipfs_storage_publish_branch(storage, entry->d_name, root, sizeof(root)) != 0) {
+            closedir(dir);
+            return NULL;
+        }
         gyatt_hash_t commit_hash;
         hex_to_hash(commit_hex, &commit_hash);
         char *cid = ipfs_storage_get_cid(storage, &commit_hash);
 
         if (cid) {
             if (branch_count > 0) strcat(manifest, ",\n");
-            char entry_json[512];
+            char entry_json[768];
             snprintf(entry_json, sizeof(entry_json),
                      "    \"%s\": {\n"
                      "      \"commit\": \"%s\",\n"
-                     "      \"cid\": \"%s\"\n"
+                     "      \"cid\": \"%s\",\n"
+                     "      \"root\": \"%s\"\n"
                      "    }",
-                     entry->d_name, commit_hex, cid);
+                     entry->d_name, commit_hex, cid, root);
             strcat(manifest, entry_json);
             free(cid);
             branch_count++;
@@ -406,13 +874,105 @@ char* ipfs_storage_publish_manifest(ipfs_storage_t *storage) {
         return NULL;
     }
 
-    // Pin the manifest
-    if (storage->auto_pin) {
-        ipfs_pin_add(storage->client, manifest_cid);
-    }
-
     printf("\n✓ Manifest published to IPFS: %s\n", manifest_cid);
     printf("  View at: https://ipfs.io/ipfs/%s\n", manifest_cid);
 
     return manifest_cid;
 }
+
+// The string value of key inside [obj, end), as publish_manifest() writes it
+static int manifest_string(const char *obj, const char *end, const char *key, char *out, size_t out_size) {
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    size_t quoted_len = strlen(quoted);
+
+    for (const char *p = obj; p + quoted_len < end; p++) {
+        if (memcmp(p, quoted, quoted_len) != 0) continue;
+        p += quoted_len;
+        p += strspn(p, " \t\r\n");
+        if (*p++ != ':') return -1;
+        p += strspn(p, " \t\r\n");
+        if (*p++ != '"') return -1;
+        const char *close = memchr(p, '"', (size_t)(end - p));
+        if (!close || (size_t)(close - p) >= out_size) return -1;
+        memcpy(out, p, (size_t)(close - p));
+        out[close - p] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+int ipfs_storage_read_manifest(ipfs_storage_t *storage, const char *cid,
+                               ipfs_manifest_branch_t **branches, size_t *count) {
+    *branches = NULL;
+    *count = 0;
+
+    ipfs_response_t *response = ipfs_cat(storage->client, cid);
+    if (!response || response->status_code != 200) {
+        fprintf(stderr, "Error: Couldn't fetch manifest %s\n", cid);
+        if (response) ipfs_response_free(response);
+        return -1;
+    }
+
+    const char *p = strstr(response->data, "\"branches\"");
+    p = p ? strchr(p, '{') : NULL;
+    if (!p || !strstr(response->data, "\"gyatt-repository\"")) {
+        fprintf(stderr, "Error: %s isn't a gyatt repository manifest\n", cid);
+        ipfs_response_free(response);
+        return -1;
+    }
+
+    // "name": { "commit": "...", "cid": "...", "root": "..." }, ...
+    size_t capacity = 0;
+    int result = 0;
+    p++;
+    for (;;) {
+        p += strspn(p, " \t\r\n,");
+        if (*p != '"') break;
+        const char *name = ++p;
+        const char *name_end = strchr(name, '"');
+        const char *obj = name_end ? strchr(name_end, '{') : NULL;
+        const char *obj_end = obj ? strchr(obj, '}') : NULL;
+        if (!obj_end || (size_t)(name_end - name) >= sizeof((*branches)->name)) {
+            result = -1;
+            break;
+        }
+
+        if (*count >= capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            ipfs_manifest_branch_t *grown = realloc(*branches, new_capacity * sizeof(ipfs_manifest_branch_t));
+            if (!grown) {
+                result = -1;
+                break;
+            }
+            *branches = grown;
+            capacity = new_capacity;
+        }
+
+        ipfs_manifest_branch_t *branch = &(*branches)[*count];
+        memcpy(branch->name, name, (size_t)(name_end - name));
+        branch->name[name_end - name] = '\0';
+        char commit_hex[HASH_HEX_SIZE];
+        if (manifest_string(obj, obj_end, "commit", commit_hex, sizeof(commit_hex)) != 0 ||
+            strlen(commit_hex) != HASH_HEX_SIZE - 1) {
+            result = -1;
+            break;
+        }
+        hex_to_hash(commit_hex, &branch->commit);
+        // Manifests from before branches were published as DAGs have no root
+        if (manifest_string(obj, obj_end, "root", branch->root, sizeof(branch->root)) != 0) {
+            branch->root[0] = '\0';
+        }
+        (*count)++;
+        p = obj_end + 1;
+    }
+
+    ipfs_response_free(response);
+    if (result != 0) {
+        fprintf(stderr, "Error: Malformed manifest %s\n", cid);
+        free(*branches);
+        *branches = NULL;
+        *count = 0;
+    }
+    return result;
+}
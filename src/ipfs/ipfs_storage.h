@@ -4,22 +4,27 @@
 #include "../gyatt.h"
 #include "../object.h"
 #include "ipfs.h"
+#include "cid_map.h"
 #include <stdbool.h>
 
 // IPFS storage configuration
 typedef struct {
+    gyatt_repo_t *repo;    // Repository the objects come from (borrowed)
     ipfs_client_t *client;
-    char refs_path[4096];  // Path to .gyatt/ipfs-refs
+    cid_map_t *map;        // SHA-1 -> CID, .gyatt/ipfs-map.*
+    cid_map_t *dag;        // Commit/tree SHA-1 -> DAG node CID, .gyatt/ipfs-dag.*
     bool auto_pin;         // Automatically pin uploaded objects
 } ipfs_storage_t;
 
 // Initialize IPFS storage for a repository
-ipfs_storage_t* ipfs_storage_init(const char *repo_path);
+ipfs_storage_t* ipfs_storage_init(gyatt_repo_t *repo);
 
 // Free IPFS storage
 void ipfs_storage_free(ipfs_storage_t *storage);
 
-// Upload a Gyatt object to IPFS and store SHA-1 -> CID mapping
+// Upload a Gyatt object (its payload, as object_read() gives it) to IPFS
+// and store SHA-1 -> CID mapping. What's stored is the loose form, so
+// the SHA-1 of the block is the object's hash.
 // Returns the CID on success, NULL on failure
 char* ipfs_storage_put_object(ipfs_storage_t *storage, 
                                const gyatt_hash_t *hash,
@@ -45,14 +50,37 @@ int ipfs_storage_save_mapping(ipfs_storage_t *storage,
                                const gyatt_hash_t *hash,
                                const char *cid);
 
+// Which of hashes aren't uploaded yet, in one pass (see cid_map_missing())
+size_t ipfs_storage_missing(ipfs_storage_t *storage,
+                            const gyatt_hash_t *hashes, size_t count,
+                            gyatt_hash_t *missing);
+
 // Upload all objects in the repository to IPFS
 int ipfs_storage_push_all(ipfs_storage_t *storage);
 
 // Upload a specific branch and its history to IPFS
 int ipfs_storage_push_branch(ipfs_storage_t *storage, const char *branch_name);
 
+// Publish everything a branch reaches as one DAG (see ipfs_storage.c),
+// in a single dag/import that pins the root recursively. Only what's new
+// since the last publish goes up. root_out gets the root CID.
+int ipfs_storage_publish_branch(ipfs_storage_t *storage, const char *branch_name,
+                                char *root_out, size_t root_size);
+
 // Create and publish a repository manifest to IPFS
 // Returns the manifest CID
 char* ipfs_storage_publish_manifest(ipfs_storage_t *storage);
 
+// One branch of a published manifest. root is empty for manifests
+// written before branches went up as DAGs.
+typedef struct {
+    char name[256];
+    gyatt_hash_t commit;
+    char root[IPFS_CID_MAX_LEN];
+} ipfs_manifest_branch_t;
+
+// Fetch and parse the manifest at cid; branches is malloc'd
+int ipfs_storage_read_manifest(ipfs_storage_t *storage, const char *cid,
+                               ipfs_manifest_branch_t **branches, size_t *count);
+
 #endif // IPFS_STORAGE_H
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "gyatt.h"
+#include "trace.h"
 
 void print_usage(const char *prog_name) {
     printf("Gyatt - Like Git, but with personality\n\n");
@@ -17,6 +18,11 @@ void print_usage(const char *prog_name) {
     printf("  checkout    Switch branches or restore files\n");
     printf("  push        Push changes to remote server\n");
     printf("  pull        Pull changes from remote server\n");
+    printf("  repack      Pack loose objects into a packfile\n");
+    printf("  commit-graph  Write the commit graph used by history walks\n");
+    printf("  merge-base  Find the common ancestor of two commits\n");
+    printf("  fetch-pack  Fetch objects by hash from a server in one batch\n");
+    printf("  fsmonitor   Watch the working tree so status only checks what changed\n");
     printf("  server      Start Gyatt server mode\n");
     printf("  ipfs        IPFS integration commands\n");
     printf("  help        Show this help message\n");
@@ -30,37 +36,57 @@ int main(int argc, char *argv[]) {
 
     const char *command = argv[1];
 
+    if (strcmp(command, "help") == 0 || strcmp(command, "--help") == 0) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    // GYATT_TRACE=summary|<file>: where the time went, printed or written at exit
+    trace_init(command);
+
+    // Find the repository once; everything downstream reuses these paths
+    gyatt_repo_t *repo = repo_open();
+    int result;
+
     // The world's longest if-else chain (TODO: use a hash map when we're feeling fancy)
     if (strcmp(command, "init") == 0) {
-        return cmd_init(argc - 1, argv + 1);
+        result = cmd_init(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "add") == 0) {
-        return cmd_add(argc - 1, argv + 1);
+        result = cmd_add(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "commit") == 0) {
-        return cmd_commit(argc - 1, argv + 1);
+        result = cmd_commit(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "status") == 0) {
-        return cmd_status(argc - 1, argv + 1);
+        result = cmd_status(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "log") == 0) {
-        return cmd_log(argc - 1, argv + 1);
+        result = cmd_log(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "branch") == 0) {
-        return cmd_branch(argc - 1, argv + 1);
+        result = cmd_branch(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "checkout") == 0) {
-        return cmd_checkout(argc - 1, argv + 1);
+        result = cmd_checkout(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "push") == 0) {
-        return cmd_push(argc - 1, argv + 1);
+        result = cmd_push(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "pull") == 0) {
-        return cmd_pull(argc - 1, argv + 1);
+        result = cmd_pull(repo, argc - 1, argv + 1);
+    } else if (strcmp(command, "repack") == 0) {
+        result = cmd_repack(repo, argc - 1, argv + 1);
+    } else if (strcmp(command, "commit-graph") == 0) {
+        result = cmd_commit_graph(repo, argc - 1, argv + 1);
+    } else if (strcmp(command, "merge-base") == 0) {
+        result = cmd_merge_base(repo, argc - 1, argv + 1);
+    } else if (strcmp(command, "fetch-pack") == 0) {
+        result = cmd_fetch_pack(repo, argc - 1, argv + 1);
+    } else if (strcmp(command, "fsmonitor") == 0) {
+        result = cmd_fsmonitor(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "server") == 0) {
-        return cmd_server(argc - 1, argv + 1);
+        result = cmd_server(repo, argc - 1, argv + 1);
     } else if (strcmp(command, "ipfs") == 0) {
-        return cmd_ipfs(argc - 2, argv + 2);
-    } else if (strcmp(command, "help") == 0 || strcmp(command, "--help") == 0) {
-        print_usage(argv[0]);
-        return 0;
+        result = cmd_ipfs(repo, argc - 2, argv + 2);
     } else {
         fprintf(stderr, "Error: Unknown command '%s'\n", command);
         fprintf(stderr, "Try 'gyatt help' if you're lost\n");
-        return 1;
+        result = 1;
     }
 
-    return 0; // We'll never get here but the compiler gets anxious without it
+    repo_free(repo);
+    return result;
 }
@@ -2,11 +2,24 @@
 #include "hash.h"
 #include "utils.h"
 #include "buffer.h"
+#include "pack.h"
+#include "trace.h"
+#include "compress.h"
+#include "chunk.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <zlib.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
 
 blob_object_t *blob_create(const void *data, size_t size) {
     blob_object_t *blob = calloc(1, sizeof(blob_object_t));
@@ -34,9 +47,11 @@ tree_object_t *tree_create(void) {
     if (!tree) return NULL;
 
     tree->header.type = OBJ_TREE;
+    atomic_init(&tree->header.refs, 1);
     tree->header.size = 0;
     tree->entry_count = 0;
     tree->entries = NULL;
+    arena_init(&tree->arena, 4096);
     
     return tree;
 }
@@ -46,10 +61,15 @@ commit_object_t *commit_create(void) {
     if (!commit) return NULL;
 
     commit->header.type = OBJ_COMMIT;
+    atomic_init(&commit->header.refs, 1);
     
     // Initialize with zero hashes
     memset(&commit->tree, 0, sizeof(gyatt_hash_t));
     memset(&commit->parent, 0, sizeof(gyatt_hash_t));
+    commit->author.name = commit->author.email = "";
+    commit->committer = commit->author;
+    commit->message = "";
+    arena_init(&commit->arena, 1024);
     
     return commit;
 }
@@ -62,269 +82,742 @@ void blob_free(blob_object_t *blob) {
 
 void tree_free(tree_object_t *tree) {
     if (!tree) return;
-    free(tree->entries);
+    if (atomic_fetch_sub(&tree->header.refs, 1) > 1) return;
+    if (tree->capacity > 0) free(tree->entries);
+    arena_free(&tree->arena);
+    free(tree->payload);
     free(tree);
 }
 
 void commit_free(commit_object_t *commit) {
     if (!commit) return;
+    if (atomic_fetch_sub(&commit->header.refs, 1) > 1) return;
+    arena_free(&commit->arena);
     free(commit);
 }
 
+// Binary search over the sorted entries. Returns 1 and the entry's position
+// if found, otherwise 0 and the position it would be inserted at.
+static int tree_lookup(const tree_object_t *tree, const char *name, size_t *pos) {
+    size_t lo = 0, hi = tree->entry_count;
+    
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(tree->entries[mid].name, name);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    *pos = lo;
+    return 0;
+}
+
 void tree_add_entry(tree_object_t *tree, const char *name, uint32_t mode,
                     const gyatt_hash_t *hash, object_type_t type) {
     if (!tree || !name || !hash) return;
 
-    // Reallocate entries array
-    tree_entry_t *new_entries = realloc(tree->entries, 
-                                        (tree->entry_count + 1) * sizeof(tree_entry_t));
-    if (!new_entries) return;
+    char *copy = arena_strndup(&tree->arena, name, strlen(name));
+    if (!copy) return;
+
+    // Keep entries sorted; a name that's already there is replaced
+    size_t pos;
+    if (!tree_lookup(tree, name, &pos)) {
+        if (tree->entry_count >= tree->capacity) {
+            // A parsed tree's entries sit in its arena; the first addition
+            // moves them out to somewhere they can grow
+            size_t new_capacity = tree->capacity == 0 ? 16 : tree->capacity * 2;
+            while (new_capacity <= tree->entry_count) new_capacity *= 2;
+            tree_entry_t *new_entries = tree->capacity > 0
+                ? realloc(tree->entries, new_capacity * sizeof(tree_entry_t))
+                : malloc(new_capacity * sizeof(tree_entry_t));
+            if (!new_entries) return;
+            if (tree->capacity == 0 && tree->entry_count > 0) {
+                memcpy(new_entries, tree->entries, tree->entry_count * sizeof(tree_entry_t));
+            }
+            
+            tree->entries = new_entries;
+            tree->capacity = new_capacity;
+        }
+        
+        // Entries usually arrive in order, in which case this is an append
+        if (pos < tree->entry_count) {
+            memmove(&tree->entries[pos + 1], &tree->entries[pos],
+                    (tree->entry_count - pos) * sizeof(tree_entry_t));
+        }
+        tree->entry_count++;
+    }
     
-    tree->entries = new_entries;
-    tree_entry_t *entry = &tree->entries[tree->entry_count];
+    tree_entry_t *entry = &tree->entries[pos];
     
     // Set entry data
-    strncpy(entry->name, name, sizeof(entry->name) - 1);
-    entry->name[sizeof(entry->name) - 1] = '\0';
+    entry->name = copy;
     entry->mode = mode;
     hash_copy(&entry->hash, hash);
     entry->type = type;
-    
-    tree->entry_count++;
 }
 
 tree_entry_t *tree_find_entry(tree_object_t *tree, const char *name) {
     if (!tree || !name) return NULL;
     
-    for (size_t i = 0; i < tree->entry_count; i++) {
-        if (strcmp(tree->entries[i].name, name) == 0) {
-            return &tree->entries[i];
-        }
-    }
+    size_t pos;
+    if (!tree_lookup(tree, name, &pos)) return NULL;
     
-    return NULL;
+    return &tree->entries[pos];
 }
 
 // ==================== Object Storage ====================
 
-// Get the path for an object based on its hash
-char *object_path(const gyatt_hash_t *hash) {
+// Get the path for an object based on its hash. Writes into a caller
+// buffer so the per-object cost is two memcpys instead of a repo walk.
+int object_path(const gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                char *out, size_t out_size) {
+    if (!repo || !hash || !out) return -1;
+
+    // <objects>/xx/yyyy... (+ '/' twice and the terminator)
+    size_t needed = repo->objects_dir_len + 1 + 2 + 1 + (HASH_HEX_SIZE - 3) + 1;
+    if (out_size < needed) return -1;
+
     char hex[HASH_HEX_SIZE];
     hash_to_hex(hash, hex);
-    
-    char *gyatt_dir = get_gyatt_dir();
-    if (!gyatt_dir) return NULL;
-    
+
     // Use Git's sharding: first 2 hex chars as directory, rest as filename
-    char dir_name[3] = {hex[0], hex[1], '\0'};
-    char *file_name = hex + 2;
-    
-    char *objects_dir = path_join(gyatt_dir, "objects");
-    char *shard_dir = path_join(objects_dir, dir_name);
-    char *obj_path = path_join(shard_dir, file_name);
-    
-    free(gyatt_dir);
-    free(objects_dir);
-    free(shard_dir);
-    
-    return obj_path;
+    char *p = out;
+    memcpy(p, repo->objects_dir, repo->objects_dir_len);
+    p += repo->objects_dir_len;
+    *p++ = '/';
+    *p++ = hex[0];
+    *p++ = hex[1];
+    *p++ = '/';
+    memcpy(p, hex + 2, HASH_HEX_SIZE - 2);  // includes the terminator
+
+    return 0;
 }
 
-// Check if an object exists
-int object_exists(const gyatt_hash_t *hash) {
-    char *path = object_path(hash);
-    if (!path) return 0;
-    
-    int exists = file_exists(path);
-    free(path);
+// Check if an object exists, packed or loose
+int object_exists(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    if (pack_has_object(repo->packs, hash)) return 1;
     
-    return exists;
+    char path[PATH_MAX];
+    if (object_path(repo, hash, path, sizeof(path)) != 0) return 0;
+
+    TRACE_SYSCALL();
+    return file_exists(path);
 }
 
-// Compress data using zlib
-static void *compress_data(const void *data, size_t size, size_t *compressed_size) {
-    uLongf dest_len = compressBound(size);
-    Bytef *dest = malloc(dest_len);
-    if (!dest) return NULL;
-    
-    int result = compress2(dest, &dest_len, data, size, Z_DEFAULT_COMPRESSION);
-    if (result != Z_OK) {
-        free(dest);
-        return NULL;
+// ==================== Streaming Object Writer ====================
+
+// Size of the read/deflate buffers; this is the writer's whole footprint
+#define OBJECT_STREAM_CHUNK (64 * 1024)
+
+struct object_writer {
+    gyatt_repo_t *repo;
+    sha1_ctx_t sha;
+    compressor_t zs;
+    int started;               // Codec picked and the header fed to it
+    object_type_t type;
+    char header[64];
+    size_t header_len;
+    size_t expected_size;
+    size_t written;
+    int fd;
+    trace_span_t span;         // Open to close, whoever drives it
+    char tmp_path[PATH_MAX];
+    unsigned char out[OBJECT_STREAM_CHUNK];
+};
+
+static const char *object_type_name(object_type_t type) {
+    return (type == OBJ_BLOB) ? "blob" :
+           (type == OBJ_TREE) ? "tree" :
+           (type == OBJ_COMMIT) ? "commit" :
+           (type == OBJ_CHUNKED) ? "chunked" : "unknown";
+}
+
+size_t object_format_header(object_type_t type, size_t size, char *out, size_t out_size) {
+    int len = snprintf(out, out_size, "%s %zu", object_type_name(type), size);
+    return (size_t)len + 1;
+}
+
+// Compress in and push whatever comes out to the temp file; with finish,
+// everything the compressor still holds too
+static int writer_drain(object_writer_t *w, const unsigned char *in, size_t in_len, int finish) {
+    int ret;
+    size_t room;
+    do {
+        unsigned char *next_out = w->out;
+        room = sizeof(w->out);
+        ret = compressor_run(&w->zs, &in, &in_len, &next_out, &room, finish);
+        if (ret < 0) return -1;
+
+        size_t have = sizeof(w->out) - room;
+        const unsigned char *p = w->out;
+        while (have > 0) {
+            ssize_t n = write(w->fd, p, have);
+            TRACE_SYSCALL();
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            p += n;
+            have -= n;
+        }
+    } while (finish ? ret != 1 : in_len > 0 || room == 0);
+
+    return 0;
+}
+
+// The codec is picked once the first payload bytes are in, so the probe
+// has something to look at
+static int writer_start(object_writer_t *w, const void *sample, size_t sample_len) {
+    compress_codec_t codec;
+    int level;
+    compress_choose(&w->repo->config, w->type, sample, sample_len, &codec, &level);
+    if (compressor_init(&w->zs, codec, level) != 0) {
+        compressor_end(&w->zs);
+        return -1;
     }
-    
-    *compressed_size = dest_len;
-    return dest;
+    w->started = 1;
+    return writer_drain(w, (const unsigned char *)w->header, w->header_len, 0);
 }
 
-// Decompress data using zlib
-static void *decompress_data(const void *data, size_t compressed_size, size_t expected_size) {
-    uLongf dest_len = expected_size;
-    Bytef *dest = malloc(dest_len);
-    if (!dest) return NULL;
-    
-    int result = uncompress(dest, &dest_len, data, compressed_size);
-    if (result != Z_OK) {
-        free(dest);
+static int writer_feed(object_writer_t *w, const void *data, size_t len) {
+    sha1_update(&w->sha, data, len);
+    if (!w->started && writer_start(w, data, len) != 0) return -1;
+    return writer_drain(w, data, len, 0);
+}
+
+object_writer_t *object_writer_open(gyatt_repo_t *repo, object_type_t type, size_t size) {
+    if (!repo) return NULL;
+
+    object_writer_t *w = malloc(sizeof(object_writer_t));
+    if (!w) return NULL;
+
+    w->repo = repo;
+    w->started = 0;
+    w->type = type;
+    w->expected_size = size;
+    w->written = 0;
+    w->span = trace_begin(TRACE_OBJECT_WRITE);
+
+    snprintf(w->tmp_path, sizeof(w->tmp_path), "%s/tmp_obj_XXXXXX", repo->objects_dir);
+    w->fd = mkstemp(w->tmp_path);
+    if (w->fd < 0) {
+        free(w);
         return NULL;
     }
-    
-    return dest;
+    fchmod(w->fd, 0644);
+    TRACE_SYSCALLS(2);
+
+    sha1_init(&w->sha);
+    w->header_len = object_format_header(type, size, w->header, sizeof(w->header));
+    sha1_update(&w->sha, w->header, w->header_len);
+    return w;
 }
 
-// Write an object to storage
-int object_write(const void *data, size_t size, object_type_t type, gyatt_hash_t *hash) {
-    if (!data || size == 0) return -1;
-    
-    // Create object header: "type size\0"
-    buffer_t *header_buf = buffer_create(64);
-    const char *type_str = (type == OBJ_BLOB) ? "blob" :
-                          (type == OBJ_TREE) ? "tree" :
-                          (type == OBJ_COMMIT) ? "commit" : "unknown";
-    
-    buffer_append_str(header_buf, type_str);
-    buffer_append_char(header_buf, ' ');
-    buffer_append_uint(header_buf, size);
-    buffer_append_char(header_buf, '\0');
-    
-    // Combine header and data for hashing
-    size_t total_size = header_buf->len + size;
-    void *combined = malloc(total_size);
-    if (!combined) {
-        buffer_free(header_buf);
+int object_writer_write(object_writer_t *w, const void *data, size_t len) {
+    if (!w) return -1;
+    if (len == 0) return 0;
+    if (w->written + len > w->expected_size) return -1;
+
+    if (writer_feed(w, data, len) != 0) return -1;
+    w->written += len;
+    return 0;
+}
+
+void object_writer_abort(object_writer_t *w) {
+    if (!w) return;
+    if (w->started) compressor_end(&w->zs);
+    close(w->fd);
+    unlink(w->tmp_path);
+    TRACE_SYSCALLS(2);
+    trace_end(w->span, w->written, 0);
+    free(w);
+}
+
+// expected (optional): only install the object if that's what it hashed to
+static int writer_install(object_writer_t *w, const gyatt_hash_t *expected, gyatt_hash_t *hash);
+
+static int writer_close(object_writer_t *w, const gyatt_hash_t *expected, gyatt_hash_t *hash) {
+    if (!w) return -1;
+
+    trace_span_t span = w->span;
+    size_t written = w->written;
+    int result = writer_install(w, expected, hash);
+    trace_end(span, written, 0);
+    return result;
+}
+
+static int writer_install(object_writer_t *w, const gyatt_hash_t *expected, gyatt_hash_t *hash) {
+    // Spans end in writer_close
+    w->span.start = 0;
+
+    // The header promised a size; anything else would store a corrupt object
+    if (w->written != w->expected_size) {
+        object_writer_abort(w);
         return -1;
     }
+
+    if ((!w->started && writer_start(w, NULL, 0) != 0) || writer_drain(w, NULL, 0, 1) != 0) {
+        object_writer_abort(w);
+        return -1;
+    }
+    compressor_end(&w->zs);
+    w->started = 0;
+
+    gyatt_hash_t result;
+    sha1_final(&w->sha, result.hash);
+
+    int fd = w->fd;
+    w->fd = -1;
+    TRACE_SYSCALLS(3);  // close, then the two existence checks
+    if (close(fd) != 0 || (expected && hash_compare(&result, expected) != 0)) {
+        unlink(w->tmp_path);
+        free(w);
+        return -1;
+    }
+
+    char obj_path[PATH_MAX];
+    if (object_path(w->repo, &result, obj_path, sizeof(obj_path)) != 0) {
+        unlink(w->tmp_path);
+        free(w);
+        return -1;
+    }
+
+    if (pack_has_object(w->repo->packs, &result) || file_exists(obj_path)) {
+        // Someone already stored this content (loose or packed); keep theirs
+        unlink(w->tmp_path);
+    } else {
+        // Create the shard directory. The objects directory itself is
+        // created by init, so one mkdir is enough.
+        char *shard_end = obj_path + w->repo->objects_dir_len + 3;
+        *shard_end = '\0';
+        if (mkdir(obj_path, 0755) != 0 && errno != EEXIST) {
+            unlink(w->tmp_path);
+            free(w);
+            return -1;
+        }
+        *shard_end = '/';
+
+        TRACE_SYSCALLS(2);
+        if (rename(w->tmp_path, obj_path) != 0) {
+            unlink(w->tmp_path);
+            free(w);
+            return -1;
+        }
+    }
+
+    if (hash) hash_copy(hash, &result);
+    free(w);
+    return 0;
+}
+
+int object_writer_close(object_writer_t *w, gyatt_hash_t *hash) {
+    return writer_close(w, NULL, hash);
+}
+
+int object_writer_close_verified(object_writer_t *w, const gyatt_hash_t *expected) {
+    return writer_close(w, expected, NULL);
+}
+
+// Hash header and payload in place - no combined copy
+void object_hash(const void *data, size_t size, object_type_t type, gyatt_hash_t *hash) {
+    char header[64];
+    size_t header_len = object_format_header(type, size, header, sizeof(header));
+    
+    trace_span_t span = trace_begin(TRACE_SHA1);
+    sha1_ctx_t ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, header, header_len);
+    sha1_update(&ctx, data, size);
+    sha1_final(&ctx, hash->hash);
+    trace_end(span, size, 0);
+}
+
+// Write an object to storage
+int object_write(gyatt_repo_t *repo, const void *data, size_t size,
+                 object_type_t type, gyatt_hash_t *hash) {
+    if (!data && size > 0) return -1;
     
-    memcpy(combined, header_buf->data, header_buf->len);
-    memcpy((char *)combined + header_buf->len, data, size);
-    
-    // Calculate hash
-    sha1_hash(combined, total_size, hash);
+    object_hash(data, size, type, hash);
     
     // Check if object already exists
-    if (object_exists(hash)) {
-        buffer_free(header_buf);
-        free(combined);
+    if (object_exists(repo, hash)) {
         return 0;  // Already exists, success
     }
     
-    // Compress the combined data
-    size_t compressed_size;
-    void *compressed = compress_data(combined, total_size, &compressed_size);
-    free(combined);
-    buffer_free(header_buf);
+    // Deflate straight from the caller's buffer into the object file
+    object_writer_t *w = object_writer_open(repo, type, size);
+    if (!w) return -1;
     
-    if (!compressed) return -1;
+    if (object_writer_write(w, data, size) != 0) {
+        object_writer_abort(w);
+        return -1;
+    }
     
-    // Get object path and create directory
-    char *obj_path = object_path(hash);
-    if (!obj_path) {
-        free(compressed);
+    return object_writer_close(w, hash);
+}
+
+// Hash a file as a blob without storing it, reading it in chunks
+static int hash_file(gyatt_repo_t *repo, const char *path, const gyatt_hash_t *like,
+                     gyatt_hash_t *hash, size_t *hashed);
+
+int object_hash_file(gyatt_repo_t *repo, const char *path, const gyatt_hash_t *like, gyatt_hash_t *hash) {
+    trace_span_t span = trace_begin(TRACE_SHA1);
+    size_t hashed = 0;
+    int result = hash_file(repo, path, like, hash, &hashed);
+    trace_end(span, hashed, 0);
+    return result;
+}
+
+static int hash_file(gyatt_repo_t *repo, const char *path, const gyatt_hash_t *like,
+                     gyatt_hash_t *hash, size_t *hashed) {
+    int fd = open(path, O_RDONLY);
+    TRACE_SYSCALL();
+    if (fd < 0) return -1;
+    
+    struct stat st;
+    TRACE_SYSCALLS(2);  // fstat and, one way or another, close
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
         return -1;
     }
     
-    // Create parent directory
-    char *parent_dir = str_duplicate(obj_path);
-    char *last_sep = strrchr(parent_dir, '/');
-    if (last_sep) {
-        *last_sep = '\0';
-        mkdir_recursive(parent_dir);
+    // Big files are known by their chunk list. Matching how like was
+    // stored keeps a changed threshold from looking like changed content.
+    int chunked = chunk_wanted(repo, (uint64_t)st.st_size);
+    object_type_t like_type;
+    if (like && object_read_header(repo, like, &like_type, NULL) == 0) chunked = like_type == OBJ_CHUNKED;
+    if (chunked) {
+        int result = chunk_file(repo, fd, (uint64_t)st.st_size, 0, hash);
+        close(fd);
+        if (result == 0) *hashed = (size_t)st.st_size;
+        return result;
     }
-    free(parent_dir);
     
-    // Write compressed data
-    int result = write_file(obj_path, compressed, compressed_size);
+    char header[64];
+    size_t header_len = object_format_header(OBJ_BLOB, (size_t)st.st_size, header, sizeof(header));
+    
+    sha1_ctx_t ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, header, header_len);
+    
+    unsigned char buf[OBJECT_STREAM_CHUNK];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        TRACE_SYSCALL();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        sha1_update(&ctx, buf, n);
+        total += n;
+    }
+    TRACE_SYSCALL();
+    close(fd);
+    *hashed = total;
     
-    free(obj_path);
-    free(compressed);
+    // File changed size under us; the header would be wrong
+    if (total != (size_t)st.st_size) return -1;
     
-    return result;
+    sha1_final(&ctx, hash->hash);
+    return 0;
 }
 
-// Read an object from storage
-void *object_read(const gyatt_hash_t *hash, object_type_t *type, size_t *size) {
-    char *obj_path = object_path(hash);
-    if (!obj_path) return NULL;
-    
-    // Read compressed data
-    size_t compressed_size;
-    void *compressed = read_file(obj_path, &compressed_size);
-    free(obj_path);
+// ==================== Streaming Object Reader ====================
+
+// Longest possible "type size\0" header: "commit " + 20 digits + NUL
+#define OBJECT_HEADER_MAX 32
+
+// How much compressed input a header peek pulls in at a time; the header
+// is in the first few bytes out, so there's no point reading more
+#define OBJECT_PEEK_CHUNK 256
+
+typedef struct {
+    int fd;
+    decompressor_t zs;
+    const unsigned char *next_in;
+    size_t avail_in;
+    size_t read_size;
+    int eof;
+    unsigned char in[OBJECT_STREAM_CHUNK];
+} object_reader_t;
+
+static object_reader_t *object_reader_open(gyatt_repo_t *repo, const gyatt_hash_t *hash, size_t read_size) {
+    char obj_path[PATH_MAX];
+    if (object_path(repo, hash, obj_path, sizeof(obj_path)) != 0) return NULL;
     
-    if (!compressed) return NULL;
+    object_reader_t *r = malloc(sizeof(object_reader_t));
+    if (!r) return NULL;
     
-    // Decompress (we need to find the uncompressed size first)
-    // Try progressively larger sizes
-    void *decompressed = NULL;
-    size_t try_size = compressed_size * 2;
+    r->fd = open(obj_path, O_RDONLY);
+    TRACE_SYSCALL();
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
     
-    for (int i = 0; i < 5; i++) {
-        uLongf dest_len = try_size;
-        decompressed = malloc(dest_len);
-        if (!decompressed) break;
-        
-        int result = uncompress(decompressed, &dest_len, compressed, compressed_size);
-        if (result == Z_OK) {
-            // Success! Parse header
-            char *data = (char *)decompressed;
-            char *space = strchr(data, ' ');
-            if (!space) {
-                free(decompressed);
-                free(compressed);
-                return NULL;
-            }
-            
-            *space = '\0';
-            const char *type_str = data;
-            char *null_term = strchr(space + 1, '\0');
-            if (!null_term) {
-                free(decompressed);
-                free(compressed);
-                return NULL;
+    // The file's first bytes say which codec wrote it
+    decompressor_init(&r->zs, COMPRESS_DETECT);
+    r->next_in = NULL;
+    r->avail_in = 0;
+    r->read_size = read_size;
+    r->eof = 0;
+    return r;
+}
+
+static void object_reader_close(object_reader_t *r) {
+    if (!r) return;
+    decompressor_end(&r->zs);
+    close(r->fd);
+    TRACE_SYSCALL();
+    free(r);
+}
+
+// Inflate up to len bytes into out. Returns how many were produced (short
+// only at the end of the stream), or -1 on a read or decompression error.
+static ssize_t object_reader_inflate(object_reader_t *r, void *out, size_t len) {
+    unsigned char *dst = out;
+    size_t room = len;
+    
+    while (room > 0 && !r->eof) {
+        if (r->avail_in == 0) {
+            ssize_t n = read(r->fd, r->in, r->read_size);
+            TRACE_SYSCALL();
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
             }
-            
-            // Parse type
-            if (type) {
-                if (strcmp(type_str, "blob") == 0) *type = OBJ_BLOB;
-                else if (strcmp(type_str, "tree") == 0) *type = OBJ_TREE;
-                else if (strcmp(type_str, "commit") == 0) *type = OBJ_COMMIT;
+            if (n == 0) {
+                // A raw object simply ends with its file; anything else
+                // was truncated before the stream did
+                if (!r->zs.started || r->zs.codec != COMPRESS_RAW) return -1;
+                r->eof = 1;
+                break;
             }
+            r->next_in = r->in;
+            r->avail_in = (size_t)n;
+        }
+        
+        int ret = decompressor_run(&r->zs, &r->next_in, &r->avail_in, &dst, &room);
+        if (ret < 0) return -1;
+        if (ret == 1) r->eof = 1;
+    }
+    
+    return (ssize_t)(len - room);
+}
+
+size_t object_parse_header(const char *buf, size_t len, object_type_t *type, size_t *size) {
+    const char *space = memchr(buf, ' ', len);
+    const char *nul = memchr(buf, '\0', len);
+    if (!space || !nul || nul < space) return 0;
+    
+    size_t type_len = (size_t)(space - buf);
+    if (type_len == 4 && memcmp(buf, "blob", 4) == 0) *type = OBJ_BLOB;
+    else if (type_len == 4 && memcmp(buf, "tree", 4) == 0) *type = OBJ_TREE;
+    else if (type_len == 6 && memcmp(buf, "commit", 6) == 0) *type = OBJ_COMMIT;
+    else if (type_len == 7 && memcmp(buf, "chunked", 7) == 0) *type = OBJ_CHUNKED;
+    else return 0;
+    
+    const char *digits = space + 1;
+    if (digits == nul) return 0;
+    
+    size_t value = 0;
+    for (const char *p = digits; p < nul; p++) {
+        if (*p < '0' || *p > '9') return 0;
+        size_t next = value * 10 + (size_t)(*p - '0');
+        if (next / 10 != value) return 0;  // Overflow
+        value = next;
+    }
+    
+    *size = value;
+    return (size_t)(nul - buf) + 1;
+}
+
+// Peek at an object's type and size, inflating only its first few bytes
+int object_read_header(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                       object_type_t *type, size_t *size) {
+    if (pack_read_header(repo->packs, hash, type, size) == 0) return 0;
+    
+    object_reader_t *r = object_reader_open(repo, hash, OBJECT_PEEK_CHUNK);
+    if (!r) return -1;
+    
+    char header[OBJECT_HEADER_MAX];
+    ssize_t n = object_reader_inflate(r, header, sizeof(header));
+    object_reader_close(r);
+    if (n <= 0) return -1;
+    
+    object_type_t obj_type;
+    size_t obj_size;
+    if (object_parse_header(header, (size_t)n, &obj_type, &obj_size) == 0) return -1;
+    
+    if (type) *type = obj_type;
+    if (size) *size = obj_size;
+    return 0;
+}
+
+static void *object_read_stored(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                                object_type_t *type, size_t *size);
+
+void *object_read(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                  object_type_t *type, size_t *size) {
+    trace_span_t span = trace_begin(TRACE_OBJECT_READ);
+    size_t got = 0;
+    void *data = object_read_stored(repo, hash, type, &got);
+    if (size) *size = got;
+    trace_end(span, data ? got : 0, 0);
+    return data;
+}
+
+// Read an object from storage. The header says exactly how big the payload
+// is, so it is inflated once, straight into a buffer allocated once. The
+// result is NUL-terminated (not counted in size) for the text parsers.
+static void *object_read_stored(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                                object_type_t *type, size_t *size) {
+    // Packs first: one shared mapping instead of an open() per object
+    void *packed = pack_read_object(repo->packs, hash, type, size);
+    if (packed) return packed;
+    
+    object_reader_t *r = object_reader_open(repo, hash, OBJECT_STREAM_CHUNK);
+    if (!r) return NULL;
+    
+    char header[OBJECT_HEADER_MAX];
+    ssize_t n = object_reader_inflate(r, header, sizeof(header));
+    
+    object_type_t obj_type;
+    size_t obj_size;
+    size_t header_len = n > 0 ? object_parse_header(header, (size_t)n, &obj_type, &obj_size) : 0;
+    
+    // Whatever came out past the header is the start of the payload
+    size_t have = header_len > 0 ? (size_t)n - header_len : 0;
+    
+    char *data = NULL;
+    if (header_len > 0 && have <= obj_size && obj_size < SIZE_MAX) data = malloc(obj_size + 1);
+    if (!data) {
+        object_reader_close(r);
+        return NULL;
+    }
+    
+    memcpy(data, header + header_len, have);
+    ssize_t rest = object_reader_inflate(r, data + have, obj_size - have);
+    
+    // The stream must end exactly where the header said it would
+    char extra;
+    int ok = rest >= 0 && have + (size_t)rest == obj_size &&
+             object_reader_inflate(r, &extra, 1) == 0;
+    object_reader_close(r);
+    
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    
+    data[obj_size] = '\0';
+    if (type) *type = obj_type;
+    if (size) *size = obj_size;
+    return data;
+}
+
+static int is_hex_name(const char *name, size_t len) {
+    if (strlen(name) != len) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return 0;
+    }
+    return 1;
+}
+
+// Walk objects/xx/yyyy... and report every loose object
+int object_foreach_loose(gyatt_repo_t *repo, object_foreach_fn fn, void *arg) {
+    DIR *dir = opendir(repo->objects_dir);
+    if (!dir) return 0;  // Nothing loose
+    
+    int ret = 0;
+    struct dirent *entry;
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        if (!is_hex_name(entry->d_name, 2)) continue;
+        
+        char shard_path[PATH_MAX];
+        snprintf(shard_path, sizeof(shard_path), "%s/%s", repo->objects_dir, entry->d_name);
+        
+        DIR *shard = opendir(shard_path);
+        if (!shard) continue;
+        
+        struct dirent *obj_entry;
+        while (ret == 0 && (obj_entry = readdir(shard)) != NULL) {
+            if (!is_hex_name(obj_entry->d_name, HASH_HEX_SIZE - 3)) continue;
             
-            // Parse size
-            size_t obj_size = strtoull(space + 1, NULL, 10);
-            if (size) *size = obj_size;
-            
-            // Extract actual data
-            size_t header_len = (null_term - data) + 1;
-            void *obj_data = malloc(obj_size);
-            if (obj_data) {
-                memcpy(obj_data, data + header_len, obj_size);
-            }
+            char hash_hex[HASH_HEX_SIZE];
+            memcpy(hash_hex, entry->d_name, 2);
+            memcpy(hash_hex + 2, obj_entry->d_name, HASH_HEX_SIZE - 2);
             
-            free(decompressed);
-            free(compressed);
-            return obj_data;
+            gyatt_hash_t hash;
+            hex_to_hash(hash_hex, &hash);
+            ret = fn(&hash, arg);
         }
         
-        free(decompressed);
-        try_size *= 2;
+        closedir(shard);
     }
     
-    free(compressed);
-    return NULL;
+    closedir(dir);
+    return ret;
+}
+
+// Loose objects, then packed ones. An object is only ever stored once
+// (object_write skips anything that already exists), except right after a
+// repack fails halfway, so callers that care should tolerate repeats.
+int object_foreach(gyatt_repo_t *repo, object_foreach_fn fn, void *arg) {
+    int ret = object_foreach_loose(repo, fn, arg);
+    if (ret != 0) return ret;
+    return pack_foreach(repo->packs, fn, arg);
 }
 
 // ==================== Blob Operations ====================
 
-int blob_write(blob_object_t *blob) {
+int blob_write(gyatt_repo_t *repo, blob_object_t *blob) {
     if (!blob) return -1;
-    return object_write(blob->data, blob->header.size, OBJ_BLOB, &blob->header.hash);
+    return object_write(repo, blob->data, blob->header.size, OBJ_BLOB, &blob->header.hash);
+}
+
+static int append_chunk(const void *data, size_t len, void *arg) {
+    unsigned char **out = arg;
+    memcpy(*out, data, len);
+    *out += len;
+    return 0;
 }
 
-blob_object_t *blob_read(const gyatt_hash_t *hash) {
+// A chunked file put back together in memory
+static void *chunked_read(gyatt_repo_t *repo, const void *list, size_t list_size, size_t *size) {
+    uint64_t total;
+    if (chunk_list_total(list, list_size, &total) != 0 || total > SIZE_MAX - 1) return NULL;
+    
+    unsigned char *data = malloc((size_t)total + 1);
+    if (!data) return NULL;
+    unsigned char *out = data;
+    if (chunk_read(repo, list, list_size, append_chunk, &out) != 0) {
+        free(data);
+        return NULL;
+    }
+    data[total] = '\0';
+    *size = (size_t)total;
+    return data;
+}
+
+blob_object_t *blob_read(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
     object_type_t type;
     size_t size;
-    void *data = object_read(hash, &type, &size);
+    void *data = object_read(repo, hash, &type, &size);
+    
+    if (data && type == OBJ_CHUNKED) {
+        void *list = data;
+        data = chunked_read(repo, list, size, &size);
+        free(list);
+        type = OBJ_BLOB;
+    }
     
     if (!data || type != OBJ_BLOB) {
         free(data);
@@ -345,6 +838,43 @@ blob_object_t *blob_read(const gyatt_hash_t *hash) {
     return blob;
 }
 
+static int write_chunk(const void *data, size_t len, void *arg) {
+    int fd = *(int *)arg;
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int blob_read_to_fd(gyatt_repo_t *repo, const gyatt_hash_t *hash, int fd, size_t *size) {
+    object_type_t type;
+    size_t obj_size;
+    void *data = object_read(repo, hash, &type, &obj_size);
+    if (!data || (type != OBJ_BLOB && type != OBJ_CHUNKED)) {
+        free(data);
+        return -1;
+    }
+    
+    int result;
+    uint64_t total = obj_size;
+    if (type == OBJ_CHUNKED) {
+        // One chunk in memory at a time, however big the file is
+        result = chunk_list_total(data, obj_size, &total);
+        if (result == 0) result = chunk_read(repo, data, obj_size, write_chunk, &fd);
+    } else {
+        result = write_chunk(data, obj_size, &fd);
+    }
+    free(data);
+    
+    if (result == 0 && size) *size = (size_t)total;
+    return result;
+}
+
 blob_object_t *blob_from_file(const char *path) {
     size_t size;
     void *data = read_file(path, &size);
@@ -356,9 +886,68 @@ blob_object_t *blob_from_file(const char *path) {
     return blob;
 }
 
+// Stream a file into the object store. Memory use is fixed at one chunk
+// no matter how large the file is.
+int blob_write_file(gyatt_repo_t *repo, const char *path, gyatt_hash_t *hash, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    
+    if (chunk_wanted(repo, (uint64_t)st.st_size)) {
+        int result = chunk_file(repo, fd, (uint64_t)st.st_size, 1, hash);
+        close(fd);
+        if (result == 0 && size) *size = (size_t)st.st_size;
+        return result;
+    }
+    
+    object_writer_t *w = object_writer_open(repo, OBJ_BLOB, (size_t)st.st_size);
+    if (!w) {
+        close(fd);
+        return -1;
+    }
+    
+    unsigned char *buf = malloc(OBJECT_STREAM_CHUNK);
+    if (!buf) {
+        object_writer_abort(w);
+        close(fd);
+        return -1;
+    }
+    
+    ssize_t n;
+    while ((n = read(fd, buf, OBJECT_STREAM_CHUNK)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (object_writer_write(w, buf, n) != 0) {
+            n = -1;
+            break;
+        }
+    }
+    
+    free(buf);
+    close(fd);
+    
+    if (n != 0) {
+        object_writer_abort(w);
+        return -1;
+    }
+    
+    // Fails if the file grew or shrank while we were reading it
+    if (object_writer_close(w, hash) != 0) return -1;
+    
+    if (size) *size = (size_t)st.st_size;
+    return 0;
+}
+
 // ==================== Tree Operations ====================
 
-int tree_write(tree_object_t *tree) {
+int tree_write(gyatt_repo_t *repo, tree_object_t *tree) {
     if (!tree) return -1;
     
     // Serialize tree: each entry is "mode name\0hash"
@@ -374,65 +963,143 @@ int tree_write(tree_object_t *tree) {
         buffer_append(buf, entry->hash.hash, HASH_SIZE);
     }
     
-    int result = object_write(buf->data, buf->len, OBJ_TREE, &tree->header.hash);
+    int result = object_write(repo, buf->data, buf->len, OBJ_TREE, &tree->header.hash);
     tree->header.size = buf->len;
     
     buffer_free(buf);
     return result;
 }
 
-tree_object_t *tree_read(const gyatt_hash_t *hash) {
-    object_type_t type;
-    size_t size;
-    void *data = object_read(hash, &type, &size);
-    
-    if (!data || type != OBJ_TREE) {
-        free(data);
-        return NULL;
-    }
-    
-    tree_object_t *tree = tree_create();
-    if (!tree) {
-        free(data);
-        return NULL;
-    }
-    
-    hash_copy(&tree->header.hash, hash);
-    tree->header.size = size;
-    
-    // Parse tree entries
-    char *ptr = (char *)data;
-    char *end = ptr + size;
+// Walk the entries of a tree payload, each "mode name\0hash". Returns how
+// many there were, filling in entries (names pointing into data) if given.
+static size_t tree_parse_entries(const char *data, size_t size, tree_entry_t *entries) {
+    const char *ptr = data;
+    const char *end = data + size;
+    size_t count = 0;
     
     while (ptr < end) {
-        // Parse mode
-        uint32_t mode = strtoul(ptr, &ptr, 10);
-        if (*ptr != ' ') break;
+        // Parse mode (written in decimal)
+        uint32_t mode = 0;
+        const char *digits = ptr;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9') mode = mode * 10 + (uint32_t)(*ptr++ - '0');
+        if (ptr == digits || ptr >= end || *ptr != ' ') break;
         ptr++;
         
         // Parse name
-        char *name = ptr;
-        while (ptr < end && *ptr != '\0') ptr++;
-        if (ptr >= end) break;
+        const char *name = ptr;
+        ptr = memchr(ptr, '\0', (size_t)(end - ptr));
+        if (!ptr) break;
         ptr++;  // Skip null terminator
         
         // Parse hash
-        if (ptr + HASH_SIZE > end) break;
-        gyatt_hash_t entry_hash;
-        memcpy(entry_hash.hash, ptr, HASH_SIZE);
+        if (HASH_SIZE > end - ptr) break;
+        if (entries) {
+            tree_entry_t *entry = &entries[count];
+            entry->name = name;
+            entry->mode = mode;
+            entry->type = mode == TREE_MODE_DIR ? OBJ_TREE : OBJ_BLOB;
+            memcpy(entry->hash.hash, ptr, HASH_SIZE);
+        }
         ptr += HASH_SIZE;
-        
-        // Add entry (assume blob for now, could be tree)
-        tree_add_entry(tree, name, mode, &entry_hash, OBJ_BLOB);
+        count++;
+    }
+    
+    return count;
+}
+
+tree_object_t *tree_parse(const void *data, size_t size, const gyatt_hash_t *hash) {
+    tree_object_t *tree = tree_create();
+    if (!tree) return NULL;
+    
+    hash_copy(&tree->header.hash, hash);
+    tree->header.size = size;
+    
+    // The names stay where they are in data; only the entries get an
+    // allocation, sized to fit, so a parsed tree is two mallocs whatever
+    // its size
+    size_t count = tree_parse_entries(data, size, NULL);
+    if (count == 0) return tree;
+    size_t entries_size = count * sizeof(tree_entry_t);
+    arena_init(&tree->arena, entries_size);
+    tree_entry_t *entries = arena_alloc(&tree->arena, entries_size);
+    if (!entries) {
+        tree_free(tree);
+        return NULL;
+    }
+    tree_parse_entries(data, size, entries);
+    
+    // Trees are written sorted; anything else goes the slow way, which
+    // sorts and lets a repeated name win
+    int sorted = 1;
+    for (size_t i = 1; i < count && sorted; i++) {
+        sorted = strcmp(entries[i - 1].name, entries[i].name) < 0;
+    }
+    if (sorted) {
+        tree->entries = count > 0 ? entries : NULL;
+        tree->entry_count = count;
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            tree_add_entry(tree, entries[i].name, entries[i].mode, &entries[i].hash, entries[i].type);
+        }
     }
     
-    free(data);
     return tree;
 }
 
+static tree_object_t *tree_load(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    object_type_t type;
+    size_t size;
+    void *data = object_read(repo, hash, &type, &size);
+    
+    // The tree takes over what was read, so the names point right into it
+    tree_object_t *tree = data && type == OBJ_TREE ? tree_parse(data, size, hash) : NULL;
+    if (tree) tree->payload = data;
+    else free(data);
+    return tree;
+}
+
+static int tree_flatten(gyatt_repo_t *repo, const gyatt_hash_t *hash, const char *prefix,
+                        tree_object_t *flat) {
+    tree_object_t *tree = tree_read(repo, hash);
+    if (!tree) return -1;
+    
+    int result = 0;
+    for (size_t i = 0; i < tree->entry_count && result == 0; i++) {
+        tree_entry_t *entry = &tree->entries[i];
+        
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s%s%s", prefix, prefix[0] ? "/" : "", entry->name);
+        if (len < 0 || len >= (int)sizeof(path)) {
+            result = -1;
+        } else if (entry->type == OBJ_TREE) {
+            result = tree_flatten(repo, &entry->hash, path, flat);
+        } else {
+            tree_add_entry(flat, path, entry->mode, &entry->hash, entry->type);
+        }
+    }
+    
+    tree_free(tree);
+    return result;
+}
+
+tree_object_t *tree_read_flat(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    tree_object_t *flat = tree_create();
+    if (!flat) return NULL;
+    
+    // Depth-first order is nearly path order already; tree_add_entry
+    // fixes up the rest ("a.txt" sorts before "a/b")
+    if (tree_flatten(repo, hash, "", flat) != 0) {
+        tree_free(flat);
+        return NULL;
+    }
+    
+    hash_copy(&flat->header.hash, hash);
+    return flat;
+}
+
 // ==================== Commit Operations ====================
 
-int commit_write(commit_object_t *commit) {
+int commit_write(gyatt_repo_t *repo, commit_object_t *commit) {
     if (!commit) return -1;
     
     buffer_t *buf = buffer_create(4096);
@@ -485,130 +1152,284 @@ int commit_write(commit_object_t *commit) {
     // Message
     buffer_append_str(buf, commit->message);
     
-    int result = object_write(buf->data, buf->len, OBJ_COMMIT, &commit->header.hash);
+    int result = object_write(repo, buf->data, buf->len, OBJ_COMMIT, &commit->header.hash);
     commit->header.size = buf->len;
     
     buffer_free(buf);
     return result;
 }
 
-commit_object_t *commit_read(const gyatt_hash_t *hash) {
-    object_type_t type;
-    size_t size;
-    void *data = object_read(hash, &type, &size);
-    
-    if (!data || type != OBJ_COMMIT) {
-        free(data);
-        return NULL;
-    }
-    
+// "Name <email> timestamp +zone" from an author or committer line (from
+// the start of the name up to end), cut into strings in place
+static void commit_parse_person(char *start, char *end, author_info_t *info) {
+    char *email_start = memchr(start, '<', (size_t)(end - start));
+    if (!email_start) return;
+    char *email_end = memchr(email_start, '>', (size_t)(end - email_start));
+    if (!email_end) return;
+    
+    info->timestamp = atol(email_end + 1);
+    if (email_start > start && email_start[-1] == ' ') email_start[-1] = '\0';
+    *email_start = '\0';
+    *email_end = '\0';
+    info->name = start;
+    info->email = email_start + 1;
+}
+
+commit_object_t *commit_parse(const void *data, size_t size, const gyatt_hash_t *hash) {
     commit_object_t *commit = commit_create();
-    if (!commit) {
-        free(data);
-        return NULL;
-    }
+    if (!commit) return NULL;
     
     hash_copy(&commit->header.hash, hash);
     commit->header.size = size;
     
-    // Parse commit data line by line
-    char *content = (char *)data;
+    // Work on a terminated copy the strings can point into
+    arena_init(&commit->arena, size + 1);
+    char *content = arena_alloc(&commit->arena, size + 1);
+    if (!content) {
+        commit_free(commit);
+        return NULL;
+    }
+    memcpy(content, data, size);
+    content[size] = '\0';
+    char *end = content + size;
+    
+    // Headers line by line, up to the empty one before the message
     char *line_start = content;
-    char *ptr = content;
-    int in_message = 0;
-    char *message_start = NULL;
-    
-    while (ptr < content + size) {
-        // Find end of line
-        char *line_end = ptr;
-        while (line_end < content + size && *line_end != '\n') {
-            line_end++;
-        }
+    while (line_start < end) {
+        char *line_end = memchr(line_start, '\n', (size_t)(end - line_start));
+        if (!line_end) line_end = end;
+        size_t line_len = (size_t)(line_end - line_start);
         
-        size_t line_len = line_end - line_start;
+        if (line_len == 0) {
+            commit->message = line_end + 1 <= end ? line_end + 1 : end;
+            break;
+        }
         
-        if (!in_message) {
-            if (line_len == 0) {
-                // Empty line marks start of commit message
-                in_message = 1;
-                message_start = line_end + 1;
-            } else if (strncmp(line_start, "tree ", 5) == 0 && line_len > 5) {
-                char tree_hex[HASH_HEX_SIZE];
-                size_t hex_len = (line_len - 5) < (HASH_HEX_SIZE - 1) ? (line_len - 5) : (HASH_HEX_SIZE - 1);
-                memcpy(tree_hex, line_start + 5, hex_len);
-                tree_hex[hex_len] = '\0';
-                hex_to_hash(tree_hex, &commit->tree);
-            } else if (strncmp(line_start, "parent ", 7) == 0 && line_len > 7) {
-                char parent_hex[HASH_HEX_SIZE];
-                size_t hex_len = (line_len - 7) < (HASH_HEX_SIZE - 1) ? (line_len - 7) : (HASH_HEX_SIZE - 1);
-                memcpy(parent_hex, line_start + 7, hex_len);
-                parent_hex[hex_len] = '\0';
-                hex_to_hash(parent_hex, &commit->parent);
-            } else if (strncmp(line_start, "author ", 7) == 0) {
-                // Parse: "author Name <email> timestamp +0000"
-                char *name_start = line_start + 7;
-                char *email_start = memchr(name_start, '<', line_len - 7);
-                if (email_start) {
-                    size_t name_len = email_start - name_start - 1;
-                    if (name_len > 0 && name_len < sizeof(commit->author.name)) {
-                        memcpy(commit->author.name, name_start, name_len);
-                        commit->author.name[name_len] = '\0';
-                    }
-                    
-                    char *email_end = memchr(email_start, '>', line_end - email_start);
-                    if (email_end) {
-                        size_t email_len = email_end - email_start - 1;
-                        if (email_len > 0 && email_len < sizeof(commit->author.email)) {
-                            memcpy(commit->author.email, email_start + 1, email_len);
-                            commit->author.email[email_len] = '\0';
-                        }
-                        
-                        commit->author.timestamp = atol(email_end + 2);
-                    }
-                }
-            } else if (strncmp(line_start, "committer ", 10) == 0) {
-                // Parse committer (same format as author)
-                char *name_start = line_start + 10;
-                char *email_start = memchr(name_start, '<', line_len - 10);
-                if (email_start) {
-                    size_t name_len = email_start - name_start - 1;
-                    if (name_len > 0 && name_len < sizeof(commit->committer.name)) {
-                        memcpy(commit->committer.name, name_start, name_len);
-                        commit->committer.name[name_len] = '\0';
-                    }
-                    
-                    char *email_end = memchr(email_start, '>', line_end - email_start);
-                    if (email_end) {
-                        size_t email_len = email_end - email_start - 1;
-                        if (email_len > 0 && email_len < sizeof(commit->committer.email)) {
-                            memcpy(commit->committer.email, email_start + 1, email_len);
-                            commit->committer.email[email_len] = '\0';
-                        }
-                        
-                        commit->committer.timestamp = atol(email_end + 2);
-                    }
-                }
-            }
+        if (strncmp(line_start, "tree ", 5) == 0 && line_len > 5) {
+            char tree_hex[HASH_HEX_SIZE];
+            size_t hex_len = (line_len - 5) < (HASH_HEX_SIZE - 1) ? (line_len - 5) : (HASH_HEX_SIZE - 1);
+            memcpy(tree_hex, line_start + 5, hex_len);
+            tree_hex[hex_len] = '\0';
+            hex_to_hash(tree_hex, &commit->tree);
+        } else if (strncmp(line_start, "parent ", 7) == 0 && line_len > 7) {
+            char parent_hex[HASH_HEX_SIZE];
+            size_t hex_len = (line_len - 7) < (HASH_HEX_SIZE - 1) ? (line_len - 7) : (HASH_HEX_SIZE - 1);
+            memcpy(parent_hex, line_start + 7, hex_len);
+            parent_hex[hex_len] = '\0';
+            hex_to_hash(parent_hex, &commit->parent);
+        } else if (strncmp(line_start, "author ", 7) == 0) {
+            commit_parse_person(line_start + 7, line_end, &commit->author);
+        } else if (strncmp(line_start, "committer ", 10) == 0) {
+            commit_parse_person(line_start + 10, line_end, &commit->committer);
         }
         
-        // Move to next line
-        if (line_end < content + size) {
-            line_start = line_end + 1;
-            ptr = line_start;
-        } else {
+        line_start = line_end + 1;
+    }
+    
+    return commit;
+}
+
+static commit_object_t *commit_load(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    object_type_t type;
+    size_t size;
+    void *data = object_read(repo, hash, &type, &size);
+    
+    commit_object_t *commit = data && type == OBJ_COMMIT ? commit_parse(data, size, hash) : NULL;
+    free(data);
+    return commit;
+}
+
+// ==================== Object Cache ====================
+
+// Parsed trees and commits, keyed by hash, in LRU order. Entries hold a
+// reference of their own, so eviction never pulls an object out from under
+// a caller still using it.
+typedef struct cache_entry {
+    gyatt_hash_t hash;
+    object_type_t type;
+    object_header_t *object;     // A tree_object_t or commit_object_t
+    size_t bytes;
+    struct cache_entry *prev;    // LRU list, most recently used first
+    struct cache_entry *next;
+    struct cache_entry *chain;   // Bucket chain
+} cache_entry_t;
+
+struct object_cache {
+    pthread_mutex_t lock;
+    cache_entry_t **buckets;
+    size_t bucket_mask;
+    cache_entry_t *head;
+    cache_entry_t *tail;
+    size_t budget;
+    object_cache_stats_t stats;
+};
+
+object_cache_t *object_cache_create(size_t budget) {
+    if (budget == 0) return NULL;
+
+    object_cache_t *cache = calloc(1, sizeof(object_cache_t));
+    if (!cache) return NULL;
+
+    // Roughly one bucket per small commit's worth of budget
+    size_t bucket_count = 256;
+    while (bucket_count < budget / 4096 && bucket_count < ((size_t)1 << 20)) bucket_count <<= 1;
+
+    cache->buckets = calloc(bucket_count, sizeof(cache_entry_t *));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    cache->bucket_mask = bucket_count - 1;
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void object_release(object_type_t type, object_header_t *object) {
+    if (type == OBJ_TREE) tree_free((tree_object_t *)object);
+    else commit_free((commit_object_t *)object);
+}
+
+void object_cache_free(object_cache_t *cache) {
+    if (!cache) return;
+    cache_entry_t *entry = cache->head;
+    while (entry) {
+        cache_entry_t *next = entry->next;
+        object_release(entry->type, entry->object);
+        free(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
+
+void object_cache_get_stats(const object_cache_t *cache, object_cache_stats_t *stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!cache) return;
+
+    pthread_mutex_lock((pthread_mutex_t *)&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock((pthread_mutex_t *)&cache->lock);
+}
+
+static size_t cache_bucket(const object_cache_t *cache, const gyatt_hash_t *hash) {
+    size_t key;
+    memcpy(&key, hash->hash, sizeof(key));  // SHA-1 bytes are already uniform
+    return key & cache->bucket_mask;
+}
+
+static void cache_unlink(object_cache_t *cache, cache_entry_t *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void cache_push_front(object_cache_t *cache, cache_entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if (!cache->tail) cache->tail = entry;
+}
+
+static void cache_evict(object_cache_t *cache, cache_entry_t *entry) {
+    cache_entry_t **link = &cache->buckets[cache_bucket(cache, &entry->hash)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+
+    cache_unlink(cache, entry);
+    cache->stats.bytes -= entry->bytes;
+    cache->stats.count--;
+    cache->stats.evictions++;
+
+    object_release(entry->type, entry->object);
+    free(entry);
+}
+
+// Returns a new reference, or NULL on a miss
+static object_header_t *cache_get(object_cache_t *cache, const gyatt_hash_t *hash,
+                                  object_type_t type) {
+    if (!cache) return NULL;
+
+    object_header_t *found = NULL;
+    pthread_mutex_lock(&cache->lock);
+    for (cache_entry_t *entry = cache->buckets[cache_bucket(cache, hash)]; entry; entry = entry->chain) {
+        if (entry->type == type && memcmp(entry->hash.hash, hash->hash, HASH_SIZE) == 0) {
+            cache_unlink(cache, entry);
+            cache_push_front(cache, entry);
+            atomic_fetch_add(&entry->object->refs, 1);
+            found = entry->object;
             break;
         }
     }
-    
-    // Copy commit message
-    if (message_start && message_start < content + size) {
-        size_t message_len = (content + size) - message_start;
-        if (message_len > 0 && message_len < sizeof(commit->message)) {
-            memcpy(commit->message, message_start, message_len);
-            commit->message[message_len] = '\0';
+    if (found) cache->stats.hits++;
+    else cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+// Takes a reference of its own on success; the caller keeps theirs
+static void cache_put(object_cache_t *cache, const gyatt_hash_t *hash, object_type_t type,
+                      object_header_t *object, size_t bytes) {
+    // Anything big enough to flush a good part of the cache isn't worth it
+    if (!cache || bytes > cache->budget / 8) return;
+
+    cache_entry_t *entry = malloc(sizeof(cache_entry_t));
+    if (!entry) return;
+    entry->hash = *hash;
+    entry->type = type;
+    entry->object = object;
+    entry->bytes = bytes;
+
+    pthread_mutex_lock(&cache->lock);
+
+    // Two threads can race to parse the same object; keep the first
+    size_t bucket = cache_bucket(cache, hash);
+    for (cache_entry_t *e = cache->buckets[bucket]; e; e = e->chain) {
+        if (e->type == type && memcmp(e->hash.hash, hash->hash, HASH_SIZE) == 0) {
+            pthread_mutex_unlock(&cache->lock);
+            free(entry);
+            return;
         }
     }
-    
-    free(data);
+
+    while (cache->tail && cache->stats.bytes + bytes > cache->budget) {
+        cache_evict(cache, cache->tail);
+    }
+
+    atomic_fetch_add(&object->refs, 1);
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    cache_push_front(cache, entry);
+    cache->stats.bytes += bytes;
+    cache->stats.count++;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+tree_object_t *tree_read(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    object_cache_t *cache = repo ? repo->cache : NULL;
+    tree_object_t *tree = (tree_object_t *)cache_get(cache, hash, OBJ_TREE);
+    if (tree) return tree;
+
+    tree = tree_load(repo, hash);
+    if (tree && cache) {
+        cache_put(cache, hash, OBJ_TREE, &tree->header,
+                  sizeof(tree_object_t) + tree->header.size + tree->entry_count * sizeof(tree_entry_t));
+    }
+    return tree;
+}
+
+commit_object_t *commit_read(gyatt_repo_t *repo, const gyatt_hash_t *hash) {
+    object_cache_t *cache = repo ? repo->cache : NULL;
+    commit_object_t *commit = (commit_object_t *)cache_get(cache, hash, OBJ_COMMIT);
+    if (commit) return commit;
+
+    commit = commit_load(repo, hash);
+    if (commit) cache_put(cache, hash, OBJ_COMMIT, &commit->header, sizeof(commit_object_t) + commit->header.size + 1);
     return commit;
 }
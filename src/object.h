@@ -2,13 +2,17 @@
 #define OBJECT_H
 
 #include "gyatt.h"
+#include "arena.h"
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 // Object header structure
 typedef struct {
     object_type_t type;
     size_t size;
     gyatt_hash_t hash;
+    atomic_int refs;    // Trees and commits can be shared with the object cache
 } object_header_t;
 
 // Blob object (file content)
@@ -17,37 +21,47 @@ typedef struct {
     void *data;
 } blob_object_t;
 
-// Tree entry
+// Tree entry. The name lives in the tree's own memory (for a parsed tree,
+// straight in its copy of the payload), so it goes when the tree does.
 typedef struct {
-    char name[256];
+    const char *name;
     uint32_t mode;  // File permissions
-    gyatt_hash_t hash;
     object_type_t type;
+    gyatt_hash_t hash;
 } tree_entry_t;
 
+// Mode of a tree entry that is itself a tree (a subdirectory)
+#define TREE_MODE_DIR 0040000
+
 // Tree object (directory)
 typedef struct {
     object_header_t header;
     size_t entry_count;
-    tree_entry_t *entries;
+    size_t capacity;        // Of a malloc'd entries array; 0 while it's in the arena
+    tree_entry_t *entries;  // Sorted by name
+    arena_t arena;          // Added names, and a parsed tree's entries
+    void *payload;          // What a loaded tree's names point into; owned
 } tree_object_t;
 
 // Commit author/committer info
 typedef struct {
-    char name[256];
-    char email[256];
+    const char *name;
+    const char *email;
     time_t timestamp;
     int timezone;
 } author_info_t;
 
-// Commit object
+// Commit object. A parsed commit's strings point into its own copy of the
+// payload; for one being built, they're the caller's and only need to
+// last until commit_write.
 typedef struct {
     object_header_t header;
     gyatt_hash_t tree;
     gyatt_hash_t parent;  // Zero hash if no parent
     author_info_t author;
     author_info_t committer;
-    char message[4096];
+    const char *message;
+    arena_t arena;
 } commit_object_t;
 
 // Object functions
@@ -65,22 +79,87 @@ void tree_add_entry(tree_object_t *tree, const char *name, uint32_t mode,
 tree_entry_t *tree_find_entry(tree_object_t *tree, const char *name);
 
 // Object storage functions
-int object_write(const void *data, size_t size, object_type_t type, gyatt_hash_t *hash);
-void *object_read(const gyatt_hash_t *hash, object_type_t *type, size_t *size);
-int object_exists(const gyatt_hash_t *hash);
-char *object_path(const gyatt_hash_t *hash);
+int object_write(gyatt_repo_t *repo, const void *data, size_t size,
+                 object_type_t type, gyatt_hash_t *hash);
+void *object_read(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                  object_type_t *type, size_t *size);
+int object_read_header(gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                       object_type_t *type, size_t *size);
+int object_exists(gyatt_repo_t *repo, const gyatt_hash_t *hash);
+int object_path(const gyatt_repo_t *repo, const gyatt_hash_t *hash,
+                char *out, size_t out_size);
+
+// Enumerate stored objects; fn returning non-zero stops the walk and
+// becomes the return value
+typedef int (*object_foreach_fn)(const gyatt_hash_t *hash, void *arg);
+int object_foreach_loose(gyatt_repo_t *repo, object_foreach_fn fn, void *arg);
+int object_foreach(gyatt_repo_t *repo, object_foreach_fn fn, void *arg);
+
+// Streaming object writer: hashes and deflates data as it arrives into a
+// temp file that is renamed into place on close. Memory use is constant.
+typedef struct object_writer object_writer_t;
+
+object_writer_t *object_writer_open(gyatt_repo_t *repo, object_type_t type, size_t size);
+int object_writer_write(object_writer_t *writer, const void *data, size_t len);
+int object_writer_close(object_writer_t *writer, gyatt_hash_t *hash);
+// Same, but nothing is stored (and -1 returned) unless the data hashed to expected
+int object_writer_close_verified(object_writer_t *writer, const gyatt_hash_t *expected);
+void object_writer_abort(object_writer_t *writer);
+
+// Format the "type size\0" header loose objects start with, returning its
+// length (terminator included)
+size_t object_format_header(object_type_t type, size_t size, char *out, size_t out_size);
+// And back: the header's length (terminator included), 0 if buf doesn't
+// start with a valid one
+size_t object_parse_header(const char *buf, size_t len, object_type_t *type, size_t *size);
+
+// Hash data (or a file, as a blob) the way it would be stored, without storing it.
+// Files over the repo's chunk threshold get their chunk list's hash, unless
+// like (optional: the version it's being compared with) says otherwise.
+void object_hash(const void *data, size_t size, object_type_t type, gyatt_hash_t *hash);
+int object_hash_file(gyatt_repo_t *repo, const char *path, const gyatt_hash_t *like, gyatt_hash_t *hash);
 
 // Blob storage
-int blob_write(blob_object_t *blob);
-blob_object_t *blob_read(const gyatt_hash_t *hash);
+int blob_write(gyatt_repo_t *repo, blob_object_t *blob);
+int blob_write_file(gyatt_repo_t *repo, const char *path, gyatt_hash_t *hash, size_t *size);
+// Blobs and chunked files both read back as a blob: blob_read() puts
+// the whole file in memory, blob_read_to_fd() writes it out one chunk at a
+// time and says how big it was
+blob_object_t *blob_read(gyatt_repo_t *repo, const gyatt_hash_t *hash);
+int blob_read_to_fd(gyatt_repo_t *repo, const gyatt_hash_t *hash, int fd, size_t *size);
 blob_object_t *blob_from_file(const char *path);
 
-// Tree storage
-int tree_write(tree_object_t *tree);
-tree_object_t *tree_read(const gyatt_hash_t *hash);
+// Tree storage. Trees and commits from the *_read functions may be shared
+// with the repo's object cache: treat them as read-only, and release them
+// with tree_free/commit_free as usual.
+int tree_write(gyatt_repo_t *repo, tree_object_t *tree);
+tree_object_t *tree_read(gyatt_repo_t *repo, const gyatt_hash_t *hash);
+// The whole tree below hash as one flat tree of files, named by their
+// path relative to it and sorted like the index
+tree_object_t *tree_read_flat(gyatt_repo_t *repo, const gyatt_hash_t *hash);
 
 // Commit storage
-int commit_write(commit_object_t *commit);
-commit_object_t *commit_read(const gyatt_hash_t *hash);
+int commit_write(gyatt_repo_t *repo, commit_object_t *commit);
+commit_object_t *commit_read(gyatt_repo_t *repo, const gyatt_hash_t *hash);
+
+// Parse a payload that isn't (or isn't yet) in the store, e.g. one that
+// just arrived. hash is only recorded, not checked; free as usual. A tree's
+// entry names point into data, which has to outlive it.
+tree_object_t *tree_parse(const void *data, size_t size, const gyatt_hash_t *hash);
+commit_object_t *commit_parse(const void *data, size_t size, const gyatt_hash_t *hash);
+
+// Object cache: parsed trees and commits, bounded by a byte budget
+// (core.objectcache, in MB; 0 turns it off)
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t bytes;
+    size_t count;
+} object_cache_stats_t;
+
+object_cache_t *object_cache_create(size_t budget);
+void object_cache_free(object_cache_t *cache);
+void object_cache_get_stats(const object_cache_t *cache, object_cache_stats_t *stats);
 
 #endif // OBJECT_H
@@ -0,0 +1,1505 @@
+#include "pack.h"
+#include "object.h"
+#include "hash.h"
+#include "buffer.h"
+#include "utils.h"
+#include "delta.h"
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+#define PACK_HEADER_SIZE 12
+#define PACK_IDX_HEADER_SIZE 8
+#define PACK_IDX_FANOUT_SIZE (256 * 4)
+#define PACK_WRITE_CHUNK (64 * 1024)
+
+struct pack {
+    const unsigned char *idx;
+    size_t idx_size;
+    const unsigned char *data;
+    size_t data_size;
+    uint32_t count;
+    const unsigned char *fanout;
+    const unsigned char *hashes;
+    const unsigned char *offsets;
+    int fd;                   // The .pack, kept open for sendfile(); -1 if not
+    pthread_mutex_t ends_lock;
+    uint64_t *ends;           // Entry offsets in file order, built on first use
+};
+
+// The idx isn't necessarily aligned past the fanout, so go through memcpy
+static uint32_t read_u32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t read_u64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// fd_out (optional) keeps the file open and gets its descriptor
+static void *map_file(const char *path, size_t *size, int *fd_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED || !fd_out) close(fd);
+    if (map == MAP_FAILED) return NULL;
+    if (fd_out) *fd_out = fd;
+
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+// ==================== Delta Base Cache ====================
+
+// Resolved delta bases, keyed by (pack, offset). Neighbouring revisions
+// usually share most of a chain, so without this every blob_read() of a
+// deep delta would re-inflate and re-apply the whole chain.
+#define DELTA_CACHE_SLOTS 256
+#define DELTA_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+typedef struct {
+    const pack_t *pack;
+    uint64_t offset;
+    object_type_t type;
+    void *data;
+    size_t size;
+} delta_cache_slot_t;
+
+struct delta_cache {
+    pthread_mutex_t lock;
+    size_t bytes;
+    size_t evict_cursor;
+    delta_cache_slot_t slots[DELTA_CACHE_SLOTS];
+};
+
+static size_t delta_cache_slot(const pack_t *pack, uint64_t offset) {
+    uint64_t key = (uint64_t)(uintptr_t)pack ^ (offset * 0x9e3779b97f4a7c15ull);
+    return (size_t)((key >> 32) ^ key) % DELTA_CACHE_SLOTS;
+}
+
+static void delta_cache_drop(delta_cache_t *cache, delta_cache_slot_t *slot) {
+    if (!slot->data) return;
+    cache->bytes -= slot->size;
+    free(slot->data);
+    slot->data = NULL;
+    slot->pack = NULL;
+}
+
+// Hands back a private copy, so the entry can be evicted while in use
+static void *delta_cache_get(delta_cache_t *cache, const pack_t *pack, uint64_t offset,
+                             object_type_t *type, size_t *size) {
+    if (!cache) return NULL;
+
+    void *copy = NULL;
+    pthread_mutex_lock(&cache->lock);
+    delta_cache_slot_t *slot = &cache->slots[delta_cache_slot(pack, offset)];
+    if (slot->data && slot->pack == pack && slot->offset == offset) {
+        copy = malloc(slot->size + 1);
+        if (copy) {
+            memcpy(copy, slot->data, slot->size + 1);
+            *type = slot->type;
+            *size = slot->size;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return copy;
+}
+
+static void delta_cache_put(delta_cache_t *cache, const pack_t *pack, uint64_t offset,
+                            object_type_t type, const void *data, size_t size) {
+    // One huge base shouldn't wipe out everything else
+    if (!cache || size > DELTA_CACHE_MAX_BYTES / 4) return;
+
+    void *copy = malloc(size + 1);
+    if (!copy) return;
+    memcpy(copy, data, size + 1);
+
+    pthread_mutex_lock(&cache->lock);
+    delta_cache_slot_t *slot = &cache->slots[delta_cache_slot(pack, offset)];
+    delta_cache_drop(cache, slot);
+
+    while (cache->bytes + size > DELTA_CACHE_MAX_BYTES) {
+        delta_cache_drop(cache, &cache->slots[cache->evict_cursor]);
+        cache->evict_cursor = (cache->evict_cursor + 1) % DELTA_CACHE_SLOTS;
+    }
+
+    slot->pack = pack;
+    slot->offset = offset;
+    slot->type = type;
+    slot->data = copy;
+    slot->size = size;
+    cache->bytes += size;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static delta_cache_t *delta_cache_create(void) {
+    delta_cache_t *cache = calloc(1, sizeof(delta_cache_t));
+    if (!cache) return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void delta_cache_free(delta_cache_t *cache) {
+    if (!cache) return;
+    for (size_t i = 0; i < DELTA_CACHE_SLOTS; i++) {
+        free(cache->slots[i].data);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static pack_t *pack_alloc(void) {
+    pack_t *pack = calloc(1, sizeof(pack_t));
+    if (!pack) return NULL;
+    pack->fd = -1;
+    pthread_mutex_init(&pack->ends_lock, NULL);
+    return pack;
+}
+
+static void pack_close(pack_t *pack) {
+    if (!pack) return;
+    if (pack->idx) munmap((void *)pack->idx, pack->idx_size);
+    if (pack->data) munmap((void *)pack->data, pack->data_size);
+    if (pack->fd >= 0) close(pack->fd);
+    pthread_mutex_destroy(&pack->ends_lock);
+    free(pack->ends);
+    free(pack);
+}
+
+// Map an idx and its pack, checking that the two agree and the sizes add up
+static pack_t *pack_open(const char *idx_path) {
+    pack_t *pack = pack_alloc();
+    if (!pack) return NULL;
+
+    pack->idx = map_file(idx_path, &pack->idx_size, NULL);
+    if (!pack->idx || pack->idx_size < PACK_IDX_HEADER_SIZE + PACK_IDX_FANOUT_SIZE + 2 * HASH_SIZE ||
+        memcmp(pack->idx, PACK_IDX_SIGNATURE, 4) != 0 ||
+        read_u32(pack->idx + 4) != PACK_IDX_VERSION) {
+        pack_close(pack);
+        return NULL;
+    }
+
+    pack->fanout = pack->idx + PACK_IDX_HEADER_SIZE;
+    uint32_t prev = 0;
+    for (int i = 0; i < 256; i++) {
+        uint32_t n = read_u32(pack->fanout + i * 4);
+        if (n < prev) {
+            pack_close(pack);
+            return NULL;
+        }
+        prev = n;
+    }
+    pack->count = prev;
+
+    uint64_t expected = PACK_IDX_HEADER_SIZE + PACK_IDX_FANOUT_SIZE +
+                        (uint64_t)pack->count * (HASH_SIZE + 8) + 2 * HASH_SIZE;
+    if (expected != pack->idx_size) {
+        pack_close(pack);
+        return NULL;
+    }
+    pack->hashes = pack->fanout + PACK_IDX_FANOUT_SIZE;
+    pack->offsets = pack->hashes + (size_t)pack->count * HASH_SIZE;
+
+    // pack-<sha>.idx -> pack-<sha>.pack
+    char pack_path[PATH_MAX];
+    size_t len = strlen(idx_path);
+    if (len < 4 || len >= sizeof(pack_path)) {
+        pack_close(pack);
+        return NULL;
+    }
+    memcpy(pack_path, idx_path, len - 4);
+    strcpy(pack_path + len - 4, ".pack");
+
+    pack->data = map_file(pack_path, &pack->data_size, &pack->fd);
+    if (!pack->data || pack->data_size < PACK_HEADER_SIZE + HASH_SIZE ||
+        memcmp(pack->data, PACK_SIGNATURE, 4) != 0 ||
+        read_u32(pack->data + 4) != PACK_VERSION ||
+        read_u32(pack->data + 8) != pack->count ||
+        memcmp(pack->data + pack->data_size - HASH_SIZE,
+               pack->idx + pack->idx_size - 2 * HASH_SIZE, HASH_SIZE) != 0) {
+        pack_close(pack);
+        return NULL;
+    }
+
+    return pack;
+}
+
+// Readers never lock: a grown array is published before the count that
+// covers it, and replaced arrays stay around until the store is freed
+static int pack_store_add(pack_store_t *store, pack_t *pack) {
+    pthread_mutex_lock(&store->add_lock);
+    size_t count = atomic_load(&store->count);
+    pack_t **packs = atomic_load(&store->packs);
+
+    int result = 0;
+    if (count >= store->capacity) {
+        size_t capacity = store->capacity == 0 ? 4 : store->capacity * 2;
+        pack_t **grown = malloc(capacity * sizeof(pack_t *));
+        pack_t ***retired = packs ? realloc(store->retired, (store->retired_count + 1) * sizeof(pack_t **)) : NULL;
+        if (retired) store->retired = retired;
+        if (!grown || (packs && !retired)) {
+            free(grown);
+            result = -1;
+        } else {
+            if (count > 0) memcpy(grown, packs, count * sizeof(pack_t *));
+            if (packs) store->retired[store->retired_count++] = packs;
+            packs = grown;
+            store->capacity = capacity;
+            atomic_store(&store->packs, packs);
+        }
+    }
+
+    if (result == 0) {
+        packs[count] = pack;
+        atomic_store(&store->count, count + 1);
+    }
+    pthread_mutex_unlock(&store->add_lock);
+    return result;
+}
+
+pack_store_t *pack_store_open(const gyatt_repo_t *repo) {
+    pack_store_t *store = calloc(1, sizeof(pack_store_t));
+    if (!store) return NULL;
+
+    store->cache = delta_cache_create();
+    pthread_mutex_init(&store->add_lock, NULL);
+
+    char pack_dir[PATH_MAX];
+    snprintf(pack_dir, sizeof(pack_dir), "%s/pack", repo->objects_dir);
+
+    // No pack directory is the normal state for a fresh repository
+    DIR *dir = opendir(pack_dir);
+    if (!dir) return store;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 9 || strncmp(entry->d_name, "pack-", 5) != 0 ||
+            strcmp(entry->d_name + len - 4, ".idx") != 0) {
+            continue;
+        }
+
+        char idx_path[PATH_MAX];
+        if (snprintf(idx_path, sizeof(idx_path), "%s/%s", pack_dir, entry->d_name) >= (int)sizeof(idx_path)) {
+            continue;
+        }
+
+        pack_t *pack = pack_open(idx_path);
+        if (!pack) {
+            fprintf(stderr, "Warning: Ignoring unreadable pack '%s'\n", entry->d_name);
+            continue;
+        }
+
+        if (pack_store_add(store, pack) != 0) {
+            pack_close(pack);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return store;
+}
+
+void pack_store_free(pack_store_t *store) {
+    if (!store) return;
+    for (size_t i = 0; i < store->count; i++) {
+        pack_close(store->packs[i]);
+    }
+    free(store->packs);
+    for (size_t i = 0; i < store->retired_count; i++) free(store->retired[i]);
+    free(store->retired);
+    pthread_mutex_destroy(&store->add_lock);
+    delta_cache_free(store->cache);
+    free(store);
+}
+
+// Fanout narrows the search to hashes sharing the first byte, then it's a
+// plain binary search over 20-byte keys
+static int pack_lookup(const pack_t *pack, const gyatt_hash_t *hash, uint64_t *offset) {
+    unsigned char first = hash->hash[0];
+    uint32_t lo = first == 0 ? 0 : read_u32(pack->fanout + (first - 1) * 4);
+    uint32_t hi = read_u32(pack->fanout + first * 4);
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(pack->hashes + (size_t)mid * HASH_SIZE, hash->hash, HASH_SIZE);
+        if (cmp == 0) {
+            *offset = read_u64(pack->offsets + (size_t)mid * 8);
+            return 0;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return -1;
+}
+
+static const pack_t *pack_store_find(const pack_store_t *store, const gyatt_hash_t *hash, uint64_t *offset) {
+    if (!store) return NULL;
+    size_t count = atomic_load(&store->count);
+    pack_t **packs = atomic_load(&store->packs);
+    for (size_t i = 0; i < count; i++) {
+        if (pack_lookup(packs[i], hash, offset) == 0) return packs[i];
+    }
+    return NULL;
+}
+
+// A decoded entry header. Whole objects are type | size varint | zlib;
+// deltas are PACK_OBJ_OFS_DELTA | target size | base distance | delta
+// size | zlib(delta), with the base earlier in the same pack; copied loose
+// objects are PACK_OBJ_LOOSE | type | size | zlib("type size\0" payload).
+typedef struct {
+    unsigned char kind;       // OBJ_*, PACK_OBJ_OFS_DELTA or PACK_OBJ_LOOSE
+    object_type_t type;       // What a non-delta entry holds
+    size_t size;              // Size of the object this entry decodes to
+    size_t loose_header;      // PACK_OBJ_LOOSE only: inflated header length
+    uint64_t base_offset;     // Deltas only
+    size_t delta_size;        // Deltas only: inflated size of the delta
+    int codec;                // compress_codec_t, or COMPRESS_DETECT
+    uint64_t data_offset;     // Start of the compressed stream
+} pack_entry_t;
+
+static int read_varint(const pack_t *pack, const unsigned char **p, uint64_t *value) {
+    const unsigned char *end = pack->data + pack->data_size - HASH_SIZE;
+    uint64_t v = 0;
+    int shift = 0;
+    for (;;) {
+        if (*p >= end || shift > 63) return -1;
+        unsigned char byte = *(*p)++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+        shift += 7;
+    }
+    *value = v;
+    return 0;
+}
+
+static int pack_entry_header(const pack_t *pack, uint64_t offset, pack_entry_t *entry) {
+    uint64_t end = pack->data_size - HASH_SIZE;
+    if (offset < PACK_HEADER_SIZE || offset >= end) return -1;
+
+    const unsigned char *p = pack->data + offset;
+    entry->codec = *p >> PACK_CODEC_SHIFT;
+    entry->kind = *p++ & PACK_KIND_MASK;
+    entry->type = (object_type_t)entry->kind;
+    entry->loose_header = 0;
+    if (entry->codec >= COMPRESS_CODEC_COUNT) return -1;
+    if (entry->kind == PACK_OBJ_LOOSE) {
+        entry->type = (object_type_t)*p++;
+        entry->codec = COMPRESS_DETECT;
+    }
+
+    uint64_t size;
+    if (read_varint(pack, &p, &size) != 0 || size >= SIZE_MAX) return -1;
+    entry->size = (size_t)size;
+
+    if (entry->kind == PACK_OBJ_OFS_DELTA) {
+        uint64_t distance, delta_size;
+        if (read_varint(pack, &p, &distance) != 0 || distance == 0 || distance > offset ||
+            read_varint(pack, &p, &delta_size) != 0 || delta_size >= SIZE_MAX) {
+            return -1;
+        }
+        entry->base_offset = offset - distance;
+        entry->delta_size = (size_t)delta_size;
+    } else if (entry->type < OBJ_BLOB || entry->type > OBJ_CHUNKED) {
+        return -1;
+    } else if (entry->kind == PACK_OBJ_LOOSE) {
+        char header[64];
+        entry->loose_header = object_format_header(entry->type, entry->size, header, sizeof(header));
+    }
+
+    entry->data_offset = (uint64_t)(p - pack->data);
+    return 0;
+}
+
+int pack_has_object(const pack_store_t *store, const gyatt_hash_t *hash) {
+    uint64_t offset;
+    return pack_store_find(store, hash, &offset) != NULL;
+}
+
+// Deltas keep the size of the object they produce in their own header, so
+// only the type needs the chain followed - and only its headers
+int pack_read_header(const pack_store_t *store, const gyatt_hash_t *hash,
+                     object_type_t *type, size_t *size) {
+    uint64_t offset;
+    const pack_t *pack = pack_store_find(store, hash, &offset);
+    if (!pack) return -1;
+
+    pack_entry_t entry;
+    if (pack_entry_header(pack, offset, &entry) != 0) return -1;
+    size_t obj_size = entry.size;
+
+    while (entry.kind == PACK_OBJ_OFS_DELTA) {
+        if (pack_entry_header(pack, entry.base_offset, &entry) != 0) return -1;
+    }
+
+    if (type) *type = entry.type;
+    if (size) *size = obj_size;
+    return 0;
+}
+
+// Inflate straight out of the mapping into a buffer of exactly out_size.
+// consumed (optional) gets the length of the compressed stream.
+static void *pack_inflate(const pack_t *pack, uint64_t start, size_t out_size, int codec, uint64_t *consumed) {
+    char *out = malloc(out_size + 1);
+    if (!out) return NULL;
+
+    const unsigned char *in = pack->data + start;
+    size_t in_left = pack->data_size - HASH_SIZE - start;
+    if (codec == COMPRESS_DETECT) codec = compress_sniff(in, in_left);
+
+    // Raw streams are exactly as long as what they decode to
+    uint64_t used = out_size;
+    int ok = out_size <= in_left;
+    if (codec == COMPRESS_RAW) {
+        if (ok) memcpy(out, in, out_size);
+    } else {
+        decompressor_t zs;
+        ok = decompressor_init(&zs, codec) == 0;
+
+        // One spare byte lets us notice a stream that runs past out_size
+        unsigned char *next_out = (unsigned char *)out;
+        size_t room = out_size + 1;
+        const unsigned char *next_in = in;
+        int ret = 0;
+        while (ok && ret == 0) {
+            ret = decompressor_run(&zs, &next_in, &in_left, &next_out, &room);
+            if (ret < 0 || (ret == 0 && (in_left == 0 || room == 0))) ok = 0;
+        }
+        ok = ok && room == 1;
+        used = (uint64_t)(next_in - in);
+        decompressor_end(&zs);
+    }
+
+    if (!ok) {
+        free(out);
+        return NULL;
+    }
+
+    out[out_size] = '\0';
+    if (consumed) *consumed = used;
+    return out;
+}
+
+// Inflate an entry's own payload: the delta for deltas, otherwise the
+// object, with a copied loose object's header checked and stripped
+static void *pack_inflate_entry(const pack_t *pack, const pack_entry_t *entry, uint64_t *consumed) {
+    if (entry->kind == PACK_OBJ_OFS_DELTA) {
+        return pack_inflate(pack, entry->data_offset, entry->delta_size, entry->codec, consumed);
+    }
+    if (entry->kind != PACK_OBJ_LOOSE) {
+        return pack_inflate(pack, entry->data_offset, entry->size, entry->codec, consumed);
+    }
+
+    char *data = pack_inflate(pack, entry->data_offset, entry->loose_header + entry->size,
+                              entry->codec, consumed);
+    if (!data) return NULL;
+
+    char header[64];
+    object_format_header(entry->type, entry->size, header, sizeof(header));
+    if (memcmp(data, header, entry->loose_header) != 0) {
+        free(data);
+        return NULL;
+    }
+    memmove(data, data + entry->loose_header, entry->size + 1);
+    return data;
+}
+
+// Decode the entry at offset, resolving delta chains. The chain is walked
+// down to a whole object (or a cached base) and then applied back up, so
+// a long one costs no stack; chains longer than the writer ever makes
+// (PACK_DELTA_MAX_DEPTH) are refused. Bases along the way go into the cache.
+static void *pack_unpack(delta_cache_t *cache, const pack_t *pack, uint64_t offset,
+                         object_type_t *type, size_t *size) {
+    uint64_t chain[PACK_DELTA_MAX_DEPTH];
+    size_t depth = 0;
+    object_type_t obj_type;
+    size_t obj_size;
+    void *data = NULL;
+    int cached = 0;
+
+    uint64_t at = offset;
+    for (;;) {
+        pack_entry_t entry;
+        if (pack_entry_header(pack, at, &entry) != 0) return NULL;
+        if (entry.kind != PACK_OBJ_OFS_DELTA) {
+            data = pack_inflate_entry(pack, &entry, NULL);
+            if (!data) return NULL;
+            obj_type = entry.type;
+            obj_size = entry.size;
+            break;
+        }
+        if (depth == PACK_DELTA_MAX_DEPTH) return NULL;
+        chain[depth++] = at;
+
+        data = delta_cache_get(cache, pack, entry.base_offset, &obj_type, &obj_size);
+        if (data) {
+            cached = 1;
+            break;
+        }
+        at = entry.base_offset;
+    }
+
+    while (depth > 0) {
+        pack_entry_t entry;
+        void *delta = NULL;
+        if (pack_entry_header(pack, chain[--depth], &entry) == 0) {
+            // What we have is this delta's base; keep it unless it came from the cache
+            if (!cached) delta_cache_put(cache, pack, entry.base_offset, obj_type, data, obj_size);
+            delta = pack_inflate_entry(pack, &entry, NULL);
+        }
+        cached = 0;
+        if (!delta) {
+            free(data);
+            return NULL;
+        }
+
+        size_t out_size;
+        void *out = delta_apply(data, obj_size, delta, entry.delta_size, &out_size);
+        free(delta);
+        free(data);
+        if (!out || out_size != entry.size) {
+            free(out);
+            return NULL;
+        }
+        data = out;
+        obj_size = out_size;
+    }
+
+    *type = obj_type;
+    *size = obj_size;
+    return data;
+}
+
+void *pack_read_object(const pack_store_t *store, const gyatt_hash_t *hash,
+                       object_type_t *type, size_t *size) {
+    uint64_t offset;
+    const pack_t *pack = pack_store_find(store, hash, &offset);
+    if (!pack) return NULL;
+
+    object_type_t obj_type;
+    size_t obj_size;
+    void *data = pack_unpack(store->cache, pack, offset, &obj_type, &obj_size);
+    if (!data) return NULL;
+
+    if (type) *type = obj_type;
+    if (size) *size = obj_size;
+    return data;
+}
+
+int pack_foreach(const pack_store_t *store, object_foreach_fn fn, void *arg) {
+    if (!store) return 0;
+
+    size_t count = atomic_load(&store->count);
+    pack_t **packs = atomic_load(&store->packs);
+    for (size_t i = 0; i < count; i++) {
+        const pack_t *pack = packs[i];
+        for (uint32_t j = 0; j < pack->count; j++) {
+            gyatt_hash_t hash;
+            memcpy(hash.hash, pack->hashes + (size_t)j * HASH_SIZE, HASH_SIZE);
+            int ret = fn(&hash, arg);
+            if (ret != 0) return ret;
+        }
+    }
+
+    return 0;
+}
+
+// ==================== Pack Writer ====================
+
+// Buffered, checksummed output for the .pack temp file - or, for a pack
+// that's being streamed somewhere, for a memory buffer
+typedef struct {
+    int fd;
+    buffer_t *sink;           // Used instead of fd when set
+    const gyatt_config_t *config; // Codec and levels for new entries
+    sha1_ctx_t sha;
+    uint64_t offset;
+    size_t len;
+    unsigned char buf[PACK_WRITE_CHUNK];
+} pack_out_t;
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int pack_out_flush(pack_out_t *out) {
+    if (out->len == 0) return 0;
+    int result = 0;
+    if (out->sink) buffer_append(out->sink, out->buf, out->len);
+    else result = write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+    return result;
+}
+
+static int pack_out_write(pack_out_t *out, const void *data, size_t len) {
+    sha1_update(&out->sha, data, len);
+    out->offset += len;
+
+    const unsigned char *p = data;
+    while (len > 0) {
+        size_t room = sizeof(out->buf) - out->len;
+        size_t n = len < room ? len : room;
+        memcpy(out->buf + out->len, p, n);
+        out->len += n;
+        p += n;
+        len -= n;
+        if (out->len == sizeof(out->buf) && pack_out_flush(out) != 0) return -1;
+    }
+    return 0;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t value) {
+    size_t n = 0;
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        p[n++] = byte;
+    } while (value);
+    return n;
+}
+
+// Header, with the codec in its first byte, then the payload compressed
+// straight into the pack. type is what the entry decodes to, for the
+// per-type level.
+static int pack_write_entry(pack_out_t *out, unsigned char *header, size_t header_len,
+                            object_type_t type, const void *data, size_t size) {
+    compress_codec_t codec;
+    int level;
+    compress_choose(out->config, type, data, size, &codec, &level);
+    header[0] |= (unsigned char)(codec << PACK_CODEC_SHIFT);
+    if (pack_out_write(out, header, header_len) != 0) return -1;
+    if (codec == COMPRESS_RAW) return pack_out_write(out, data, size);
+
+    compressor_t zs;
+    if (compressor_init(&zs, codec, level) != 0) {
+        compressor_end(&zs);
+        return -1;
+    }
+
+    unsigned char chunk[PACK_WRITE_CHUNK];
+    const unsigned char *in = data;
+    size_t in_left = size;
+    int ret;
+    do {
+        unsigned char *next_out = chunk;
+        size_t room = sizeof(chunk);
+        ret = compressor_run(&zs, &in, &in_left, &next_out, &room, 1);
+        if (ret < 0 || pack_out_write(out, chunk, sizeof(chunk) - room) != 0) {
+            compressor_end(&zs);
+            return -1;
+        }
+    } while (ret != 1);
+
+    compressor_end(&zs);
+    return 0;
+}
+
+static int pack_write_whole(pack_out_t *out, object_type_t type, const void *data, size_t size) {
+    unsigned char header[16];
+    size_t header_len = 0;
+    header[header_len++] = (unsigned char)type;
+    header_len += put_varint(header + header_len, size);
+    return pack_write_entry(out, header, header_len, type, data, size);
+}
+
+static int pack_write_delta(pack_out_t *out, object_type_t type, uint64_t base_offset, size_t target_size,
+                            const void *delta, size_t delta_size) {
+    unsigned char header[40];
+    size_t header_len = 0;
+    header[header_len++] = PACK_OBJ_OFS_DELTA;
+    header_len += put_varint(header + header_len, target_size);
+    header_len += put_varint(header + header_len, out->offset - base_offset);
+    header_len += put_varint(header + header_len, delta_size);
+    return pack_write_entry(out, header, header_len, type, delta, delta_size);
+}
+
+// Objects too small aren't worth a delta, and huge ones would make the
+// window eat too much memory
+#define PACK_DELTA_MIN_SIZE 64
+#define PACK_DELTA_MAX_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+    gyatt_hash_t hash;
+    uint32_t name_hash;
+    object_type_t type;
+    size_t size;
+    uint64_t offset;
+    int depth;               // Deltas to get to it; only while indexing
+} pack_object_t;
+
+// One recently written object the next ones may delta against
+typedef struct {
+    void *data;
+    size_t size;
+    object_type_t type;
+    uint64_t offset;
+    int depth;
+    delta_index_t *index;    // Built the first time a target tries it
+} pack_window_t;
+
+// Same as git's pack name hash: the last characters weigh the most, so
+// files with the same extension/basename land next to each other
+static uint32_t pack_name_hash(const char *name) {
+    uint32_t hash = 0;
+    if (!name) return 0;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+        if (isspace(*c)) continue;
+        hash = (hash >> 2) + ((uint32_t)*c << 24);
+    }
+    return hash;
+}
+
+static int pack_object_hash_compare(const void *a, const void *b) {
+    const pack_object_t *oa = a, *ob = b;
+    return memcmp(oa->hash.hash, ob->hash.hash, HASH_SIZE);
+}
+
+// Delta search order: by type, then name, then biggest first (deltas that
+// remove data are smaller than ones that add it)
+static int pack_object_delta_compare(const void *a, const void *b) {
+    const pack_object_t *oa = *(pack_object_t *const *)a;
+    const pack_object_t *ob = *(pack_object_t *const *)b;
+    if (oa->type != ob->type) return oa->type < ob->type ? -1 : 1;
+    if (oa->name_hash != ob->name_hash) return oa->name_hash < ob->name_hash ? -1 : 1;
+    if (oa->size != ob->size) return oa->size > ob->size ? -1 : 1;
+    return memcmp(oa->hash.hash, ob->hash.hash, HASH_SIZE);
+}
+
+static void pack_window_clear(pack_window_t *slot) {
+    free(slot->data);
+    delta_index_free(slot->index);
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Try every window slot as a base for data; returns the smallest delta
+// found (at most half the object) and which slot it's against
+static void *pack_find_delta(pack_window_t *window, object_type_t type, const void *data,
+                             size_t size, size_t *delta_size, int *base_slot) {
+    void *best = NULL;
+    size_t best_size = size / 2;
+
+    for (int s = 0; s < PACK_DELTA_WINDOW; s++) {
+        pack_window_t *slot = &window[s];
+        if (!slot->data || slot->type != type || slot->depth >= PACK_DELTA_MAX_DEPTH) continue;
+
+        // Growing by more than the budget can't produce a small enough delta
+        if (size > slot->size && size - slot->size >= best_size) continue;
+
+        if (!slot->index) slot->index = delta_index_create(slot->data, slot->size);
+        if (!slot->index) continue;
+
+        size_t this_size;
+        void *delta = delta_create(slot->index, data, size, best_size - 1, &this_size);
+        if (!delta) continue;
+
+        free(best);
+        best = delta;
+        best_size = this_size;
+        *base_slot = s;
+    }
+
+    if (best) *delta_size = best_size;
+    return best;
+}
+
+static int pack_write_header(pack_out_t *out, uint32_t count) {
+    uint32_t version = PACK_VERSION;
+    if (pack_out_write(out, PACK_SIGNATURE, 4) != 0 ||
+        pack_out_write(out, &version, 4) != 0 ||
+        pack_out_write(out, &count, 4) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Write one object, as a delta against the window if that pays, and make
+// it a candidate base for the ones after it
+static int pack_write_object(gyatt_repo_t *repo, pack_out_t *out, pack_window_t *window,
+                             size_t *next_slot, pack_object_t *obj, size_t *deltas) {
+    object_type_t type;
+    size_t size;
+    void *data = object_read(repo, &obj->hash, &type, &size);
+    if (!data) {
+        char hex[HASH_HEX_SIZE];
+        hash_to_hex(&obj->hash, hex);
+        fprintf(stderr, "Error: Could not read object %s\n", hex);
+        return -1;
+    }
+
+    int candidate = size >= PACK_DELTA_MIN_SIZE && size <= PACK_DELTA_MAX_SIZE;
+    size_t delta_size = 0;
+    int base_slot = -1;
+    void *delta = candidate ? pack_find_delta(window, type, data, size, &delta_size, &base_slot) : NULL;
+
+    obj->offset = out->offset;
+    int depth = 0;
+    int result;
+    if (delta) {
+        result = pack_write_delta(out, type, window[base_slot].offset, size, delta, delta_size);
+        depth = window[base_slot].depth + 1;
+        (*deltas)++;
+        free(delta);
+    } else {
+        result = pack_write_whole(out, type, data, size);
+    }
+
+    if (!candidate) {
+        free(data);
+        return result;
+    }
+
+    pack_window_t *slot = &window[*next_slot];
+    *next_slot = (*next_slot + 1) % PACK_DELTA_WINDOW;
+    pack_window_clear(slot);
+    slot->data = data;
+    slot->size = size;
+    slot->type = type;
+    slot->offset = obj->offset;
+    slot->depth = depth;
+    return result;
+}
+
+// Trailer: checksum of the whole pack, which also names it
+static int pack_write_trailer(pack_out_t *out, gyatt_hash_t *pack_sum) {
+    if (pack_out_flush(out) != 0) return -1;
+    sha1_final(&out->sha, pack_sum->hash);
+    if (out->sink) {
+        buffer_append(out->sink, pack_sum->hash, HASH_SIZE);
+        return 0;
+    }
+    return write_all(out->fd, pack_sum->hash, HASH_SIZE);
+}
+
+// Write the header, every object and the trailing checksum to out->fd.
+// Objects go out in delta search order, so a delta's base is always some
+// earlier entry still sitting in the window.
+static int pack_write_data(gyatt_repo_t *repo, pack_out_t *out, pack_object_t **order,
+                           size_t count, gyatt_hash_t *pack_sum, size_t *delta_count) {
+    if (pack_write_header(out, (uint32_t)count) != 0) return -1;
+
+    pack_window_t window[PACK_DELTA_WINDOW];
+    memset(window, 0, sizeof(window));
+    size_t next_slot = 0;
+    size_t deltas = 0;
+    int result = 0;
+
+    for (size_t i = 0; i < count && result == 0; i++) {
+        result = pack_write_object(repo, out, window, &next_slot, order[i], &deltas);
+    }
+
+    for (int s = 0; s < PACK_DELTA_WINDOW; s++) {
+        pack_window_clear(&window[s]);
+    }
+    if (result != 0) return -1;
+
+    if (delta_count) *delta_count = deltas;
+    return pack_write_trailer(out, pack_sum);
+}
+
+// The idx is only 28 bytes per object, so it's built in memory
+static buffer_t *pack_build_idx(const pack_object_t *sorted, size_t count,
+                                const gyatt_hash_t *pack_sum) {
+    buffer_t *idx = buffer_create(PACK_IDX_HEADER_SIZE + PACK_IDX_FANOUT_SIZE +
+                                  count * (HASH_SIZE + 8) + 2 * HASH_SIZE);
+    if (!idx) return NULL;
+
+    uint32_t version = PACK_IDX_VERSION;
+    buffer_append(idx, PACK_IDX_SIGNATURE, 4);
+    buffer_append(idx, &version, 4);
+
+    size_t cursor = 0;
+    for (int b = 0; b < 256; b++) {
+        while (cursor < count && sorted[cursor].hash.hash[0] == b) cursor++;
+        uint32_t n = (uint32_t)cursor;
+        buffer_append(idx, &n, 4);
+    }
+    for (size_t i = 0; i < count; i++) {
+        buffer_append(idx, sorted[i].hash.hash, HASH_SIZE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        buffer_append(idx, &sorted[i].offset, 8);
+    }
+    buffer_append(idx, pack_sum->hash, HASH_SIZE);
+
+    gyatt_hash_t idx_sum;
+    sha1_hash(idx->data, idx->len, &idx_sum);
+    buffer_append(idx, idx_sum.hash, HASH_SIZE);
+    return idx;
+}
+
+// Sorted, de-duplicated objects with their headers read, plus the order to
+// write them in (delta search order). The pack's offsets land back in
+// objects, which is what the idx is built from.
+static int pack_plan(gyatt_repo_t *repo, const gyatt_hash_t *hashes, const char *const *names,
+                     size_t count, pack_object_t **objects_out, pack_object_t ***order_out,
+                     size_t *unique_out) {
+    pack_object_t *objects = malloc(count * sizeof(pack_object_t));
+    pack_object_t **order = malloc(count * sizeof(pack_object_t *));
+    if (!objects || !order) {
+        free(objects);
+        free(order);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        objects[i].hash = hashes[i];
+        objects[i].name_hash = pack_name_hash(names ? names[i] : NULL);
+        objects[i].offset = 0;
+    }
+    qsort(objects, count, sizeof(pack_object_t), pack_object_hash_compare);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique > 0 && memcmp(&objects[unique - 1].hash, &objects[i].hash, HASH_SIZE) == 0) {
+            // The same blob under several paths: any name beats none
+            if (!objects[unique - 1].name_hash) objects[unique - 1].name_hash = objects[i].name_hash;
+            continue;
+        }
+        objects[unique++] = objects[i];
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < unique && result == 0; i++) {
+        result = object_read_header(repo, &objects[i].hash, &objects[i].type, &objects[i].size);
+        order[i] = &objects[i];
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error: Could not read object headers\n");
+        free(objects);
+        free(order);
+        return -1;
+    }
+    qsort(order, unique, sizeof(pack_object_t *), pack_object_delta_compare);
+
+    *objects_out = objects;
+    *order_out = order;
+    *unique_out = unique;
+    return 0;
+}
+
+static int pack_dir_path(const gyatt_repo_t *repo, char *out, size_t out_size) {
+    int n = snprintf(out, out_size, "%s/pack", repo->objects_dir);
+    if (n < 0 || (size_t)n >= out_size) return -1;
+    return mkdir(out, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+int pack_tmp_create(const gyatt_repo_t *repo, char *path, size_t path_size) {
+    char pack_dir[PATH_MAX];
+    if (!repo || pack_dir_path(repo, pack_dir, sizeof(pack_dir)) != 0 ||
+        snprintf(path, path_size, "%s/tmp_pack_XXXXXX", pack_dir) >= (int)path_size) {
+        return -1;
+    }
+    return mkstemp(path);
+}
+
+// Write the idx for a finished temp pack and move both into place. The
+// pack goes first: readers find packs by their idx, so an idx must never
+// appear without its pack.
+static int pack_install(const char *pack_dir, const char *tmp_pack, const gyatt_hash_t *pack_sum,
+                        const pack_object_t *sorted, size_t count, char *name_out, size_t name_size) {
+    char tmp_idx[PATH_MAX];
+    if (snprintf(tmp_idx, sizeof(tmp_idx), "%s/tmp_idx_XXXXXX", pack_dir) >= (int)sizeof(tmp_idx)) {
+        return -1;
+    }
+
+    buffer_t *idx = pack_build_idx(sorted, count, pack_sum);
+    int idx_fd = idx ? mkstemp(tmp_idx) : -1;
+    int result = idx_fd < 0 || write_all(idx_fd, idx->data, idx->len) != 0 ? -1 : 0;
+    if (idx_fd >= 0 && close(idx_fd) != 0) result = -1;
+    buffer_free(idx);
+
+    char hex[HASH_HEX_SIZE];
+    char final_pack[PATH_MAX], final_idx[PATH_MAX];
+    if (result == 0) {
+        hash_to_hex(pack_sum, hex);
+        int len_pack = snprintf(final_pack, sizeof(final_pack), "%s/pack-%s.pack", pack_dir, hex);
+        int len_idx = snprintf(final_idx, sizeof(final_idx), "%s/pack-%s.idx", pack_dir, hex);
+
+        chmod(tmp_pack, 0444);
+        chmod(tmp_idx, 0444);
+        if (len_pack >= (int)sizeof(final_pack) || len_idx >= (int)sizeof(final_idx) ||
+            rename(tmp_pack, final_pack) != 0 || rename(tmp_idx, final_idx) != 0) {
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        if (name_out) snprintf(name_out, name_size, "pack-%s", hex);
+    } else if (idx_fd >= 0) {
+        unlink(tmp_idx);
+    }
+    return result;
+}
+
+int pack_write(gyatt_repo_t *repo, const gyatt_hash_t *hashes, const char *const *names,
+               size_t count, char *name_out, size_t name_size, size_t *delta_count) {
+    if (!repo || count == 0 || count > UINT32_MAX) return -1;
+
+    char pack_dir[PATH_MAX];
+    if (pack_dir_path(repo, pack_dir, sizeof(pack_dir)) != 0) return -1;
+
+    pack_object_t *objects;
+    pack_object_t **order;
+    size_t unique;
+    if (pack_plan(repo, hashes, names, count, &objects, &order, &unique) != 0) return -1;
+
+    pack_out_t *out = malloc(sizeof(pack_out_t));
+    char tmp_pack[PATH_MAX];
+    if (!out || snprintf(tmp_pack, sizeof(tmp_pack), "%s/tmp_pack_XXXXXX", pack_dir) >= (int)sizeof(tmp_pack)) {
+        free(objects);
+        free(order);
+        free(out);
+        return -1;
+    }
+
+    out->sink = NULL;
+    out->config = &repo->config;
+    out->len = 0;
+    out->offset = 0;
+    sha1_init(&out->sha);
+    out->fd = mkstemp(tmp_pack);
+
+    gyatt_hash_t pack_sum;
+    int result = out->fd < 0 ? -1 : pack_write_data(repo, out, order, unique, &pack_sum, delta_count);
+    if (out->fd >= 0 && close(out->fd) != 0) result = -1;
+
+    if (result == 0) {
+        result = pack_install(pack_dir, tmp_pack, &pack_sum, objects, unique, name_out, name_size);
+    }
+    if (result != 0 && out->fd >= 0) unlink(tmp_pack);
+
+    free(objects);
+    free(order);
+    free(out);
+    return result;
+}
+
+// ==================== Pack Streams ====================
+
+struct pack_stream {
+    gyatt_repo_t *repo;
+    pack_object_t *objects;
+    pack_object_t **order;
+    size_t count;
+    size_t next;              // Next object in order to write
+    int done;
+    size_t deltas;
+    pack_window_t window[PACK_DELTA_WINDOW];
+    size_t next_slot;
+    pack_out_t out;
+    int reuse;                // Send stored zlib data as is, see pack_stream_reuse()
+    pack_raw_fn raw_fn;
+    void *raw_arg;
+};
+
+pack_stream_t *pack_stream_create(gyatt_repo_t *repo, const gyatt_hash_t *hashes, size_t count) {
+    if (!repo || count > UINT32_MAX) return NULL;
+
+    pack_stream_t *stream = calloc(1, sizeof(pack_stream_t));
+    if (!stream) return NULL;
+    stream->repo = repo;
+
+    if (count > 0 && pack_plan(repo, hashes, NULL, count, &stream->objects, &stream->order, &stream->count) != 0) {
+        free(stream);
+        return NULL;
+    }
+
+    sha1_init(&stream->out.sha);
+    stream->out.fd = -1;
+    stream->out.config = &repo->config;
+    return stream;
+}
+
+void pack_stream_reuse(pack_stream_t *stream, pack_raw_fn fn, void *arg) {
+    if (!stream) return;
+    stream->reuse = 1;
+    stream->raw_fn = fn;
+    stream->raw_arg = arg;
+}
+
+static int offset_compare(const void *a, const void *b) {
+    uint64_t oa = *(const uint64_t *)a, ob = *(const uint64_t *)b;
+    return oa < ob ? -1 : oa > ob;
+}
+
+// Where the entry at offset stops, which is where the next one starts.
+// The idx only has offsets in hash order, so the first call sorts a copy.
+static int pack_entry_end(const pack_t *pack, uint64_t offset, uint64_t *end) {
+    // The table is the only part of a pack that changes after it's opened
+    pack_t *lazy = (pack_t *)pack;
+    pthread_mutex_lock(&lazy->ends_lock);
+    if (!lazy->ends && pack->count > 0) {
+        uint64_t *ends = malloc((size_t)pack->count * sizeof(uint64_t));
+        if (ends) {
+            for (uint32_t i = 0; i < pack->count; i++) ends[i] = read_u64(pack->offsets + (size_t)i * 8);
+            qsort(ends, pack->count, sizeof(uint64_t), offset_compare);
+        }
+        lazy->ends = ends;
+    }
+    pthread_mutex_unlock(&lazy->ends_lock);
+    if (!pack->ends) return -1;
+
+    const uint64_t *found = bsearch(&offset, pack->ends, pack->count, sizeof(uint64_t), offset_compare);
+    if (!found) return -1;
+    size_t i = (size_t)(found - pack->ends);
+    *end = i + 1 < pack->count ? pack->ends[i + 1] : pack->data_size - HASH_SIZE;
+    return 0;
+}
+
+// Hand a file range to the stream's owner instead of copying it
+static int pack_stream_range(pack_stream_t *stream, int fd, uint64_t offset, size_t length) {
+    if (pack_out_flush(&stream->out) != 0) return -1;
+    buffer_t *sink = stream->raw_fn(stream->raw_arg, stream->out.sink, fd, offset, length);
+    if (!sink) return -1;
+    stream->out.sink = sink;
+    stream->out.offset += length;
+    return 0;
+}
+
+// Reuse mode: write an object the way it's already stored. Whole entries
+// from a pack are copied byte for byte; a loose object becomes a
+// PACK_OBJ_LOOSE entry wrapping its file. Returns 1 if the object went
+// out, 0 if it has to be re-encoded instead (it's stored as a delta).
+static int pack_stream_stored(pack_stream_t *stream, pack_object_t *obj) {
+    pack_out_t *out = &stream->out;
+    uint64_t offset, end;
+    const pack_t *pack = pack_store_find(stream->repo->packs, &obj->hash, &offset);
+    if (pack) {
+        pack_entry_t entry;
+        if (pack_entry_header(pack, offset, &entry) != 0 || entry.kind == PACK_OBJ_OFS_DELTA ||
+            pack_entry_end(pack, offset, &end) != 0 || end - offset > SIZE_MAX) {
+            return 0;
+        }
+
+        obj->offset = out->offset;
+        size_t length = (size_t)(end - offset);
+        int result = length >= PACK_RAW_MIN && stream->raw_fn && pack->fd >= 0
+                         ? pack_stream_range(stream, pack->fd, offset, length)
+                         : pack_out_write(out, pack->data + offset, length);
+        return result == 0 ? 1 : -1;
+    }
+
+    char path[PATH_MAX];
+    struct stat st;
+    object_type_t type;
+    size_t size;
+    if (object_path(stream->repo, &obj->hash, path, sizeof(path)) != 0 || stat(path, &st) != 0 ||
+        object_read_header(stream->repo, &obj->hash, &type, &size) != 0) {
+        return 0;  // The re-encoding path reports it
+    }
+
+    unsigned char header[16];
+    size_t header_len = 0;
+    header[header_len++] = PACK_OBJ_LOOSE;
+    header[header_len++] = (unsigned char)type;
+    header_len += put_varint(header + header_len, size);
+
+    obj->offset = out->offset;
+    if (pack_out_write(out, header, header_len) != 0) return -1;
+
+    int result;
+    if ((size_t)st.st_size >= PACK_RAW_MIN && stream->raw_fn) {
+        int fd = open(path, O_RDONLY);
+        result = fd >= 0 ? pack_stream_range(stream, fd, 0, (size_t)st.st_size) : -1;
+        if (fd >= 0) close(fd);
+    } else {
+        size_t len;
+        char *data = read_file(path, &len);
+        result = data ? pack_out_write(out, data, len) : -1;
+        free(data);
+    }
+    return result == 0 ? 1 : -1;
+}
+
+size_t pack_stream_count(const pack_stream_t *stream) {
+    return stream ? stream->count : 0;
+}
+
+size_t pack_stream_deltas(const pack_stream_t *stream) {
+    return stream ? stream->deltas : 0;
+}
+
+int pack_stream_next(pack_stream_t *stream, buffer_t *out, size_t budget) {
+    if (!stream || !out || stream->done) return stream && stream->done ? 0 : -1;
+
+    stream->out.sink = out;
+    uint64_t start = stream->out.offset;
+    int result = 0;
+
+    if (stream->next == 0 && stream->out.offset == 0) {
+        result = pack_write_header(&stream->out, (uint32_t)stream->count);
+    }
+
+    while (result == 0 && stream->next < stream->count && stream->out.offset - start < budget) {
+        pack_object_t *obj = stream->order[stream->next++];
+        int stored = stream->reuse ? pack_stream_stored(stream, obj) : 0;
+        if (stored < 0) result = -1;
+        else if (!stored) result = pack_write_object(stream->repo, &stream->out, stream->window,
+                                                     &stream->next_slot, obj, &stream->deltas);
+    }
+
+    if (result == 0 && stream->next == stream->count) {
+        // Bytes that were never read can't be hashed, so with ranges
+        // handed out the trailer is left to whoever stores it
+        gyatt_hash_t pack_sum;
+        result = stream->raw_fn ? pack_out_flush(&stream->out) : pack_write_trailer(&stream->out, &pack_sum);
+        stream->done = 1;
+    } else if (result == 0) {
+        result = pack_out_flush(&stream->out);
+    }
+
+    stream->out.sink = NULL;
+    if (result != 0) return -1;
+    return stream->done ? 0 : 1;
+}
+
+void pack_stream_free(pack_stream_t *stream) {
+    if (!stream) return;
+    for (int s = 0; s < PACK_DELTA_WINDOW; s++) {
+        pack_window_clear(&stream->window[s]);
+    }
+    free(stream->objects);
+    free(stream->order);
+    free(stream);
+}
+
+// ==================== Indexing Received Packs ====================
+
+// Most of a received pack is small trees, commits and blobs, and hashing
+// those one at a time leaves sha1_hash_many()'s parallel lanes idle. So
+// small objects are kept in their loose form ("type size\0" + payload)
+// and hashed a batch at a time; bigger ones are hashed straight away
+// rather than copied.
+#define PACK_HASH_BATCH 16
+#define PACK_HASH_BATCH_MAX_SIZE (16 * 1024)
+
+typedef struct {
+    void *loose[PACK_HASH_BATCH];
+    size_t lens[PACK_HASH_BATCH];
+    gyatt_hash_t *out[PACK_HASH_BATCH];
+    size_t count;
+} hash_batch_t;
+
+static void hash_batch_flush(hash_batch_t *batch) {
+    gyatt_hash_t hashes[PACK_HASH_BATCH];
+    sha1_hash_many((const void *const *)batch->loose, batch->lens, batch->count, hashes);
+    for (size_t i = 0; i < batch->count; i++) {
+        *batch->out[i] = hashes[i];
+        free(batch->loose[i]);
+    }
+    batch->count = 0;
+}
+
+static void hash_batch_discard(hash_batch_t *batch) {
+    for (size_t i = 0; i < batch->count; i++) free(batch->loose[i]);
+    batch->count = 0;
+}
+
+// hash gets filled in by the time the batch is flushed
+static int hash_batch_add(hash_batch_t *batch, const void *data, size_t size, object_type_t type,
+                          gyatt_hash_t *hash) {
+    if (size > PACK_HASH_BATCH_MAX_SIZE) {
+        object_hash(data, size, type, hash);
+        return 0;
+    }
+
+    char header[64];
+    size_t header_len = object_format_header(type, size, header, sizeof(header));
+    unsigned char *loose = malloc(header_len + size);
+    if (!loose) return -1;
+    memcpy(loose, header, header_len);
+    if (size > 0) memcpy(loose + header_len, data, size);
+
+    batch->loose[batch->count] = loose;
+    batch->lens[batch->count] = header_len + size;
+    batch->out[batch->count] = hash;
+    if (++batch->count == PACK_HASH_BATCH) hash_batch_flush(batch);
+    return 0;
+}
+
+// The entry among the first count (in pack order, so by offset) that
+// starts at offset, or NULL if none does
+static const pack_object_t *pack_scan_find(const pack_object_t *objects, uint32_t count, uint64_t offset) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (objects[mid].offset == offset) return &objects[mid];
+        if (objects[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// Walk every entry of a mapped pack - inflating it and resolving deltas -
+// to learn each object's hash and offset, and that the pack is sound.
+// A delta must name an entry before it as its base, and no chain may be
+// longer than PACK_DELTA_MAX_DEPTH: a pushed pack of a million tiny
+// deltas on deltas would otherwise take quadratic time to resolve.
+static int pack_scan_entries(pack_t *pack, delta_cache_t *cache, pack_object_t *objects, hash_batch_t *batch) {
+    uint64_t offset = PACK_HEADER_SIZE;
+    uint64_t end = pack->data_size - HASH_SIZE;
+
+    for (uint32_t i = 0; i < pack->count; i++) {
+        pack_entry_t entry;
+        if (pack_entry_header(pack, offset, &entry) != 0) return -1;
+
+        int is_delta = entry.kind == PACK_OBJ_OFS_DELTA;
+        uint64_t consumed;
+        void *payload = pack_inflate_entry(pack, &entry, &consumed);
+        if (!payload) return -1;
+
+        object_type_t type = entry.type;
+        void *data = payload;
+        size_t size = entry.size;
+        objects[i].depth = 0;
+        if (is_delta) {
+            const pack_object_t *base_obj = pack_scan_find(objects, i, entry.base_offset);
+            if (!base_obj || base_obj->depth >= PACK_DELTA_MAX_DEPTH) {
+                if (base_obj) fprintf(stderr, "Error: Pack has delta chains deeper than %d\n", PACK_DELTA_MAX_DEPTH);
+                free(payload);
+                return -1;
+            }
+            objects[i].depth = base_obj->depth + 1;
+
+            // Bases always come earlier, so they've been checked already
+            // and usually sit in the cache
+            size_t base_size;
+            void *base = delta_cache_get(cache, pack, entry.base_offset, &type, &base_size);
+            if (!base) base = pack_unpack(cache, pack, entry.base_offset, &type, &base_size);
+            data = base ? delta_apply(base, base_size, payload, entry.delta_size, &size) : NULL;
+            free(base);
+            free(payload);
+            if (!data || size != entry.size) {
+                free(data);
+                return -1;
+            }
+        }
+
+        if (size >= PACK_DELTA_MIN_SIZE) delta_cache_put(cache, pack, offset, type, data, size);
+        int hashed = hash_batch_add(batch, data, size, type, &objects[i].hash);
+        objects[i].type = type;
+        objects[i].size = size;
+        objects[i].offset = offset;
+        free(data);
+        if (hashed != 0) return -1;
+
+        offset = entry.data_offset + consumed;
+        if (offset > end) return -1;
+    }
+
+    return offset == end ? 0 : -1;
+}
+
+static int pack_scan(pack_t *pack, delta_cache_t *cache, pack_object_t *objects) {
+    hash_batch_t batch = {0};
+    int result = pack_scan_entries(pack, cache, objects, &batch);
+    if (result == 0) hash_batch_flush(&batch);
+    else hash_batch_discard(&batch);
+    return result;
+}
+
+int pack_index(gyatt_repo_t *repo, const char *path, char *name_out, size_t name_size, size_t *count) {
+    char pack_dir[PATH_MAX];
+    if (!repo || !path || pack_dir_path(repo, pack_dir, sizeof(pack_dir)) != 0) return -1;
+
+    pack_t *pack = pack_alloc();
+    if (!pack) return -1;
+
+    pack->data = map_file(path, &pack->data_size, NULL);
+    if (!pack->data || pack->data_size < PACK_HEADER_SIZE + HASH_SIZE ||
+        memcmp(pack->data, PACK_SIGNATURE, 4) != 0 ||
+        read_u32(pack->data + 4) != PACK_VERSION) {
+        fprintf(stderr, "Error: Received data is not a pack\n");
+        pack_close(pack);
+        return -1;
+    }
+    pack->count = read_u32(pack->data + 8);
+
+    gyatt_hash_t pack_sum;
+    sha1_hash(pack->data, pack->data_size - HASH_SIZE, &pack_sum);
+    if (memcmp(pack_sum.hash, pack->data + pack->data_size - HASH_SIZE, HASH_SIZE) != 0) {
+        fprintf(stderr, "Error: Pack checksum mismatch\n");
+        pack_close(pack);
+        return -1;
+    }
+
+    // Every entry is at least a few bytes, which bounds a bogus count
+    pack_object_t *objects = pack->count <= pack->data_size ? malloc(((size_t)pack->count + 1) * sizeof(pack_object_t)) : NULL;
+    delta_cache_t *cache = delta_cache_create();
+    int result = objects && cache ? pack_scan(pack, cache, objects) : -1;
+    delta_cache_free(cache);
+    if (result != 0) fprintf(stderr, "Error: Received pack is corrupt\n");
+
+    // An idx can't hold the same hash twice
+    if (result == 0) {
+        qsort(objects, pack->count, sizeof(pack_object_t), pack_object_hash_compare);
+        for (uint32_t i = 1; i < pack->count && result == 0; i++) {
+            if (memcmp(objects[i - 1].hash.hash, objects[i].hash.hash, HASH_SIZE) == 0) result = -1;
+        }
+        if (result != 0) fprintf(stderr, "Error: Received pack has duplicate objects\n");
+    }
+
+    uint32_t object_count = pack->count;
+    pack_close(pack);
+
+    if (result == 0) {
+        result = pack_install(pack_dir, path, &pack_sum, objects, object_count, name_out, name_size);
+    }
+    free(objects);
+
+    // Make the new objects visible through this repo handle straight away;
+    // other threads may be reading from it, so the pack is added in place.
+    // The name comes from the checksum, since name_out is optional.
+    if (result == 0) {
+        char hex[HASH_HEX_SIZE];
+        char idx_path[PATH_MAX];
+        pack_t *added = NULL;
+        hash_to_hex(&pack_sum, hex);
+        if (snprintf(idx_path, sizeof(idx_path), "%s/pack-%s.idx", pack_dir, hex) < (int)sizeof(idx_path)) {
+            added = pack_open(idx_path);
+        }
+        if (added && pack_store_add(repo->packs, added) != 0) {
+            pack_close(added);
+            added = NULL;
+        }
+        if (!added) fprintf(stderr, "Warning: New pack won't be readable until the repository is reopened\n");
+        if (count) *count = object_count;
+    }
+    return result;
+}
@@ -0,0 +1,121 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "gyatt.h"
+#include "object.h"
+#include "buffer.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Packfiles: many objects in one file instead of one loose file each.
+//
+// pack-<sha>.pack   "PACK" | version u32 | count u32
+//                   count entries, each either
+//                     type u8 | size varint | zlib(payload)
+//                   or an offset delta against an earlier entry
+//                     6 u8 | size varint | distance varint |
+//                     delta size varint | zlib(delta)
+//                   or a loose object file copied in whole
+//                     7 u8 | type u8 | size varint |
+//                     zlib("type size\0" payload)
+//                   SHA-1 of everything above
+//                   The high nibble of an entry's first byte names the
+//                   codec that wrote its stream (compress_codec_t), so
+//                   "zlib" above may be zstd or raw; packs from before
+//                   codecs read as zlib. Copied loose objects leave it 0:
+//                   their stream names its own, as the file did.
+// pack-<sha>.idx    "GIDX" | version u32 | fanout[256] u32
+//                   count sorted hashes | count offsets u64
+//                   pack checksum | SHA-1 of everything above
+//
+// fanout[b] is the number of objects whose first hash byte is <= b, so a
+// lookup binary-searches only the slice of hashes sharing that byte.
+// "distance" is how far back (in bytes) the base entry starts; see delta.h
+// for the delta format itself.
+#define PACK_SIGNATURE "PACK"
+#define PACK_VERSION 1
+#define PACK_IDX_SIGNATURE "GIDX"
+#define PACK_IDX_VERSION 1
+#define PACK_OBJ_OFS_DELTA 6
+#define PACK_OBJ_LOOSE 7
+#define PACK_KIND_MASK 0x0f
+#define PACK_CODEC_SHIFT 4
+
+// How far back the writer looks for a delta base, and how long a chain of
+// deltas-on-deltas it allows before storing an object whole again
+#define PACK_DELTA_WINDOW 10
+#define PACK_DELTA_MAX_DEPTH 50
+
+typedef struct pack pack_t;
+typedef struct delta_cache delta_cache_t;
+
+// Every pack in a repository, mmapped once when the repo is opened, so
+// lookups are safe from any thread. Packs are only ever added (by
+// pack_index()), without stopping readers. The cache of resolved delta
+// bases has its own lock.
+typedef struct pack_store {
+    pack_t **_Atomic packs;
+    atomic_size_t count;
+    size_t capacity;
+    pthread_mutex_t add_lock;
+    pack_t ***retired;        // Outgrown arrays a reader may still hold
+    size_t retired_count;
+    delta_cache_t *cache;
+} pack_store_t;
+
+pack_store_t *pack_store_open(const gyatt_repo_t *repo);
+void pack_store_free(pack_store_t *store);
+
+// Lookups; has_object returns 0/1, the readers -1/NULL if no pack has it
+int pack_has_object(const pack_store_t *store, const gyatt_hash_t *hash);
+int pack_read_header(const pack_store_t *store, const gyatt_hash_t *hash,
+                     object_type_t *type, size_t *size);
+void *pack_read_object(const pack_store_t *store, const gyatt_hash_t *hash,
+                       object_type_t *type, size_t *size);
+
+// Call fn for every packed object; stops early if fn returns non-zero
+int pack_foreach(const pack_store_t *store, object_foreach_fn fn, void *arg);
+
+// Write the given objects (read through object_read, so from loose files or
+// existing packs) into a new pack + idx. name_out gets "pack-<sha>".
+// names (optional, parallel to hashes, entries may be NULL) are the paths
+// the objects were seen at; similar names are tried as delta bases first.
+// delta_count (optional) gets how many objects went in as deltas.
+int pack_write(gyatt_repo_t *repo, const gyatt_hash_t *hashes, const char *const *names,
+               size_t count, char *name_out, size_t name_size, size_t *delta_count);
+
+// The same pack format produced a slice at a time into memory, for
+// sending over the wire. Each pack_stream_next() appends whole entries
+// (roughly budget bytes' worth) to out; it returns 1 while there's more,
+// 0 once the trailer has gone out, -1 on error.
+typedef struct pack_stream pack_stream_t;
+
+pack_stream_t *pack_stream_create(gyatt_repo_t *repo, const gyatt_hash_t *hashes, size_t count);
+int pack_stream_next(pack_stream_t *stream, buffer_t *out, size_t budget);
+// Reuse mode: objects go out compressed the way they're stored - whole
+// packed entries byte for byte, loose files as PACK_OBJ_LOOSE - and only
+// deltas are re-encoded. Stored data of PACK_RAW_MIN bytes or more isn't
+// even copied when fn is set: everything before it is flushed to out,
+// then fn gets the file range (fd is only borrowed) and returns the buffer
+// to carry on appending to. In that case no trailer is written; the
+// receiver computes it over what it got.
+#define PACK_RAW_MIN (64 * 1024)
+
+typedef buffer_t *(*pack_raw_fn)(void *arg, buffer_t *out, int fd, uint64_t offset, size_t length);
+void pack_stream_reuse(pack_stream_t *stream, pack_raw_fn fn, void *arg);
+
+size_t pack_stream_count(const pack_stream_t *stream);   // Objects, after de-duplication
+size_t pack_stream_deltas(const pack_stream_t *stream);  // How many went out as deltas so far
+void pack_stream_free(pack_stream_t *stream);
+
+// A temp file in objects/pack for a pack arriving from elsewhere; the fd
+// is open for writing and path gets its name
+int pack_tmp_create(const gyatt_repo_t *repo, char *path, size_t path_size);
+
+// Verify a pack written to a temp file (checksum, and every object
+// inflated and hashed), build its idx and move both into place. The pack
+// joins repo->packs so the objects are readable right away, even from
+// threads already using it. name_out (optional) gets "pack-<sha>".
+int pack_index(gyatt_repo_t *repo, const char *path, char *name_out, size_t name_size, size_t *count);
+
+#endif // PACK_H
@@ -0,0 +1,166 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define POOL_QUEUE_PER_THREAD 64
+
+typedef struct {
+    pool_task_fn fn;
+    void *arg;
+} pool_task_t;
+
+struct pool {
+    pthread_t *threads;
+    int thread_count;
+
+    pool_task_t *queue;       // Ring buffer
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+    size_t pending;           // Queued + running
+    int shutting_down;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+};
+
+static void *pool_worker(void *arg) {
+    pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->count == 0 && !pool->shutting_down) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        if (pool->count == 0 && pool->shutting_down) break;
+
+        pool_task_t task = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+pool_t *pool_create(int threads) {
+    pool_t *pool = calloc(1, sizeof(pool_t));
+    if (!pool) return NULL;
+
+    if (threads <= 1) {
+        // Inline pool: no threads, no queue
+        pool->thread_count = 0;
+        return pool;
+    }
+
+    pool->capacity = (size_t)threads * POOL_QUEUE_PER_THREAD;
+    pool->queue = malloc(pool->capacity * sizeof(pool_task_t));
+    pool->threads = malloc((size_t)threads * sizeof(pthread_t));
+    if (!pool->queue || !pool->threads) {
+        free(pool->queue);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+            break;  // Run with however many we got
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        // Couldn't start any threads; fall back to running inline
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->not_empty);
+        pthread_cond_destroy(&pool->not_full);
+        pthread_cond_destroy(&pool->idle);
+        free(pool->queue);
+        free(pool->threads);
+        pool->queue = NULL;
+        pool->threads = NULL;
+    }
+
+    return pool;
+}
+
+int pool_submit(pool_t *pool, pool_task_fn fn, void *arg) {
+    if (!pool || !fn) return -1;
+
+    if (pool->thread_count == 0) {
+        fn(arg);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == pool->capacity) {
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+    }
+
+    size_t tail = (pool->head + pool->count) % pool->capacity;
+    pool->queue[tail].fn = fn;
+    pool->queue[tail].arg = arg;
+    pool->count++;
+    pool->pending++;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void pool_wait(pool_t *pool) {
+    if (!pool || pool->thread_count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_thread_count(const pool_t *pool) {
+    if (!pool) return 0;
+    return pool->thread_count > 0 ? pool->thread_count : 1;
+}
+
+void pool_free(pool_t *pool) {
+    if (!pool) return;
+
+    if (pool->thread_count > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutting_down = 1;
+        pthread_cond_broadcast(&pool->not_empty);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->thread_count; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->not_empty);
+        pthread_cond_destroy(&pool->not_full);
+        pthread_cond_destroy(&pool->idle);
+    }
+
+    free(pool->queue);
+    free(pool->threads);
+    free(pool);
+}
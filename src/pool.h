@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Fixed-size worker pool with a bounded task queue. Submitting blocks when
+// the queue is full, so a fast producer can't run away from the workers.
+typedef void (*pool_task_fn)(void *arg);
+
+typedef struct pool pool_t;
+
+// threads <= 1 gives an inline pool that runs each task inside pool_submit()
+pool_t *pool_create(int threads);
+void pool_free(pool_t *pool);  // Waits for queued tasks, then joins
+
+int pool_submit(pool_t *pool, pool_task_fn fn, void *arg);
+void pool_wait(pool_t *pool);  // Block until every submitted task has run
+
+int pool_thread_count(const pool_t *pool);
+
+#endif // POOL_H
@@ -0,0 +1,14 @@
+#include "protocol.h"
+
+void proto_frame_header(unsigned char header[PROTO_FRAME_HEADER], int type, uint32_t length) {
+    header[0] = (unsigned char)type;
+    header[1] = (unsigned char)(length >> 24);
+    header[2] = (unsigned char)(length >> 16);
+    header[3] = (unsigned char)(length >> 8);
+    header[4] = (unsigned char)length;
+}
+
+uint32_t proto_frame_length(const unsigned char header[PROTO_FRAME_HEADER]) {
+    return ((uint32_t)header[1] << 24) | ((uint32_t)header[2] << 16) |
+           ((uint32_t)header[3] << 8) | (uint32_t)header[4];
+}
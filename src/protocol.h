@@ -0,0 +1,81 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Protocol v2. A connection starts out on the line protocol (v1); the
+// client asks for "PROTOCOL 2\n", and once the server answers
+// "OK PROTOCOL 2[ capability...]\n" both sides speak in frames:
+//
+//   type u8 | payload length u32 (big-endian) | payload
+//
+// Client -> server
+//   W  WANT   n * 20-byte hashes the client is asking for
+//   H  HAVE   n * 20-byte hashes the client already has
+//   D  DONE   end of a batch: answer everything wanted so far; an
+//             optional flags byte asks for PROTO_DONE_* options
+//   L  LIST-REFS
+//   K  PUSH   the next slice of a pack the client is pushing
+//   U  UPDATE "<old hex> <new hex> <branch>": move a branch once the
+//             pushed pack is in, if it still holds old (zeros: create)
+//   F  FINISH end of a push: store the pack, then apply the updates
+//   Q  QUIT
+//
+// Server -> client
+//   M  MISSING  wanted hashes the server doesn't have (optional)
+//   P  PACK     the next slice of one pack holding every wanted object
+//               the client doesn't have (omitted if that's nothing)
+//   R  REFS     reply to L: "<hex> <branch>\n" for every branch
+//   S  STATUS   one per UPDATE, in order: "ok <branch>" or
+//               "ng <branch> <reason>"
+//   E  END      batch (or push) complete
+//   X  ERROR    message; the server hangs up after it
+//
+// A DONE with PROTO_DONE_CLOSURE treats the wants as tips: the pack then
+// holds everything they reach that the haves don't (see reach.h), so a
+// pull only needs the remote's branch and its own.
+//
+// WANT and HAVE frames can be sent back to back without waiting for
+// anything, so a whole fetch is one round trip however many objects it
+// covers.
+//
+// Capabilities
+//   compressed  DONE can set PROTO_DONE_COMPRESSED: the pack then comes
+//               straight from storage (see pack_stream_reuse() in
+//               pack.h), so it may hold PACK_OBJ_LOOSE entries and has no
+//               trailer - the client appends the SHA-1 of what it got.
+#define PROTO_VERSION 2
+#define PROTO_FRAME_HEADER 5
+
+#define PROTO_WANT    'W'
+#define PROTO_HAVE    'H'
+#define PROTO_DONE    'D'
+#define PROTO_QUIT    'Q'
+#define PROTO_MISSING 'M'
+#define PROTO_PACK    'P'
+#define PROTO_END     'E'
+#define PROTO_ERROR   'X'
+#define PROTO_LIST_REFS 'L'
+#define PROTO_REFS    'R'
+#define PROTO_PUSH    'K'
+#define PROTO_UPDATE  'U'
+#define PROTO_FINISH  'F'
+#define PROTO_STATUS  'S'
+
+#define PROTO_CAP_COMPRESSED "compressed"
+#define PROTO_DONE_COMPRESSED 0x01
+#define PROTO_DONE_CLOSURE    0x02
+
+// Most branch updates one push can carry
+#define PROTO_MAX_UPDATES 1024
+
+// Hashes per WANT/HAVE frame a client sends, and the biggest PUSH frame;
+// small enough to fit any sane server buffer
+#define PROTO_HASHES_PER_FRAME 2048
+#define PROTO_PUSH_FRAME (32 * 1024)
+
+void proto_frame_header(unsigned char header[PROTO_FRAME_HEADER], int type, uint32_t length);
+uint32_t proto_frame_length(const unsigned char header[PROTO_FRAME_HEADER]);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,265 @@
+#include "reach.h"
+#include "object.h"
+#include "hash.h"
+#include "commit_graph.h"
+#include "chunk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Open-addressed set of hashes; they're uniformly random already, so the
+// first bytes make a fine bucket index
+typedef struct {
+    gyatt_hash_t *slots;
+    unsigned char *used;
+    size_t capacity;         // Power of two
+    size_t count;
+} hash_set_t;
+
+typedef struct {
+    gyatt_repo_t *repo;
+    hash_set_t seen;         // Everything sent, or known to be on the other side
+    gyatt_hash_t *out;
+    size_t count;
+    size_t capacity;
+} reach_t;
+
+static size_t bucket(const hash_set_t *set, const gyatt_hash_t *hash) {
+    uint64_t v;
+    memcpy(&v, hash->hash, sizeof(v));
+    return (size_t)v & (set->capacity - 1);
+}
+
+static int set_grow(hash_set_t *set) {
+    hash_set_t grown = { NULL, NULL, set->capacity ? set->capacity * 2 : 1024, 0 };
+    grown.slots = malloc(grown.capacity * sizeof(gyatt_hash_t));
+    grown.used = calloc(grown.capacity, 1);
+    if (!grown.slots || !grown.used) {
+        free(grown.slots);
+        free(grown.used);
+        return -1;
+    }
+
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (!set->used[i]) continue;
+        size_t b = bucket(&grown, &set->slots[i]);
+        while (grown.used[b]) b = (b + 1) & (grown.capacity - 1);
+        grown.slots[b] = set->slots[i];
+        grown.used[b] = 1;
+        grown.count++;
+    }
+
+    free(set->slots);
+    free(set->used);
+    *set = grown;
+    return 0;
+}
+
+// 1 if it was already there, 0 if just added, -1 if out of memory
+static int set_add(hash_set_t *set, const gyatt_hash_t *hash) {
+    if ((set->count + 1) * 2 > set->capacity && set_grow(set) != 0) return -1;
+
+    size_t b = bucket(set, hash);
+    while (set->used[b]) {
+        if (memcmp(set->slots[b].hash, hash->hash, HASH_SIZE) == 0) return 1;
+        b = (b + 1) & (set->capacity - 1);
+    }
+    set->slots[b] = *hash;
+    set->used[b] = 1;
+    set->count++;
+    return 0;
+}
+
+static int set_has(const hash_set_t *set, const gyatt_hash_t *hash) {
+    if (set->count == 0) return 0;
+    size_t b = bucket(set, hash);
+    while (set->used[b]) {
+        if (memcmp(set->slots[b].hash, hash->hash, HASH_SIZE) == 0) return 1;
+        b = (b + 1) & (set->capacity - 1);
+    }
+    return 0;
+}
+
+static void set_free(hash_set_t *set) {
+    free(set->slots);
+    free(set->used);
+}
+
+// Queue an object unless it's been seen; 1 if it was new
+static int emit(reach_t *r, const gyatt_hash_t *hash) {
+    int seen = set_add(&r->seen, hash);
+    if (seen != 0) return seen < 0 ? -1 : 0;
+
+    if (r->count >= r->capacity) {
+        size_t new_capacity = r->capacity == 0 ? 1024 : r->capacity * 2;
+        gyatt_hash_t *grown = realloc(r->out, new_capacity * sizeof(gyatt_hash_t));
+        if (!grown) return -1;
+        r->out = grown;
+        r->capacity = new_capacity;
+    }
+    r->out[r->count++] = *hash;
+    return 1;
+}
+
+typedef struct {
+    reach_t *r;
+    hash_set_t old;          // The chunks the file had in the parent
+} chunk_walk_t;
+
+static int add_old_chunk(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)size;
+    return set_add(&((chunk_walk_t *)arg)->old, hash) < 0 ? -1 : 0;
+}
+
+static int emit_new_chunk(const gyatt_hash_t *hash, uint32_t size, void *arg) {
+    (void)size;
+    chunk_walk_t *walk = arg;
+    if (set_has(&walk->old, hash)) return 0;
+    return emit(walk->r, hash) < 0 ? -1 : 0;
+}
+
+// A chunked file needs its chunks too, but only the ones the version in
+// the parent didn't have: an edit in the middle of a big file sends a
+// chunk or two. The parent's chunks are skipped by way of their own set,
+// not r->seen: the parent may still be on its way over, and then its walk
+// has to send them. (The chunks sent here go through emit() and so into
+// r->seen like anything else.)
+static int emit_chunks(reach_t *r, const gyatt_hash_t *hash, const gyatt_hash_t *old_hash) {
+    object_type_t type;
+    size_t size;
+    if (object_read_header(r->repo, hash, &type, &size) != 0 || type != OBJ_CHUNKED) return 0;
+
+    void *list = object_read(r->repo, hash, &type, &size);
+    if (!list) return -1;
+
+    chunk_walk_t walk = { r, {0} };
+    int result = 0;
+    size_t old_size;
+    void *old = old_hash ? object_read(r->repo, old_hash, &type, &old_size) : NULL;
+    if (old && type == OBJ_CHUNKED) result = chunk_list_foreach(old, old_size, add_old_chunk, &walk);
+    free(old);
+
+    if (result == 0) result = chunk_list_foreach(list, size, emit_new_chunk, &walk);
+    if (result != 0) {
+        char hex[HASH_HEX_SIZE];
+        hash_to_hex(hash, hex);
+        fprintf(stderr, "Error: Could not read chunk list %s\n", hex);
+    }
+    set_free(&walk.old);
+    free(list);
+    return result;
+}
+
+// Send tree and whatever under it isn't the same in old (NULL: nothing to
+// compare against). Entries equal to old's were in the parent commit.
+static int emit_tree(reach_t *r, const gyatt_hash_t *hash, const gyatt_hash_t *old_hash) {
+    if (old_hash && hash_compare(hash, old_hash) == 0) return 0;
+
+    int fresh = emit(r, hash);
+    if (fresh <= 0) return fresh;
+
+    tree_object_t *tree = tree_read(r->repo, hash);
+    tree_object_t *old = old_hash ? tree_read(r->repo, old_hash) : NULL;
+    if (!tree || (old_hash && !old)) {
+        char hex[HASH_HEX_SIZE];
+        hash_to_hex(tree ? old_hash : hash, hex);
+        fprintf(stderr, "Error: Could not read tree %s\n", hex);
+        tree_free(tree);
+        tree_free(old);
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < tree->entry_count && result >= 0; i++) {
+        tree_entry_t *entry = &tree->entries[i];
+        tree_entry_t *before = old ? tree_find_entry(old, entry->name) : NULL;
+        if (before && hash_compare(&before->hash, &entry->hash) == 0) continue;
+
+        if (entry->type == OBJ_TREE) {
+            int same_kind = before && before->type == OBJ_TREE;
+            result = emit_tree(r, &entry->hash, same_kind ? &before->hash : NULL);
+        } else {
+            result = emit(r, &entry->hash);
+            if (result > 0) result = emit_chunks(r, &entry->hash, before ? &before->hash : NULL);
+        }
+    }
+
+    tree_free(tree);
+    tree_free(old);
+    return result < 0 ? -1 : 0;
+}
+
+int reach_missing(gyatt_repo_t *repo, const gyatt_hash_t *tips, size_t tip_count,
+                  const gyatt_hash_t *haves, size_t have_count,
+                  gyatt_hash_t **out, size_t *out_count) {
+    if (!repo || !out || !out_count) return -1;
+
+    reach_t r;
+    memset(&r, 0, sizeof(r));
+    r.repo = repo;
+
+    // Where each tip's history joins what the other side has. A have that
+    // is a descendant of a tip makes the tip itself the boundary.
+    hash_set_t bases = {0};
+    int result = 0;
+    for (size_t h = 0; h < have_count && result == 0; h++) {
+        commit_info_t info;
+        if (commit_info_get(repo, &haves[h], &info) != 0) continue;
+
+        for (size_t t = 0; t < tip_count && result == 0; t++) {
+            gyatt_hash_t base;
+            int ret = commit_merge_base(repo, &tips[t], &haves[h], &base);
+            if (ret < 0) result = -1;
+            else if (ret == 0 && set_add(&bases, &base) < 0) result = -1;
+        }
+    }
+
+    for (size_t t = 0; t < tip_count && result == 0; t++) {
+        gyatt_hash_t hash = tips[t];
+        while (!set_has(&bases, &hash)) {
+            commit_info_t info;
+            if (commit_info_get(repo, &hash, &info) != 0) {
+                char hex[HASH_HEX_SIZE];
+                hash_to_hex(&hash, hex);
+                fprintf(stderr, "Error: Could not read commit %s\n", hex);
+                result = -1;
+                break;
+            }
+
+            // Another tip's walk already came through here
+            int fresh = emit(&r, &hash);
+            if (fresh <= 0) {
+                if (fresh < 0) result = -1;
+                break;
+            }
+
+            gyatt_hash_t parent_tree;
+            commit_info_t parent;
+            int has_parent_tree = info.has_parent && commit_info_get(repo, &info.parent, &parent) == 0;
+            if (has_parent_tree) parent_tree = parent.tree;
+            if (info.has_parent && !has_parent_tree) {
+                fprintf(stderr, "Error: History is incomplete\n");
+                result = -1;
+                break;
+            }
+
+            if (emit_tree(&r, &info.tree, has_parent_tree ? &parent_tree : NULL) != 0) {
+                result = -1;
+                break;
+            }
+            if (!info.has_parent) break;
+            hash = info.parent;
+        }
+    }
+
+    set_free(&bases);
+    set_free(&r.seen);
+    if (result != 0) {
+        free(r.out);
+        return -1;
+    }
+    *out = r.out;
+    *out_count = r.count;
+    return 0;
+}
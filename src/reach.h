@@ -0,0 +1,21 @@
+#ifndef REACH_H
+#define REACH_H
+
+#include "gyatt.h"
+
+// Reachability for push and pull: the objects one side has to send so the
+// other ends up with everything the tips reach.
+//
+// The other side is assumed to hold each of its haves along with all of
+// its history (which is what only moving refs after a complete transfer
+// guarantees). History is walked from each tip down to where it meets a
+// have, and each commit's tree is only descended where it differs from
+// its parent's, so the cost follows what changed, not the repository size.
+// Haves this side doesn't know are ignored.
+
+// out gets a malloc'd list of commits, trees and blobs, without duplicates
+int reach_missing(gyatt_repo_t *repo, const gyatt_hash_t *tips, size_t tip_count,
+                  const gyatt_hash_t *haves, size_t have_count,
+                  gyatt_hash_t **out, size_t *out_count);
+
+#endif // REACH_H
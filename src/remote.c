@@ -0,0 +1,548 @@
+#include "remote.h"
+#include "protocol.h"
+#include "buffer.h"
+#include "pack.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// Batched frames go out once this much has piled up
+#define REMOTE_SEND_CHUNK (64 * 1024)
+
+int parse_remote_url(const char *url, char *hostname, int *port) {
+    char *colon = strchr(url, ':');
+    if (colon) {
+        size_t len = colon - url;
+        if (len >= 256) return -1;
+        memcpy(hostname, url, len);
+        hostname[len] = '\0';
+        *port = atoi(colon + 1);
+    } else {
+        strncpy(hostname, url, 255);
+        hostname[255] = '\0';
+        *port = 9418;
+    }
+    return 0;
+}
+
+int connect_to_server(const char *hostname, int port) {
+    int sock;
+    struct sockaddr_in server_addr;
+    
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    
+    if (inet_pton(AF_INET, hostname, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Error: Invalid address\n");
+        close(sock);
+        return -1;
+    }
+    
+    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Connection failed");
+        close(sock);
+        return -1;
+    }
+    
+    return sock;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Refill the read-ahead buffer; -1 on error or if the server hung up
+static int remote_fill(remote_t *remote) {
+    remote->buf_pos = 0;
+    remote->buf_len = 0;
+    for (;;) {
+        ssize_t n = recv(remote->fd, remote->buf, sizeof(remote->buf), 0);
+        if (n > 0) {
+            remote->buf_len = (size_t)n;
+            return 0;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        return -1;
+    }
+}
+
+static int remote_read(remote_t *remote, void *out, size_t len) {
+    unsigned char *p = out;
+    while (len > 0) {
+        if (remote->buf_pos == remote->buf_len && remote_fill(remote) != 0) return -1;
+        size_t n = remote->buf_len - remote->buf_pos;
+        if (n > len) n = len;
+        memcpy(p, remote->buf + remote->buf_pos, n);
+        remote->buf_pos += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// One '\n'-terminated line, without the newline. Overlong lines are cut
+// short (the rest is still consumed).
+static int remote_read_line(remote_t *remote, char *out, size_t out_size) {
+    size_t len = 0;
+    for (;;) {
+        if (remote->buf_pos == remote->buf_len && remote_fill(remote) != 0) return -1;
+        char c = (char)remote->buf[remote->buf_pos++];
+        if (c == '\n') break;
+        if (len + 1 < out_size) out[len++] = c;
+    }
+    if (len > 0 && out[len - 1] == '\r') len--;
+    out[len] = '\0';
+    return 0;
+}
+
+int remote_command(remote_t *remote, const char *cmd, char *response, size_t response_size) {
+    if (send_all(remote->fd, cmd, strlen(cmd)) != 0) return -1;
+    return remote_read_line(remote, response, response_size);
+}
+
+remote_t *remote_open(const char *url) {
+    char hostname[256];
+    int port;
+    if (parse_remote_url(url, hostname, &port) != 0) {
+        fprintf(stderr, "Error: Invalid remote URL\n");
+        return NULL;
+    }
+
+    remote_t *remote = calloc(1, sizeof(remote_t));
+    if (!remote) return NULL;
+
+    remote->fd = connect_to_server(hostname, port);
+    if (remote->fd < 0) {
+        free(remote);
+        return NULL;
+    }
+
+    if (remote_read_line(remote, remote->banner, sizeof(remote->banner)) != 0 ||
+        strncmp(remote->banner, "GYATT-SERVER", 12) != 0) {
+        fprintf(stderr, "Error: %s:%d is not a gyatt server\n", hostname, port);
+        close(remote->fd);
+        free(remote);
+        return NULL;
+    }
+
+    // Older servers answer "ERROR Unknown command" and stay on v1
+    char response[256];
+    char request[32];
+    snprintf(request, sizeof(request), "PROTOCOL %d\n", PROTO_VERSION);
+    if (remote_command(remote, request, response, sizeof(response)) != 0) {
+        fprintf(stderr, "Error: Handshake failed\n");
+        close(remote->fd);
+        free(remote);
+        return NULL;
+    }
+    // Anything after the version is a list of capabilities
+    if (strncmp(response, "OK PROTOCOL 2", 13) == 0 && (response[13] == '\0' || response[13] == ' ')) {
+        remote->version = 2;
+        for (char *cap = strtok(response + 13, " "); cap; cap = strtok(NULL, " ")) {
+            if (strcmp(cap, PROTO_CAP_COMPRESSED) == 0) remote->compressed = 1;
+        }
+    } else {
+        remote->version = 1;
+    }
+
+    return remote;
+}
+
+void remote_close(remote_t *remote) {
+    if (!remote) return;
+
+    if (remote->version >= 2) {
+        unsigned char header[PROTO_FRAME_HEADER];
+        proto_frame_header(header, PROTO_QUIT, 0);
+        send_all(remote->fd, header, sizeof(header));
+    } else {
+        char response[64];
+        remote_command(remote, "QUIT\n", response, sizeof(response));
+    }
+
+    close(remote->fd);
+    free(remote);
+}
+
+static void append_frame(buffer_t *out, int type, const void *payload, size_t len) {
+    unsigned char header[PROTO_FRAME_HEADER];
+    proto_frame_header(header, type, (uint32_t)len);
+    buffer_append(out, header, sizeof(header));
+    if (len > 0) buffer_append(out, payload, len);
+}
+
+// Queue hashes as frames of type, sending whenever enough has piled up
+static int send_hashes(remote_t *remote, buffer_t *out, int type,
+                       const gyatt_hash_t *hashes, size_t count) {
+    for (size_t i = 0; i < count; i += PROTO_HASHES_PER_FRAME) {
+        size_t n = count - i < PROTO_HASHES_PER_FRAME ? count - i : PROTO_HASHES_PER_FRAME;
+        append_frame(out, type, hashes + i, n * HASH_SIZE);
+
+        if (out->len >= REMOTE_SEND_CHUNK) {
+            if (send_all(remote->fd, out->data, out->len) != 0) return -1;
+            buffer_clear(out);
+        }
+    }
+    return 0;
+}
+
+// Copy a PACK frame's payload from the socket into the temp pack, and
+// into the running checksum if there is one
+static int receive_pack_slice(remote_t *remote, int fd, uint32_t len, sha1_ctx_t *sha) {
+    while (len > 0) {
+        if (remote->buf_pos == remote->buf_len && remote_fill(remote) != 0) return -1;
+        size_t n = remote->buf_len - remote->buf_pos;
+        if (n > len) n = len;
+
+        const unsigned char *p = remote->buf + remote->buf_pos;
+        if (sha) sha1_update(sha, p, n);
+        size_t left = n;
+        while (left > 0) {
+            ssize_t w = write(fd, p, left);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            p += w;
+            left -= (size_t)w;
+        }
+
+        remote->buf_pos += n;
+        len -= (uint32_t)n;
+    }
+    return 0;
+}
+
+int remote_fetch(gyatt_repo_t *repo, remote_t *remote,
+                 const gyatt_hash_t *wants, size_t want_count,
+                 const gyatt_hash_t *haves, size_t have_count,
+                 int closure, remote_fetch_stats_t *stats) {
+    if (!repo || !remote) return -1;
+    if (remote->version < 2) {
+        fprintf(stderr, "Error: Server doesn't speak protocol v2\n");
+        return -1;
+    }
+
+    remote_fetch_stats_t local = {0};
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    // The whole request goes out before anything is read back
+    buffer_t *out = buffer_create(REMOTE_SEND_CHUNK + PROTO_HASHES_PER_FRAME * HASH_SIZE + 64);
+    if (!out) return -1;
+    int result = send_hashes(remote, out, PROTO_WANT, wants, want_count);
+    if (result == 0) result = send_hashes(remote, out, PROTO_HAVE, haves, have_count);
+    // Packs sent as stored skip the server's recompression (and, with
+    // sendfile, its copies), so ask for that whenever it's on offer
+    unsigned char flags = (remote->compressed ? PROTO_DONE_COMPRESSED : 0) | (closure ? PROTO_DONE_CLOSURE : 0);
+    if (result == 0) {
+        append_frame(out, PROTO_DONE, &flags, flags ? 1 : 0);
+        result = send_all(remote->fd, out->data, out->len);
+    }
+    buffer_free(out);
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to send request\n");
+        return -1;
+    }
+
+    char tmp_path[PATH_MAX];
+    int pack_fd = -1;
+    sha1_ctx_t sha;
+    sha1_init(&sha);
+
+    while (result == 0) {
+        unsigned char header[PROTO_FRAME_HEADER];
+        if (remote_read(remote, header, sizeof(header)) != 0) {
+            fprintf(stderr, "Error: Connection lost during fetch\n");
+            result = -1;
+            break;
+        }
+        uint32_t len = proto_frame_length(header);
+
+        if (header[0] == PROTO_END) {
+            break;
+        } else if (header[0] == PROTO_PACK) {
+            if (pack_fd < 0) pack_fd = pack_tmp_create(repo, tmp_path, sizeof(tmp_path));
+            if (pack_fd < 0 || receive_pack_slice(remote, pack_fd, len, remote->compressed ? &sha : NULL) != 0) {
+                fprintf(stderr, "Error: Failed to receive pack\n");
+                result = -1;
+            }
+            stats->bytes += len;
+        } else if (header[0] == PROTO_MISSING && len % HASH_SIZE == 0) {
+            for (uint32_t i = 0; i < len / HASH_SIZE && result == 0; i++) {
+                gyatt_hash_t hash;
+                char hex[HASH_HEX_SIZE];
+                result = remote_read(remote, hash.hash, HASH_SIZE);
+                hash_to_hex(&hash, hex);
+                fprintf(stderr, "Warning: Remote doesn't have %s\n", hex);
+            }
+            stats->missing += len / HASH_SIZE;
+        } else if (header[0] == PROTO_ERROR && len < 1024) {
+            char message[1024];
+            if (remote_read(remote, message, len) == 0) {
+                message[len] = '\0';
+                fprintf(stderr, "Error: Remote: %s\n", message);
+            }
+            result = -1;
+        } else {
+            fprintf(stderr, "Error: Unexpected reply from remote\n");
+            result = -1;
+        }
+    }
+
+    // A pack sent as stored comes without its trailer
+    if (pack_fd >= 0 && result == 0 && remote->compressed) {
+        gyatt_hash_t pack_sum;
+        sha1_final(&sha, pack_sum.hash);
+        if (write(pack_fd, pack_sum.hash, HASH_SIZE) != HASH_SIZE) result = -1;
+    }
+    if (pack_fd >= 0 && close(pack_fd) != 0) result = -1;
+    if (pack_fd >= 0 && result == 0) {
+        char name[64];
+        result = pack_index(repo, tmp_path, name, sizeof(name), &stats->objects);
+    }
+    if (pack_fd >= 0 && result != 0) unlink(tmp_path);
+
+    return result;
+}
+
+// Read a frame that's expected to be small and whole: type, and the
+// payload NUL-terminated into a malloc'd buffer. An ERROR is reported and
+// turned into -1.
+static int read_small_frame(remote_t *remote, int *type, char **payload, uint32_t *len) {
+    unsigned char header[PROTO_FRAME_HEADER];
+    if (remote_read(remote, header, sizeof(header)) != 0) {
+        fprintf(stderr, "Error: Connection lost\n");
+        return -1;
+    }
+    *len = proto_frame_length(header);
+    *type = header[0];
+    if (*len > 64 * 1024 * 1024) {
+        fprintf(stderr, "Error: Unexpected reply from remote\n");
+        return -1;
+    }
+
+    *payload = malloc((size_t)*len + 1);
+    if (!*payload || remote_read(remote, *payload, *len) != 0) {
+        free(*payload);
+        return -1;
+    }
+    (*payload)[*len] = '\0';
+
+    if (*type == PROTO_ERROR) {
+        fprintf(stderr, "Error: Remote: %s\n", *payload);
+        free(*payload);
+        return -1;
+    }
+    return 0;
+}
+
+// "<hex> <branch>" lines, from either protocol
+static int parse_ref_line(char *line, remote_ref_t *ref) {
+    char *space = strchr(line, ' ');
+    if (!space || space - line != HASH_HEX_SIZE - 1 || strlen(space + 1) >= sizeof(ref->name) || !space[1]) {
+        return -1;
+    }
+    *space = '\0';
+    hex_to_hash(line, &ref->hash);
+    strcpy(ref->name, space + 1);
+    return 0;
+}
+
+static int add_ref(remote_ref_t **refs, size_t *count, size_t *capacity, char *line) {
+    if (*count >= *capacity) {
+        size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        remote_ref_t *grown = realloc(*refs, new_capacity * sizeof(remote_ref_t));
+        if (!grown) return -1;
+        *refs = grown;
+        *capacity = new_capacity;
+    }
+    if (parse_ref_line(line, &(*refs)[*count]) == 0) (*count)++;
+    return 0;
+}
+
+int remote_list_refs(remote_t *remote, remote_ref_t **refs, size_t *count) {
+    if (!remote || !refs || !count) return -1;
+    *refs = NULL;
+    *count = 0;
+    size_t capacity = 0;
+
+    if (remote->version < 2) {
+        char line[512];
+        if (remote_command(remote, "LIST-REFS\n", line, sizeof(line)) != 0 || strcmp(line, "OK REFS") != 0) {
+            fprintf(stderr, "Error: Remote can't list refs\n");
+            return -1;
+        }
+        while (remote_read_line(remote, line, sizeof(line)) == 0) {
+            if (strcmp(line, "END") == 0) return 0;
+            if (add_ref(refs, count, &capacity, line) != 0) break;
+        }
+        free(*refs);
+        *refs = NULL;
+        return -1;
+    }
+
+    unsigned char header[PROTO_FRAME_HEADER];
+    proto_frame_header(header, PROTO_LIST_REFS, 0);
+    if (send_all(remote->fd, header, sizeof(header)) != 0) return -1;
+
+    int type;
+    char *payload;
+    uint32_t len;
+    if (read_small_frame(remote, &type, &payload, &len) != 0) return -1;
+    if (type != PROTO_REFS) {
+        fprintf(stderr, "Error: Unexpected reply from remote\n");
+        free(payload);
+        return -1;
+    }
+
+    int result = 0;
+    for (char *line = strtok(payload, "\n"); line && result == 0; line = strtok(NULL, "\n")) {
+        result = add_ref(refs, count, &capacity, line);
+    }
+    free(payload);
+    if (result != 0) {
+        free(*refs);
+        *refs = NULL;
+    }
+    return result;
+}
+
+const remote_ref_t *remote_find_ref(const remote_ref_t *refs, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(refs[i].name, name) == 0) return &refs[i];
+    }
+    return NULL;
+}
+
+// Stream the pack in PUSH frames as it's produced; it's never held whole
+static int send_push_pack(gyatt_repo_t *repo, remote_t *remote, const gyatt_hash_t *objects,
+                          size_t object_count, remote_push_stats_t *stats) {
+    pack_stream_t *stream = pack_stream_create(repo, objects, object_count);
+    buffer_t *slice = buffer_create(PROTO_PUSH_FRAME * 2);
+    buffer_t *frames = buffer_create(PROTO_PUSH_FRAME * 2 + 64);
+    if (!stream || !slice || !frames) {
+        pack_stream_free(stream);
+        buffer_free(slice);
+        buffer_free(frames);
+        return -1;
+    }
+
+    // What's already compressed on disk goes out as is
+    pack_stream_reuse(stream, NULL, NULL);
+    stats->objects = pack_stream_count(stream);
+
+    int ret = 1;
+    while (ret == 1) {
+        buffer_clear(slice);
+        ret = pack_stream_next(stream, slice, PROTO_PUSH_FRAME);
+        for (size_t pos = 0; ret >= 0 && pos < slice->len; pos += PROTO_PUSH_FRAME) {
+            size_t n = slice->len - pos < PROTO_PUSH_FRAME ? slice->len - pos : PROTO_PUSH_FRAME;
+            buffer_clear(frames);
+            append_frame(frames, PROTO_PUSH, slice->data + pos, n);
+            if (send_all(remote->fd, frames->data, frames->len) != 0) ret = -1;
+            stats->bytes += n;
+        }
+    }
+
+    pack_stream_free(stream);
+    buffer_free(slice);
+    buffer_free(frames);
+    return ret == 0 ? 0 : -1;
+}
+
+int remote_push(gyatt_repo_t *repo, remote_t *remote,
+                const gyatt_hash_t *objects, size_t object_count,
+                remote_update_t *updates, size_t update_count,
+                remote_push_stats_t *stats) {
+    if (!repo || !remote) return -1;
+    if (remote->version < 2) {
+        fprintf(stderr, "Error: Server doesn't speak protocol v2\n");
+        return -1;
+    }
+
+    remote_push_stats_t local = {0};
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    if (object_count > 0 && send_push_pack(repo, remote, objects, object_count, stats) != 0) {
+        fprintf(stderr, "Error: Failed to send pack\n");
+        return -1;
+    }
+
+    buffer_t *out = buffer_create(512);
+    if (!out) return -1;
+    for (size_t i = 0; i < update_count; i++) {
+        char line[HASH_HEX_SIZE * 2 + 300];
+        char old_hex[HASH_HEX_SIZE], new_hex[HASH_HEX_SIZE];
+        hash_to_hex(&updates[i].old_hash, old_hex);
+        hash_to_hex(&updates[i].new_hash, new_hex);
+        snprintf(line, sizeof(line), "%s %s %s", old_hex, new_hex, updates[i].branch);
+        append_frame(out, PROTO_UPDATE, line, strlen(line));
+        updates[i].ok = 0;
+        strcpy(updates[i].reason, "no reply");
+    }
+    append_frame(out, PROTO_FINISH, NULL, 0);
+    int result = send_all(remote->fd, out->data, out->len);
+    buffer_free(out);
+
+    // One STATUS per update, in the order they were sent
+    for (size_t i = 0; result == 0;) {
+        int type;
+        char *payload;
+        uint32_t len;
+        if (read_small_frame(remote, &type, &payload, &len) != 0) {
+            result = -1;
+            break;
+        }
+
+        if (type == PROTO_END) {
+            free(payload);
+            break;
+        }
+        if (type == PROTO_STATUS && i < update_count) {
+            updates[i].ok = strncmp(payload, "ok ", 3) == 0;
+            const char *reason = "";
+            if (!updates[i].ok) {
+                // "ng <branch> <reason>"
+                const char *space = strchr(payload + 3, ' ');
+                reason = space ? space + 1 : "refused";
+            }
+            snprintf(updates[i].reason, sizeof(updates[i].reason), "%s", reason);
+            i++;
+        } else {
+            fprintf(stderr, "Error: Unexpected reply from remote\n");
+            result = -1;
+        }
+        free(payload);
+    }
+
+    return result;
+}
@@ -0,0 +1,76 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include "gyatt.h"
+#include <stdint.h>
+
+// The client end of the 'gyatt server' protocol (see protocol.h)
+
+#define REMOTE_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    int fd;
+    int version;             // 2 if the server took the upgrade, else 1
+    int compressed;          // Server can send objects as stored (PROTO_CAP_COMPRESSED)
+    char banner[128];        // The server's greeting line
+    unsigned char buf[REMOTE_BUFFER_SIZE];   // Read-ahead
+    size_t buf_pos;
+    size_t buf_len;
+} remote_t;
+
+// "host:port" or just "host" (port 9418)
+int parse_remote_url(const char *url, char *hostname, int *port);
+int connect_to_server(const char *hostname, int port);
+
+// Connect, read the greeting and ask for protocol v2
+remote_t *remote_open(const char *url);
+void remote_close(remote_t *remote);   // Says goodbye, then hangs up
+
+// v1 only: send one command line and read one response line back
+int remote_command(remote_t *remote, const char *cmd, char *response, size_t response_size);
+
+typedef struct {
+    size_t objects;          // Objects that arrived (in one new pack)
+    size_t missing;          // Wanted objects the server doesn't have
+    uint64_t bytes;          // Pack bytes received
+} remote_fetch_stats_t;
+
+// Fetch wants minus haves as one pack, pipelined in a single round trip,
+// and index it into the repository. With closure set the wants are tips,
+// and everything they reach that the haves don't comes too. Needs v2.
+int remote_fetch(gyatt_repo_t *repo, remote_t *remote,
+                 const gyatt_hash_t *wants, size_t want_count,
+                 const gyatt_hash_t *haves, size_t have_count,
+                 int closure, remote_fetch_stats_t *stats);
+
+typedef struct {
+    char name[256];          // Branch name
+    gyatt_hash_t hash;
+} remote_ref_t;
+
+// The remote's branches, as a malloc'd array
+int remote_list_refs(remote_t *remote, remote_ref_t **refs, size_t *count);
+const remote_ref_t *remote_find_ref(const remote_ref_t *refs, size_t count, const char *name);
+
+typedef struct {
+    char branch[256];
+    gyatt_hash_t old_hash;   // What the remote should still have; zeros to create
+    gyatt_hash_t new_hash;
+    int ok;                  // Filled in: did the remote take it
+    char reason[128];        //   and if not, why
+} remote_update_t;
+
+typedef struct {
+    size_t objects;          // Objects sent
+    uint64_t bytes;          // Pack bytes sent
+} remote_push_stats_t;
+
+// Send objects as one pack, then ask for the updates. Returns 0 if the
+// exchange went through - check each update's ok for what was applied.
+// Needs v2.
+int remote_push(gyatt_repo_t *repo, remote_t *remote,
+                const gyatt_hash_t *objects, size_t object_count,
+                remote_update_t *updates, size_t update_count,
+                remote_push_stats_t *stats);
+
+#endif // REMOTE_H
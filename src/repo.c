@@ -0,0 +1,295 @@
+#include "gyatt.h"
+#include "utils.h"
+#include "pack.h"
+#include "hash.h"
+#include "commit_graph.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+// One find_repo_root() per process instead of one per object lookup
+
+gyatt_repo_t *repo_open_at(const char *root) {
+    if (!root) return NULL;
+
+    gyatt_repo_t *repo = calloc(1, sizeof(gyatt_repo_t));
+    if (!repo) return NULL;
+
+    repo->root = str_duplicate(root);
+    repo->gyatt_dir = path_join(root, GYATT_DIR);
+    repo->cwd = get_current_dir();
+    if (!repo->root || !repo->gyatt_dir || !repo->cwd) {
+        repo_free(repo);
+        return NULL;
+    }
+
+    repo->root_len = strlen(repo->root);
+    repo->objects_dir = path_join(repo->gyatt_dir, "objects");
+    repo->index_path = path_join(repo->gyatt_dir, "index");
+    if (!repo->objects_dir || !repo->index_path) {
+        repo_free(repo);
+        return NULL;
+    }
+    repo->objects_dir_len = strlen(repo->objects_dir);
+
+    // A missing or unreadable config just means defaults
+    if (config_read(repo, &repo->config) != 0) {
+        config_defaults(&repo->config);
+    }
+
+    // Mapping packs is lazy and cheap; a repo without any gets an empty store
+    repo->packs = pack_store_open(repo);
+
+    if (repo->config.object_cache_mb > 0) {
+        repo->cache = object_cache_create((size_t)repo->config.object_cache_mb * 1024 * 1024);
+    }
+
+    // Same for the commit graph; without one, history walks parse commits
+    repo->graph = commit_graph_open(repo);
+
+    return repo;
+}
+
+gyatt_repo_t *repo_open(void) {
+    char *root = find_repo_root();
+    if (!root) return NULL;
+
+    gyatt_repo_t *repo = repo_open_at(root);
+    free(root);
+    return repo;
+}
+
+void repo_free(gyatt_repo_t *repo) {
+    if (!repo) return;
+    free(repo->root);
+    free(repo->cwd);
+    free(repo->gyatt_dir);
+    free(repo->objects_dir);
+    free(repo->index_path);
+    pack_store_free(repo->packs);
+    object_cache_free(repo->cache);
+    commit_graph_free(repo->graph);
+    free(repo);
+}
+
+// Turn a user-supplied path (relative to cwd, or absolute) into a clean
+// path relative to the repository root: no "./", no "..", no doubled slashes.
+// Returns -1 if the path lies outside the repository.
+int repo_relative_path(const gyatt_repo_t *repo, const char *path,
+                       char *out, size_t out_size) {
+    if (!repo || !path || !out || out_size == 0) return -1;
+
+    char abs[4096];
+    int n;
+    if (path[0] == '/') {
+        n = snprintf(abs, sizeof(abs), "%s", path);
+    } else {
+        n = snprintf(abs, sizeof(abs), "%s/%s", repo->cwd, path);
+    }
+    if (n < 0 || (size_t)n >= sizeof(abs)) return -1;
+
+    // Lexically normalize in place, segment by segment
+    size_t len = 0;
+    const char *p = abs;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        const char *seg = p;
+        while (*p && *p != '/') p++;
+        size_t seg_len = p - seg;
+
+        if (seg_len == 1 && seg[0] == '.') continue;
+        if (seg_len == 2 && seg[0] == '.' && seg[1] == '.') {
+            while (len > 0 && abs[len - 1] != '/') len--;
+            if (len > 0) len--;
+            continue;
+        }
+
+        abs[len++] = '/';
+        memmove(abs + len, seg, seg_len);
+        len += seg_len;
+    }
+    abs[len] = '\0';
+
+    if (strncmp(abs, repo->root, repo->root_len) != 0) return -1;
+
+    const char *rel = abs + repo->root_len;
+    if (*rel != '\0' && *rel != '/') return -1;  // "/repo-other" is not inside "/repo"
+    if (*rel == '/') rel++;
+
+    size_t rel_len = strlen(rel);
+    if (rel_len >= out_size) return -1;
+    memcpy(out, rel, rel_len + 1);
+
+    return 0;
+}
+
+static int is_full_hex(const char *s) {
+    for (int i = 0; i < HASH_HEX_SIZE - 1; i++) {
+        if (!isxdigit((unsigned char)s[i])) return 0;
+    }
+    return s[HASH_HEX_SIZE - 1] == '\0';
+}
+
+// Read a ref file holding a hex hash (plus a newline)
+static int read_ref_file(const char *path, gyatt_hash_t *hash) {
+    char *content = read_file(path, NULL);
+    if (!content) return -1;
+
+    content[strcspn(content, "\r\n")] = '\0';
+    int result = is_full_hex(content) ? 0 : -1;
+    if (result == 0) hex_to_hash(content, hash);
+    free(content);
+    return result;
+}
+
+int repo_resolve_ref(const gyatt_repo_t *repo, const char *name, gyatt_hash_t *hash) {
+    if (!repo || !name || !hash || !name[0]) return -1;
+
+    char path[4096];
+    if (strcmp(name, "HEAD") == 0) {
+        snprintf(path, sizeof(path), "%s/HEAD", repo->gyatt_dir);
+        char *head = read_file(path, NULL);
+        if (!head) return -1;
+
+        // Either "ref: refs/heads/<branch>" or a detached hash
+        char *ref = head;
+        if (strncmp(ref, "ref:", 4) == 0) {
+            ref += 4;
+            while (*ref == ' ' || *ref == '\t') ref++;
+        }
+        ref[strcspn(ref, "\r\n")] = '\0';
+
+        int result;
+        if (is_full_hex(ref)) {
+            hex_to_hash(ref, hash);
+            result = 0;
+        } else if (snprintf(path, sizeof(path), "%s/%s", repo->gyatt_dir, ref) >= (int)sizeof(path)) {
+            result = -1;
+        } else {
+            result = read_ref_file(path, hash);
+        }
+        free(head);
+        return result;
+    }
+
+    // Branch names win over hashes, like git
+    if (!strstr(name, "..") &&
+        snprintf(path, sizeof(path), "%s/refs/heads/%s", repo->gyatt_dir, name) < (int)sizeof(path) &&
+        file_exists(path)) {
+        return read_ref_file(path, hash);
+    }
+
+    if (is_full_hex(name)) {
+        hex_to_hash(name, hash);
+        return 0;
+    }
+    return -1;
+}
+
+int repo_head_branch(const gyatt_repo_t *repo, char *out, size_t out_size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/HEAD", repo->gyatt_dir);
+    char *head = read_file(path, NULL);
+    if (!head) return -1;
+
+    const char *prefix = "ref: refs/heads/";
+    int result = -1;
+    if (strncmp(head, prefix, strlen(prefix)) == 0) {
+        char *name = head + strlen(prefix);
+        name[strcspn(name, "\r\n")] = '\0';
+        if (name[0] && strlen(name) < out_size) {
+            strcpy(out, name);
+            result = 0;
+        }
+    }
+    free(head);
+    return result;
+}
+
+int repo_foreach_branch(const gyatt_repo_t *repo, repo_ref_fn fn, void *arg) {
+    char heads_path[4096];
+    snprintf(heads_path, sizeof(heads_path), "%s/refs/heads", repo->gyatt_dir);
+
+    DIR *dir = opendir(heads_path);
+    if (!dir) return 0;
+
+    int ret = 0;
+    struct dirent *entry;
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || (len > 5 && strcmp(entry->d_name + len - 5, ".lock") == 0)) continue;
+
+        char path[4096];
+        gyatt_hash_t hash;
+        if (snprintf(path, sizeof(path), "%s/%s", heads_path, entry->d_name) >= (int)sizeof(path) ||
+            read_ref_file(path, &hash) != 0) {
+            continue;  // A branch with no commits yet
+        }
+        ret = fn(entry->d_name, &hash, arg);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+// Branch names end up as file names, so keep them to something tame
+static int valid_branch_name(const char *name) {
+    if (!name[0] || name[0] == '.' || name[0] == '-' || strlen(name) > 255) return 0;
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && !strchr("._-+", *c)) return 0;
+    }
+    size_t len = strlen(name);
+    return !(len > 5 && strcmp(name + len - 5, ".lock") == 0);
+}
+
+int repo_update_branch(const gyatt_repo_t *repo, const char *name,
+                       const gyatt_hash_t *old_hash, const gyatt_hash_t *new_hash) {
+    if (!repo || !name || !new_hash) return -1;
+    if (!valid_branch_name(name)) {
+        fprintf(stderr, "Error: Invalid branch name '%s'\n", name);
+        return -1;
+    }
+
+    char path[4096], lock_path[4096];
+    if (snprintf(path, sizeof(path), "%s/refs/heads/%s", repo->gyatt_dir, name) >= (int)sizeof(path) ||
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", path) >= (int)sizeof(lock_path)) {
+        return -1;
+    }
+
+    // Whoever creates the lock file owns the ref until it's renamed over
+    // it, which is also what makes the new value appear all at once
+    int fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return errno == EEXIST ? 1 : -1;
+
+    gyatt_hash_t current;
+    int exists = read_ref_file(path, &current) == 0;
+    int matches = 1;
+    if (old_hash) {
+        gyatt_hash_t zero;
+        memset(&zero, 0, sizeof(zero));
+        matches = hash_compare(old_hash, &zero) == 0 ? !exists
+                                                     : exists && hash_compare(old_hash, &current) == 0;
+    }
+
+    char hex[HASH_HEX_SIZE + 1];
+    hash_to_hex(new_hash, hex);
+    strcat(hex, "\n");
+
+    int result = matches ? 0 : 1;
+    if (result == 0) {
+        size_t len = strlen(hex);
+        if (write(fd, hex, len) != (ssize_t)len || fsync(fd) != 0) result = -1;
+    }
+    if (close(fd) != 0 && result == 0) result = -1;
+
+    if (result == 0 && rename(lock_path, path) != 0) result = -1;
+    if (result != 0) unlink(lock_path);
+    return result;
+}
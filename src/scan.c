@@ -0,0 +1,380 @@
+#include "scan.h"
+#include "pool.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// A directory waiting to be read
+typedef struct {
+    size_t len;
+    char path[];               // Relative to the repo root; "" is the root
+} scan_dir_t;
+
+// Each worker's own queue of directories. The owner works off the back
+// (depth first, so it stays near what it just read); thieves take from
+// the front, where the directories nearest the top, and usually the
+// biggest subtrees, are.
+typedef struct {
+    scan_dir_t **items;        // Ring buffer
+    size_t head;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+} scan_deque_t;
+
+typedef struct scan_state scan_state_t;
+
+typedef struct {
+    scan_state_t *state;
+    int id;
+    scan_deque_t deque;
+    arena_t arena;             // Paths found by this worker
+    scan_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    uint64_t syscalls;         // opens, stats and closes, for GYATT_TRACE
+} scan_worker_t;
+
+struct scan_state {
+    int root_fd;
+    ignore_t *ignore;
+    scan_worker_t *workers;
+    int worker_count;
+
+    atomic_size_t pending;     // Directories queued or being read
+    atomic_size_t queued;      // Directories sitting in some deque
+    atomic_int waiting;        // Workers asleep on wake
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    trace_span_t span;
+};
+
+static int deque_push(scan_deque_t *deque, scan_dir_t *dir) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t new_capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+        scan_dir_t **items = malloc(new_capacity * sizeof(scan_dir_t *));
+        if (!items) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = new_capacity;
+    }
+    deque->items[(deque->head + deque->count) % deque->capacity] = dir;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+static scan_dir_t *deque_pop_back(scan_deque_t *deque) {
+    scan_dir_t *dir = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        dir = deque->items[(deque->head + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+static scan_dir_t *deque_pop_front(scan_deque_t *deque) {
+    scan_dir_t *dir = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        dir = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+static void scan_push_dir(scan_worker_t *worker, const char *path, size_t len) {
+    scan_state_t *state = worker->state;
+    scan_dir_t *dir = malloc(sizeof(scan_dir_t) + len + 1);
+    if (!dir) return;
+    dir->len = len;
+    memcpy(dir->path, path, len);
+    dir->path[len] = '\0';
+
+    atomic_fetch_add(&state->pending, 1);
+    if (deque_push(&worker->deque, dir) != 0) {
+        atomic_fetch_sub(&state->pending, 1);
+        free(dir);
+        return;
+    }
+    atomic_fetch_add(&state->queued, 1);
+
+    if (atomic_load(&state->waiting) > 0) {
+        pthread_mutex_lock(&state->lock);
+        pthread_cond_signal(&state->wake);
+        pthread_mutex_unlock(&state->lock);
+    }
+}
+
+static void scan_add_file(scan_worker_t *worker, const char *path, size_t len, const struct stat *st) {
+    if (worker->count >= worker->capacity) {
+        size_t new_capacity = worker->capacity == 0 ? 256 : worker->capacity * 2;
+        scan_entry_t *entries = realloc(worker->entries, new_capacity * sizeof(scan_entry_t));
+        if (!entries) return;
+        worker->entries = entries;
+        worker->capacity = new_capacity;
+    }
+
+    const char *copy = arena_strndup(&worker->arena, path, len);
+    if (!copy) return;
+    worker->entries[worker->count].path = copy;
+    worker->entries[worker->count].st = *st;
+    worker->count++;
+}
+
+// List one directory: files are recorded, subdirectories queued
+static void scan_read_dir(scan_worker_t *worker, const scan_dir_t *dir) {
+    scan_state_t *state = worker->state;
+    int fd = openat(state->root_fd, dir->len ? dir->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    worker->syscalls += 2;  // And the close
+    if (fd < 0) return;
+    DIR *d = fdopendir(fd);
+    if (!d) {
+        close(fd);
+        return;
+    }
+
+    char path[PATH_MAX];
+    size_t base = dir->len;
+    memcpy(path, dir->path, base);
+    if (base > 0) path[base++] = '/';
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        size_t name_len = strlen(name);
+        if (base + name_len >= sizeof(path)) continue;
+        memcpy(path + base, name, name_len + 1);
+        size_t len = base + name_len;
+
+        // With d_type known, directories and ignored entries never need
+        // a stat; symlinks are followed, so those do
+        int known = entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK;
+        if (known) {
+            if (entry->d_type != DT_DIR && entry->d_type != DT_REG) continue;
+            if (ignore_entry(state->ignore, path, entry->d_type == DT_DIR)) continue;
+            if (entry->d_type == DT_DIR) {
+                scan_push_dir(worker, path, len);
+                continue;
+            }
+        }
+
+        struct stat st;
+        worker->syscalls++;
+        if (fstatat(fd, name, &st, 0) != 0) continue;
+        if (!known) {
+            if (ignore_entry(state->ignore, path, S_ISDIR(st.st_mode))) continue;
+            if (S_ISDIR(st.st_mode)) {
+                scan_push_dir(worker, path, len);
+                continue;
+            }
+        }
+        if (S_ISREG(st.st_mode)) scan_add_file(worker, path, len, &st);
+    }
+
+    closedir(d);
+}
+
+// Runs until every queued directory has been read, by someone
+static void scan_worker_run(void *arg) {
+    scan_worker_t *worker = arg;
+    scan_state_t *state = worker->state;
+
+    for (;;) {
+        scan_dir_t *dir = deque_pop_back(&worker->deque);
+        for (int i = 1; !dir && i < state->worker_count; i++) {
+            dir = deque_pop_front(&state->workers[(worker->id + i) % state->worker_count].deque);
+        }
+
+        if (dir) {
+            atomic_fetch_sub(&state->queued, 1);
+            scan_read_dir(worker, dir);
+            free(dir);
+            if (atomic_fetch_sub(&state->pending, 1) == 1) {
+                pthread_mutex_lock(&state->lock);
+                pthread_cond_broadcast(&state->wake);
+                pthread_mutex_unlock(&state->lock);
+            }
+            continue;
+        }
+
+        // Nothing to steal: sleep until someone queues more or it's over
+        pthread_mutex_lock(&state->lock);
+        atomic_fetch_add(&state->waiting, 1);
+        while (atomic_load(&state->queued) == 0 && atomic_load(&state->pending) > 0) {
+            pthread_cond_wait(&state->wake, &state->lock);
+        }
+        atomic_fetch_sub(&state->waiting, 1);
+        int done = atomic_load(&state->pending) == 0;
+        pthread_mutex_unlock(&state->lock);
+        if (done) return;
+    }
+}
+
+static int scan_entry_compare(const void *a, const void *b) {
+    return strcmp(((const scan_entry_t *)a)->path, ((const scan_entry_t *)b)->path);
+}
+
+static int scan_begin(scan_state_t *state, gyatt_repo_t *repo, ignore_t *ignore, int threads,
+                      pool_t **pool) {
+    memset(state, 0, sizeof(*state));
+    state->span = trace_begin(TRACE_SCAN);
+    state->ignore = ignore;
+    state->root_fd = open(repo->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (state->root_fd < 0) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", repo->root);
+        return -1;
+    }
+
+    // Workers are long-running pool tasks, one per thread
+    *pool = pool_create(threads);
+    if (*pool) {
+        state->worker_count = pool_thread_count(*pool);
+        state->workers = calloc((size_t)state->worker_count, sizeof(scan_worker_t));
+    }
+    if (!state->workers) {
+        pool_free(*pool);
+        close(state->root_fd);
+        return -1;
+    }
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->wake, NULL);
+    for (int i = 0; i < state->worker_count; i++) {
+        state->workers[i].state = state;
+        state->workers[i].id = i;
+        pthread_mutex_init(&state->workers[i].deque.lock, NULL);
+        arena_init(&state->workers[i].arena, 0);
+    }
+    return 0;
+}
+
+// Run the workers over whatever's been queued, then gather up what they
+// found into one sorted list
+static scan_t *scan_finish(scan_state_t *state, pool_t *pool) {
+    for (int i = 0; i < state->worker_count; i++) {
+        pool_submit(pool, scan_worker_run, &state->workers[i]);
+    }
+    pool_wait(pool);
+    pool_free(pool);
+
+    scan_t *scan = calloc(1, sizeof(scan_t));
+    size_t total = 0;
+    uint64_t syscalls = 0;
+    for (int i = 0; i < state->worker_count; i++) {
+        total += state->workers[i].count;
+        syscalls += state->workers[i].syscalls;
+    }
+    if (scan) {
+        arena_init(&scan->arena, 0);
+        scan->entries = arena_alloc(&scan->arena, (total > 0 ? total : 1) * sizeof(scan_entry_t));
+    }
+
+    for (int i = 0; i < state->worker_count; i++) {
+        scan_worker_t *worker = &state->workers[i];
+        if (scan && scan->entries) {
+            memcpy(scan->entries + scan->count, worker->entries, worker->count * sizeof(scan_entry_t));
+            scan->count += worker->count;
+            arena_absorb(&scan->arena, &worker->arena);
+        }
+        arena_free(&worker->arena);
+        free(worker->entries);
+        free(worker->deque.items);
+        pthread_mutex_destroy(&worker->deque.lock);
+    }
+    free(state->workers);
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->wake);
+    close(state->root_fd);
+
+    if (scan && !scan->entries) {
+        scan_free(scan);
+        return NULL;
+    }
+    if (scan) qsort(scan->entries, scan->count, sizeof(scan_entry_t), scan_entry_compare);
+    trace_end(state->span, 0, syscalls);
+    return scan;
+}
+
+scan_t *scan_worktree(gyatt_repo_t *repo, const char *rel_dir, ignore_t *ignore, int threads) {
+    scan_state_t state;
+    pool_t *pool;
+    if (scan_begin(&state, repo, ignore, threads, &pool) != 0) return NULL;
+
+    scan_push_dir(&state.workers[0], rel_dir, strlen(rel_dir));
+    return scan_finish(&state, pool);
+}
+
+scan_t *scan_paths(gyatt_repo_t *repo, char *const *paths, size_t count, ignore_t *ignore, int threads) {
+    scan_state_t state;
+    pool_t *pool;
+    if (scan_begin(&state, repo, ignore, threads, &pool) != 0) return NULL;
+
+    // One path inside another gets found twice; skip what's already
+    // covered (sorted, so a directory comes right before its contents)
+    const char *covering = NULL;
+    size_t covering_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *path = paths[i];
+        size_t len = strlen(path);
+        if (covering && len > covering_len && strncmp(path, covering, covering_len) == 0 &&
+            path[covering_len] == '/') {
+            continue;
+        }
+
+        struct stat st;
+        state.workers[0].syscalls++;
+        if (len == 0 || fstatat(state.root_fd, path, &st, 0) != 0) continue;
+        if (ignore_path(ignore, path, S_ISDIR(st.st_mode))) continue;
+        if (S_ISDIR(st.st_mode)) {
+            scan_push_dir(&state.workers[0], path, len);
+            covering = path;
+            covering_len = len;
+        } else if (S_ISREG(st.st_mode)) {
+            scan_add_file(&state.workers[0], path, len, &st);
+        }
+    }
+
+    // A directory sorting between another and its contents ("a", "a-b",
+    // "a/c") slips past that, so drop whatever still came up twice
+    scan_t *scan = scan_finish(&state, pool);
+    if (scan && scan->count > 1) {
+        size_t kept = 1;
+        for (size_t i = 1; i < scan->count; i++) {
+            if (strcmp(scan->entries[i].path, scan->entries[kept - 1].path) != 0) {
+                scan->entries[kept++] = scan->entries[i];
+            }
+        }
+        scan->count = kept;
+    }
+    return scan;
+}
+
+void scan_free(scan_t *scan) {
+    if (!scan) return;
+    arena_free(&scan->arena);
+    free(scan);
+}
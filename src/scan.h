@@ -0,0 +1,33 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "gyatt.h"
+#include "arena.h"
+#include "ignore.h"
+#include <sys/stat.h>
+
+// Listing the working tree: every regular file under a directory that
+// .gyattignore doesn't exclude. Directories are opened relative to the
+// repo root and entries stat'ed relative to their directory, d_type saves
+// the stat wherever it can, and subdirectories are spread over worker
+// threads that steal from each other when they run dry.
+
+typedef struct {
+    const char *path;          // Relative to the repo root
+    struct stat st;
+} scan_entry_t;
+
+typedef struct {
+    scan_entry_t *entries;     // Sorted by path, same as the index
+    size_t count;
+    arena_t arena;             // Owns all the paths
+} scan_t;
+
+// rel_dir relative to the repo root, "" for all of it. ignore may be NULL.
+scan_t *scan_worktree(gyatt_repo_t *repo, const char *rel_dir, ignore_t *ignore, int threads);
+// Just these paths, sorted: files are stat'ed, directories walked. Ones
+// that don't exist (or are ignored) are left out.
+scan_t *scan_paths(gyatt_repo_t *repo, char *const *paths, size_t count, ignore_t *ignore, int threads);
+void scan_free(scan_t *scan);
+
+#endif // SCAN_H
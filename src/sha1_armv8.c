@@ -0,0 +1,61 @@
+// SHA-1 on the ARMv8 cryptography extensions (SHA1C/SHA1P/SHA1M do four
+// rounds each, SHA1SU0/SU1 the message schedule)
+#include "sha1_impl.h"
+
+#ifdef SHA1_HAVE_ARMV8
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA1
+    #define HWCAP_SHA1 (1 << 5)
+#endif
+
+int sha1_armv8_supported(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+__attribute__((target("+crypto")))
+void sha1_blocks_armv8(uint32_t state[5], const uint8_t *data, size_t blocks) {
+    static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+
+    while (blocks-- > 0) {
+        uint32x4_t abcd_save = abcd;
+        uint32_t e_save = e0;
+        uint32_t e = e0;
+
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+
+        // Quad i consumes msg[i % 4], then that register is refilled with
+        // the words for quad i + 4
+        for (int i = 0; i < 20; i++) {
+            uint32x4_t w = vaddq_u32(msg[i % 4], vdupq_n_u32(k[i / 5]));
+            uint32_t e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+            if (i < 5) abcd = vsha1cq_u32(abcd, e, w);
+            else if (i < 10 || i >= 15) abcd = vsha1pq_u32(abcd, e, w);
+            else abcd = vsha1mq_u32(abcd, e, w);
+            e = e_next;
+
+            if (i + 4 < 20) {
+                msg[i % 4] = vsha1su1q_u32(vsha1su0q_u32(msg[i % 4], msg[(i + 1) % 4], msg[(i + 2) % 4]),
+                                           msg[(i + 3) % 4]);
+            }
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        e0 = e + e_save;
+        data += 64;
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+
+#endif // SHA1_HAVE_ARMV8
@@ -0,0 +1,176 @@
+// Multi-buffer SHA-1: eight independent messages hashed side by side, one
+// per 32-bit lane of the AVX2 registers. A single SHA-1 stream can't be
+// vectorized (every round depends on the last), but unrelated small
+// objects - tree entries, a batch of blobs - can.
+#include "sha1_impl.h"
+
+#ifdef SHA1_HAVE_X86
+
+#include <immintrin.h>
+#include <string.h>
+
+#define LANES 8
+
+int sha1_avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+// Where one lane is in its message. The final one or two blocks (the
+// leftover bytes, 0x80, zeros, bit length) are built in tail.
+typedef struct {
+    const uint8_t *data;
+    size_t full_blocks;
+    size_t total_blocks;
+    size_t block;
+    size_t message;          // Index into the caller's arrays
+    int active;
+    uint8_t tail[128];
+} lane_t;
+
+static void lane_start(lane_t *lane, const uint8_t *data, size_t len, size_t message) {
+    lane->data = data;
+    lane->full_blocks = len / 64;
+    lane->total_blocks = (len + 8) / 64 + 1;
+    lane->block = 0;
+    lane->message = message;
+    lane->active = 1;
+
+    size_t rest = len % 64;
+    size_t tail_len = (lane->total_blocks - lane->full_blocks) * 64;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rest) memcpy(lane->tail, data + lane->full_blocks * 64, rest);
+    lane->tail[rest] = 0x80;
+
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        lane->tail[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+}
+
+static const uint8_t *lane_block(const lane_t *lane) {
+    if (lane->block < lane->full_blocks) return lane->data + lane->block * 64;
+    return lane->tail + (lane->block - lane->full_blocks) * 64;
+}
+
+static uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+#define ROTL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+// One block for every lane. state[i] holds word i of all eight lanes.
+__attribute__((target("avx2")))
+static void sha1_transform_x8(uint32_t state[5][LANES], const uint8_t *blocks[LANES]) {
+    __m256i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm256_setr_epi32((int)load_be32(blocks[0] + 4 * t), (int)load_be32(blocks[1] + 4 * t),
+                                 (int)load_be32(blocks[2] + 4 * t), (int)load_be32(blocks[3] + 4 * t),
+                                 (int)load_be32(blocks[4] + 4 * t), (int)load_be32(blocks[5] + 4 * t),
+                                 (int)load_be32(blocks[6] + 4 * t), (int)load_be32(blocks[7] + 4 * t));
+    }
+
+    __m256i a = _mm256_loadu_si256((const __m256i *)state[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)state[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i *)state[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i *)state[3]);
+    __m256i e = _mm256_loadu_si256((const __m256i *)state[4]);
+    __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+    const __m256i k0 = _mm256_set1_epi32(0x5A827999);
+    const __m256i k1 = _mm256_set1_epi32(0x6ED9EBA1);
+    const __m256i k2 = _mm256_set1_epi32((int)0x8F1BBCDC);
+    const __m256i k3 = _mm256_set1_epi32((int)0xCA62C1D6);
+
+    for (int t = 0; t < 80; t++) {
+        if (t >= 16) {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                         _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+            w[t & 15] = ROTL(x, 1);
+        }
+
+        __m256i f, k;
+        if (t < 20) {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+            k = k0;
+        } else if (t < 40) {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = k1;
+        } else if (t < 60) {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = k2;
+        } else {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = k3;
+        }
+
+        __m256i temp = _mm256_add_epi32(_mm256_add_epi32(ROTL(a, 5), f),
+                                        _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15]));
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    _mm256_storeu_si256((__m256i *)state[0], _mm256_add_epi32(a, a0));
+    _mm256_storeu_si256((__m256i *)state[1], _mm256_add_epi32(b, b0));
+    _mm256_storeu_si256((__m256i *)state[2], _mm256_add_epi32(c, c0));
+    _mm256_storeu_si256((__m256i *)state[3], _mm256_add_epi32(d, d0));
+    _mm256_storeu_si256((__m256i *)state[4], _mm256_add_epi32(e, e0));
+}
+
+static const uint32_t sha1_iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+// Lanes pick up the next message as soon as theirs is done, so a mix of
+// lengths still keeps all eight busy until the queue runs dry
+void sha1_many_avx2(const void *const *data, const size_t *lens, size_t count,
+                    gyatt_hash_t *hashes) {
+    lane_t lanes[LANES];
+    uint32_t state[5][LANES];
+    static const uint8_t idle_block[64];
+    size_t next = 0;
+    int active = 0;
+
+    for (int l = 0; l < LANES; l++) {
+        lanes[l].active = 0;
+        if (next < count) {
+            lane_start(&lanes[l], data[next], lens[next], next);
+            next++;
+            active++;
+        }
+        for (int i = 0; i < 5; i++) state[i][l] = sha1_iv[i];
+    }
+
+    while (active > 0) {
+        const uint8_t *blocks[LANES];
+        for (int l = 0; l < LANES; l++) {
+            blocks[l] = lanes[l].active ? lane_block(&lanes[l]) : idle_block;
+        }
+
+        sha1_transform_x8(state, blocks);
+
+        for (int l = 0; l < LANES; l++) {
+            lane_t *lane = &lanes[l];
+            if (!lane->active || ++lane->block < lane->total_blocks) continue;
+
+            uint8_t *out = hashes[lane->message].hash;
+            for (int i = 0; i < 5; i++) {
+                out[i * 4] = (uint8_t)(state[i][l] >> 24);
+                out[i * 4 + 1] = (uint8_t)(state[i][l] >> 16);
+                out[i * 4 + 2] = (uint8_t)(state[i][l] >> 8);
+                out[i * 4 + 3] = (uint8_t)state[i][l];
+                state[i][l] = sha1_iv[i];
+            }
+
+            lane->active = 0;
+            active--;
+            if (next < count) {
+                lane_start(lane, data[next], lens[next], next);
+                next++;
+                active++;
+            }
+        }
+    }
+}
+
+#endif // SHA1_HAVE_X86
@@ -0,0 +1,32 @@
+#ifndef SHA1_IMPL_H
+#define SHA1_IMPL_H
+
+// SHA-1 kernels behind hash.c's dispatch. Only hash.c should need this.
+
+#include "gyatt.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Compress blocks consecutive 64-byte blocks into state
+typedef void (*sha1_blocks_fn)(uint32_t state[5], const uint8_t *data, size_t blocks);
+
+// Hash count independent messages at once
+typedef void (*sha1_many_fn)(const void *const *data, const size_t *lens, size_t count,
+                             gyatt_hash_t *hashes);
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define SHA1_HAVE_X86 1
+    int sha1_shani_supported(void);
+    void sha1_blocks_shani(uint32_t state[5], const uint8_t *data, size_t blocks);
+    int sha1_avx2_supported(void);
+    void sha1_many_avx2(const void *const *data, const size_t *lens, size_t count,
+                        gyatt_hash_t *hashes);
+#endif
+
+#if defined(__aarch64__)
+    #define SHA1_HAVE_ARMV8 1
+    int sha1_armv8_supported(void);
+    void sha1_blocks_armv8(uint32_t state[5], const uint8_t *data, size_t blocks);
+#endif
+
+#endif // SHA1_IMPL_H
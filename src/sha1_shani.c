@@ -0,0 +1,71 @@
+// SHA-1 on the x86 SHA extensions (SHA-NI): four rounds per instruction,
+// with the message schedule done in hardware too
+#include "sha1_impl.h"
+
+#ifdef SHA1_HAVE_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+int sha1_shani_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    int sse41 = (ecx & bit_SSE4_1) != 0;
+    int ssse3 = (ecx & bit_SSSE3) != 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return sse41 && ssse3 && (ebx & (1u << 29)) != 0;
+}
+
+// One group of four rounds. msg[] holds the schedule for quads i..i+3 in
+// rotation; the tail of each step starts the words three quads ahead.
+#define SHA1_QUAD(i, f) do {                                                 \
+        if ((i) < 4) {                                                       \
+            msg[(i) % 4] = _mm_shuffle_epi8(                                 \
+                _mm_loadu_si128((const __m128i *)(data + 16 * (i))), bswap); \
+        }                                                                    \
+        __m128i e_in = (i) == 0 ? _mm_add_epi32(e, msg[0])                   \
+                                : _mm_sha1nexte_epu32(e, msg[(i) % 4]);      \
+        e = abcd;                                                            \
+        if ((i) >= 3 && (i) <= 18) {                                         \
+            msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], msg[(i) % 4]); \
+        }                                                                    \
+        abcd = _mm_sha1rnds4_epu32(abcd, e_in, f);                           \
+        if ((i) >= 1 && (i) <= 16) {                                         \
+            msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], msg[(i) % 4]); \
+        }                                                                    \
+        if ((i) >= 2 && (i) <= 17) {                                         \
+            msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], msg[(i) % 4]); \
+        }                                                                    \
+    } while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha1_blocks_shani(uint32_t state[5], const uint8_t *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    // The instructions want a in the top lane
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    while (blocks-- > 0) {
+        __m128i abcd_save = abcd;
+        __m128i e_save = e0;
+        __m128i e = e0;
+        __m128i msg[4];
+
+        SHA1_QUAD(0, 0);  SHA1_QUAD(1, 0);  SHA1_QUAD(2, 0);  SHA1_QUAD(3, 0);
+        SHA1_QUAD(4, 0);  SHA1_QUAD(5, 1);  SHA1_QUAD(6, 1);  SHA1_QUAD(7, 1);
+        SHA1_QUAD(8, 1);  SHA1_QUAD(9, 1);  SHA1_QUAD(10, 2); SHA1_QUAD(11, 2);
+        SHA1_QUAD(12, 2); SHA1_QUAD(13, 2); SHA1_QUAD(14, 2); SHA1_QUAD(15, 3);
+        SHA1_QUAD(16, 3); SHA1_QUAD(17, 3); SHA1_QUAD(18, 3); SHA1_QUAD(19, 3);
+
+        e0 = _mm_sha1nexte_epu32(e, e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+        data += 64;
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#endif // SHA1_HAVE_X86
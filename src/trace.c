@@ -0,0 +1,183 @@
+#include "trace.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Spans kept for the trace file; past this they're only counted
+#define TRACE_MAX_EVENTS (1 << 20)
+
+typedef struct {
+    uint64_t start;
+    uint64_t duration;
+    uint64_t bytes;
+    uint32_t tid;
+    trace_phase_t phase;
+} trace_event_t;
+
+typedef struct {
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t ns;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t syscalls;
+} trace_counter_t;
+
+static const char *const phase_names[TRACE_PHASE_COUNT] = {
+    "find_repo_root",
+    "index_read",
+    "index_write",
+    "scan",
+    "object_read",
+    "object_write",
+    "sha1",
+    "chunk",
+    "server_command",
+    "server_job",
+    "ipfs_request",
+};
+
+int trace_enabled = 0;
+_Thread_local uint64_t trace_thread_syscalls = 0;
+
+static trace_counter_t counters[TRACE_PHASE_COUNT];
+static char *trace_path;       // NULL for the summary
+static const char *trace_command;
+static uint64_t trace_start;
+
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_event_t *events;
+static size_t event_count;
+static size_t event_capacity;
+static size_t events_dropped;
+
+static atomic_uint next_tid = 1;
+static _Thread_local uint32_t thread_id;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void trace_record(const trace_span_t *span, uint64_t bytes, uint64_t extra_syscalls) {
+    uint64_t end = trace_now();
+    uint64_t duration = end > span->start ? end - span->start : 0;
+    trace_counter_t *counter = &counters[span->phase];
+    atomic_fetch_add(&counter->calls, 1);
+    atomic_fetch_add(&counter->ns, duration);
+    atomic_fetch_add(&counter->bytes, bytes);
+    atomic_fetch_add(&counter->syscalls, trace_thread_syscalls - span->syscalls + extra_syscalls);
+
+    if (!trace_path) return;
+    if (thread_id == 0) thread_id = atomic_fetch_add(&next_tid, 1);
+
+    pthread_mutex_lock(&events_lock);
+    if (event_count >= event_capacity && event_capacity < TRACE_MAX_EVENTS) {
+        size_t new_capacity = event_capacity == 0 ? 4096 : event_capacity * 2;
+        trace_event_t *grown = realloc(events, new_capacity * sizeof(trace_event_t));
+        if (grown) {
+            events = grown;
+            event_capacity = new_capacity;
+        }
+    }
+    if (event_count < event_capacity) {
+        trace_event_t *event = &events[event_count++];
+        event->start = span->start;
+        event->duration = duration;
+        event->bytes = bytes;
+        event->tid = thread_id;
+        event->phase = span->phase;
+    } else {
+        events_dropped++;
+    }
+    pthread_mutex_unlock(&events_lock);
+}
+
+static void write_summary(uint64_t total) {
+    fprintf(stderr, "\ngyatt %s: %.3f ms\n", trace_command, (double)total / 1e6);
+    fprintf(stderr, "%-16s %10s %12s %14s %10s\n", "phase", "calls", "wall ms", "bytes", "syscalls");
+    for (int i = 0; i < TRACE_PHASE_COUNT; i++) {
+        uint64_t calls = atomic_load(&counters[i].calls);
+        if (calls == 0) continue;
+        fprintf(stderr, "%-16s %10llu %12.3f %14llu %10llu\n", phase_names[i],
+                (unsigned long long)calls,
+                (double)atomic_load(&counters[i].ns) / 1e6,
+                (unsigned long long)atomic_load(&counters[i].bytes),
+                (unsigned long long)atomic_load(&counters[i].syscalls));
+    }
+}
+
+// The command is whatever was typed, so it's escaped; phase names are ours
+static void write_json_chars(FILE *out, const char *s) {
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+}
+
+// Complete ("X") events in microseconds since the start of the run, with
+// the totals as metadata on the span for the whole command
+static void write_trace(uint64_t total) {
+    FILE *out = fopen(trace_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write trace to %s\n", trace_path);
+        return;
+    }
+
+    int pid = (int)getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"gyatt ");
+    write_json_chars(out, trace_command);
+    fprintf(out, "\",\"cat\":\"gyatt\",\"ph\":\"X\",\"ts\":0,\"dur\":%.3f,\"pid\":%d,\"tid\":1,\"args\":{",
+            (double)total / 1e3, pid);
+    int first = 1;
+    for (int i = 0; i < TRACE_PHASE_COUNT; i++) {
+        uint64_t calls = atomic_load(&counters[i].calls);
+        if (calls == 0) continue;
+        fprintf(out, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f,\"bytes\":%llu,\"syscalls\":%llu}",
+                first ? "" : ",", phase_names[i], (unsigned long long)calls,
+                (double)atomic_load(&counters[i].ns) / 1e6,
+                (unsigned long long)atomic_load(&counters[i].bytes),
+                (unsigned long long)atomic_load(&counters[i].syscalls));
+        first = 0;
+    }
+    fprintf(out, "%s\"dropped_events\":%zu}}", first ? "" : ",", events_dropped);
+
+    for (size_t i = 0; i < event_count; i++) {
+        const trace_event_t *e = &events[i];
+        uint64_t ts = e->start > trace_start ? e->start - trace_start : 0;
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"gyatt\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"bytes\":%llu}}",
+                phase_names[e->phase], (double)ts / 1e3, (double)e->duration / 1e3, pid, e->tid,
+                (unsigned long long)e->bytes);
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+}
+
+static void trace_finish(void) {
+    uint64_t total = trace_now() - trace_start;
+    pthread_mutex_lock(&events_lock);
+    if (trace_path) write_trace(total);
+    else write_summary(total);
+    pthread_mutex_unlock(&events_lock);
+}
+
+void trace_init(const char *command) {
+    const char *setting = getenv("GYATT_TRACE");
+    if (!setting || !setting[0] || strcmp(setting, "0") == 0) return;
+
+    if (strcmp(setting, "summary") != 0 && strcmp(setting, "1") != 0) {
+        trace_path = str_duplicate(setting);
+        if (!trace_path) return;
+    }
+    trace_command = command ? command : "";
+    trace_start = trace_now();
+    thread_id = atomic_fetch_add(&next_tid, 1);
+    trace_enabled = 1;
+    atexit(trace_finish);
+}
@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Opt-in instrumentation. GYATT_TRACE=summary prints a table of calls,
+// wall time, bytes and syscalls per phase to stderr at exit;
+// GYATT_TRACE=<path> writes every span there as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev). Unset, each hook costs one branch.
+//
+// Times are inclusive: an object_write span contains its sha1 span.
+// Syscalls are the ones gyatt itself issues (open, read, write, stat,
+// rename...) on the thread that ran the span, not libc's internals.
+
+typedef enum {
+    TRACE_FIND_ROOT,
+    TRACE_INDEX_READ,
+    TRACE_INDEX_WRITE,
+    TRACE_SCAN,
+    TRACE_OBJECT_READ,
+    TRACE_OBJECT_WRITE,
+    TRACE_SHA1,
+    TRACE_CHUNK,
+    TRACE_SERVER_COMMAND,
+    TRACE_SERVER_JOB,
+    TRACE_IPFS_REQUEST,
+    TRACE_PHASE_COUNT
+} trace_phase_t;
+
+typedef struct {
+    uint64_t start;            // ns; 0 when tracing is off
+    uint64_t syscalls;         // This thread's count when the span began
+    trace_phase_t phase;
+} trace_span_t;
+
+extern int trace_enabled;
+extern _Thread_local uint64_t trace_thread_syscalls;
+
+// Read GYATT_TRACE and, if set, arrange for the output at exit. command
+// names the span covering the whole run.
+void trace_init(const char *command);
+uint64_t trace_now(void);
+void trace_record(const trace_span_t *span, uint64_t bytes, uint64_t extra_syscalls);
+
+static inline trace_span_t trace_begin(trace_phase_t phase) {
+    trace_span_t span = { 0, 0, phase };
+    if (trace_enabled) {
+        span.start = trace_now();
+        span.syscalls = trace_thread_syscalls;
+    }
+    return span;
+}
+
+// bytes moved by the span; extra_syscalls made for it on other threads
+#define trace_end(span, bytes, extra_syscalls) do { \
+        if ((span).start) trace_record(&(span), (uint64_t)(bytes), (uint64_t)(extra_syscalls)); \
+    } while (0)
+
+// Count n syscalls against whatever span this thread is in
+#define TRACE_SYSCALLS(n) do { if (trace_enabled) trace_thread_syscalls += (n); } while (0)
+#define TRACE_SYSCALL() TRACE_SYSCALLS(1)
+
+#endif // TRACE_H
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -170,8 +171,13 @@ char *get_current_dir(void) {
 
 // Find the root of the Gyatt repository
 char *find_repo_root(void) {
+    trace_span_t span = trace_begin(TRACE_FIND_ROOT);
     char *current = get_current_dir();
-    if (!current) return NULL;
+    TRACE_SYSCALL();
+    if (!current) {
+        trace_end(span, 0, 0);
+        return NULL;
+    }
     
     char *search = str_duplicate(current);
     free(current);
@@ -179,8 +185,10 @@ char *find_repo_root(void) {
     while (1) {
         char *gyatt_dir = path_join(search, ".gyatt");
         
+        TRACE_SYSCALL();
         if (dir_exists(gyatt_dir)) {
             free(gyatt_dir);
+            trace_end(span, 0, 0);
             return search;
         }
         
@@ -198,6 +206,7 @@ char *find_repo_root(void) {
         if (!last_sep || last_sep == parent) {
             // Reached root without finding .gyatt
             free(search);
+            trace_end(span, 0, 0);
             return NULL;
         }
         
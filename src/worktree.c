@@ -0,0 +1,611 @@
+#include "worktree.h"
+#include "object.h"
+#include "index.h"
+#include "hash.h"
+#include "pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+// Below this many files the pool isn't worth starting
+#define CHECKOUT_PARALLEL_MIN 8
+
+// One file to write. The diff fills in what goes where, a worker writes
+// it, and the main thread folds the result into the index.
+typedef struct {
+    gyatt_repo_t *repo;
+    char *path;                // Relative to the repo root
+    gyatt_hash_t hash;
+    uint32_t mode;
+    mode_t perms;              // What the file gets on disk
+    size_t size;
+    struct stat st;
+    int result;
+} checkout_job_t;
+
+// A directory of the target tree that the diff walked into
+typedef struct {
+    char *dir;                 // "" for the root
+    gyatt_hash_t hash;
+} checkout_tree_t;
+
+typedef struct {
+    gyatt_repo_t *repo;
+    mode_t umask;
+
+    checkout_job_t **jobs;
+    size_t job_count;
+    size_t job_capacity;
+
+    char **removed;
+    size_t removed_count;
+    size_t removed_capacity;
+
+    checkout_tree_t *trees;
+    size_t tree_count;
+    size_t tree_capacity;
+} checkout_t;
+
+// 1 if the index's cached root tree says it matches HEAD, 0 if it says it
+// doesn't, -1 if there's no valid root tree to go by
+static int index_matches_tree(const index_t *index, const gyatt_hash_t *tree_hash) {
+    gyatt_hash_t cached;
+    if (!index_cache_tree_get(index, "", 0, index->entry_count, &cached)) return -1;
+    return hash_compare(&cached, tree_hash) == 0;
+}
+
+int worktree_is_clean(gyatt_repo_t *repo) {
+    // The index tracks HEAD between commits, so anything staged shows up
+    // as a difference between the two
+    index_t *index = index_create();
+    if (!index) return 0;
+
+    index_read(repo, index);
+
+    gyatt_hash_t head_hash;
+    tree_object_t *tree = NULL;
+    int is_clean = -1;
+    if (repo_resolve_ref(repo, "HEAD", &head_hash) == 0) {
+        commit_object_t *commit = commit_read(repo, &head_hash);
+        if (commit) {
+            // Commit and checkout leave the root tree cached, which
+            // saves flattening the whole of HEAD just to compare
+            is_clean = index_matches_tree(index, &commit->tree);
+            if (is_clean < 0) tree = tree_read_flat(repo, &commit->tree);
+            commit_free(commit);
+        }
+    }
+
+    if (is_clean >= 0) {
+        // Settled by the cached tree
+    } else if (!tree) {
+        is_clean = (index->entry_count == 0);
+    } else {
+        is_clean = (index->entry_count == tree->entry_count);
+        for (size_t i = 0; is_clean && i < index->entry_count; i++) {
+            tree_entry_t *entry = tree_find_entry(tree, index_entry_path(index, &index->entries[i]));
+            if (!entry || hash_compare(&entry->hash, &index->entries[i].hash) != 0) {
+                is_clean = 0;
+            }
+        }
+        tree_free(tree);
+    }
+    index_free(index);
+
+    return is_clean;
+}
+
+// ==================== Diff ====================
+
+static char *checkout_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) return NULL;
+
+    if (dir_len > 0) {
+        memcpy(path, dir, dir_len);
+        path[dir_len++] = '/';
+    }
+    memcpy(path + dir_len, name, name_len + 1);
+    return path;
+}
+
+static int checkout_add_write(checkout_t *co, const char *dir, const tree_entry_t *entry) {
+    if (co->job_count >= co->job_capacity) {
+        size_t new_capacity = co->job_capacity == 0 ? 64 : co->job_capacity * 2;
+        checkout_job_t **new_jobs = realloc(co->jobs, new_capacity * sizeof(checkout_job_t *));
+        if (!new_jobs) return -1;
+        co->jobs = new_jobs;
+        co->job_capacity = new_capacity;
+    }
+
+    checkout_job_t *job = calloc(1, sizeof(checkout_job_t));
+    if (!job) return -1;
+
+    job->repo = co->repo;
+    job->path = checkout_path(dir, entry->name);
+    job->hash = entry->hash;
+    job->mode = entry->mode;
+    job->perms = ((entry->mode & 0111) ? 0777 : 0666) & ~co->umask;
+    job->result = -1;
+    if (!job->path) {
+        free(job);
+        return -1;
+    }
+
+    co->jobs[co->job_count++] = job;
+    return 0;
+}
+
+static int checkout_add_removal(checkout_t *co, const char *dir, const char *name) {
+    if (co->removed_count >= co->removed_capacity) {
+        size_t new_capacity = co->removed_capacity == 0 ? 64 : co->removed_capacity * 2;
+        char **new_removed = realloc(co->removed, new_capacity * sizeof(char *));
+        if (!new_removed) return -1;
+        co->removed = new_removed;
+        co->removed_capacity = new_capacity;
+    }
+
+    char *path = checkout_path(dir, name);
+    if (!path) return -1;
+    co->removed[co->removed_count++] = path;
+    return 0;
+}
+
+static int checkout_add_tree(checkout_t *co, const char *dir, const gyatt_hash_t *hash) {
+    if (co->tree_count >= co->tree_capacity) {
+        size_t new_capacity = co->tree_capacity == 0 ? 16 : co->tree_capacity * 2;
+        checkout_tree_t *new_trees = realloc(co->trees, new_capacity * sizeof(checkout_tree_t));
+        if (!new_trees) return -1;
+        co->trees = new_trees;
+        co->tree_capacity = new_capacity;
+    }
+
+    char *copy = str_duplicate(dir);
+    if (!copy) return -1;
+    co->trees[co->tree_count].dir = copy;
+    co->trees[co->tree_count].hash = *hash;
+    co->tree_count++;
+    return 0;
+}
+
+// Walk two versions of the directory dir side by side (either may be NULL,
+// for a directory that only exists on one side). Both trees are sorted by
+// name, so one merge pass pairs up their entries; subtrees with the same
+// hash on both sides are skipped without being read.
+static int checkout_diff(checkout_t *co, const char *dir, const gyatt_hash_t *from_hash,
+                         const gyatt_hash_t *to_hash) {
+    tree_object_t *from = NULL;
+    tree_object_t *to = NULL;
+    if (from_hash && !(from = tree_read(co->repo, from_hash))) {
+        fprintf(stderr, "Error: Could not read tree for '%s'\n", dir);
+        return -1;
+    }
+    if (to_hash && !(to = tree_read(co->repo, to_hash))) {
+        fprintf(stderr, "Error: Could not read tree for '%s'\n", dir);
+        tree_free(from);
+        return -1;
+    }
+
+    int result = to ? checkout_add_tree(co, dir, to_hash) : 0;
+    size_t i = 0, j = 0;
+    size_t from_count = from ? from->entry_count : 0;
+    size_t to_count = to ? to->entry_count : 0;
+
+    while (result == 0 && (i < from_count || j < to_count)) {
+        tree_entry_t *old = i < from_count ? &from->entries[i] : NULL;
+        tree_entry_t *new = j < to_count ? &to->entries[j] : NULL;
+        int cmp = !old ? 1 : !new ? -1 : strcmp(old->name, new->name);
+        if (cmp < 0) new = NULL;
+        if (cmp > 0) old = NULL;
+        if (old) i++;
+        if (new) j++;
+
+        if (old && new && old->type == new->type && old->mode == new->mode &&
+            hash_compare(&old->hash, &new->hash) == 0) {
+            continue;
+        }
+
+        const char *name = old ? old->name : new->name;
+        if (old && new && old->type == OBJ_TREE && new->type == OBJ_TREE) {
+            char *path = checkout_path(dir, name);
+            result = path ? checkout_diff(co, path, &old->hash, &new->hash) : -1;
+            free(path);
+            continue;
+        }
+
+        // Gone, or replaced by something of the other kind
+        if (old && (!new || old->type != new->type)) {
+            if (old->type == OBJ_TREE) {
+                char *path = checkout_path(dir, name);
+                result = path ? checkout_diff(co, path, &old->hash, NULL) : -1;
+                free(path);
+            } else {
+                result = checkout_add_removal(co, dir, name);
+            }
+            if (result != 0 || !new) continue;
+        }
+
+        if (new->type == OBJ_TREE) {
+            char *path = checkout_path(dir, name);
+            result = path ? checkout_diff(co, path, NULL, &new->hash) : -1;
+            free(path);
+        } else {
+            result = checkout_add_write(co, dir, new);
+        }
+    }
+
+    tree_free(from);
+    tree_free(to);
+    return result;
+}
+
+// ==================== Checks ====================
+
+static int path_compare(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Is path one of the files being removed? (co->removed has to be sorted)
+static int checkout_is_removed(const checkout_t *co, const char *path) {
+    return co->removed_count > 0 &&
+           bsearch(&path, co->removed, co->removed_count, sizeof(char *), path_compare) != NULL;
+}
+
+// 1 if anything under rel_dir would still be there after the removals:
+// untracked files in the way of what's about to be written
+static int checkout_dir_keeps_files(const checkout_t *co, const char *rel_dir) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", co->repo->root, rel_dir);
+    DIR *dir = opendir(dir_path);
+    if (!dir) return 1;
+
+    int keeps = 0;
+    struct dirent *entry;
+    while (!keeps && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        char *path = checkout_path(rel_dir, name);
+        struct stat st;
+        if (!path || fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            keeps = 1;
+        } else if (S_ISDIR(st.st_mode)) {
+            keeps = checkout_dir_keeps_files(co, path);
+        } else {
+            keeps = !checkout_is_removed(co, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+    return keeps;
+}
+
+// 1 if writing target to path (or removing it, for a NULL target) would
+// throw away something that isn't committed. Nothing there, a file that
+// matches its index entry or one that already holds target is fine. Stat
+// data settles it unless it changed or is racy; then the content does.
+static int checkout_would_lose(const checkout_t *co, index_t *index, const char *path,
+                               const gyatt_hash_t *target) {
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", co->repo->root, path);
+
+    struct stat st;
+    if (lstat(full_path, &st) != 0) {
+        if (errno == ENOENT) return 0;
+        if (errno != ENOTDIR) return 1;
+        if (!target) return 0;  // Already gone
+
+        // A file where one of its directories goes: fine if it's one of
+        // the removals (which get checked themselves)
+        char prefix[PATH_MAX];
+        snprintf(prefix, sizeof(prefix), "%s", path);
+        char *slash;
+        while ((slash = strrchr(prefix, '/')) != NULL) {
+            *slash = '\0';
+            if (checkout_is_removed(co, prefix)) return 0;
+        }
+        return 1;
+    }
+
+    // The tracked files in a directory in the way are removals; only
+    // something else in it is a problem
+    if (S_ISDIR(st.st_mode)) return !target || checkout_dir_keeps_files(co, path);
+    if (!S_ISREG(st.st_mode)) return 1;
+
+    index_entry_t *entry = index_find_entry(index, path);
+    if (entry && index_entry_stat_matches(entry, &st) && !index_entry_is_racy(index, entry)) return 0;
+
+    gyatt_hash_t hash;
+    if (entry && object_hash_file(co->repo, full_path, &entry->hash, &hash) == 0 &&
+        hash_compare(&hash, &entry->hash) == 0) {
+        return 0;
+    }
+    return !(target && object_hash_file(co->repo, full_path, target, &hash) == 0 &&
+             hash_compare(&hash, target) == 0);
+}
+
+// Every path the checkout changes, looked at before any of them is
+// touched, so it either goes ahead whole or leaves everything as it was
+static int checkout_check(checkout_t *co, index_t *index) {
+    if (co->removed_count > 1) qsort(co->removed, co->removed_count, sizeof(char *), path_compare);
+
+    size_t conflicts = 0;
+    for (size_t i = 0; i < co->removed_count; i++) {
+        if (checkout_would_lose(co, index, co->removed[i], NULL)) {
+            fprintf(stderr, "Error: Your local changes to '%s' would be lost\n", co->removed[i]);
+            conflicts++;
+        }
+    }
+    for (size_t i = 0; i < co->job_count; i++) {
+        if (checkout_would_lose(co, index, co->jobs[i]->path, &co->jobs[i]->hash)) {
+            const char *path = co->jobs[i]->path;
+            if (index_find_entry(index, path)) {
+                fprintf(stderr, "Error: Your local changes to '%s' would be overwritten\n", path);
+            } else {
+                fprintf(stderr, "Error: Untracked files at '%s' would be overwritten\n", path);
+            }
+            conflicts++;
+        }
+    }
+
+    if (conflicts > 0) {
+        fprintf(stderr, "Please commit them (or move them out of the way) first\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ==================== Apply ====================
+
+// Worker: write one file next to where it goes, then rename it into place,
+// so nothing ever sees half a file. Touches nothing shared.
+static void checkout_job_run(void *arg) {
+    checkout_job_t *job = arg;
+
+    char file_path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    const char *slash = strrchr(job->path, '/');
+    const char *name = slash ? slash + 1 : job->path;
+    int dir_len = slash ? (int)(slash - job->path) : 0;
+    snprintf(file_path, sizeof(file_path), "%s/%s", job->repo->root, job->path);
+    snprintf(temp_path, sizeof(temp_path), "%s/%.*s%s.%s.XXXXXX", job->repo->root,
+             dir_len, job->path, slash ? "/" : "", name);
+
+    if (slash) {
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%s/%.*s", job->repo->root, dir_len, job->path);
+        mkdir_recursive(parent);
+    }
+
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: Could not write file '%s'\n", job->path);
+        return;
+    }
+
+    // Chunked files stream out a chunk at a time instead of all at once
+    size_t size = 0;
+    if (blob_read_to_fd(job->repo, &job->hash, fd, &size) != 0) {
+        fprintf(stderr, "Warning: Could not read blob for '%s'\n", job->path);
+        close(fd);
+        unlink(temp_path);
+        return;
+    }
+
+    // A directory can only still be there if it's empty (the checks made
+    // sure of that), and then it just goes
+    int ok = fchmod(fd, job->perms) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (ok && rename(temp_path, file_path) != 0) {
+        ok = errno == EISDIR && rmdir(file_path) == 0 && rename(temp_path, file_path) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Warning: Could not write file '%s'\n", job->path);
+        unlink(temp_path);
+        return;
+    }
+
+    if (stat(file_path, &job->st) != 0) return;
+    job->size = size;
+    job->result = 0;
+}
+
+static int checkout_job_compare(const void *a, const void *b) {
+    const checkout_job_t *ja = *(checkout_job_t *const *)a;
+    const checkout_job_t *jb = *(checkout_job_t *const *)b;
+    return strcmp(ja->path, jb->path);
+}
+
+// Remove a file that's no longer tracked, then any directories it leaves
+// empty (rmdir refuses the ones that aren't)
+static void checkout_remove(gyatt_repo_t *repo, const char *path) {
+    char file_path[PATH_MAX];
+    int len = snprintf(file_path, sizeof(file_path), "%s/%s", repo->root, path);
+    if (len < 0 || (size_t)len >= sizeof(file_path)) return;
+
+    if (unlink(file_path) != 0 && errno != ENOENT && errno != ENOTDIR) {
+        fprintf(stderr, "Warning: Could not remove '%s'\n", path);
+        return;
+    }
+
+    size_t root_len = strlen(repo->root);
+    char *slash;
+    while ((slash = strrchr(file_path, '/')) != NULL && (size_t)(slash - file_path) > root_len) {
+        *slash = '\0';
+        if (rmdir(file_path) != 0) break;
+    }
+}
+
+// Where the entries under dir sit in the (sorted) index: everything that
+// starts with "dir/" is one contiguous run
+static size_t index_dir_count(const index_t *index, const char *dir) {
+    size_t dir_len = strlen(dir);
+    if (dir_len == 0) return index->entry_count;
+
+    char prefix[PATH_MAX];
+    if (dir_len + 1 >= sizeof(prefix)) return 0;
+    memcpy(prefix, dir, dir_len);
+    prefix[dir_len] = '/';
+    size_t prefix_len = dir_len + 1;
+
+    size_t lo = 0, hi = index->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(index_entry_path(index, &index->entries[mid]), prefix, prefix_len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t start = lo;
+    hi = index->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(index_entry_path(index, &index->entries[mid]), prefix, prefix_len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - start;
+}
+
+static void checkout_free(checkout_t *co) {
+    for (size_t i = 0; i < co->job_count; i++) {
+        free(co->jobs[i]->path);
+        free(co->jobs[i]);
+    }
+    free(co->jobs);
+    for (size_t i = 0; i < co->removed_count; i++) free(co->removed[i]);
+    free(co->removed);
+    for (size_t i = 0; i < co->tree_count; i++) free(co->trees[i].dir);
+    free(co->trees);
+}
+
+static int commit_tree_hash(gyatt_repo_t *repo, const gyatt_hash_t *commit_hash, gyatt_hash_t *tree) {
+    commit_object_t *commit = commit_read(repo, commit_hash);
+    if (!commit) {
+        fprintf(stderr, "Error: Could not read commit\n");
+        return -1;
+    }
+    *tree = commit->tree;
+    commit_free(commit);
+    return 0;
+}
+
+// Diff from against to into co and check the working tree can take it.
+// The index that the checkout starts from, or NULL; co needs freeing
+// either way.
+static index_t *checkout_prepare(checkout_t *co, gyatt_repo_t *repo, const gyatt_hash_t *from,
+                                 const gyatt_hash_t *to) {
+    memset(co, 0, sizeof(*co));
+    co->repo = repo;
+    co->umask = umask(0);
+    umask(co->umask);
+
+    gyatt_hash_t from_tree, to_tree;
+    if (commit_tree_hash(repo, to, &to_tree) != 0) return NULL;
+    if (from && commit_tree_hash(repo, from, &from_tree) != 0) return NULL;
+    if (checkout_diff(co, "", from ? &from_tree : NULL, &to_tree) != 0) return NULL;
+
+    // Starting from the index that matched from, only the paths that
+    // changed need new entries; everything else keeps its stat data
+    index_t *index = index_create();
+    if (!index) return NULL;
+    if (from && index_read(repo, index) != 0) {
+        fprintf(stderr, "Error: Failed to read index\n");
+        index_free(index);
+        return NULL;
+    }
+    if (checkout_check(co, index) != 0) {
+        index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+int worktree_checkout_check(gyatt_repo_t *repo, const gyatt_hash_t *from, const gyatt_hash_t *to) {
+    checkout_t co;
+    index_t *index = checkout_prepare(&co, repo, from, to);
+    checkout_free(&co);
+    if (!index) return -1;
+    index_free(index);
+    return 0;
+}
+
+int worktree_checkout(gyatt_repo_t *repo, const gyatt_hash_t *from, const gyatt_hash_t *to) {
+    checkout_t co;
+    index_t *index = checkout_prepare(&co, repo, from, to);
+    if (!index) {
+        checkout_free(&co);
+        return -1;
+    }
+
+    // Removals go first, so a directory that turns into a file (or the
+    // other way around) is out of the way by the time it's written
+    for (size_t i = 0; i < co.removed_count; i++) {
+        checkout_remove(repo, co.removed[i]);
+        index_remove_entry(index, co.removed[i]);
+    }
+
+    int threads = co.job_count < CHECKOUT_PARALLEL_MIN ? 1 : config_thread_count(&repo->config);
+    pool_t *pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Error: Failed to start worker threads\n");
+        index_free(index);
+        checkout_free(&co);
+        return -1;
+    }
+    for (size_t i = 0; i < co.job_count; i++) {
+        pool_submit(pool, checkout_job_run, co.jobs[i]);
+    }
+    pool_wait(pool);
+    pool_free(pool);
+
+    // Fold the results in path order, so new entries mostly append
+    qsort(co.jobs, co.job_count, sizeof(checkout_job_t *), checkout_job_compare);
+    size_t failed = 0;
+    for (size_t i = 0; i < co.job_count; i++) {
+        checkout_job_t *job = co.jobs[i];
+        if (job->result != 0) {
+            // Leave the old entry alone if there was one; status will
+            // show the file for what it is
+            failed++;
+            continue;
+        }
+
+        index_entry_t *entry = index_add_entry(index, job->path, &job->hash, job->mode,
+                                               job->size, job->st.st_mtime);
+        if (entry) index_entry_set_stat(entry, &job->st);
+    }
+
+    // Every directory the diff walked now matches its tree in the target,
+    // and the ones it skipped never changed; cache what's known so the
+    // next commit and clean check don't rebuild it
+    if (failed == 0) {
+        for (size_t i = 0; i < co.tree_count; i++) {
+            const char *dir = co.trees[i].dir;
+            index_cache_tree_set(index, dir, strlen(dir), index_dir_count(index, dir), &co.trees[i].hash);
+        }
+    }
+    checkout_free(&co);
+
+    int result = index_write(repo, index);
+    index_free(index);
+    if (result != 0) {
+        fprintf(stderr, "Error: Failed to write index\n");
+        return -1;
+    }
+    if (failed > 0) {
+        fprintf(stderr, "Error: %zu file(s) could not be checked out\n", failed);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef WORKTREE_H
+#define WORKTREE_H
+
+#include "gyatt.h"
+
+// The working directory as a whole: what checkout, and pull on the
+// current branch, need from it.
+
+// 1 if the index matches HEAD's tree (nothing staged), 0 otherwise
+int worktree_is_clean(gyatt_repo_t *repo);
+
+// Move the working directory and index from commit from (what they match
+// now) to commit to: only files that differ between the two trees are
+// written or removed, and their index entries get fresh stat data. A NULL
+// from writes out every file of to and rebuilds the index from scratch.
+// Refuses (-1, nothing touched) if a file it would overwrite or remove
+// has changes the index doesn't know about, or isn't tracked and differs;
+// also -1 if any file couldn't be written, after recording the rest.
+int worktree_checkout(gyatt_repo_t *repo, const gyatt_hash_t *from, const gyatt_hash_t *to);
+
+// Just the refusal part of that: 0 if worktree_checkout would go ahead,
+// -1 (with the reasons printed) if not. For pull, which has to know
+// before it moves the branch.
+int worktree_checkout_check(gyatt_repo_t *repo, const gyatt_hash_t *from, const gyatt_hash_t *to);
+
+#endif // WORKTREE_H